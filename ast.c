@@ -48,6 +48,7 @@ Ast *make_decl_node(Ast *type_node, char *name, Ast *expr) {
     ast->decl.type_node = type_node;
     ast->decl.name = strdup(name);
     ast->decl.expr = expr;
+    ast->decl.slot = -1;
     return ast;
 }
 
@@ -59,6 +60,7 @@ Ast *make_assign(char *name, Ast *expr) {
     ast->type = AST_ASSIGN;
     ast->assign.name = strdup(name);
     ast->assign.expr = expr;
+    ast->assign.slot = -1;
     return ast;
 }
 
@@ -77,6 +79,7 @@ Ast *make_call(char *name, Ast **args, int nargs) {
     ast->call.name = strdup(name);
     ast->call.args = args;
     ast->call.nargs = nargs;
+    ast->call.fn_id = -1;
     return ast;
 }
 
@@ -211,6 +214,7 @@ Ast *make_ident(char *name) {
     if (!ast) return NULL;
     ast->type = AST_IDENT;
     ast->ident.str = strdup(name);
+    ast->ident.slot = -1;
     return ast;
 }
 
@@ -258,6 +262,7 @@ Ast *clone_ast(Ast *ast) {
             new_ast->decl.type_node = clone_ast(ast->decl.type_node);
             new_ast->decl.name = strdup(ast->decl.name);
             new_ast->decl.expr = clone_ast(ast->decl.expr);
+            new_ast->decl.slot = ast->decl.slot;
             break;
 
         /* --- EXISTING CASES --- */
@@ -269,10 +274,12 @@ Ast *clone_ast(Ast *ast) {
             break;
         case AST_IDENT:
             new_ast->ident.str = strdup(ast->ident.str);
+            new_ast->ident.slot = ast->ident.slot;
             break;
         case AST_ASSIGN:
             new_ast->assign.name = strdup(ast->assign.name);
             new_ast->assign.expr = clone_ast(ast->assign.expr);
+            new_ast->assign.slot = ast->assign.slot;
             break;
         case AST_EXPR_STMT:
             new_ast->expr_stmt.expr = clone_ast(ast->expr_stmt.expr);
@@ -280,6 +287,7 @@ Ast *clone_ast(Ast *ast) {
         case AST_CALL:
             new_ast->call.name = strdup(ast->call.name);
             new_ast->call.nargs = ast->call.nargs;
+            new_ast->call.fn_id = ast->call.fn_id;
             new_ast->call.args = malloc(sizeof(Ast *) * new_ast->call.nargs);
             if (!new_ast->call.args) {
                 free(new_ast->call.name);
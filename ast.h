@@ -43,10 +43,12 @@ typedef struct Ast {
         int ival;
         double fval;
         char *sval;
-        struct { struct Ast *type_node; char *name; struct Ast *expr; } decl;
-        struct { char *name; struct Ast *expr; } assign;
+        // 'slot' indexes the evaluator's variable array; -1 until resolve_program() runs
+        struct { struct Ast *type_node; char *name; struct Ast *expr; int slot; } decl;
+        struct { char *name; struct Ast *expr; int slot; } assign;
         struct { struct Ast *expr; } expr_stmt;
-        struct { char *name; struct Ast **args; int nargs; } call;
+        // 'fn_id' indexes the evaluator's builtin table; -1 until resolve_program() runs
+        struct { char *name; struct Ast **args; int nargs; int fn_id; } call;
         struct { struct Ast *left; struct Ast *right; } pipe;
         struct { struct Ast **stmts; int n; } block;
         struct { struct Ast *expr; } ret;
@@ -58,7 +60,7 @@ typedef struct Ast {
         struct { char *name; char **params; int nparams; struct Ast *body; } func_def;
         struct { double num; } number;
         struct { char *str; } string;
-        struct { char *str; } ident;
+        struct { char *str; int slot; } ident;
         struct { struct Ast *left; int op; struct Ast *right; } binop;
     };
 } Ast;
@@ -0,0 +1,554 @@
+// bench.c: Micro and end-to-end benchmarks for the IML runtime
+//
+// Times every operator in runtime.h (plus canny_edge_detector through
+// run_canny) on deterministic synthetic images, and optionally whole .iml
+// scripts through the iml binary. Results are written as CSV or JSON, one
+// record per (size, benchmark), so runs can be diffed over time.
+//
+// Usage: ./bench [--sizes vga,4k,24mp] [--reps N] [--threads N]
+//                [--format csv|json] [--out FILE] [--only NAME] [--iml PATH]
+
+#define _POSIX_C_SOURCE 200809L
+#include "runtime.h"
+#include "parallel.h"
+#include "simd.h"
+#include "include/stb_image_write.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+typedef struct {
+    const char *name;
+    int width, height;
+} BenchSize;
+
+static const BenchSize sizes[] = {
+    { "vga",  640,  480 },
+    { "4k",   3840, 2160 },
+    { "24mp", 6000, 4000 },
+};
+#define NUM_SIZES (int)(sizeof(sizes) / sizeof(sizes[0]))
+
+// Shared inputs for one size; operators must not modify them
+typedef struct {
+    Image *a;
+    Image *b;           // second image for blend/mask
+    Image *a16;         // 'a' with 16-bit samples
+    const char *png;    // 'a' saved as PNG, for load and end-to-end runs
+    const char *jpg;    // 'a' saved as a quality 90 JPEG
+    const char *raw;    // 'a' saved as .imlraw
+} BenchInput;
+
+// Runs the operator once and returns its result (freed by the caller)
+typedef Image *(*BenchFn)(const BenchInput *in);
+
+typedef struct {
+    const char *name;
+    BenchFn fn;
+} BenchOp;
+
+// --- SYNTHETIC INPUTS ---
+
+// xorshift32, so every run and every machine sees the same pixels
+static unsigned int rng_next(unsigned int *state) {
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+// Smooth gradients with shapes and noise, so edge detection and PNG
+// compression see something closer to a photo than a flat fill
+static Image *make_synthetic(int w, int h, unsigned int seed) {
+    Image *img = malloc(sizeof(Image));
+    if (!img) return NULL;
+    img->width = w;
+    img->height = h;
+    img->channels = 3;
+    img->type = PIXEL_U8;
+    img->refcount = 1;
+    img->data = malloc((size_t)w * h * 3);
+    if (!img->data) {
+        free(img);
+        return NULL;
+    }
+    unsigned int state = seed ? seed : 1;
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            unsigned char *p = img->data + ((size_t)y * w + x) * 3;
+            int noise = (int)(rng_next(&state) & 31) - 16;
+            int disc = ((x / 97 + y / 61) & 1) ? 60 : 0;
+            int r = x * 255 / w + noise;
+            int g = y * 255 / h + disc + noise;
+            int b = ((x + y) & 255) / 2 + disc + noise;
+            p[0] = r < 0 ? 0 : (r > 255 ? 255 : r);
+            p[1] = g < 0 ? 0 : (g > 255 ? 255 : g);
+            p[2] = b < 0 ? 0 : (b > 255 ? 255 : b);
+        }
+    }
+    return img;
+}
+
+// --- OPERATORS ---
+
+static Image *op_load(const BenchInput *in) { return load_image(in->png); }
+static Image *op_load_jpeg(const BenchInput *in) { return load_image(in->jpg); }
+static Image *op_load_imlraw(const BenchInput *in) { return load_image(in->raw); }
+// Saves go next to the inputs and are removed with them
+static Image *op_save_png(const BenchInput *in) {
+    char path[96];
+    snprintf(path, sizeof(path), "%s.out.png", in->png);
+    save_image(path, in->a);
+    return retain_image(in->a);
+}
+static Image *op_save_png_fast(const BenchInput *in) {
+    char path[96];
+    snprintf(path, sizeof(path), "%s.out.png", in->png);
+    save_image_png(path, in->a, 1, PNG_FILTER_FAST);
+    return retain_image(in->a);
+}
+static Image *op_save_png_store(const BenchInput *in) {
+    char path[96];
+    snprintf(path, sizeof(path), "%s.out.png", in->png);
+    save_image_png(path, in->a, 0, PNG_FILTER_AUTO);
+    return retain_image(in->a);
+}
+static Image *op_save_jpeg(const BenchInput *in) {
+    char path[96];
+    snprintf(path, sizeof(path), "%s.out.jpg", in->png);
+    save_image(path, in->a);
+    return retain_image(in->a);
+}
+static Image *op_save_imlraw(const BenchInput *in) {
+    char path[96];
+    snprintf(path, sizeof(path), "%s.out.imlraw", in->png);
+    save_image(path, in->a);
+    return retain_image(in->a);
+}
+static Image *op_load_jpeg_eighth(const BenchInput *in) {
+    return load_image_scaled(in->jpg, in->a->width / 8, in->a->height / 8);
+}
+static Image *op_crop(const BenchInput *in) {
+    return crop_image(in->a, in->a->width / 4, in->a->height / 4, in->a->width / 2, in->a->height / 2);
+}
+static Image *op_blur_r2(const BenchInput *in) { return blur_image(in->a, 2); }
+static Image *op_blur_r25(const BenchInput *in) { return blur_image(in->a, 25); }
+static Image *op_gaussian_s2(const BenchInput *in) { return gaussian_image(in->a, 2.0f); }
+static Image *op_gaussian_s3(const BenchInput *in) { return gaussian_image(in->a, 3.0f); }
+static Image *op_gaussian_s20(const BenchInput *in) { return gaussian_image(in->a, 20.0f); }
+static Image *op_grayscale(const BenchInput *in) { return grayscale_image(in->a); }
+static Image *op_invert(const BenchInput *in) { return invert_image(in->a); }
+static Image *op_flip_x(const BenchInput *in) { return flip_image_along_X(in->a); }
+static Image *op_flip_y(const BenchInput *in) { return flip_image_along_Y(in->a); }
+static Image *op_canny(const BenchInput *in) { return run_canny(in->a, 1.4f, 20, 50); }
+static Image *op_brightness(const BenchInput *in) { return adjust_brightness(in->a, 30, 1); }
+static Image *op_contrast(const BenchInput *in) { return adjust_contrast(in->a, 40, 1); }
+static Image *op_threshold(const BenchInput *in) { return apply_threshold(in->a, 128, 1); }
+static Image *op_convolve(const BenchInput *in) {
+    float kernel[3][3] = { { 1 / 16.0f, 2 / 16.0f, 1 / 16.0f },
+                           { 2 / 16.0f, 4 / 16.0f, 2 / 16.0f },
+                           { 1 / 16.0f, 2 / 16.0f, 1 / 16.0f } };
+    return convolve_image(in->a, kernel);
+}
+static Image *op_convolve_5x5(const BenchInput *in) {
+    static const float kernel[25] = { 1, 4, 6, 4, 1,  4, 16, 24, 16, 4,  6, 24, 36, 24, 6,
+                                      4, 16, 24, 16, 4,  1, 4, 6, 4, 1 };
+    float k[25];
+    for (int i = 0; i < 25; i++) k[i] = kernel[i] / 256.0f;
+    return convolve_kernel(in->a, k, 5, 5, BORDER_CLAMP);
+}
+static Image *op_convolve_7x7_full(const BenchInput *in) {
+    // Outer ring of a 7x7 box: rank > 1, so no separable shortcut
+    float k[49];
+    for (int i = 0; i < 49; i++) k[i] = (i / 7 == 0 || i / 7 == 6 || i % 7 == 0 || i % 7 == 6) ? 1.0f / 24 : 0.0f;
+    return convolve_kernel(in->a, k, 7, 7, BORDER_MIRROR);
+}
+// Dense pseudo-random kernel (rank > 1) normalised to sum 1
+static Image *convolve_dense(const BenchInput *in, int size) {
+    float *k = malloc((size_t)size * size * sizeof(float));
+    if (!k) return NULL;
+    uint32_t state = 12345;
+    float sum = 0.0f;
+    for (int i = 0; i < size * size; i++) {
+        state ^= state << 13; state ^= state >> 17; state ^= state << 5;
+        k[i] = (float)(state % 100 + 1);
+        sum += k[i];
+    }
+    for (int i = 0; i < size * size; i++) k[i] /= sum;
+    Image *out = convolve_kernel(in->a, k, size, size, BORDER_CLAMP);
+    free(k);
+    return out;
+}
+static Image *op_convolve_15x15(const BenchInput *in) { return convolve_dense(in, 15); }
+static Image *op_convolve_63x63(const BenchInput *in) { return convolve_dense(in, 63); }
+static Image *op_sharpen(const BenchInput *in) { return sharpen_image(in->a, 5, 1); }
+static Image *op_blend(const BenchInput *in) { return blend_images(in->a, in->b, 0.3f); }
+static Image *op_mask(const BenchInput *in) { return mask_image(in->a, in->b); }
+static Image *op_resize_half(const BenchInput *in) {
+    return resize_image_nearest(in->a, in->a->width / 2, in->a->height / 2);
+}
+static Image *op_scale_quarter(const BenchInput *in) { return scale_image_factor(in->a, 0.25f, INTERP_NEAREST); }
+static Image *op_resize_bilinear_half(const BenchInput *in) {
+    return resize_image(in->a, in->a->width / 2, in->a->height / 2, INTERP_BILINEAR);
+}
+static Image *op_resize_bicubic_up(const BenchInput *in) {
+    return resize_image(in->a, in->a->width * 3 / 2, in->a->height * 3 / 2, INTERP_BICUBIC);
+}
+static Image *op_scale_box_half(const BenchInput *in) { return scale_image_factor(in->a, 0.5f, INTERP_BOX); }
+static Image *op_pyramid_8(const BenchInput *in) { return pyramid_image(in->a, 8); }
+static Image *op_resize_box_thumb(const BenchInput *in) { return resize_image(in->a, 256, 144, INTERP_BOX); }
+static Image *op_resize_lanczos_thumb(const BenchInput *in) { return resize_image(in->a, 256, 144, INTERP_LANCZOS3); }
+static Image *op_rotate_90(const BenchInput *in) { return rotate_image_90(in->a, 1); }
+static Image *op_rotate_30_nearest(const BenchInput *in) { return rotate_image(in->a, 30.0, INTERP_NEAREST, 1); }
+static Image *op_rotate_30_bilinear(const BenchInput *in) { return rotate_image(in->a, 30.0, INTERP_BILINEAR, 1); }
+static Image *op_rotate_30_bicubic(const BenchInput *in) { return rotate_image(in->a, 30.0, INTERP_BICUBIC, 1); }
+static Image *op_point_ops(const BenchInput *in) {
+    PointOp ops[] = { { POINT_GRAYSCALE, 0, 0, 0.0f }, { POINT_BRIGHTNESS, 20, 0, 0.0f },
+                      { POINT_CONTRAST, 0, 0, 1.3f }, { POINT_INVERT, 0, 0, 0.0f } };
+    return apply_point_ops(in->a, ops, 4);
+}
+static Image *op_lut(const BenchInput *in) {
+    unsigned char lut[256];
+    PointOp ops[] = { { POINT_BRIGHTNESS, 20, 0, 0.0f }, { POINT_CONTRAST, 0, 0, 1.3f } };
+    lut_identity(lut);
+    lut_compose_point_ops(lut, ops, 2);
+    return apply_lut(in->a, lut);
+}
+static Image *op_convert_u16(const BenchInput *in) { return convert_pixel_type(in->a, PIXEL_U16); }
+static Image *op_convert_f32(const BenchInput *in) { return convert_pixel_type(in->a, PIXEL_F32); }
+static Image *op_blur_r2_u16(const BenchInput *in) { return blur_image(in->a16, 2); }
+static Image *op_gaussian_s3_u16(const BenchInput *in) { return gaussian_image(in->a16, 3.0f); }
+static Image *op_resize_bicubic_up_u16(const BenchInput *in) {
+    return resize_image(in->a16, in->a16->width * 3 / 2, in->a16->height * 3 / 2, INTERP_BICUBIC);
+}
+static Image *op_save_png_u16(const BenchInput *in) {
+    char path[96];
+    snprintf(path, sizeof(path), "%s.out.png", in->png);
+    save_image_png(path, in->a16, 1, PNG_FILTER_FAST);
+    return retain_image(in->a16);
+}
+static Image *op_tiled(const BenchInput *in) {
+    TileStage stages[3];
+    memset(stages, 0, sizeof(stages));
+    stages[0].kind = TILE_BLUR;
+    stages[0].radius = 3;
+    stages[1].kind = TILE_SHARPEN;
+    stages[1].amount = 5;
+    stages[1].direction = 1;
+    stages[2].kind = TILE_POINT;
+    stages[2].op.kind = POINT_INVERT;
+    return run_tiled(in->a, stages, 3, (size_t)8 << 20);
+}
+
+static const BenchOp ops[] = {
+    { "load_image",           op_load },
+    { "load_jpeg",            op_load_jpeg },
+    { "load_imlraw",          op_load_imlraw },
+    { "save_png",             op_save_png },
+    { "save_png_fast",        op_save_png_fast },
+    { "save_png_store",       op_save_png_store },
+    { "save_jpeg",            op_save_jpeg },
+    { "save_imlraw",          op_save_imlraw },
+    { "load_jpeg_eighth",     op_load_jpeg_eighth },
+    { "crop_image",           op_crop },
+    { "blur_image_r2",        op_blur_r2 },
+    { "blur_image_r25",       op_blur_r25 },
+    { "gaussian_image_s2",    op_gaussian_s2 },
+    { "gaussian_image_s3",    op_gaussian_s3 },
+    { "gaussian_image_s20",   op_gaussian_s20 },
+    { "grayscale_image",      op_grayscale },
+    { "invert_image",         op_invert },
+    { "flip_image_along_X",   op_flip_x },
+    { "flip_image_along_Y",   op_flip_y },
+    { "canny_edge_detector",  op_canny },
+    { "adjust_brightness",    op_brightness },
+    { "adjust_contrast",      op_contrast },
+    { "apply_threshold",      op_threshold },
+    { "convolve_image",       op_convolve },
+    { "convolve_kernel_5x5",  op_convolve_5x5 },
+    { "convolve_kernel_7x7",  op_convolve_7x7_full },
+    { "convolve_kernel_15x15", op_convolve_15x15 },
+    { "convolve_kernel_63x63", op_convolve_63x63 },
+    { "sharpen_image",        op_sharpen },
+    { "blend_images",         op_blend },
+    { "mask_image",           op_mask },
+    { "resize_image_nearest", op_resize_half },
+    { "scale_image_factor",   op_scale_quarter },
+    { "resize_bilinear_half", op_resize_bilinear_half },
+    { "resize_bicubic_up",    op_resize_bicubic_up },
+    { "resize_box_thumb",     op_resize_box_thumb },
+    { "scale_box_half",       op_scale_box_half },
+    { "pyramid_image_8",      op_pyramid_8 },
+    { "resize_lanczos_thumb", op_resize_lanczos_thumb },
+    { "rotate_image_90",      op_rotate_90 },
+    { "rotate_30_nearest",    op_rotate_30_nearest },
+    { "rotate_30_bilinear",   op_rotate_30_bilinear },
+    { "rotate_30_bicubic",    op_rotate_30_bicubic },
+    { "apply_point_ops",      op_point_ops },
+    { "apply_lut",            op_lut },
+    { "run_tiled",            op_tiled },
+    { "convert_u16",          op_convert_u16 },
+    { "convert_f32",          op_convert_f32 },
+    { "blur_image_r2_u16",    op_blur_r2_u16 },
+    { "gaussian_image_s3_u16", op_gaussian_s3_u16 },
+    { "resize_bicubic_up_u16", op_resize_bicubic_up_u16 },
+    { "save_png_u16",         op_save_png_u16 },
+};
+#define NUM_OPS (int)(sizeof(ops) / sizeof(ops[0]))
+
+// End-to-end scripts; "%s" is replaced by the input PNG path
+static const struct {
+    const char *name;
+    const char *source;
+} scripts[] = {
+    { "iml_point_pipeline",
+      "a = load(\"%s\");\n"
+      "b = a |> grayscale() |> brighten(20, 1) |> contrast(30, 1) |> invert();\n"
+      "print(b);\n" },
+    { "iml_filters",
+      "a = load(\"%s\");\n"
+      "b = a |> blur(3) |> sharpen(5, 1);\n"
+      "c = blend(a, b, 0.5);\n"
+      "print(c);\n" },
+    { "iml_thumbnail",
+      "a = load(\"%s\");\n"
+      "b = a |> scale(0.25) |> rotate(1);\n"
+      "save(\"%s.thumb.png\", b);\n" },
+};
+#define NUM_SCRIPTS (int)(sizeof(scripts) / sizeof(scripts[0]))
+
+// --- TIMING AND OUTPUT ---
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+typedef struct {
+    FILE *out;
+    int json;
+    int records;
+} Report;
+
+static void report_begin(Report *r) {
+    if (r->json) {
+        fprintf(r->out, "[\n");
+    } else {
+        fprintf(r->out, "size,benchmark,width,height,threads,simd,reps,median_ns,min_ns,ns_per_pixel,mb_per_s\n");
+    }
+}
+
+// 'times' is sorted; MB/s counts one RGB input image per run
+static void report_record(Report *r, const BenchSize *sz, const char *name,
+                          const long long *times, int reps) {
+    long long median = times[reps / 2];
+    double pixels = (double)sz->width * sz->height;
+    double ns_per_pixel = median / pixels;
+    double mb_per_s = median > 0 ? (pixels * 3 / 1e6) / (median / 1e9) : 0.0;
+
+    if (r->json) {
+        fprintf(r->out, "%s  {\"size\": \"%s\", \"benchmark\": \"%s\", \"width\": %d, \"height\": %d, "
+                "\"threads\": %d, \"simd\": \"%s\", \"reps\": %d, \"median_ns\": %lld, \"min_ns\": %lld, "
+                "\"ns_per_pixel\": %.4f, \"mb_per_s\": %.2f}",
+                r->records ? ",\n" : "", sz->name, name, sz->width, sz->height,
+                parallel_threads(), simd_level_name(), reps, median, times[0], ns_per_pixel, mb_per_s);
+    } else {
+        fprintf(r->out, "%s,%s,%d,%d,%d,%s,%d,%lld,%lld,%.4f,%.2f\n",
+                sz->name, name, sz->width, sz->height, parallel_threads(), simd_level_name(),
+                reps, median, times[0], ns_per_pixel, mb_per_s);
+    }
+    fflush(r->out);
+    r->records++;
+}
+
+static void report_end(Report *r) {
+    if (r->json) fprintf(r->out, "\n]\n");
+}
+
+static int bench_op(const BenchOp *op, const BenchInput *in, long long *times, int reps) {
+    // Untimed warm-up run faults in pages and fills caches
+    Image *out = op->fn(in);
+    if (!out) return 0;
+    free_image(out);
+
+    for (int i = 0; i < reps; i++) {
+        long long t0 = now_ns();
+        out = op->fn(in);
+        times[i] = now_ns() - t0;
+        if (!out) return 0;
+        free_image(out);
+    }
+    qsort(times, reps, sizeof(long long), cmp_ll);
+    return 1;
+}
+
+// Runs 'iml script' in a child process; returns 0 on success
+static int run_iml(const char *iml, const char *script, int threads) {
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        char threads_arg[16];
+        snprintf(threads_arg, sizeof(threads_arg), "%d", threads);
+        if (!freopen("/dev/null", "w", stdout)) _exit(127);
+        execl(iml, iml, script, "--threads", threads_arg, (char *)NULL);
+        _exit(127);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) < 0) return -1;
+    return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : -1;
+}
+
+static int bench_script(const char *iml, const char *script, int threads, long long *times, int reps) {
+    if (run_iml(iml, script, threads) != 0) return 0;
+    for (int i = 0; i < reps; i++) {
+        long long t0 = now_ns();
+        if (run_iml(iml, script, threads) != 0) return 0;
+        times[i] = now_ns() - t0;
+    }
+    qsort(times, reps, sizeof(long long), cmp_ll);
+    return 1;
+}
+
+// Comma-separated list of size names; NULL selects all
+static int size_selected(const char *list, const char *name) {
+    if (!list) return 1;
+    size_t n = strlen(name);
+    for (const char *p = list; (p = strstr(p, name)) != NULL; p += n) {
+        int starts = (p == list || p[-1] == ',');
+        int ends = (p[n] == '\0' || p[n] == ',');
+        if (starts && ends) return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *size_list = NULL;
+    const char *only = NULL;
+    const char *out_path = NULL;
+    const char *iml = "./iml";
+    int reps = 5;
+    int threads = 0;
+    Report report = { stdout, 0, 0 };
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) {
+            size_list = argv[++i];
+        } else if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc) {
+            reps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            report.json = strcmp(argv[++i], "json") == 0;
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if (strcmp(argv[i], "--only") == 0 && i + 1 < argc) {
+            only = argv[++i];
+        } else if (strcmp(argv[i], "--iml") == 0 && i + 1 < argc) {
+            iml = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [--sizes vga,4k,24mp] [--reps N] [--threads N] "
+                    "[--format csv|json] [--out FILE] [--only NAME] [--iml PATH]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (reps < 1) reps = 1;
+    if (out_path) {
+        report.out = fopen(out_path, "w");
+        if (!report.out) {
+            perror("fopen");
+            return 1;
+        }
+    }
+
+    parallel_init(threads);
+    simd_init();
+    int have_iml = access(iml, X_OK) == 0;
+    if (!have_iml) fprintf(stderr, "Warning: %s not found, skipping end-to-end scripts\n", iml);
+
+    long long *times = malloc(sizeof(long long) * reps);
+    if (!times) {
+        fprintf(stderr, "Error: Memory allocation failed in bench\n");
+        return 1;
+    }
+
+    report_begin(&report);
+    for (int s = 0; s < NUM_SIZES; s++) {
+        const BenchSize *sz = &sizes[s];
+        if (!size_selected(size_list, sz->name)) continue;
+
+        char png[64], jpg[64], raw[64], script[64];
+        snprintf(png, sizeof(png), "/tmp/iml_bench_%d_%s.png", (int)getpid(), sz->name);
+        snprintf(jpg, sizeof(jpg), "/tmp/iml_bench_%d_%s.jpg", (int)getpid(), sz->name);
+        snprintf(raw, sizeof(raw), "/tmp/iml_bench_%d_%s.imlraw", (int)getpid(), sz->name);
+        snprintf(script, sizeof(script), "/tmp/iml_bench_%d_%s.iml", (int)getpid(), sz->name);
+
+        BenchInput in = { make_synthetic(sz->width, sz->height, 0x1234u + s),
+                          make_synthetic(sz->width, sz->height, 0xbeefu + s), NULL, png, jpg, raw };
+        if (in.a) in.a16 = convert_pixel_type(in.a, PIXEL_U16);
+        if (!in.a || !in.b || !in.a16) {
+            fprintf(stderr, "Error: Memory allocation failed for %s inputs\n", sz->name);
+            free_image(in.a);
+            free_image(in.b);
+            free_image(in.a16);
+            continue;
+        }
+        save_image(png, in.a);
+        stbi_write_jpg(jpg, in.a->width, in.a->height, 3, in.a->data, 90);
+        save_image(raw, in.a);
+
+        for (int k = 0; k < NUM_OPS; k++) {
+            if (only && !strstr(ops[k].name, only)) continue;
+            if (bench_op(&ops[k], &in, times, reps)) {
+                report_record(&report, sz, ops[k].name, times, reps);
+            } else {
+                fprintf(stderr, "Warning: %s failed on %s input\n", ops[k].name, sz->name);
+            }
+        }
+
+        for (int k = 0; have_iml && k < NUM_SCRIPTS; k++) {
+            if (only && !strstr(scripts[k].name, only)) continue;
+            FILE *f = fopen(script, "w");
+            if (!f) continue;
+            fprintf(f, scripts[k].source, png, png);
+            fclose(f);
+            if (bench_script(iml, script, threads, times, reps)) {
+                report_record(&report, sz, scripts[k].name, times, reps);
+            } else {
+                fprintf(stderr, "Warning: %s failed on %s input\n", scripts[k].name, sz->name);
+            }
+        }
+
+        char thumb[96];
+        snprintf(thumb, sizeof(thumb), "%s.thumb.png", png);
+        remove(thumb);
+        snprintf(thumb, sizeof(thumb), "%s.out.png", png);
+        remove(thumb);
+        snprintf(thumb, sizeof(thumb), "%s.out.imlraw", png);
+        remove(thumb);
+        snprintf(thumb, sizeof(thumb), "%s.out.jpg", png);
+        remove(thumb);
+        remove(script);
+        remove(png);
+        remove(jpg);
+        remove(raw);
+        free_image(in.a);
+        free_image(in.b);
+        free_image(in.a16);
+    }
+    report_end(&report);
+
+    free(times);
+    if (report.out != stdout) fclose(report.out);
+    parallel_shutdown();
+    return 0;
+}
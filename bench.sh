@@ -0,0 +1,28 @@
+#!/bin/bash
+
+# bench.sh: Build and run the IML benchmarks
+# Builds an optimised iml (for the end-to-end scripts) and the bench driver,
+# then runs every benchmark. Extra arguments are passed to ./bench, e.g.
+#   ./bench.sh --sizes vga,4k --format json --out results.json
+# Requires: bison, flex, gcc.
+
+CFLAGS="-O2 -Wall"
+
+echo "Building IML..." >&2
+bison -d parser.y && flex lexer.l &&
+gcc $CFLAGS -o iml parser.tab.c lex.yy.c ast.c runtime.c parallel.c simd.c fft.c png.c main.c eval.c -lm -lpthread
+
+if [ $? -ne 0 ]; then
+    echo "Build failed!" >&2
+    exit 1
+fi
+
+echo "Building bench..." >&2
+gcc $CFLAGS -o bench bench.c runtime.c parallel.c simd.c fft.c png.c -lm -lpthread
+
+if [ $? -ne 0 ]; then
+    echo "Build failed!" >&2
+    exit 1
+fi
+
+./bench "$@"
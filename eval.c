@@ -10,13 +10,22 @@
 
 // --- NEW SYMBOL TABLE (uses Value) ---
 
+// Variables live in a flat array indexed by slot. Names map to slots through
+// an open-addressing hash table; resolve_program() stores each identifier's
+// slot in the AST so reads and writes in the evaluator skip the lookup.
+
 typedef struct Var {
     char *name;
     Value val;
-    struct Var *next;
+    int defined;    // 0 until the first assignment
 } Var;
 
-static Var *globals = NULL;
+static Var *vars = NULL;
+static int num_vars = 0;
+static int vars_cap = 0;
+
+static int *slot_table = NULL;  // name hash -> slot, -1 marks an empty bucket
+static int table_cap = 0;       // always a power of two
 
 void runtime_error(const char *format, ...) {
     va_list args;
@@ -40,47 +49,185 @@ void free_value(Value val) {
     if (val.tag == V_STRING) {
         free(val.u.sval);
     } else if (val.tag == V_IMAGE) {
-        // Assumes free_image exists in runtime.c
+        // Drops this Value's reference; the pixels go when the last owner does
         free_image(val.u.img);
+    } else if (val.tag == V_LUT) {
+        free(val.u.lut);
     }
 }
 
-void env_set(const char *name, Value val) {
-    Var *v = globals;
-    while (v) {
-        if (strcmp(v->name, name) == 0) {
-            // Free the old value before overwriting
-            free_value(v->val); // <-- FIX: was v.val
-            v->val = val;       // <-- FIX: was v.val
-            return;
+// FNV-1a
+static unsigned int hash_name(const char *name) {
+    unsigned int h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void slot_table_grow(void) {
+    int new_cap = table_cap ? table_cap * 2 : 64;
+    int *new_table = malloc(sizeof(int) * new_cap);
+    if (!new_table) runtime_error("Memory allocation failed for symbol table");
+    for (int i = 0; i < new_cap; i++) new_table[i] = -1;
+
+    // Re-insert every known variable
+    for (int slot = 0; slot < num_vars; slot++) {
+        unsigned int i = hash_name(vars[slot].name) & (new_cap - 1);
+        while (new_table[i] != -1) i = (i + 1) & (new_cap - 1);
+        new_table[i] = slot;
+    }
+    free(slot_table);
+    slot_table = new_table;
+    table_cap = new_cap;
+}
+
+// Returns the slot for 'name', creating an (undefined) variable if 'create'
+// is set. Returns -1 if the name is unknown and 'create' is not set.
+static int lookup_slot(const char *name, int create) {
+    if (table_cap > 0) {
+        unsigned int i = hash_name(name) & (table_cap - 1);
+        while (slot_table[i] != -1) {
+            if (strcmp(vars[slot_table[i]].name, name) == 0) return slot_table[i];
+            i = (i + 1) & (table_cap - 1);
         }
-        v = v->next;
     }
-    
-    // Not found, create new variable
-    Var *nv = malloc(sizeof(Var));
-    if (!nv) {
-        runtime_error("Memory allocation failed for variable %s", name);
+    if (!create) return -1;
+
+    // Keep the table at most half full
+    if ((num_vars + 1) * 2 > table_cap) slot_table_grow();
+    if (num_vars == vars_cap) {
+        int new_cap = vars_cap ? vars_cap * 2 : 16;
+        Var *new_vars = realloc(vars, sizeof(Var) * new_cap);
+        if (!new_vars) runtime_error("Memory allocation failed for variable %s", name);
+        vars = new_vars;
+        vars_cap = new_cap;
     }
-    nv->name = strdup(name);
-    if (!nv->name) {
+
+    int slot = num_vars++;
+    vars[slot].name = strdup(name);
+    if (!vars[slot].name) {
         runtime_error("Memory allocation failed for variable name %s", name);
-        free(nv);
     }
-    nv->val = val;
-    nv->next = globals;
-    globals = nv;
+    vars[slot].val = val_none();
+    vars[slot].defined = 0;
+
+    unsigned int i = hash_name(name) & (table_cap - 1);
+    while (slot_table[i] != -1) i = (i + 1) & (table_cap - 1);
+    slot_table[i] = slot;
+    return slot;
+}
+
+static void env_set_slot(int slot, Value val) {
+    Var *v = &vars[slot];
+    // Free the old value before overwriting
+    if (v->defined) free_value(v->val);
+    v->val = val;
+    v->defined = 1;
 }
+
+static Value env_get_slot(int slot) {
+    if (!vars[slot].defined) {
+        runtime_error("Variable '%s' not found", vars[slot].name);
+    }
+    return vars[slot].val;
+}
+
+void env_set(const char *name, Value val) {
+    env_set_slot(lookup_slot(name, 1), val);
+}
+
 Value env_get(const char *name) {
-    Var *v = globals;
-    while (v) {
-        if (strcmp(v->name, name) == 0) {
-            return v->val;
-        }
-        v = v->next;
+    int slot = lookup_slot(name, 0);
+    if (slot < 0) runtime_error("Variable '%s' not found", name);
+    return env_get_slot(slot);
+}
+
+// Builtin table lookups used by the resolver, defined with the builtins below
+static void resolve_call(Ast *call, int piped);
+
+// Resolver: gives every identifier, assignment and declaration its slot,
+// and every call its builtin
+static void resolve_node(Ast *ast) {
+    if (!ast) return;
+    switch (ast->type) {
+        case AST_IDENT:
+            ast->ident.slot = lookup_slot(ast->ident.str, 1);
+            break;
+        case AST_ASSIGN:
+            ast->assign.slot = lookup_slot(ast->assign.name, 1);
+            resolve_node(ast->assign.expr);
+            break;
+        case AST_DECL:
+            ast->decl.slot = lookup_slot(ast->decl.name, 1);
+            resolve_node(ast->decl.expr);
+            break;
+        case AST_EXPR_STMT:
+            resolve_node(ast->expr_stmt.expr);
+            break;
+        case AST_CALL:
+            resolve_call(ast, 0);
+            for (int i = 0; i < ast->call.nargs; i++) resolve_node(ast->call.args[i]);
+            break;
+        case AST_PIPELINE:
+            resolve_node(ast->pipe.left);
+            if (ast->pipe.right->type == AST_CALL) {
+                resolve_call(ast->pipe.right, 1);
+                for (int i = 0; i < ast->pipe.right->call.nargs; i++) {
+                    resolve_node(ast->pipe.right->call.args[i]);
+                }
+            } else {
+                resolve_node(ast->pipe.right);
+            }
+            break;
+        case AST_BLOCK:
+            for (int i = 0; i < ast->block.n; i++) resolve_node(ast->block.stmts[i]);
+            break;
+        case AST_RETURN:
+            resolve_node(ast->ret.expr);
+            break;
+        case AST_IF:
+            resolve_node(ast->if_stmt.cond);
+            resolve_node(ast->if_stmt.block);
+            break;
+        case AST_IF_ELSE:
+            resolve_node(ast->if_else_stmt.cond);
+            resolve_node(ast->if_else_stmt.then_block);
+            resolve_node(ast->if_else_stmt.else_block);
+            break;
+        case AST_WHILE:
+            resolve_node(ast->while_stmt.cond);
+            resolve_node(ast->while_stmt.block);
+            break;
+        case AST_FOR:
+            resolve_node(ast->for_stmt.init);
+            resolve_node(ast->for_stmt.cond);
+            resolve_node(ast->for_stmt.update);
+            resolve_node(ast->for_stmt.block);
+            break;
+        case AST_BINOP:
+            resolve_node(ast->binop.left);
+            resolve_node(ast->binop.right);
+            break;
+        default:
+            // Literals have no names; function bodies are not executed
+            break;
     }
-    runtime_error("Variable '%s' not found", name);
-    return val_none(); // Unreachable
+}
+
+/**
+ * @brief Assigns a variable slot to every name and a builtin to every call.
+ *
+ * Runs once after parsing, so unknown functions and wrong argument counts
+ * are reported before anything executes. Nodes it does not reach keep
+ * slot/fn_id -1 and fall back to a by-name lookup at runtime.
+ *
+ * @return The number of variable slots in use.
+ */
+int resolve_program(Ast *prog) {
+    resolve_node(prog);
+    return num_vars;
 }
 
 // --- END NEW SYMBOL TABLE ---
@@ -145,7 +292,9 @@ Image *copy_image(Image *img) {
     new_img->width = img->width;
     new_img->height = img->height;
     new_img->channels = img->channels;
-    size_t data_size = (size_t)img->width * img->height * img->channels;
+    new_img->type = img->type;
+    new_img->refcount = 1;
+    size_t data_size = image_data_size(img);
     if (data_size == 0) {
         runtime_error("copy_image: image has zero size");
         free(new_img);
@@ -170,87 +319,98 @@ Value value_clone(Value val) {
         return new_val;
     }
     if (val.tag == V_IMAGE) {
+        // Images are shared, not copied; operators never write to their input
         Value new_val;
         new_val.tag = V_IMAGE;
-        new_val.u.img = copy_image(val.u.img);
+        new_val.u.img = retain_image(val.u.img);
         if (!new_val.u.img) runtime_error("Failed to clone image");
         return new_val;
     }
+    if (val.tag == V_LUT) {
+        Value new_val;
+        new_val.tag = V_LUT;
+        new_val.u.lut = malloc(256);
+        if (!new_val.u.lut) runtime_error("Failed to clone lut");
+        memcpy(new_val.u.lut, val.u.lut, 256);
+        return new_val;
+    }
     return val;
 }
 
 // --- END HELPERS ---
 
 
-// Central function to dispatch builtin calls.
-// It *consumes* (frees) all arguments in the 'args' array, unless specified.
-Value eval_builtin_call(const char *fname, Value *args, int nargs) {
-    Value result = val_none(); // Default return
-    int free_args = 1;
-
-    if (strcmp(fname, "load") == 0) {
-        if (nargs != 1) runtime_error("load() expects 1 argument, got %d", nargs);
-        const char *path = value_to_string(args[0]);
-        Image *img = load_image(path);
-        if (!img) {
-            result = val_none();
-        } else {
-            result.tag = V_IMAGE;
-            result.u.img = img;
-        }
-    }
-    else if (strcmp(fname, "save") == 0) {
-        if (nargs != 2) runtime_error("save() expects 2 arguments, got %d", nargs);
-        const char *path = value_to_string(args[0]);
-        Image *img = value_to_image(args[1]);
-        save_image(path, img);
-        
-        free_value(args[0]);
-        free_args = 0;
-        
-    }
-    else if (strcmp(fname, "crop") == 0) {
-        if (nargs != 5) runtime_error("crop() expects 5 arguments, got %d", nargs);
-        Image *img = value_to_image(args[0]);
-        int x = value_to_int(args[1]);
-        int y = value_to_int(args[2]);
-        int w = value_to_int(args[3]);
-        int h = value_to_int(args[4]);
-        Image *out_img = crop_image(img, x, y, w, h);
-        if (!out_img) runtime_error("crop() failed");
-        result.tag = V_IMAGE;
-        result.u.img = out_img;
-    }
-    else if (strcmp(fname, "blur") == 0) {
-        if (nargs != 2) runtime_error("blur() expects 2 arguments, got %d", nargs);
-        Image *img = value_to_image(args[0]);
-        int r = value_to_int(args[1]);
-        Image *out_img = blur_image(img, r);
-        if (!out_img) runtime_error("blur() failed");
-        result.tag = V_IMAGE;
-        result.u.img = out_img;
-    }
-    else if (strcmp(fname, "grayscale") == 0) {
-        if (nargs != 1) runtime_error("grayscale() expects 1 argument, got %d", nargs);
-        Image *img = value_to_image(args[0]);
-        Image *out_img = grayscale_image(img);
-        if (!out_img) runtime_error("grayscale() failed");
-        result.tag = V_IMAGE;
-        result.u.img = out_img;
-    }
-    else if (strcmp(fname, "invert") == 0 && nargs == 1) {
-        Image *img = value_to_image(args[0]);
-        Image *out_img = invert_image(img);
-        if (!out_img) runtime_error("invert() failed");
-        result.tag = V_IMAGE;
-        result.u.img = out_img;
-    }else if (strcmp(fname, "contrast") == 0) {
-        if (nargs != 3) runtime_error("contrast() expects 3 arguments, got %d", nargs);
-        
-        Image *img = value_to_image(args[0]);
-        int amount = value_to_int(args[1]);
-        int direction = value_to_int(args[2]);
+// --- BUILTINS ---
+
+// Every builtin has a fixed entry in 'builtins' below. resolve_program()
+// stores the entry's index in each call node, so calls dispatch through a
+// function pointer and arity is checked before the program starts running.
+
+typedef enum {
+    BI_LUT,
+    BI_APPLYLUT,
+    BI_LOAD,
+    BI_SAVE,
+    BI_CROP,
+    BI_BLUR,
+    BI_GAUSSIAN,
+    BI_CONVOLVE,
+    BI_GRAYSCALE,
+    BI_INVERT,
+    BI_CONTRAST,
+    BI_BRIGHTEN,
+    BI_THRESHOLD,
+    BI_SHARPEN,
+    BI_BLEND,
+    BI_MASK,
+    BI_RESIZE,
+    BI_SCALE,
+    BI_PYRAMID,
+    BI_ROTATE,
+    BI_FLIPX,
+    BI_FLIPY,
+    BI_TRANSPOSE,
+    BI_TRANSVERSE,
+    BI_CANNYEDGE,
+    BI_CHANNELS,
+    BI_PREMULTIPLY,
+    BI_UNPREMULTIPLY,
+    BI_CONVERT,
+    BI_PRINT,
+    BI_COUNT
+} BuiltinId;
+
+// Builtins receive their arguments already arity-checked and must not free them
+typedef Value (*BuiltinFn)(Value *args, int nargs);
+
+typedef struct {
+    const char *name;
+    BuiltinFn fn;
+    int min_args;
+    int max_args;       // -1 for variadic
+    const char *usage;  // optional parameter hint for arity errors
+} Builtin;
+
+// --- POINT-OP HELPERS ---
+
+// Builtins that map each pixel independently and can share one pass
+static int is_point_op(int id) {
+    return id == BI_GRAYSCALE || id == BI_INVERT || id == BI_BRIGHTEN ||
+           id == BI_CONTRAST || id == BI_THRESHOLD;
+}
 
+// Validates a point-op call's parameters exactly like the builtin and describes it.
+// 'args' excludes the piped image; arity has already been checked.
+static PointOp make_point_op(int id, Value *args) {
+    PointOp op = { POINT_GRAYSCALE, 0, 0, 0.0f };
+
+    if (id == BI_GRAYSCALE) {
+        op.kind = POINT_GRAYSCALE;
+    } else if (id == BI_INVERT) {
+        op.kind = POINT_INVERT;
+    } else if (id == BI_CONTRAST) {
+        int amount = value_to_int(args[0]);
+        int direction = value_to_int(args[1]);
         if (direction != 0 && direction != 1) {
             runtime_error("contrast() direction (arg 3) must be 0 (reduce) or 1 (increase), got %d", direction);
         }
@@ -259,181 +419,697 @@ Value eval_builtin_call(const char *fname, Value *args, int nargs) {
             if (amount < 0) amount = 0;
             if (amount > 100) amount = 100;
         }
-        Image *out_img = adjust_contrast(img, amount, direction);
-        if (!out_img) runtime_error("contrast() failed");
-
-        result.tag = V_IMAGE;
-        result.u.img = out_img;
-    } else if (strcmp(fname, "brighten") == 0) {
-        if (nargs != 3) runtime_error("brighten() expects 3 arguments, got %d", nargs);
-        
-        Image *img = value_to_image(args[0]);
-        int bias = value_to_int(args[1]);
-        int direction = value_to_int(args[2]);
-
+        // Same factor as adjust_contrast()
+        op.kind = POINT_CONTRAST;
+        op.fval = (direction == 1) ? 1.0f + (float)amount / 100.0f
+                                   : 1.0f - (float)amount / 100.0f;
+    } else if (id == BI_BRIGHTEN) {
+        int bias = value_to_int(args[0]);
+        int direction = value_to_int(args[1]);
         if (direction != 0 && direction != 1) {
             runtime_error("brighten() direction (arg 3) must be 0 (reduce) or 1 (increase), got %d", direction);
         }
-
-        Image *out_img = adjust_brightness(img, bias, direction);
-        if (!out_img) runtime_error("brighten() failed");
-        
-        result.tag = V_IMAGE;
-        result.u.img = out_img;
-    } else if (strcmp(fname, "threshold") == 0) {
-        if (nargs != 3) runtime_error("threshold() expects 3 arguments, got %d", nargs);
-        
-        Image *img = value_to_image(args[0]);
-        int threshold = value_to_int(args[1]);
-        int direction = value_to_int(args[2]);
-
+        op.kind = POINT_BRIGHTNESS;
+        op.ival = (direction == 1) ? bias : -bias;
+    } else if (id == BI_THRESHOLD) {
+        int threshold = value_to_int(args[0]);
+        int direction = value_to_int(args[1]);
         if (direction != 0 && direction != 1) {
             runtime_error("threshold() direction (arg 3) must be 0 (inverted) or 1 (standard), got %d", direction);
         }
-
         if (threshold < 0 || threshold > 255) {
             runtime_error("threshold() value (arg 2) must be between 0 and 255, got %d", threshold);
         }
-        Image *out_img = apply_threshold(img, threshold, direction);
-        if (!out_img) runtime_error("threshold() failed");
-        
-        result.tag = V_IMAGE;
-        result.u.img = out_img;
-    } else if (strcmp(fname, "sharpen") == 0) {
-        if (nargs != 3) runtime_error("sharpen() expects 3 arguments, got %d", nargs);
-        
-        Image *img = value_to_image(args[0]);
-        int amount = value_to_int(args[1]);
-        int direction = value_to_int(args[2]);
+        op.kind = POINT_THRESHOLD;
+        op.ival = threshold;
+        op.direction = direction;
+    }
+    return op;
+}
 
-        if (direction != 0 && direction != 1) {
-            runtime_error("sharpen() direction (arg 3) must be 0 (soften) or 1 (sharpen), got %d", direction);
+// --- END POINT-OP HELPERS ---
+
+static Value image_result(Image *img) {
+    Value v;
+    v.tag = V_IMAGE;
+    v.u.img = img;
+    return v;
+}
+
+static Value builtin_lut(Value *args, int nargs) {
+    (void)args; (void)nargs;
+    Value result;
+    result.tag = V_LUT;
+    result.u.lut = malloc(256);
+    if (!result.u.lut) runtime_error("Failed to allocate lut");
+    lut_identity(result.u.lut);
+    return result;
+}
+
+static Value builtin_applylut(Value *args, int nargs) {
+    (void)nargs;
+    Image *img = value_to_image(args[0]);
+    if (args[1].tag != V_LUT) runtime_error("Type error: expected lut, got %d", args[1].tag);
+    Image *out_img = apply_lut(img, args[1].u.lut);
+    if (!out_img) runtime_error("applylut() failed");
+    return image_result(out_img);
+}
+
+static Value builtin_load(Value *args, int nargs) {
+    const char *path = value_to_string(args[0]);
+    Image *img;
+    if (nargs == 1) {
+        img = load_image(path);
+    } else {
+        if (nargs != 3) runtime_error("load() expects (path) or (path, width, height), got %d arguments", nargs);
+        img = load_image_scaled(path, value_to_int(args[1]), value_to_int(args[2]));
+    }
+    if (!img) return val_none();
+    return image_result(img);
+}
+
+static ImageFormat image_format_from_name(const char *name) {
+    static const struct { const char *name; ImageFormat format; } names[] = {
+        { "png", IMAGE_FORMAT_PNG }, { "jpeg", IMAGE_FORMAT_JPEG }, { "jpg", IMAGE_FORMAT_JPEG },
+        { "bmp", IMAGE_FORMAT_BMP }, { "tga", IMAGE_FORMAT_TGA }, { "ppm", IMAGE_FORMAT_PPM },
+        { "pam", IMAGE_FORMAT_PAM }, { "imlraw", IMAGE_FORMAT_IMLRAW }, { "hdr", IMAGE_FORMAT_HDR },
+    };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(name, names[i].name) == 0) return names[i].format;
+    }
+    runtime_error("save() format (arg 3) must be \"png\", \"jpeg\", \"bmp\", \"tga\", \"ppm\", \"pam\", "
+                  "\"imlraw\" or \"hdr\", got \"%s\"", name);
+    return IMAGE_FORMAT_AUTO;
+}
+
+static PngFilter png_filter_from_name(int argno, const char *name) {
+    static const struct { const char *name; PngFilter filter; } names[] = {
+        { "none", PNG_FILTER_NONE }, { "sub", PNG_FILTER_SUB }, { "up", PNG_FILTER_UP },
+        { "average", PNG_FILTER_AVERAGE }, { "paeth", PNG_FILTER_PAETH },
+        { "adaptive", PNG_FILTER_ADAPTIVE }, { "fast", PNG_FILTER_FAST },
+    };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(name, names[i].name) == 0) return names[i].filter;
+    }
+    runtime_error("save() filter (arg %d) must be \"none\", \"sub\", \"up\", \"average\", \"paeth\", "
+                  "\"adaptive\" or \"fast\", got \"%s\"", argno, name);
+    return PNG_FILTER_AUTO;
+}
+
+// save(path, img, [format], [options...]): the format is a name or, when
+// left out, the path's extension. PNG takes (level 0..9, filter), JPEG
+// takes (quality 1..100, "420" or "444" chroma subsampling).
+static Value builtin_save(Value *args, int nargs) {
+    const char *path = value_to_string(args[0]);
+    Image *img = value_to_image(args[1]);
+    int opt = 2;
+    ImageFormat format = IMAGE_FORMAT_AUTO;
+    if (nargs > 2 && args[2].tag == V_STRING) {
+        format = image_format_from_name(value_to_string(args[2]));
+        opt = 3;
+    }
+    if (format == IMAGE_FORMAT_AUTO) format = image_format_from_path(path);
+    if (nargs == opt) {
+        save_image_as(path, img, format);
+        return val_none();
+    }
+    if (nargs > opt + 2) runtime_error("save() takes at most 2 options after the format, got %d", nargs - opt);
+    if (format == IMAGE_FORMAT_PNG) {
+        int level = value_to_int(args[opt]);
+        if (level < 0 || level > 9) runtime_error("save() level (arg %d) must be 0..9, got %d", opt + 1, level);
+        PngFilter filter = nargs > opt + 1 ? png_filter_from_name(opt + 2, value_to_string(args[opt + 1]))
+                                           : PNG_FILTER_AUTO;
+        save_image_png(path, img, level, filter);
+    } else if (format == IMAGE_FORMAT_JPEG) {
+        int quality = value_to_int(args[opt]);
+        if (quality < 1 || quality > 100) {
+            runtime_error("save() quality (arg %d) must be 1..100, got %d", opt + 1, quality);
         }
-        if (amount < 0) {
-            fprintf(stderr, "Warning: sharpen amount %d is negative, using 0.\n", amount);
-            amount = 0;
+        JpegSubsample subsample = JPEG_SUBSAMPLE_AUTO;
+        if (nargs > opt + 1) {
+            const char *name = value_to_string(args[opt + 1]);
+            if (strcmp(name, "420") == 0) subsample = JPEG_SUBSAMPLE_420;
+            else if (strcmp(name, "444") == 0) subsample = JPEG_SUBSAMPLE_444;
+            else runtime_error("save() subsampling (arg %d) must be \"420\" or \"444\", got \"%s\"", opt + 2, name);
         }
-        
-        if (direction == 1 && amount > 20) {
-                fprintf(stderr, "Warning: sharpen amount %d is very high, capping at 20.\n", amount);
-                amount = 20;
+        save_image_jpeg(path, img, quality, subsample);
+    } else {
+        runtime_error("save() takes no options for this format, got %d extra arguments", nargs - opt);
+    }
+    return val_none();
+}
+
+static Value builtin_crop(Value *args, int nargs) {
+    (void)nargs;
+    Image *img = value_to_image(args[0]);
+    int x = value_to_int(args[1]);
+    int y = value_to_int(args[2]);
+    int w = value_to_int(args[3]);
+    int h = value_to_int(args[4]);
+    Image *out_img = crop_image(img, x, y, w, h);
+    if (!out_img) runtime_error("crop() failed");
+    return image_result(out_img);
+}
+
+static Value builtin_blur(Value *args, int nargs) {
+    (void)nargs;
+    Image *img = value_to_image(args[0]);
+    int r = value_to_int(args[1]);
+    Image *out_img = blur_image(img, r);
+    if (!out_img) runtime_error("blur() failed");
+    return image_result(out_img);
+}
+
+static Value builtin_gaussian(Value *args, int nargs) {
+    (void)nargs;
+    Image *img = value_to_image(args[0]);
+    float sigma = (float)value_to_float(args[1]);
+
+    if (!(sigma > 0.0f)) {
+        runtime_error("gaussian() sigma (arg 2) must be positive, got %f", sigma);
+    }
+    Image *out_img = gaussian_image(img, sigma);
+    if (!out_img) runtime_error("gaussian() failed");
+    return image_result(out_img);
+}
+
+// Parses a kernel literal such as "1 2 1; 2 4 2; 1 2 1 / 16": rows end at
+// ';' or a newline, weights are separated by spaces or commas, and an
+// optional trailing "/ divisor" scales every weight.
+static float *parse_kernel(const char *text, int *kw_out, int *kh_out) {
+    size_t cap = 16, n = 0;
+    float *k = malloc(cap * sizeof(float));
+    if (!k) runtime_error("Memory allocation failed for convolve() kernel");
+    int kw = -1, kh = 0, cols = 0;
+    float divisor = 1.0f;
+    const char *p = text;
+
+    for (;;) {
+        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == ',') p++;
+        if (*p == ';' || *p == '\n' || *p == '/' || *p == '\0') {
+            if (cols > 0) {
+                if (kw < 0) {
+                    kw = cols;
+                } else if (cols != kw) {
+                    runtime_error("convolve() kernel row %d has %d weights, expected %d", kh + 1, cols, kw);
+                }
+                kh++;
+                cols = 0;
+            }
+            if (*p == '/') {
+                char *end;
+                divisor = strtof(p + 1, &end);
+                while (*end == ' ' || *end == '\t' || *end == '\r' || *end == '\n') end++;
+                if (end == p + 1 || *end != '\0' || divisor == 0.0f) {
+                    runtime_error("convolve() kernel divisor must be a non-zero number at the end");
+                }
+                break;
+            }
+            if (*p == '\0') break;
+            p++;
+            continue;
         }
-        
-        if (direction == 0 && amount == 0) {
-            amount = 1; 
+        char *end;
+        float v = strtof(p, &end);
+        if (end == p) {
+            runtime_error("convolve() kernel: unexpected '%c' at offset %d", *p, (int)(p - text));
         }
+        if (n == cap) {
+            cap *= 2;
+            float *grown = realloc(k, cap * sizeof(float));
+            if (!grown) runtime_error("Memory allocation failed for convolve() kernel");
+            k = grown;
+        }
+        k[n++] = v;
+        cols++;
+        p = end;
+    }
+    if (kh == 0) runtime_error("convolve() kernel is empty");
 
-        Image *out_img = sharpen_image(img, amount, direction);
-        if (!out_img) runtime_error("sharpen() failed");
-        
-        result.tag = V_IMAGE;
-        result.u.img = out_img;
-    } else if (strcmp(fname, "blend") == 0) {
-        if (nargs != 3) runtime_error("blend() expects 3 arguments, got %d", nargs);
-        
-        Image *img1 = value_to_image(args[0]);
-        Image *img2 = value_to_image(args[1]);
-        float alpha = (float)value_to_float(args[2]);
+    for (size_t i = 0; i < n; i++) k[i] /= divisor;
+    *kw_out = kw;
+    *kh_out = kh;
+    return k;
+}
 
-        if (alpha < 0.0f || alpha > 1.0f) {
-            fprintf(stderr, "Warning: blend() alpha %f is outside [0.0, 1.0], clamping.\n", alpha);
-            if (alpha < 0.0f) alpha = 0.0f;
-            if (alpha > 1.0f) alpha = 1.0f;
-        }
+static Value builtin_convolve(Value *args, int nargs) {
+    Image *img = value_to_image(args[0]);
+    const char *text = value_to_string(args[1]);
+    BorderMode border = BORDER_CLAMP;
+
+    if (nargs > 2) {
+        const char *name = value_to_string(args[2]);
+        if (strcmp(name, "clamp") == 0) border = BORDER_CLAMP;
+        else if (strcmp(name, "mirror") == 0) border = BORDER_MIRROR;
+        else if (strcmp(name, "wrap") == 0) border = BORDER_WRAP;
+        else if (strcmp(name, "zero") == 0) border = BORDER_ZERO;
+        else runtime_error("convolve() border (arg 3) must be \"clamp\", \"mirror\", \"wrap\" or \"zero\", got \"%s\"", name);
+    }
 
-        Image *out_img = blend_images(img1, img2, alpha);
-        if (!out_img) runtime_error("blend() failed (check image dimensions match)");
-        
-        result.tag = V_IMAGE;
-        result.u.img = out_img;
-    } else if (strcmp(fname, "mask") == 0) {
-        if (nargs != 2) runtime_error("mask() expects 2 arguments, got %d", nargs);
-        
-        Image *img = value_to_image(args[0]);
-        Image *mask = value_to_image(args[1]);
+    int kw, kh;
+    float *kernel = parse_kernel(text, &kw, &kh);
+    Image *out_img = convolve_kernel(img, kernel, kw, kh, border);
+    free(kernel);
+    if (!out_img) runtime_error("convolve() failed");
+    return image_result(out_img);
+}
 
-        Image *out_img = mask_image(img, mask);
-        if (!out_img) runtime_error("mask() failed (check image dimensions match)");
-        
-        result.tag = V_IMAGE;
-        result.u.img = out_img;
-    } else if (strcmp(fname, "resize") == 0) {
-        if (nargs != 3) runtime_error("resize() expects 3 arguments, got %d", nargs);
-        
-        Image *img = value_to_image(args[0]);
-        int w = value_to_int(args[1]);
-        int h = value_to_int(args[2]);
-        Image *out_img = resize_image_nearest(img, w, h);
-        if (!out_img) runtime_error("resize() failed");
-         
-        result.tag = V_IMAGE;
-        result.u.img = out_img;
-    } else if (strcmp(fname, "scale") == 0) {
-        if (nargs != 2) runtime_error("scale() expects 2 arguments (img, factor), got %d", nargs);
-        
-        Image *img = value_to_image(args[0]);
-        float factor = value_to_float(args[1]);
+static Value builtin_grayscale(Value *args, int nargs) {
+    (void)nargs;
+    Image *img = value_to_image(args[0]);
+    Image *out_img = grayscale_image(img);
+    if (!out_img) runtime_error("grayscale() failed");
+    return image_result(out_img);
+}
 
-        Image *out_img = scale_image_factor(img, factor);
-        if (!out_img) runtime_error("scale() failed");
-        
-        result.tag = V_IMAGE;
-        result.u.img = out_img;
-    } else if (strcmp(fname, "rotate") == 0) {
-        if (nargs != 2) runtime_error("rotate() expects 2 arguments (img, angle_degrees), got %d", nargs);
-        
-        Image *img = value_to_image(args[0]);
-        int direction = value_to_int(args[1]);
+static Value builtin_invert(Value *args, int nargs) {
+    (void)nargs;
+    Image *img = value_to_image(args[0]);
+    Image *out_img = invert_image(img);
+    if (!out_img) runtime_error("invert() failed");
+    return image_result(out_img);
+}
 
-        Image *out_img = rotate_image_90(img, direction);
-        if (!out_img) runtime_error("rotate() failed");
-        
-        result.tag = V_IMAGE;
-        result.u.img = out_img;
-    } else if (strcmp(fname, "print") == 0) {
-        for (int i = 0; i < nargs; i++) {
-            switch (args[i].tag) {
-                case V_IMAGE:
-                    printf("<Image %dx%d>", args[i].u.img->width, args[i].u.img->height);
-                    break;
-                case V_INT:
-                    printf("%d", args[i].u.ival);
-                    break;
-                case V_FLOAT:
-                    printf("%f", args[i].u.fval);
-                    break;
-                case V_STRING:
-                    print_string_escaped(args[i].u.sval);
-                    break;
-                case V_NONE:
-                    printf("<null>");
-                    break;
-                default:
-                    printf("<unknown_type>");
-                    break;
-            }
-            
-            // if (i < nargs - 1) {
-            //     print_string_escaped(" ");
-            // }
+static Value builtin_contrast(Value *args, int nargs) {
+    (void)nargs;
+    Image *img = value_to_image(args[0]);
+    int amount = value_to_int(args[1]);
+    int direction = value_to_int(args[2]);
+
+    if (direction != 0 && direction != 1) {
+        runtime_error("contrast() direction (arg 3) must be 0 (reduce) or 1 (increase), got %d", direction);
+    }
+    if (amount < 0 || amount > 100) {
+        fprintf(stderr, "Warning: contrast amount %d is outside recommended 0-100 range. Clamping.\n", amount);
+        if (amount < 0) amount = 0;
+        if (amount > 100) amount = 100;
+    }
+    Image *out_img = adjust_contrast(img, amount, direction);
+    if (!out_img) runtime_error("contrast() failed");
+    return image_result(out_img);
+}
+
+static Value builtin_brighten(Value *args, int nargs) {
+    (void)nargs;
+    Image *img = value_to_image(args[0]);
+    int bias = value_to_int(args[1]);
+    int direction = value_to_int(args[2]);
+
+    if (direction != 0 && direction != 1) {
+        runtime_error("brighten() direction (arg 3) must be 0 (reduce) or 1 (increase), got %d", direction);
+    }
+
+    Image *out_img = adjust_brightness(img, bias, direction);
+    if (!out_img) runtime_error("brighten() failed");
+    return image_result(out_img);
+}
+
+static Value builtin_threshold(Value *args, int nargs) {
+    (void)nargs;
+    Image *img = value_to_image(args[0]);
+    int threshold = value_to_int(args[1]);
+    int direction = value_to_int(args[2]);
+
+    if (direction != 0 && direction != 1) {
+        runtime_error("threshold() direction (arg 3) must be 0 (inverted) or 1 (standard), got %d", direction);
+    }
+
+    if (threshold < 0 || threshold > 255) {
+        runtime_error("threshold() value (arg 2) must be between 0 and 255, got %d", threshold);
+    }
+    Image *out_img = apply_threshold(img, threshold, direction);
+    if (!out_img) runtime_error("threshold() failed");
+    return image_result(out_img);
+}
+
+// Validates sharpen()'s amount and direction; 'args' excludes the image
+static void sharpen_args(Value *args, int *amount_out, int *direction_out) {
+    int amount = value_to_int(args[0]);
+    int direction = value_to_int(args[1]);
+
+    if (direction != 0 && direction != 1) {
+        runtime_error("sharpen() direction (arg 3) must be 0 (soften) or 1 (sharpen), got %d", direction);
+    }
+    if (amount < 0) {
+        fprintf(stderr, "Warning: sharpen amount %d is negative, using 0.\n", amount);
+        amount = 0;
+    }
+
+    if (direction == 1 && amount > 20) {
+            fprintf(stderr, "Warning: sharpen amount %d is very high, capping at 20.\n", amount);
+            amount = 20;
+    }
+
+    if (direction == 0 && amount == 0) {
+        amount = 1;
+    }
+    *amount_out = amount;
+    *direction_out = direction;
+}
+
+static Value builtin_sharpen(Value *args, int nargs) {
+    (void)nargs;
+    Image *img = value_to_image(args[0]);
+    int amount, direction;
+    sharpen_args(args + 1, &amount, &direction);
+
+    Image *out_img = sharpen_image(img, amount, direction);
+    if (!out_img) runtime_error("sharpen() failed");
+    return image_result(out_img);
+}
+
+static Value builtin_blend(Value *args, int nargs) {
+    (void)nargs;
+    Image *img1 = value_to_image(args[0]);
+    Image *img2 = value_to_image(args[1]);
+    float alpha = (float)value_to_float(args[2]);
+
+    if (alpha < 0.0f || alpha > 1.0f) {
+        fprintf(stderr, "Warning: blend() alpha %f is outside [0.0, 1.0], clamping.\n", alpha);
+        if (alpha < 0.0f) alpha = 0.0f;
+        if (alpha > 1.0f) alpha = 1.0f;
+    }
+
+    Image *out_img = blend_images(img1, img2, alpha);
+    if (!out_img) runtime_error("blend() failed (check image dimensions, channel counts and pixel types match)");
+    return image_result(out_img);
+}
+
+static Value builtin_mask(Value *args, int nargs) {
+    (void)nargs;
+    Image *img = value_to_image(args[0]);
+    Image *mask = value_to_image(args[1]);
+
+    Image *out_img = mask_image(img, mask);
+    if (!out_img) runtime_error("mask() failed (check image dimensions match)");
+    return image_result(out_img);
+}
+
+// Filter name for rotate(), resize() and scale(). Box and Lanczos only
+// exist for resizing.
+static Interp interp_from_name(const char *name, const char *fn, int argno, int resize) {
+    if (strcmp(name, "nearest") == 0) return INTERP_NEAREST;
+    if (strcmp(name, "bilinear") == 0) return INTERP_BILINEAR;
+    if (strcmp(name, "bicubic") == 0) return INTERP_BICUBIC;
+    if (resize && strcmp(name, "box") == 0) return INTERP_BOX;
+    if (resize && strcmp(name, "lanczos") == 0) return INTERP_LANCZOS3;
+    if (resize) {
+        runtime_error("%s() filter (arg %d) must be \"nearest\", \"box\", \"bilinear\", \"bicubic\" or \"lanczos\", got \"%s\"",
+                      fn, argno, name);
+    }
+    runtime_error("%s() interp (arg %d) must be \"nearest\", \"bilinear\" or \"bicubic\", got \"%s\"", fn, argno, name);
+    return INTERP_NEAREST;
+}
+
+// resize(img, w, h, [filter]): nearest unless a filter is named
+static Value builtin_resize(Value *args, int nargs) {
+    Image *img = value_to_image(args[0]);
+    int w = value_to_int(args[1]);
+    int h = value_to_int(args[2]);
+    Interp filter = nargs > 3 ? interp_from_name(value_to_string(args[3]), "resize", 4, 1) : INTERP_NEAREST;
+    Image *out_img = resize_image(img, w, h, filter);
+    if (!out_img) runtime_error("resize() failed");
+    return image_result(out_img);
+}
+
+static Value builtin_scale(Value *args, int nargs) {
+    Image *img = value_to_image(args[0]);
+    float factor = value_to_float(args[1]);
+    Interp filter = nargs > 2 ? interp_from_name(value_to_string(args[2]), "scale", 3, 1) : INTERP_NEAREST;
+
+    Image *out_img = scale_image_factor(img, factor, filter);
+    if (!out_img) runtime_error("scale() failed");
+    return image_result(out_img);
+}
+
+// pyramid(img, levels): every halving packed left to right in one image
+static Value builtin_pyramid(Value *args, int nargs) {
+    (void)nargs;
+    Image *img = value_to_image(args[0]);
+    int levels = value_to_int(args[1]);
+
+    if (levels < 1 || levels > 16) {
+        runtime_error("pyramid() levels (arg 2) must be between 1 and 16, got %d", levels);
+    }
+    Image *out_img = pyramid_image(img, levels);
+    if (!out_img) runtime_error("pyramid() failed");
+    return image_result(out_img);
+}
+
+// rotate(img, angle, [interp], [expand]): clockwise by any angle in degrees.
+// With two arguments, 1 and -1 are still accepted as the old right/left
+// directions.
+static Value builtin_rotate(Value *args, int nargs) {
+    Image *img = value_to_image(args[0]);
+    double angle = value_to_float(args[1]);
+    Interp interp = INTERP_BILINEAR;
+    int expand = 1;
+
+    if (nargs == 2 && (angle == 1.0 || angle == -1.0)) angle *= 90.0;
+    if (nargs > 2) interp = interp_from_name(value_to_string(args[2]), "rotate", 3, 0);
+    if (nargs > 3) expand = value_to_int(args[3]) != 0;
+
+    Image *out_img = rotate_image(img, angle, interp, expand);
+    if (!out_img) runtime_error("rotate() failed");
+    return image_result(out_img);
+}
+
+static Value builtin_flipx(Value *args, int nargs) {
+    (void)nargs;
+    Image *out_img = flip_image_along_X(value_to_image(args[0]));
+    if (!out_img) runtime_error("flipX() failed");
+    return image_result(out_img);
+}
+
+static Value builtin_flipy(Value *args, int nargs) {
+    (void)nargs;
+    Image *out_img = flip_image_along_Y(value_to_image(args[0]));
+    if (!out_img) runtime_error("flipY() failed");
+    return image_result(out_img);
+}
+
+static Value builtin_transpose(Value *args, int nargs) {
+    (void)nargs;
+    Image *out_img = orient_image(value_to_image(args[0]), ORIENT_TRANSPOSE);
+    if (!out_img) runtime_error("transpose() failed");
+    return image_result(out_img);
+}
+
+static Value builtin_transverse(Value *args, int nargs) {
+    (void)nargs;
+    Image *out_img = orient_image(value_to_image(args[0]), ORIENT_TRANSVERSE);
+    if (!out_img) runtime_error("transverse() failed");
+    return image_result(out_img);
+}
+
+static Value builtin_cannyedge(Value *args, int nargs) {
+    (void)nargs;
+    Image *img = value_to_image(args[0]);
+    float sigma = (float)value_to_float(args[1]);
+    int low = value_to_int(args[2]);
+    int high = value_to_int(args[3]);
+
+    if (!(sigma > 0.0f)) {
+        runtime_error("cannyedge() sigma (arg 2) must be positive, got %f", sigma);
+    }
+    if (low < 0 || low > 255 || high < 0 || high > 255) {
+        runtime_error("cannyedge() thresholds (args 3, 4) must be between 0 and 255, got %d and %d", low, high);
+    }
+    if (low > high) {
+        runtime_error("cannyedge() low threshold %d is greater than high threshold %d", low, high);
+    }
+
+    Image *out_img = run_canny(img, sigma, (unsigned char)low, (unsigned char)high);
+    if (!out_img) runtime_error("cannyedge() failed");
+    return image_result(out_img);
+}
+
+// channels(img, n): 1 (gray), 3 (RGB) or 4 (RGBA)
+static Value builtin_channels(Value *args, int nargs) {
+    (void)nargs;
+    Image *img = value_to_image(args[0]);
+    int channels = value_to_int(args[1]);
+
+    if (channels != 1 && channels != 3 && channels != 4) {
+        runtime_error("channels() count (arg 2) must be 1, 3 or 4, got %d", channels);
+    }
+    Image *out_img = convert_channels(img, channels);
+    if (!out_img) runtime_error("channels() failed");
+    return image_result(out_img);
+}
+
+static Value builtin_premultiply(Value *args, int nargs) {
+    (void)nargs;
+    Image *out_img = premultiply_image(value_to_image(args[0]));
+    if (!out_img) runtime_error("premultiply() failed");
+    return image_result(out_img);
+}
+
+static Value builtin_unpremultiply(Value *args, int nargs) {
+    (void)nargs;
+    Image *out_img = unpremultiply_image(value_to_image(args[0]));
+    if (!out_img) runtime_error("unpremultiply() failed");
+    return image_result(out_img);
+}
+
+// convert(img, type): "u8", "u16" or "f32" samples
+static Value builtin_convert(Value *args, int nargs) {
+    (void)nargs;
+    Image *img = value_to_image(args[0]);
+    const char *name = value_to_string(args[1]);
+    PixelType type;
+
+    if (strcmp(name, "u8") == 0) {
+        type = PIXEL_U8;
+    } else if (strcmp(name, "u16") == 0) {
+        type = PIXEL_U16;
+    } else if (strcmp(name, "f32") == 0) {
+        type = PIXEL_F32;
+    } else {
+        runtime_error("convert() type (arg 2) must be \"u8\", \"u16\" or \"f32\", got \"%s\"", name);
+        return val_none();
+    }
+    Image *out_img = convert_pixel_type(img, type);
+    if (!out_img) runtime_error("convert() failed");
+    return image_result(out_img);
+}
+
+static Value builtin_print(Value *args, int nargs) {
+    for (int i = 0; i < nargs; i++) {
+        switch (args[i].tag) {
+            case V_IMAGE:
+                printf("<Image %dx%d>", args[i].u.img->width, args[i].u.img->height);
+                break;
+            case V_INT:
+                printf("%d", args[i].u.ival);
+                break;
+            case V_FLOAT:
+                printf("%f", args[i].u.fval);
+                break;
+            case V_STRING:
+                print_string_escaped(args[i].u.sval);
+                break;
+            case V_LUT:
+                printf("<Lut>");
+                break;
+            case V_NONE:
+                printf("<null>");
+                break;
+            default:
+                printf("<unknown_type>");
+                break;
         }
-        // print_string_escaped("\n"); 
-        
-        result.tag = V_NONE;
     }
-    else {
-        runtime_error("Unknown function call: %s", fname);
+    return val_none();
+}
+
+// Indexed by BuiltinId
+static const Builtin builtins[BI_COUNT] = {
+    [BI_LUT]       = { "lut",       builtin_lut,       0,  0, NULL },
+    [BI_APPLYLUT]  = { "applylut",  builtin_applylut,  2,  2, NULL },
+    [BI_LOAD]      = { "load",      builtin_load,      1,  3, "(path, [width, height])" },
+    [BI_SAVE]      = { "save",      builtin_save,      2,  5, "(path, img, [format], [level|quality], [filter|subsampling])" },
+    [BI_CROP]      = { "crop",      builtin_crop,      5,  5, NULL },
+    [BI_BLUR]      = { "blur",      builtin_blur,      2,  2, NULL },
+    [BI_GAUSSIAN]  = { "gaussian",  builtin_gaussian,  2,  2, "(img, sigma)" },
+    [BI_CONVOLVE]  = { "convolve",  builtin_convolve,  2,  3, "(img, kernel, [border])" },
+    [BI_GRAYSCALE] = { "grayscale", builtin_grayscale, 1,  1, NULL },
+    [BI_INVERT]    = { "invert",    builtin_invert,    1,  1, NULL },
+    [BI_CONTRAST]  = { "contrast",  builtin_contrast,  3,  3, NULL },
+    [BI_BRIGHTEN]  = { "brighten",  builtin_brighten,  3,  3, NULL },
+    [BI_THRESHOLD] = { "threshold", builtin_threshold, 3,  3, NULL },
+    [BI_SHARPEN]   = { "sharpen",   builtin_sharpen,   3,  3, NULL },
+    [BI_BLEND]     = { "blend",     builtin_blend,     3,  3, NULL },
+    [BI_MASK]      = { "mask",      builtin_mask,      2,  2, NULL },
+    [BI_RESIZE]    = { "resize",    builtin_resize,    3,  4, "(img, width, height, [filter])" },
+    [BI_SCALE]     = { "scale",     builtin_scale,     2,  3, "(img, factor, [filter])" },
+    [BI_PYRAMID]   = { "pyramid",   builtin_pyramid,   2,  2, "(img, levels)" },
+    [BI_ROTATE]    = { "rotate",    builtin_rotate,    2,  4, "(img, angle_degrees, [interp], [expand])" },
+    [BI_FLIPX]     = { "flipX",     builtin_flipx,     1,  1, NULL },
+    [BI_FLIPY]     = { "flipY",     builtin_flipy,     1,  1, NULL },
+    [BI_TRANSPOSE] = { "transpose", builtin_transpose, 1,  1, NULL },
+    [BI_TRANSVERSE] = { "transverse", builtin_transverse, 1, 1, NULL },
+    [BI_CANNYEDGE] = { "cannyedge", builtin_cannyedge, 4,  4, "(img, sigma, low, high)" },
+    [BI_CHANNELS]  = { "channels",  builtin_channels,  2,  2, "(img, count)" },
+    [BI_PREMULTIPLY] = { "premultiply", builtin_premultiply, 1, 1, NULL },
+    [BI_UNPREMULTIPLY] = { "unpremultiply", builtin_unpremultiply, 1, 1, NULL },
+    [BI_CONVERT]   = { "convert",   builtin_convert,   2,  2, "(img, type)" },
+    [BI_PRINT]     = { "print",     builtin_print,     0, -1, NULL },
+};
+
+// Returns the BuiltinId for 'name', or -1 if there is no such builtin
+static int find_builtin(const char *name) {
+    for (int id = 0; id < BI_COUNT; id++) {
+        if (strcmp(builtins[id].name, name) == 0) return id;
     }
+    return -1;
+}
+
+static void check_arity(int id, int nargs) {
+    const Builtin *b = &builtins[id];
+    if (nargs >= b->min_args && (b->max_args < 0 || nargs <= b->max_args)) return;
+    if (b->min_args == b->max_args) {
+        runtime_error("%s() expects %d argument%s%s%s, got %d", b->name, b->min_args,
+                      b->min_args == 1 ? "" : "s", b->usage ? " " : "", b->usage ? b->usage : "", nargs);
+    }
+    if (b->max_args < 0) {
+        runtime_error("%s() expects at least %d argument%s%s%s, got %d", b->name, b->min_args,
+                      b->min_args == 1 ? "" : "s", b->usage ? " " : "", b->usage ? b->usage : "", nargs);
+    }
+    runtime_error("%s() expects %d to %d arguments%s%s, got %d", b->name, b->min_args, b->max_args,
+                  b->usage ? " " : "", b->usage ? b->usage : "", nargs);
+}
 
-    if (free_args) {
-        for (int i = 0; i < nargs; i++) {
-            free_value(args[i]);
+// Resolves a call node once; 'piped' is 1 when the call is a pipeline stage
+// and so receives the left-hand side as an extra first argument.
+static void resolve_call(Ast *call, int piped) {
+    int id = find_builtin(call->call.name);
+    if (id < 0) runtime_error("Unknown function call: %s", call->call.name);
+    check_arity(id, call->call.nargs + piped);
+    call->call.fn_id = id;
+}
+
+static int call_id(Ast *call) {
+    if (call->call.fn_id >= 0) return call->call.fn_id;
+    int id = find_builtin(call->call.name);
+    if (id < 0) runtime_error("Unknown function call: %s", call->call.name);
+    return id;
+}
+
+// Runs builtin 'id' on an already arity-checked argument list.
+// It *consumes* (frees) all arguments in the 'args' array.
+static Value call_builtin(int id, Value *args, int nargs) {
+    Value result;
+
+    if (nargs >= 1 && args[0].tag == V_LUT && is_point_op(id)) {
+        // Compose into the table instead of touching pixels: lut() |> brighten(20, 1)
+        PointOp op = make_point_op(id, args + 1);
+        if (!lut_compose_point_ops(args[0].u.lut, &op, 1)) {
+            runtime_error("%s() cannot be applied to a lut", builtins[id].name);
         }
+        result = args[0];
+        args[0] = val_none(); // ownership moved to result
+    } else {
+        result = builtins[id].fn(args, nargs);
+    }
+
+    for (int i = 0; i < nargs; i++) {
+        free_value(args[i]);
     }
-    
     return result;
 }
 
+// Dispatches a builtin by name.
+// It *consumes* (frees) all arguments in the 'args' array, unless specified.
+Value eval_builtin_call(const char *fname, Value *args, int nargs) {
+    int id = find_builtin(fname);
+    if (id < 0) runtime_error("Unknown function call: %s", fname);
+    check_arity(id, nargs);
+    return call_builtin(id, args, nargs);
+}
+
+// --- END BUILTINS ---
+
 void eval_block(Ast *block) {
     if (!block) {
         runtime_error("eval_block: received NULL block");
@@ -484,7 +1160,8 @@ void eval_stmt(Ast *stmt) {
             }
             
             // 3. Store in environment
-            env_set(stmt->decl.name, val);
+            if (stmt->decl.slot >= 0) env_set_slot(stmt->decl.slot, val);
+            else env_set(stmt->decl.name, val);
             break;
         }
 
@@ -492,7 +1169,8 @@ void eval_stmt(Ast *stmt) {
             Value val = eval_expr(stmt->assign.expr);
             // In a strongly typed system, we would check the variable's existing type.
             // For now, we just overwrite.
-            env_set(stmt->assign.name, val);
+            if (stmt->assign.slot >= 0) env_set_slot(stmt->assign.slot, val);
+            else env_set(stmt->assign.name, val);
             break;
         }
 
@@ -581,6 +1259,7 @@ void eval_program(Ast *prog) {
         fprintf(stderr, "Error: NULL program in eval_program\n");
         return;
     }
+    resolve_program(prog);
     for (int i = 0; i < prog->block.n; i++) {
         eval_stmt(prog->block.stmts[i]);
     }
@@ -589,6 +1268,192 @@ void eval_program(Ast *prog) {
     env_shutdown();
 }
 
+// --- FUSED POINT-OP PIPELINES ---
+
+// Evaluates 'src |> op1(...) |> op2(...) ...' as one pass when two or more
+// consecutive stages are point ops. Returns 0 (and evaluates nothing) otherwise.
+static int eval_fused_pipeline(Ast *expr, Value *result) {
+    int nstages = 0;
+    Ast *node = expr;
+    while (node->type == AST_PIPELINE && node->pipe.right->type == AST_CALL &&
+           is_point_op(call_id(node->pipe.right))) {
+        nstages++;
+        node = node->pipe.left;
+    }
+    if (nstages < 2) return 0;
+
+    // Stages were collected outermost-first; store them in execution order
+    Ast **stages = malloc(sizeof(Ast *) * nstages);
+    PointOp *ops = malloc(sizeof(PointOp) * nstages);
+    if (!stages || !ops) runtime_error("Failed to allocate fused pipeline");
+    node = expr;
+    for (int i = nstages - 1; i >= 0; i--) {
+        stages[i] = node->pipe.right;
+        node = node->pipe.left;
+    }
+
+    // Same evaluation order as the unfused pipeline: source, then each stage's args
+    Value src = eval_expr(node);
+    for (int i = 0; i < nstages; i++) {
+        Ast *c = stages[i];
+        int id = call_id(c);
+        Value args[2];
+        int nargs = c->call.nargs;
+        check_arity(id, nargs + 1); // point ops take at most 3 arguments
+        for (int j = 0; j < nargs; j++) {
+            args[j] = eval_expr(c->call.args[j]);
+        }
+        ops[i] = make_point_op(id, args);
+        for (int j = 0; j < nargs; j++) {
+            free_value(args[j]);
+        }
+    }
+
+    if (src.tag == V_LUT) {
+        // Building a table: fold every stage in, no pixels involved
+        if (!lut_compose_point_ops(src.u.lut, ops, nstages)) {
+            runtime_error("grayscale() and threshold() cannot be applied to a lut");
+        }
+        free(stages);
+        free(ops);
+        *result = src;
+        return 1;
+    }
+
+    Image *img = value_to_image(src);
+    Image *out_img = apply_point_ops(img, ops, nstages);
+    if (!out_img) runtime_error("%s() failed", stages[nstages - 1]->call.name);
+    free_value(src);
+    free(stages);
+    free(ops);
+
+    result->tag = V_IMAGE;
+    result->u.img = out_img;
+    return 1;
+}
+
+// --- END FUSED POINT-OP PIPELINES ---
+
+// --- TILED PIPELINES ---
+
+// Stages run_tiled() can execute band by band
+static int is_tile_op(int id) {
+    return is_point_op(id) || id == BI_BLUR || id == BI_SHARPEN || id == BI_CROP ||
+           id == BI_FLIPX || id == BI_FLIPY;
+}
+
+// Evaluates 'src |> stage1(...) |> stage2(...) ...' with run_tiled() when a
+// tile budget is set and two or more consecutive stages are local operators,
+// at least one of them not a point op (those already fuse into one pass).
+// Returns 0 (and evaluates nothing) otherwise.
+static int eval_tiled_pipeline(Ast *expr, Value *result) {
+    if (tile_budget() == 0) return 0;
+
+    int nstages = 0, has_local = 0;
+    Ast *node = expr;
+    while (node->type == AST_PIPELINE && node->pipe.right->type == AST_CALL &&
+           is_tile_op(call_id(node->pipe.right))) {
+        if (!is_point_op(call_id(node->pipe.right))) has_local = 1;
+        nstages++;
+        node = node->pipe.left;
+    }
+    if (nstages < 2 || !has_local) return 0;
+
+    Ast **calls = malloc(sizeof(Ast *) * nstages);
+    TileStage *stages = calloc(nstages, sizeof(TileStage));
+    if (!calls || !stages) runtime_error("Failed to allocate tiled pipeline");
+    node = expr;
+    for (int i = nstages - 1; i >= 0; i--) {
+        calls[i] = node->pipe.right;
+        node = node->pipe.left;
+    }
+
+    // Same evaluation order as the untiled pipeline: source, then each stage's args
+    Value src = eval_expr(node);
+    for (int i = 0; i < nstages; i++) {
+        Ast *c = calls[i];
+        int id = call_id(c);
+        Value args[4];
+        int nargs = c->call.nargs;
+        check_arity(id, nargs + 1); // tileable builtins take at most 5 arguments
+        for (int j = 0; j < nargs; j++) {
+            args[j] = eval_expr(c->call.args[j]);
+        }
+
+        TileStage *st = &stages[i];
+        if (is_point_op(id)) {
+            st->kind = TILE_POINT;
+            st->op = make_point_op(id, args);
+        } else if (id == BI_BLUR) {
+            st->kind = TILE_BLUR;
+            st->radius = value_to_int(args[0]);
+        } else if (id == BI_SHARPEN) {
+            st->kind = TILE_SHARPEN;
+            sharpen_args(args, &st->amount, &st->direction);
+        } else if (id == BI_FLIPX || id == BI_FLIPY) {
+            st->kind = id == BI_FLIPX ? TILE_FLIP_X : TILE_FLIP_Y;
+        } else {
+            st->kind = TILE_CROP;
+            st->x = value_to_int(args[0]);
+            st->y = value_to_int(args[1]);
+            st->w = value_to_int(args[2]);
+            st->h = value_to_int(args[3]);
+        }
+        for (int j = 0; j < nargs; j++) {
+            free_value(args[j]);
+        }
+    }
+
+    Image *img = value_to_image(src);
+    Image *out_img = run_tiled(img, stages, nstages, tile_budget());
+    if (!out_img) runtime_error("Tiled pipeline failed");
+    free_value(src);
+    free(calls);
+    free(stages);
+
+    result->tag = V_IMAGE;
+    result->u.img = out_img;
+    return 1;
+}
+
+// --- END TILED PIPELINES ---
+
+// --- SCALED LOADS ---
+
+// Evaluates 'load(path) |> resize(w, h, ...)' on a JPEG as
+// 'load(path, w, h) |> resize(w, h, ...)', decoding straight from the DCT
+// blocks at the smallest power-of-two reduction that still covers w x h, so a
+// large photo going to a thumbnail is never decoded at full size. The reduced
+// decode averages the pixels it replaces, so the result is close to, but not
+// identical with, resizing the full image. Any other file (or a missing one)
+// is loaded exactly as the plain pipeline would. Returns 0 (and evaluates
+// nothing) for any other pipeline stage.
+static int eval_scaled_load(Ast *expr, Value *result) {
+    Ast *src = expr->pipe.left, *c = expr->pipe.right;
+    if (src->type != AST_CALL || c->type != AST_CALL) return 0;
+    if (call_id(src) != BI_LOAD || src->call.nargs != 1 || call_id(c) != BI_RESIZE) return 0;
+
+    // Same evaluation order as the plain pipeline: path, then resize's args
+    int nargs = c->call.nargs + 1;
+    check_arity(BI_RESIZE, nargs);
+    Value args[4];
+    Value path = eval_expr(src->call.args[0]);
+    int jpeg = is_jpeg_file(value_to_string(path));
+    if (!jpeg) args[0] = builtin_load(&path, 1);
+    for (int i = 0; i < c->call.nargs; i++) {
+        args[i + 1] = eval_expr(c->call.args[i]);
+    }
+    if (jpeg) {
+        Value hint[3] = { path, args[1], args[2] };
+        args[0] = builtin_load(hint, 3);
+    }
+    free_value(path);
+    *result = call_builtin(BI_RESIZE, args, nargs);
+    return 1;
+}
+
+// --- END SCALED LOADS ---
+
 Value eval_expr(Ast *expr) {
     if (!expr) {
         runtime_error("NULL expression in eval_expr");
@@ -617,6 +1482,7 @@ Value eval_expr(Ast *expr) {
             return val_none();
         
         case AST_IDENT:
+            if (expr->ident.slot >= 0) return value_clone(env_get_slot(expr->ident.slot));
             return value_clone(env_get(expr->ident.str));
 
         case AST_CALL: {
@@ -630,7 +1496,9 @@ Value eval_expr(Ast *expr) {
             }
             
             // 2. Call the builtin function
-            Value result = eval_builtin_call(expr->call.name, args, nargs);
+            int id = call_id(expr);
+            check_arity(id, nargs);
+            Value result = call_builtin(id, args, nargs);
             
             // 3. Free the args array
             free(args);
@@ -753,6 +1621,14 @@ Value eval_expr(Ast *expr) {
         }
 
         case AST_PIPELINE: {
+            // 0. Runs of local stages execute band by band under a tile
+            // budget; runs of per-pixel stages execute as a single fused
+            // pass; a load feeding a resize decodes at reduced size
+            Value fused;
+            if (eval_tiled_pipeline(expr, &fused)) return fused;
+            if (eval_fused_pipeline(expr, &fused)) return fused;
+            if (eval_scaled_load(expr, &fused)) return fused;
+
             // 1. Evaluate LHS
             Value lhs = eval_expr(expr->pipe.left);
             
@@ -775,7 +1651,9 @@ Value eval_expr(Ast *expr) {
             }
 
             // 5. Call builtin
-            Value result = eval_builtin_call(c->call.name, args, nargs);
+            int id = call_id(c);
+            check_arity(id, nargs);
+            Value result = call_builtin(id, args, nargs);
             
             // 6. Free args array
             free(args);
@@ -799,16 +1677,16 @@ Value eval_expr(Ast *expr) {
 
 
 void env_shutdown() {
-    Var *v = globals;
-    while (v) {
-        Var *next = v->next;
-        
+    for (int slot = 0; slot < num_vars; slot++) {
         // Free the variable's resources
-        free(v->name);
-        free_value(v->val); // Frees string/image data
-        free(v);            // Free the Var struct itself
-        
-        v = next;
+        free(vars[slot].name);
+        if (vars[slot].defined) free_value(vars[slot].val); // Frees string/image data
     }
-    globals = NULL;
+    free(vars);
+    free(slot_table);
+    vars = NULL;
+    slot_table = NULL;
+    num_vars = 0;
+    vars_cap = 0;
+    table_cap = 0;
 }
@@ -11,6 +11,7 @@ typedef enum {
     V_FLOAT,
     V_STRING,
     V_IMAGE,
+    V_LUT,      // 256-entry byte map built with lut() |> brighten(...) ...
     V_NONE
 } ValueType;
 
@@ -21,6 +22,7 @@ typedef struct Value {
         double fval;
         char *sval;
         Image *img;
+        unsigned char *lut;
     } u;
 } Value;
 
@@ -29,6 +31,7 @@ typedef struct Value {
 
 // Function declarations
 void eval_program(Ast *prog);
+int resolve_program(Ast *prog);
 void eval_stmt(Ast *stmt);
 Value eval_expr(Ast *expr); // <-- Return type changed
 // ... all other prototypes ...
@@ -38,5 +41,6 @@ void env_set(const char *name, Value val);
 Value env_get(const char *name);
 void runtime_error(const char *format, ...);
 void free_value(Value val);
+Image *copy_image(Image *img);
 
 #endif
@@ -0,0 +1,294 @@
+#include "fft.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Mixed-radix decimation in time: each stage splits a length p * m transform
+// into p interleaved length-m transforms (done recursively) and recombines
+// them with one radix-p butterfly pass.
+
+#define FFT_MAX_FACTORS 32
+#define FFT_CACHE_SIZE 8
+
+struct FftPlan {
+    int n;
+    int refs;                           // the cache's reference plus each caller's
+    int factors[2 * FFT_MAX_FACTORS];   // (radix p, remaining length m) pairs
+    FftComplex *twiddles[2];            // exp(-2 pi i k / n), then its conjugate
+};
+
+static FftPlan *plan_cache[FFT_CACHE_SIZE];
+static int plan_next;                   // round-robin eviction slot
+static pthread_mutex_t plan_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline FftComplex c_mul(FftComplex a, FftComplex b) {
+    FftComplex r = { a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re };
+    return r;
+}
+
+static inline FftComplex c_add(FftComplex a, FftComplex b) {
+    FftComplex r = { a.re + b.re, a.im + b.im };
+    return r;
+}
+
+static inline FftComplex c_sub(FftComplex a, FftComplex b) {
+    FftComplex r = { a.re - b.re, a.im - b.im };
+    return r;
+}
+
+static void bfly2(FftComplex *out, int fstride, const FftComplex *tw, int m) {
+    FftComplex *out2 = out + m;
+    for (int k = 0; k < m; k++) {
+        FftComplex t = c_mul(out2[k], tw[k * fstride]);
+        out2[k] = c_sub(out[k], t);
+        out[k] = c_add(out[k], t);
+    }
+}
+
+static void bfly3(FftComplex *out, int fstride, const FftComplex *tw, int m) {
+    float epi3 = tw[fstride * m].im;    // -+sin(2 pi / 3)
+    for (int k = 0; k < m; k++) {
+        FftComplex s1 = c_mul(out[k + m], tw[k * fstride]);
+        FftComplex s2 = c_mul(out[k + 2 * m], tw[2 * k * fstride]);
+        FftComplex s3 = c_add(s1, s2);
+        FftComplex s0 = c_sub(s1, s2);
+        FftComplex mid = { out[k].re - s3.re * 0.5f, out[k].im - s3.im * 0.5f };
+        s0.re *= epi3;
+        s0.im *= epi3;
+        out[k] = c_add(out[k], s3);
+        out[k + 2 * m].re = mid.re + s0.im;
+        out[k + 2 * m].im = mid.im - s0.re;
+        out[k + m].re = mid.re - s0.im;
+        out[k + m].im = mid.im + s0.re;
+    }
+}
+
+static void bfly4(FftComplex *out, int fstride, const FftComplex *tw, int m, int inverse) {
+    for (int k = 0; k < m; k++) {
+        FftComplex s0 = c_mul(out[k + m], tw[k * fstride]);
+        FftComplex s1 = c_mul(out[k + 2 * m], tw[2 * k * fstride]);
+        FftComplex s2 = c_mul(out[k + 3 * m], tw[3 * k * fstride]);
+        FftComplex s5 = c_sub(out[k], s1);
+        FftComplex a = c_add(out[k], s1);
+        FftComplex s3 = c_add(s0, s2);
+        FftComplex s4 = c_sub(s0, s2);
+        out[k + 2 * m] = c_sub(a, s3);
+        out[k] = c_add(a, s3);
+        if (inverse) {
+            out[k + m].re = s5.re - s4.im;
+            out[k + m].im = s5.im + s4.re;
+            out[k + 3 * m].re = s5.re + s4.im;
+            out[k + 3 * m].im = s5.im - s4.re;
+        } else {
+            out[k + m].re = s5.re + s4.im;
+            out[k + m].im = s5.im - s4.re;
+            out[k + 3 * m].re = s5.re - s4.im;
+            out[k + 3 * m].im = s5.im + s4.re;
+        }
+    }
+}
+
+static void bfly5(FftComplex *out, int fstride, const FftComplex *tw, int m) {
+    FftComplex ya = tw[fstride * m], yb = tw[2 * fstride * m];
+    FftComplex *o0 = out, *o1 = out + m, *o2 = out + 2 * m, *o3 = out + 3 * m, *o4 = out + 4 * m;
+    for (int u = 0; u < m; u++) {
+        FftComplex s0 = o0[u];
+        FftComplex s1 = c_mul(o1[u], tw[u * fstride]);
+        FftComplex s2 = c_mul(o2[u], tw[2 * u * fstride]);
+        FftComplex s3 = c_mul(o3[u], tw[3 * u * fstride]);
+        FftComplex s4 = c_mul(o4[u], tw[4 * u * fstride]);
+        FftComplex s7 = c_add(s1, s4), s10 = c_sub(s1, s4);
+        FftComplex s8 = c_add(s2, s3), s9 = c_sub(s2, s3);
+
+        o0[u].re += s7.re + s8.re;
+        o0[u].im += s7.im + s8.im;
+
+        FftComplex s5 = { s0.re + s7.re * ya.re + s8.re * yb.re, s0.im + s7.im * ya.re + s8.im * yb.re };
+        FftComplex s6 = { s10.im * ya.im + s9.im * yb.im, -s10.re * ya.im - s9.re * yb.im };
+        o1[u] = c_sub(s5, s6);
+        o4[u] = c_add(s5, s6);
+
+        FftComplex s11 = { s0.re + s7.re * yb.re + s8.re * ya.re, s0.im + s7.im * yb.re + s8.im * ya.re };
+        FftComplex s12 = { -s10.im * yb.im + s9.im * ya.im, s10.re * yb.im - s9.re * ya.im };
+        o2[u] = c_add(s11, s12);
+        o3[u] = c_sub(s11, s12);
+    }
+}
+
+// Any other radix: a direct length-p DFT per output group. Returns 0 if
+// the scratch could not be allocated.
+static int bfly_generic(FftComplex *out, int fstride, const FftComplex *tw, int m, int p, int n) {
+    FftComplex *scratch = malloc((size_t)p * sizeof(FftComplex));
+    if (!scratch) return 0;
+    for (int u = 0; u < m; u++) {
+        for (int q = 0, k = u; q < p; q++, k += m) scratch[q] = out[k];
+        for (int q1 = 0, k = u; q1 < p; q1++, k += m) {
+            int twidx = 0;
+            FftComplex sum = scratch[0];
+            for (int q = 1; q < p; q++) {
+                twidx += fstride * k;
+                if (twidx >= n) twidx -= n;
+                sum = c_add(sum, c_mul(scratch[q], tw[twidx]));
+            }
+            out[k] = sum;
+        }
+    }
+    free(scratch);
+    return 1;
+}
+
+static int fft_work(FftComplex *out, const FftComplex *in, int fstride, int in_stride,
+                    const int *factors, const FftPlan *plan, int inverse) {
+    int p = factors[0], m = factors[1];
+    const FftComplex *tw = plan->twiddles[inverse];
+
+    if (m == 1) {
+        for (int q = 0; q < p; q++) out[q] = in[(size_t)q * fstride * in_stride];
+    } else {
+        for (int q = 0; q < p; q++) {
+            if (!fft_work(out + q * m, in + (size_t)q * fstride * in_stride, fstride * p,
+                          in_stride, factors + 2, plan, inverse)) {
+                return 0;
+            }
+        }
+    }
+
+    switch (p) {
+        case 2: bfly2(out, fstride, tw, m); break;
+        case 3: bfly3(out, fstride, tw, m); break;
+        case 4: bfly4(out, fstride, tw, m, inverse); break;
+        case 5: bfly5(out, fstride, tw, m); break;
+        default: return bfly_generic(out, fstride, tw, m, p, plan->n);
+    }
+    return 1;
+}
+
+int fft_forward(const FftPlan *plan, const FftComplex *in, int in_stride, FftComplex *out) {
+    if (!fft_work(out, in, 1, in_stride, plan->factors, plan, 0)) {
+        fprintf(stderr, "Error: Memory allocation failed in fft_forward\n");
+        return 0;
+    }
+    return 1;
+}
+
+int fft_inverse(const FftPlan *plan, const FftComplex *in, int in_stride, FftComplex *out) {
+    if (!fft_work(out, in, 1, in_stride, plan->factors, plan, 1)) {
+        fprintf(stderr, "Error: Memory allocation failed in fft_inverse\n");
+        return 0;
+    }
+    return 1;
+}
+
+// Radix 4 first, then 2, 3, 5 and odd numbers; a prime left over above
+// sqrt(n) becomes a single generic stage.
+static void factorize(int n, int *factors) {
+    int p = 4;
+    int limit = (int)floor(sqrt((double)n));
+    do {
+        while (n % p) {
+            switch (p) {
+                case 4: p = 2; break;
+                case 2: p = 3; break;
+                default: p += 2; break;
+            }
+            if (p > limit) p = n;
+        }
+        n /= p;
+        *factors++ = p;
+        *factors++ = n;
+    } while (n > 1);
+}
+
+static FftPlan *plan_create(int n) {
+    FftPlan *plan = malloc(sizeof(FftPlan));
+    if (!plan) return NULL;
+    plan->n = n;
+    plan->refs = 1;
+    plan->twiddles[0] = malloc((size_t)n * 2 * sizeof(FftComplex));
+    if (!plan->twiddles[0]) {
+        free(plan);
+        return NULL;
+    }
+    plan->twiddles[1] = plan->twiddles[0] + n;
+    for (int k = 0; k < n; k++) {
+        double phase = -2.0 * M_PI * k / n;
+        plan->twiddles[0][k].re = (float)cos(phase);
+        plan->twiddles[0][k].im = (float)sin(phase);
+        plan->twiddles[1][k].re = plan->twiddles[0][k].re;
+        plan->twiddles[1][k].im = -plan->twiddles[0][k].im;
+    }
+    factorize(n, plan->factors);
+    return plan;
+}
+
+static void plan_free(FftPlan *plan) {
+    if (!plan) return;
+    free(plan->twiddles[0]);
+    free(plan);
+}
+
+// Drops one reference; the caller holds plan_lock
+static void plan_unref(FftPlan *plan) {
+    if (plan && --plan->refs == 0) plan_free(plan);
+}
+
+/**
+ * @brief Returns the plan for length n, building and caching it if needed.
+ *
+ * The cache keeps the FFT_CACHE_SIZE most recently built lengths. Each
+ * returned plan carries a reference for the caller, so it stays valid -
+ * even if later calls evict it from the cache - until the caller hands it
+ * back with fft_plan_release().
+ *
+ * @param n Transform length, >= 1.
+ * @return The plan, or NULL on failure.
+ */
+const FftPlan *fft_plan(int n) {
+    if (n < 1) return NULL;
+    pthread_mutex_lock(&plan_lock);
+    for (int i = 0; i < FFT_CACHE_SIZE; i++) {
+        if (plan_cache[i] && plan_cache[i]->n == n) {
+            FftPlan *hit = plan_cache[i];
+            hit->refs++;
+            pthread_mutex_unlock(&plan_lock);
+            return hit;
+        }
+    }
+    FftPlan *plan = plan_create(n);
+    if (plan) {
+        plan->refs++;
+        plan_unref(plan_cache[plan_next]);
+        plan_cache[plan_next] = plan;
+        plan_next = (plan_next + 1) % FFT_CACHE_SIZE;
+    }
+    pthread_mutex_unlock(&plan_lock);
+    return plan;
+}
+
+void fft_plan_release(const FftPlan *plan) {
+    pthread_mutex_lock(&plan_lock);
+    plan_unref((FftPlan *)plan);
+    pthread_mutex_unlock(&plan_lock);
+}
+
+void fft_shutdown(void) {
+    pthread_mutex_lock(&plan_lock);
+    for (int i = 0; i < FFT_CACHE_SIZE; i++) {
+        plan_unref(plan_cache[i]);
+        plan_cache[i] = NULL;
+    }
+    plan_next = 0;
+    pthread_mutex_unlock(&plan_lock);
+}
+
+int fft_good_size(int n) {
+    if (n <= 1) return 1;
+    for (;; n++) {
+        int m = n;
+        while (m % 2 == 0) m /= 2;
+        while (m % 3 == 0) m /= 3;
+        while (m % 5 == 0) m /= 5;
+        if (m == 1) return n;
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef FFT_H
+#define FFT_H
+
+// Complex FFTs of any length for the frequency-domain convolution path.
+//
+// Lengths are factored into radix 4, 2, 3 and 5 butterflies (any other
+// prime falls back to a generic DFT step), so fft_good_size() lengths of the
+// form 2^a * 3^b * 5^c are the fast ones. Plans hold the factorisation and
+// twiddle table for one length; fft_plan() caches the most recent ones and
+// hands out a reference that fft_plan_release() returns. A plan is
+// read-only once built, so any number of threads can run transforms with it
+// at the same time.
+
+typedef struct {
+    float re, im;
+} FftComplex;
+
+typedef struct FftPlan FftPlan;
+
+const FftPlan *fft_plan(int n);     // cached; NULL if n < 1 or out of memory
+void fft_plan_release(const FftPlan *plan); // drops the caller's reference; NULL is ignored
+void fft_shutdown(void);            // drops the cache's references
+int fft_good_size(int n);           // smallest 2^a * 3^b * 5^c >= n
+
+// out[k] = sum in[j * in_stride] * exp(-+2 pi i j k / n), unnormalised.
+// 'out' holds n values and must not overlap 'in'. Both return 0 (leaving
+// 'out' undefined) if a generic-radix stage cannot allocate its scratch.
+int fft_forward(const FftPlan *plan, const FftComplex *in, int in_stride, FftComplex *out);
+int fft_inverse(const FftPlan *plan, const FftComplex *in, int in_stride, FftComplex *out);
+
+#endif
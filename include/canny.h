@@ -1,7 +1,10 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "../runtime.h"
+#include "../parallel.h"
+#include "../simd.h"
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -11,41 +14,83 @@
 #define CANNY_STRONG 255
 
 
-// static unsigned char* grayscale_to_mono(Image *img);
 // static float* create_gaussian_kernel(float sigma, int *kernel_size);
-// static unsigned char* gaussian_blur_mono(unsigned char *data, int w, int h, float sigma);
-// static int sobel_operator(unsigned char *data, int w, int h, float **magnitude, float **direction);
-// static unsigned char* non_maximum_suppression(float *magnitude, float *direction, int w, int h);
-// static void hysteresis_connect(unsigned char *data, int w, int h, int y, int x);
-// static void double_threshold_hysteresis(unsigned char *data, int w, int h, unsigned char low, unsigned char high);
+// static void double_threshold_hysteresis(CannyJob *job);
 // Image *canny_edge_detector(Image *img, float sigma, unsigned char low_thresh, unsigned char high_thresh);
 
 // #include "canny.h"
 
 
 
-/**
- * @brief Helper to convert 3-channel RGB image to a 1-channel grayscale buffer.
- * @param img The source 3-channel image.
- * @return A new 1-channel (unsigned char*) buffer, or NULL on failure.
- */
-static unsigned char* grayscale_to_mono(Image *img) {
-    if (!img || !img->data) return NULL;
-    size_t data_size = (size_t)img->width * img->height;
-    unsigned char *mono_data = (unsigned char*)malloc(data_size);
-    if (!mono_data) {
-        fprintf(stderr, "Error: Memory allocation failed in grayscale_to_mono\n");
-        return NULL;
+// Shared state for the row-band stages below. Every stage writes only the
+// rows of its band, so bands can run on the worker pool in any order.
+typedef struct {
+    const Image *img;
+    Image *out;
+    int w, h;
+    const float *kernel;        // Gaussian taps, kernel_size = 2 * radius + 1
+    int radius;
+    unsigned char *mono;        // grayscale, then the blurred image, then the edge map
+    unsigned char *temp;        // horizontal blur pass, later the NMS output
+    int *mag2;                  // squared gradient magnitude, later union-find parents
+    unsigned char *sector;      // quantised gradient direction (CANNY_DIR_*)
+    const double *luma;         // 3 x 256 luminance products
+    unsigned char low, high;
+    int ntiles;                 // row tiles for edge linking
+    int failed;                 // set by a band that could not allocate scratch
+} CannyJob;
+
+// Gradient directions, quantised to the neighbour pair NMS compares against
+enum { CANNY_DIR_0, CANNY_DIR_45, CANNY_DIR_90, CANNY_DIR_135 };
+
+// Scratch reused across calls, so repeated detections do not go back to the
+// allocator for their intermediate planes. Grows to the largest frame seen
+// and is freed by canny_shutdown(). It is not locked: only one detection may
+// run at a time (the interpreter thread), although that detection's bands
+// share it across the worker threads.
+static unsigned char *canny_scratch = NULL;
+static size_t canny_scratch_size = 0;
+
+static unsigned char *canny_scratch_get(size_t size) {
+    if (size > canny_scratch_size) {
+        free(canny_scratch);
+        canny_scratch = (unsigned char *)malloc(size);
+        canny_scratch_size = canny_scratch ? size : 0;
     }
+    return canny_scratch;
+}
 
-    for (int y = 0; y < img->height; y++) {
-        for (int x = 0; x < img->width; x++) {
-            unsigned char *p = img->data + (y * img->width + x) * 3;
-            // Using standard luminance calculation (0.299*R + 0.587*G + 0.114*B)
-            mono_data[y * img->width + x] = (unsigned char)(0.299 * p[0] + 0.587 * p[1] + 0.114 * p[2]);
+void canny_shutdown(void) {
+    free(canny_scratch);
+    canny_scratch = NULL;
+    canny_scratch_size = 0;
+}
+
+/**
+ * @brief Row band: converts the source to 1-channel luminance.
+ *
+ * Uses per-channel tables of the (0.299*R + 0.587*G + 0.114*B) products,
+ * summed in the same order, so results match the direct formula exactly.
+ * Alpha is ignored.
+ */
+static void canny_mono_rows(void *ctx, int y0, int y1) {
+    CannyJob *job = (CannyJob *)ctx;
+    const double *lr = job->luma, *lg = job->luma + 256, *lb = job->luma + 512;
+    size_t w = job->w;
+    int cn = job->img->channels;
+
+    for (int y = y0; y < y1; y++) {
+        const unsigned char *p = job->img->data + (size_t)y * w * cn;
+        unsigned char *q = job->mono + (size_t)y * w;
+        if (cn == 1) {
+            // Through the same tables, so gray input matches its RGB copy
+            for (size_t x = 0; x < w; x++) q[x] = (unsigned char)(lr[p[x]] + lg[p[x]] + lb[p[x]]);
+            continue;
+        }
+        for (size_t x = 0; x < w; x++, p += cn) {
+            q[x] = (unsigned char)(lr[p[0]] + lg[p[1]] + lb[p[2]]);
         }
     }
-    return mono_data;
 }
 
 /**
@@ -80,224 +125,358 @@ static float* create_gaussian_kernel(float sigma, int *kernel_size) {
 }
 
 /**
- * @brief Helper to apply 1D separable Gaussian blur (Horizontal + Vertical).
- * @param data The 1-channel source buffer.
- * @param w Width of the buffer.
- * @param h Height of the buffer.
- * @param sigma Standard deviation for the blur.
- * @return A new 1-channel (unsigned char*) blurred buffer, or NULL on failure.
+ * @brief Row band: horizontal Gaussian pass (mono -> temp), borders clamped.
+ *
+ * Interior pixels accumulate tap by tap across the whole row, which keeps
+ * each pixel's sum in tap order while the vector unit works along x.
  */
-static unsigned char* gaussian_blur_mono(unsigned char *data, int w, int h, float sigma) {
-    int kernel_size;
-    float *kernel = create_gaussian_kernel(sigma, &kernel_size);
-    if (!kernel) return NULL;
-    int radius = kernel_size / 2;
-
-    size_t data_size = (size_t)w * h;
-    unsigned char *temp_data = (unsigned char *)malloc(data_size);
-    unsigned char *out_data = (unsigned char *)malloc(data_size);
-    if (!temp_data || !out_data) {
-        fprintf(stderr, "Error: Memory allocation failed for Gaussian blur buffers\n");
-        free(kernel);
-        free(temp_data);
-        free(out_data);
-        return NULL;
+static void canny_blur_h_rows(void *ctx, int y0, int y1) {
+    CannyJob *job = (CannyJob *)ctx;
+    int w = job->w, radius = job->radius;
+    const float *kernel = job->kernel;
+    float *acc = (float *)malloc(sizeof(float) * w);
+    if (!acc) {
+        job->failed = 1;
+        return;
     }
 
-    // Horizontal pass (from data -> temp_data)
-    for (int y = 0; y < h; y++) {
-        for (int x = 0; x < w; x++) {
+    for (int y = y0; y < y1; y++) {
+        const unsigned char *row = job->mono + (size_t)y * w;
+        unsigned char *out = job->temp + (size_t)y * w;
+        int x0 = radius < w ? radius : w;           // first interior pixel
+        int x1 = w - radius > x0 ? w - radius : x0; // one past the last
+
+        for (int x = x0; x < x1; x++) acc[x] = 0.0f;
+        for (int k = 0; k <= 2 * radius; k++) {
+            simd_madd_u8_f32(acc + x0, row - radius + k + x0, x1 - x0, kernel[k]);
+        }
+        for (int x = x0; x < x1; x++) out[x] = (unsigned char)acc[x];
+
+        for (int x = 0; x < w; x = (x + 1 == x0) ? x1 : x + 1) {
             float sum = 0.0;
             for (int k = -radius; k <= radius; k++) {
                 int kx = x + k;
                 // Handle borders by clamping
                 if (kx < 0) kx = 0;
                 if (kx >= w) kx = w - 1;
-                sum += data[y * w + kx] * kernel[k + radius];
+                sum += row[kx] * kernel[k + radius];
             }
-            temp_data[y * w + x] = (unsigned char)sum;
+            out[x] = (unsigned char)sum;
         }
     }
+    free(acc);
+}
 
-    // Vertical pass (from temp_data -> out_data)
-    for (int y = 0; y < h; y++) {
-        for (int x = 0; x < w; x++) {
-            float sum = 0.0;
-            for (int k = -radius; k <= radius; k++) {
-                int ky = y + k;
-                // Handle borders by clamping
-                if (ky < 0) ky = 0;
-                if (ky >= h) ky = h - 1;
-                sum += temp_data[ky * w + x] * kernel[k + radius];
-            }
-            out_data[y * w + x] = (unsigned char)sum;
+/**
+ * @brief Row band: vertical Gaussian pass (temp -> mono), borders clamped.
+ *
+ * Walks source rows in tap order, accumulating a whole output row at once,
+ * so memory is read sequentially rather than down columns.
+ */
+static void canny_blur_v_rows(void *ctx, int y0, int y1) {
+    CannyJob *job = (CannyJob *)ctx;
+    int w = job->w, h = job->h, radius = job->radius;
+    const float *kernel = job->kernel;
+    float *acc = (float *)malloc(sizeof(float) * w);
+    if (!acc) {
+        job->failed = 1;
+        return;
+    }
+
+    for (int y = y0; y < y1; y++) {
+        for (int x = 0; x < w; x++) acc[x] = 0.0f;
+        for (int k = -radius; k <= radius; k++) {
+            int ky = y + k;
+            // Handle borders by clamping
+            if (ky < 0) ky = 0;
+            if (ky >= h) ky = h - 1;
+            simd_madd_u8_f32(acc, job->temp + (size_t)ky * w, w, kernel[k + radius]);
         }
+        unsigned char *out = job->mono + (size_t)y * w;
+        for (int x = 0; x < w; x++) out[x] = (unsigned char)acc[x];
     }
+    free(acc);
+}
 
-    free(kernel);
-    free(temp_data);
-    return out_data;
+// Quantises a gradient to one of four directions without trigonometry.
+// Folding (gx, gy) into the upper half plane gives an angle in [0, 180];
+// the sector edges at 22.5 and 67.5 degrees are tested exactly through
+// tan(22.5) = sqrt(2) - 1, squared to stay in integers.
+static inline unsigned char canny_sector(int gx, int gy) {
+    if (gy < 0 || (gy == 0 && gx < 0)) {
+        gx = -gx;
+        gy = -gy;
+    }
+    long long ax = gx < 0 ? -gx : gx;
+    long long s = ax + gy;
+    if (s * s < 2 * ax * ax) return CANNY_DIR_0;          // angle < 22.5 or > 157.5
+    if (s * s < 2 * (long long)gy * gy) return CANNY_DIR_90;  // 67.5 < angle < 112.5
+    return gx > 0 ? CANNY_DIR_45 : CANNY_DIR_135;
 }
 
 /**
- * @brief Helper for Sobel operator to find gradient magnitude and direction.
- * @param data The 1-channel blurred source buffer.
- * @param w Width.
- * @param h Height.
- * @param magnitude Output pointer for gradient magnitude (float*).
- * @param direction Output pointer for gradient direction (float*).
- * @return 1 on success, 0 on failure.
+ * @brief Row band: Sobel gradients of the blurred image (mono).
+ *
+ * Stores the squared magnitude, which orders pixels exactly as the true
+ * magnitude does, and the quantised direction. Border pixels get 0.
  */
-static int sobel_operator(unsigned char *data, int w, int h, float **magnitude, float **direction) {
-    *magnitude = (float*)calloc((size_t)w * h, sizeof(float));
-    *direction = (float*)calloc((size_t)w * h, sizeof(float));
-    if (!*magnitude || !*direction) {
-        fprintf(stderr, "Error: Memory allocation failed for Sobel buffers\n");
-        return 0;
+static void canny_sobel_rows(void *ctx, int y0, int y1) {
+    CannyJob *job = (CannyJob *)ctx;
+    int w = job->w, h = job->h;
+
+    for (int y = y0; y < y1; y++) {
+        int *mag2 = job->mag2 + (size_t)y * w;
+        unsigned char *sector = job->sector + (size_t)y * w;
+        if (y == 0 || y == h - 1 || w < 3) {
+            memset(mag2, 0, sizeof(int) * w);
+            continue;
+        }
+        const unsigned char *up = job->mono + (size_t)(y - 1) * w;
+        const unsigned char *mid = up + w;
+        const unsigned char *dn = mid + w;
+        mag2[0] = mag2[w - 1] = 0;
+        for (int x = 1; x < w - 1; x++) {
+            int gx = (up[x + 1] - up[x - 1]) + 2 * (mid[x + 1] - mid[x - 1]) + (dn[x + 1] - dn[x - 1]);
+            int gy = (dn[x - 1] + 2 * dn[x] + dn[x + 1]) - (up[x - 1] + 2 * up[x] + up[x + 1]);
+            mag2[x] = gx * gx + gy * gy;
+            sector[x] = canny_sector(gx, gy);
+        }
     }
+}
 
-    int sobel_x[3][3] = {{-1, 0, 1}, {-2, 0, 2}, {-1, 0, 1}};
-    int sobel_y[3][3] = {{-1, -2, -1}, {0, 0, 0}, {1, 2, 1}};
+// floor(sqrt(v)) for the magnitudes NMS writes out
+static inline int canny_isqrt(int v) {
+    int r = (int)sqrtf((float)v);
+    while (r * r > v) r--;
+    while ((r + 1) * (r + 1) <= v) r++;
+    return r;
+}
 
-    for (int y = 1; y < h - 1; y++) { // Skip borders
+/**
+ * @brief Row band: non-maximum suppression (mag2/sector -> temp).
+ *
+ * Keeps a pixel only if its magnitude is at least that of both neighbours
+ * along the gradient, writing the magnitude clamped to 255. Border rows
+ * and columns are cleared.
+ */
+static void canny_nms_rows(void *ctx, int y0, int y1) {
+    CannyJob *job = (CannyJob *)ctx;
+    int w = job->w, h = job->h;
+
+    for (int y = y0; y < y1; y++) {
+        unsigned char *out = job->temp + (size_t)y * w;
+        if (y == 0 || y == h - 1 || w < 3) {
+            memset(out, 0, w);
+            continue;
+        }
+        const int *mag2 = job->mag2 + (size_t)y * w;
+        const unsigned char *sector = job->sector + (size_t)y * w;
+        out[0] = out[w - 1] = 0;
         for (int x = 1; x < w - 1; x++) {
-            float gx = 0, gy = 0;
-            for (int dy = -1; dy <= 1; dy++) {
-                for (int dx = -1; dx <= 1; dx++) {
-                    gx += data[(y + dy) * w + (x + dx)] * sobel_x[dy + 1][dx + 1];
-                    gy += data[(y + dy) * w + (x + dx)] * sobel_y[dy + 1][dx + 1];
-                }
+            int mag = mag2[x];
+            out[x] = 0;
+            if (mag == 0) continue; // Not an edge
+
+            int mag1, mag2n;
+            switch (sector[x]) {
+                case CANNY_DIR_0:   // horizontal neighbours
+                    mag1 = mag2[x - 1];
+                    mag2n = mag2[x + 1];
+                    break;
+                case CANNY_DIR_45:  // top-right / bottom-left
+                    mag1 = mag2[x - w + 1];
+                    mag2n = mag2[x + w - 1];
+                    break;
+                case CANNY_DIR_90:  // top / bottom
+                    mag1 = mag2[x - w];
+                    mag2n = mag2[x + w];
+                    break;
+                default:            // top-left / bottom-right
+                    mag1 = mag2[x - w - 1];
+                    mag2n = mag2[x + w + 1];
+                    break;
+            }
+
+            // Suppress if not a local maximum
+            if (mag >= mag1 && mag >= mag2n) {
+                out[x] = mag >= 255 * 255 ? 255 : (unsigned char)canny_isqrt(mag);
             }
-            size_t idx = y * w + x;
-            (*magnitude)[idx] = sqrt(gx * gx + gy * gy);
-            (*direction)[idx] = atan2(gy, gx); // Angle in radians
         }
     }
-    return 1;
 }
 
-/**
- * @brief Helper for non-maximum suppression to thin edges.
- * @param magnitude Gradient magnitude buffer.
- * @param direction Gradient direction buffer.
- * @param w Width.
- * @param h Height.
- * @return A new 1-channel (unsigned char*) buffer with thinned edges, or NULL on failure.
- */
-static unsigned char* non_maximum_suppression(float *magnitude, float *direction, int w, int h) {
-    unsigned char *output = (unsigned char*)calloc((size_t)w * h, sizeof(unsigned char));
-    if (!output) {
-        fprintf(stderr, "Error: Memory allocation failed for NMS buffer\n");
-        return NULL;
+// --- EDGE LINKING ---
+//
+// Hysteresis keeps a weak pixel when it is 8-connected, through any chain of
+// weak or strong pixels, to a strong one. Edge pixels are grouped with a
+// union-find over pixel indices (the int plane, reused once NMS is done):
+// each tile of rows links its own pixels in parallel, the seams between
+// tiles are stitched serially, and a final parallel pass keeps every pixel
+// whose component contains a strong pixel. Memory is fixed at one int per
+// pixel and nothing recurses, however long an edge runs.
+
+// Root of i's set, halving the path on the way
+static inline int canny_find(int *parent, int i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
     }
+    return i;
+}
 
-    for (int y = 1; y < h - 1; y++) {
-        for (int x = 1; x < w - 1; x++) {
-            size_t idx = y * w + x;
-            float mag = magnitude[idx];
-            if (mag == 0) continue; // Not an edge
+// Read-only find, safe while other tiles are resolving
+static inline int canny_find_root(const int *parent, int i) {
+    while (parent[i] != i) i = parent[i];
+    return i;
+}
 
-            float angle = direction[idx] * 180.0 / M_PI; // Convert to degrees
-            if (angle < 0) angle += 180;
+// Merges the sets of a and b under the lower index. A set is strong when its
+// root's pixel is CANNY_STRONG, so the surviving root inherits strength.
+static inline void canny_union(int *parent, unsigned char *data, int a, int b) {
+    int ra = canny_find(parent, a);
+    int rb = canny_find(parent, b);
+    if (ra == rb) return;
+    if (ra > rb) {
+        int t = ra;
+        ra = rb;
+        rb = t;
+    }
+    parent[rb] = ra;
+    if (data[rb] == CANNY_STRONG) data[ra] = CANNY_STRONG;
+}
 
-            float mag1 = 0, mag2 = 0;
+// Rows [y0, y1) of tile t out of n
+static inline void canny_tile_rows(int h, int t, int n, int *y0, int *y1) {
+    *y0 = (int)((long long)h * t / n);
+    *y1 = (int)((long long)h * (t + 1) / n);
+}
 
-            // --- Find neighbors in the gradient direction ---
-            // Angle 0 or 180 (horizontal edge)
-            if ((angle >= 0 && angle < 22.5) || (angle >= 157.5 && angle <= 180)) {
-                mag1 = magnitude[idx - 1]; // Left
-                mag2 = magnitude[idx + 1]; // Right
-            }
-            // Angle 45 (diagonal)
-            else if (angle >= 22.5 && angle < 67.5) {
-                mag1 = magnitude[idx - w + 1]; // Top-right
-                mag2 = magnitude[idx + w - 1]; // Bottom-left
-            }
-            // Angle 90 (vertical edge)
-            else if (angle >= 67.5 && angle < 112.5) {
-                mag1 = magnitude[idx - w]; // Top
-                mag2 = magnitude[idx + w]; // Bottom
-            }
-            // Angle 135 (diagonal)
-            else if (angle >= 112.5 && angle < 157.5) {
-                mag1 = magnitude[idx - w - 1]; // Top-left
-                mag2 = magnitude[idx + w + 1]; // Bottom-right
+/**
+ * @brief Tile band: classifies NMS output as CANNY_STRONG, CANNY_WEAK or 0,
+ * then links each edge pixel to its already-visited neighbours in the tile.
+ */
+static void canny_link_tiles(void *ctx, int t0, int t1) {
+    CannyJob *job = (CannyJob *)ctx;
+    int w = job->w;
+    unsigned char *data = job->temp;
+    int *parent = job->mag2;
+
+    for (int t = t0; t < t1; t++) {
+        int y0, y1;
+        canny_tile_rows(job->h, t, job->ntiles, &y0, &y1);
+        for (int y = y0; y < y1; y++) {
+            unsigned char *row = data + (size_t)y * w;
+            for (int x = 0; x < w; x++) {
+                // NMS-suppressed pixels stay 0 even with a zero threshold
+                if (!row[x]) continue;
+                if (row[x] >= job->high) {
+                    row[x] = CANNY_STRONG;
+                } else if (row[x] >= job->low) {
+                    row[x] = CANNY_WEAK;
+                } else {
+                    row[x] = 0;
+                }
             }
 
-            // Suppress if not a local maximum
-            if (mag >= mag1 && mag >= mag2) {
-                // Clamp magnitude to 255
-                output[idx] = (mag > 255) ? 255 : (unsigned char)mag;
+            for (int x = 0; x < w; x++) {
+                if (!row[x]) continue;
+                int i = y * w + x;
+                parent[i] = i;
+                if (x > 0 && row[x - 1]) canny_union(parent, data, i, i - 1);
+                if (y > y0) {
+                    // NW, N and NE
+                    for (int dx = -1; dx <= 1; dx++) {
+                        int nx = x + dx;
+                        if (nx >= 0 && nx < w && row[nx - w]) canny_union(parent, data, i, i - w + dx);
+                    }
+                }
             }
         }
     }
-    return output;
 }
 
 /**
- * @brief Helper: Recursive part of hysteresis for edge tracking.
- * @param data The 1-channel NMS buffer (modified in-place).
- * @param w Width.
- * @param h Height.
- * @param y Current y-coordinate.
- * @param x Current x-coordinate.
+ * @brief Tile band: writes 255 (into mono) for every edge pixel whose set
+ * is strong, and 0 everywhere else.
  */
-static void hysteresis_connect(unsigned char *data, int w, int h, int y, int x) {
-    // Check bounds and if already visited or not a weak edge
-    if (y < 0 || y >= h || x < 0 || x >= w || data[y * w + x] != CANNY_WEAK) {
-        return;
+static void canny_resolve_tiles(void *ctx, int t0, int t1) {
+    CannyJob *job = (CannyJob *)ctx;
+    int w = job->w;
+    const unsigned char *data = job->temp;
+    const int *parent = job->mag2;
+
+    for (int t = t0; t < t1; t++) {
+        int y0, y1;
+        canny_tile_rows(job->h, t, job->ntiles, &y0, &y1);
+        for (int i = y0 * w; i < y1 * w; i++) {
+            int keep = data[i] && data[canny_find_root(parent, i)] == CANNY_STRONG;
+            job->mono[i] = keep ? CANNY_STRONG : 0;
+        }
     }
-    
-    data[y * w + x] = CANNY_STRONG; // Promote weak edge to strong
-
-    // Recurse on 8 neighbors
-    hysteresis_connect(data, w, h, y - 1, x - 1);
-    hysteresis_connect(data, w, h, y - 1, x);
-    hysteresis_connect(data, w, h, y - 1, x + 1);
-    hysteresis_connect(data, w, h, y, x - 1);
-    hysteresis_connect(data, w, h, y, x + 1);
-    hysteresis_connect(data, w, h, y + 1, x - 1);
-    hysteresis_connect(data, w, h, y + 1, x);
-    hysteresis_connect(data, w, h, y + 1, x + 1);
 }
 
 /**
  * @brief Helper: Applies double thresholding and hysteresis.
- * @param data The 1-channel NMS buffer (modified in-place).
- * @param w Width.
- * @param h Height.
- * @param low Lower threshold.
- * @param high Upper threshold.
+ *
+ * Reads the NMS plane (job->temp, which is clobbered) and leaves the final
+ * edge map in job->mono. Uses job->mag2 as the union-find parent array.
+ *
+ * @param job Canny state with w, h, low and high set.
  */
-static void double_threshold_hysteresis(unsigned char *data, int w, int h, unsigned char low, unsigned char high) {
-    size_t data_size = (size_t)w * h;
-
-    // 1. Apply thresholds: classify pixels as STRONG, WEAK, or 0
-    for (size_t i = 0; i < data_size; i++) {
-        if (data[i] >= high) {
-            data[i] = CANNY_STRONG;
-        } else if (data[i] >= low) {
-            data[i] = CANNY_WEAK;
-        } else {
-            data[i] = 0;
+static void double_threshold_hysteresis(CannyJob *job) {
+    int w = job->w, h = job->h;
+    size_t npixels = (size_t)w * h;
+
+    if (npixels > 0x7fffffff) {
+        // Pixel indices would overflow the int parent array
+        fprintf(stderr, "Warning: image too large for Canny edge linking, keeping strong edges only\n");
+        for (size_t i = 0; i < npixels; i++) {
+            job->mono[i] = job->temp[i] >= job->high ? CANNY_STRONG : 0;
         }
+        return;
     }
 
-    // 2. Hysteresis: connect weak edges to strong edges
-    for (int y = 0; y < h; y++) {
+    // 1. Threshold and link inside each tile
+    job->ntiles = parallel_threads() < h ? parallel_threads() : h;
+    parallel_for_rows(job->ntiles, canny_link_tiles, job);
+
+    // 2. Stitch the seams between tiles
+    for (int t = 1; t < job->ntiles; t++) {
+        int y0, y1;
+        canny_tile_rows(h, t, job->ntiles, &y0, &y1);
+        const unsigned char *row = job->temp + (size_t)y0 * w;
         for (int x = 0; x < w; x++) {
-            if (data[y * w + x] == CANNY_STRONG) {
-                // This strong edge will recursively find all connected weak edges
-                hysteresis_connect(data, w, h, y, x);
+            if (!row[x]) continue;
+            int i = y0 * w + x;
+            for (int dx = -1; dx <= 1; dx++) {
+                int nx = x + dx;
+                if (nx >= 0 && nx < w && row[nx - w]) canny_union(job->mag2, job->temp, i, i - w + dx);
             }
         }
     }
 
-    // 3. Clean up: remove any remaining weak edges that weren't connected
-    for (size_t i = 0; i < data_size; i++) {
-        if (data[i] == CANNY_WEAK) {
-            data[i] = 0;
-        }
+    // 3. Keep the pixels of strong sets
+    parallel_for_rows(job->ntiles, canny_resolve_tiles, job);
+}
+
+/**
+ * @brief Row band: expands the 1-channel edge map (mono) to the output's
+ * channel count, copying alpha from the source.
+ */
+static void canny_output_rows(void *ctx, int y0, int y1) {
+    CannyJob *job = (CannyJob *)ctx;
+    size_t w = job->w;
+    int cn = job->out->channels;
+    const unsigned char *p = job->mono + (size_t)y0 * w;
+    unsigned char *q = job->out->data + (size_t)y0 * w * cn;
+    if (cn == 1) {
+        memcpy(q, p, (size_t)(y1 - y0) * w);
+        return;
+    }
+    const unsigned char *a = job->img->data + (size_t)y0 * w * cn + 3;
+    for (size_t i = 0; i < (size_t)(y1 - y0) * w; i++, q += cn) {
+        q[0] = q[1] = q[2] = p[i];  // R=G=B=edge_value
+        if (cn == 4) q[3] = a[i * 4];
     }
 }
 
@@ -311,11 +490,18 @@ static void double_threshold_hysteresis(unsigned char *data, int w, int h, unsig
  * 4. Non-maximum suppression
  * 5. Double thresholding and hysteresis
  *
+ * Every step runs in row bands on the worker pool; edge linking adds a
+ * short serial pass over the seams between bands.
+ * Intermediate planes (two byte planes, the squared magnitudes and the
+ * quantised directions) live in one scratch block that is reused across
+ * calls, and no step needs sqrt() or atan2() per pixel.
+ *
  * @param img The source Image.
  * @param sigma The standard deviation (sigma) for the Gaussian blur. (e.g., 1.4)
  * @param low_thresh The lower threshold for hysteresis. (e.g., 20)
  * @param high_thresh The upper threshold for hysteresis. (e.g., 50)
- * @return A new, 3-channel Image showing the edges, or NULL on failure.
+ * @return A new Image showing the edges, with the source's channel count
+ *         (alpha copied), or NULL on failure.
  */
 Image *canny_edge_detector(Image *img, float sigma, unsigned char low_thresh, unsigned char high_thresh) {
     if (!img || !img->data) {
@@ -326,78 +512,89 @@ Image *canny_edge_detector(Image *img, float sigma, unsigned char low_thresh, un
         fprintf(stderr, "Error: Canny low threshold cannot be greater than high threshold\n");
         return NULL;
     }
+    if (!(sigma > 0.0f)) {
+        fprintf(stderr, "Error: Canny sigma must be positive, got %f\n", sigma);
+        return NULL;
+    }
 
     int w = img->width;
     int h = img->height;
+    size_t npixels = (size_t)w * h;
 
-    // --- Step 1: Grayscale ---
-    unsigned char *mono_data = grayscale_to_mono(img);
-    if (!mono_data) {
-        fprintf(stderr, "Error: Canny failed at grayscale step\n");
-        return NULL;
-    }
-
-    // --- Step 2: Gaussian Blur ---
-    unsigned char *blur_data = gaussian_blur_mono(mono_data, w, h, sigma);
-    free(mono_data); // Done with original mono
-    if (!blur_data) {
-        fprintf(stderr, "Error: Canny failed at Gaussian blur step\n");
-        return NULL;
-    }
+    int kernel_size;
+    float *kernel = create_gaussian_kernel(sigma, &kernel_size);
+    if (!kernel) return NULL;
 
-    // --- Step 3: Sobel Operator ---
-    float *magnitude = NULL, *direction = NULL;
-    if (!sobel_operator(blur_data, w, h, &magnitude, &direction)) {
-        fprintf(stderr, "Error: Canny failed at Sobel operator step\n");
-        free(blur_data);
-        free(magnitude);
-        free(direction);
-        return NULL;
-    }
-    free(blur_data); // Done with blurred data
-
-    // --- Step 4: Non-Maximum Suppression ---
-    unsigned char *nms_data = non_maximum_suppression(magnitude, direction, w, h);
-    free(magnitude); // Done with gradient data
-    free(direction);
-    if (!nms_data) {
-        fprintf(stderr, "Error: Canny failed at Non-Maximum Suppression step\n");
+    // Scratch layout: mag2 first so the ints stay aligned
+    unsigned char *scratch = canny_scratch_get(npixels * (sizeof(int) + 3));
+    if (!scratch) {
+        fprintf(stderr, "Error: Memory allocation failed for Canny scratch buffers\n");
+        free(kernel);
         return NULL;
     }
 
-    // --- Step 5: Double Thresholding and Hysteresis ---
-    // This step modifies nms_data in-place
-    double_threshold_hysteresis(nms_data, w, h, low_thresh, high_thresh);
-
-    // --- Step 6: Convert final 1-channel edge map back to 3-channel RGB image ---
     Image *out = (Image*)malloc(sizeof(Image));
     if (!out) {
         fprintf(stderr, "Error: Memory allocation failed for Canny output image\n");
-        free(nms_data);
+        free(kernel);
         return NULL;
     }
     out->width = w;
     out->height = h;
-    out->channels = 3;
-    out->data = (unsigned char*)malloc((size_t)w * h * 3);
+    out->channels = img->channels;
+    out->type = PIXEL_U8;
+    out->refcount = 1;
+    out->data = (unsigned char*)malloc(npixels * out->channels);
     if (!out->data) {
         fprintf(stderr, "Error: Memory allocation failed for Canny output data\n");
-        free(nms_data);
+        free(kernel);
         free(out);
         return NULL;
     }
 
-    // Populate output image data (R=G=B=edge_value)
-    for (int y = 0; y < h; y++) {
-        for (int x = 0; x < w; x++) {
-            unsigned char val = nms_data[y * w + x];
-            unsigned char *p = out->data + (y * w + x) * 3;
-            p[0] = val; // R
-            p[1] = val; // G
-            p[2] = val; // B
-        }
+    double luma[3 * 256];
+    for (int i = 0; i < 256; i++) {
+        luma[i] = 0.299 * i;
+        luma[256 + i] = 0.587 * i;
+        luma[512 + i] = 0.114 * i;
     }
 
-    free(nms_data); // Free the final 1-channel buffer
+    CannyJob job = {
+        .img = img, .out = out, .w = w, .h = h,
+        .kernel = kernel, .radius = kernel_size / 2,
+        .mag2 = (int *)scratch,
+        .mono = scratch + npixels * sizeof(int),
+        .temp = scratch + npixels * (sizeof(int) + 1),
+        .sector = scratch + npixels * (sizeof(int) + 2),
+        .luma = luma,
+    };
+
+    // --- Step 1: Grayscale ---
+    parallel_for_rows(h, canny_mono_rows, &job);
+
+    // --- Step 2: Gaussian Blur (mono -> temp -> mono) ---
+    parallel_for_rows(h, canny_blur_h_rows, &job);
+    if (!job.failed) parallel_for_rows(h, canny_blur_v_rows, &job);
+    free(kernel);
+    if (job.failed) {
+        fprintf(stderr, "Error: Canny failed at Gaussian blur step\n");
+        free(out->data);
+        free(out);
+        return NULL;
+    }
+
+    // --- Step 3: Sobel Operator ---
+    parallel_for_rows(h, canny_sobel_rows, &job);
+
+    // --- Step 4: Non-Maximum Suppression (into temp) ---
+    parallel_for_rows(h, canny_nms_rows, &job);
+
+    // --- Step 5: Double Thresholding and Hysteresis (temp -> mono) ---
+    job.low = low_thresh;
+    job.high = high_thresh;
+    double_threshold_hysteresis(&job);
+
+    // --- Step 6: Expand the 1-channel edge map to the output's channels ---
+    parallel_for_rows(h, canny_output_rows, &job);
     return out;
-}
\ No newline at end of file
+}
@@ -1,6 +1,9 @@
 #include "ast.h"
 #include "runtime.h"
 #include "eval.h" // <-- This header will have env_shutdown()
+#include "parallel.h"
+#include "simd.h"
+#include "fft.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,11 +14,29 @@ extern FILE *yyin;
 
 int main(int argc, char **argv) {
     if (argc < 2) {
-        printf("Usage: %s <script.iml> [--dump-ast]\n", argv[0]);
+        printf("Usage: %s <script.iml> [--dump-ast] [--threads N] [--tile-mem MB]\n", argv[0]);
         return 1;
     }
     int dump = 0;
-    if (argc > 2 && strcmp(argv[2], "--dump-ast") == 0) dump = 1;
+    // Worker threads: --threads wins over IML_THREADS; 0 means one per CPU
+    int threads = 0;
+    const char *env_threads = getenv("IML_THREADS");
+    if (env_threads) threads = atoi(env_threads);
+    // Tiled execution budget in MiB: --tile-mem wins over IML_TILE_MEM; 0 disables
+    long tile_mb = 0;
+    const char *env_tile = getenv("IML_TILE_MEM");
+    if (env_tile) tile_mb = atol(env_tile);
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--dump-ast") == 0) {
+            dump = 1;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--tile-mem") == 0 && i + 1 < argc) {
+            tile_mb = atol(argv[++i]);
+        } else {
+            fprintf(stderr, "Warning: ignoring unknown option %s\n", argv[i]);
+        }
+    }
 
     yyin = fopen(argv[1], "r");
     if (!yyin) {
@@ -32,6 +53,9 @@ int main(int argc, char **argv) {
     if (dump) dump_ast(root, 0);
 
     // No runtime_init() is needed as globals start as NULL
+    parallel_init(threads);
+    simd_init();
+    tile_set_budget(tile_mb > 0 ? (size_t)tile_mb << 20 : 0);
     
     eval_program(root);
 
@@ -40,6 +64,9 @@ int main(int argc, char **argv) {
     env_shutdown(); 
     // --- END ADDED SHUTDOWN ---
 
+    parallel_shutdown();
+    fft_shutdown();
+    canny_shutdown();
     free_ast(root);
     return 0;
 }
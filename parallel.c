@@ -0,0 +1,150 @@
+#include "parallel.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Hard cap so a bad --threads value cannot exhaust the process
+#define MAX_THREADS 256
+
+static pthread_t *workers = NULL;
+static int num_threads = 1;        // including the calling thread
+static int num_workers = 0;        // background threads only
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t work_done = PTHREAD_COND_INITIALIZER;
+
+// Current job, protected by pool_lock
+static RowKernel job_fn = NULL;
+static void *job_ctx = NULL;
+static int job_rows = 0;
+static int job_bands = 0;
+static int next_band = 0;
+static int bands_done = 0;
+static int stopping = 0;
+
+static void run_band(RowKernel fn, void *ctx, int rows, int bands, int b) {
+    int y0 = (int)((long long)rows * b / bands);
+    int y1 = (int)((long long)rows * (b + 1) / bands);
+    if (y1 > y0) fn(ctx, y0, y1);
+}
+
+static void *worker_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&pool_lock);
+    while (1) {
+        while (!stopping && (!job_fn || next_band >= job_bands)) {
+            pthread_cond_wait(&work_ready, &pool_lock);
+        }
+        if (stopping) break;
+
+        int b = next_band++;
+        RowKernel fn = job_fn;
+        void *ctx = job_ctx;
+        int rows = job_rows, bands = job_bands;
+        pthread_mutex_unlock(&pool_lock);
+
+        run_band(fn, ctx, rows, bands, b);
+
+        pthread_mutex_lock(&pool_lock);
+        if (++bands_done == bands) pthread_cond_signal(&work_done);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return NULL;
+}
+
+void parallel_init(int nthreads) {
+    parallel_shutdown();
+
+    if (nthreads <= 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = (n > 0) ? (int)n : 1;
+    }
+    if (nthreads > MAX_THREADS) nthreads = MAX_THREADS;
+
+    num_threads = 1;
+    num_workers = 0;
+    if (nthreads == 1) return;
+
+    workers = malloc(sizeof(pthread_t) * (nthreads - 1));
+    if (!workers) {
+        fprintf(stderr, "Warning: Memory allocation failed for thread pool, running single-threaded\n");
+        return;
+    }
+    stopping = 0;
+    for (int i = 0; i < nthreads - 1; i++) {
+        if (pthread_create(&workers[i], NULL, worker_main, NULL) != 0) {
+            fprintf(stderr, "Warning: Could only start %d of %d worker threads\n", i, nthreads - 1);
+            break;
+        }
+        num_workers++;
+    }
+    num_threads = num_workers + 1;
+}
+
+void parallel_shutdown(void) {
+    if (!workers) return;
+
+    pthread_mutex_lock(&pool_lock);
+    stopping = 1;
+    pthread_cond_broadcast(&work_ready);
+    pthread_mutex_unlock(&pool_lock);
+
+    for (int i = 0; i < num_workers; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    workers = NULL;
+    num_workers = 0;
+    num_threads = 1;
+    stopping = 0;
+}
+
+int parallel_threads(void) {
+    return num_threads;
+}
+
+/**
+ * @brief Runs fn over rows [0, rows) split into one band per thread.
+ *
+ * The calling thread takes bands too, so this is safe with an empty pool.
+ * Not re-entrant: kernels must not call parallel_for_rows() themselves.
+ *
+ * @param rows Number of rows to cover.
+ * @param fn Kernel invoked as fn(ctx, y0, y1) for each band.
+ * @param ctx Opaque kernel state, shared by all bands.
+ */
+void parallel_for_rows(int rows, RowKernel fn, void *ctx) {
+    if (rows <= 0) return;
+
+    int bands = num_threads < rows ? num_threads : rows;
+    if (bands <= 1) {
+        fn(ctx, 0, rows);
+        return;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    job_fn = fn;
+    job_ctx = ctx;
+    job_rows = rows;
+    job_bands = bands;
+    next_band = 0;
+    bands_done = 0;
+    pthread_cond_broadcast(&work_ready);
+
+    // Work alongside the pool until every band has been handed out
+    while (next_band < job_bands) {
+        int b = next_band++;
+        pthread_mutex_unlock(&pool_lock);
+        run_band(fn, ctx, rows, bands, b);
+        pthread_mutex_lock(&pool_lock);
+        bands_done++;
+    }
+    while (bands_done < job_bands) {
+        pthread_cond_wait(&work_done, &pool_lock);
+    }
+    job_fn = NULL;
+    job_ctx = NULL;
+    pthread_mutex_unlock(&pool_lock);
+}
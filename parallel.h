@@ -0,0 +1,18 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+// Process-wide worker pool used by the runtime kernels.
+//
+// Kernels describe their work as a function over a half-open band of rows
+// [y0, y1). parallel_for_rows() splits the image into bands, runs them on
+// the pool and returns once every band is done. Each output row is written
+// by exactly one band, so results are identical to the serial path.
+
+typedef void (*RowKernel)(void *ctx, int y0, int y1);
+
+void parallel_init(int nthreads);   // nthreads <= 0 picks the number of online CPUs
+void parallel_shutdown(void);
+int parallel_threads(void);
+void parallel_for_rows(int rows, RowKernel fn, void *ctx);
+
+#endif
@@ -0,0 +1,787 @@
+#include "png.h"
+#include "parallel.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PNG_WINDOW 32768
+#define PNG_WMASK (PNG_WINDOW - 1)
+#define PNG_MAX_DIST 32767
+#define PNG_HASH_BITS 15
+#define PNG_MIN_MATCH 3
+#define PNG_MAX_MATCH 258
+#define PNG_CHUNK_BYTES (256 * 1024)   // filtered bytes per independently compressed band
+#define PNG_BLOCK_SYMBOLS 16384         // LZ77 symbols per Huffman block
+#define PNG_SAMPLE_STEP 8               // PNG_FILTER_FAST judges every 8th pixel
+
+#define PNG_TOO_FAR 4096                // 3-byte matches further back than this cost more than literals
+
+// Match search effort per level, as in zlib: a match of 'good' bytes cuts
+// the remaining chain to a quarter; 'lazy' is the longest match still worth
+// checking the next byte against (greedy levels: the longest match whose
+// inner positions get hashed); 'nice' ends the search; 'chain' bounds it.
+static const struct {
+    int good, lazy, nice, chain, greedy;
+} png_levels[10] = {
+    { 0, 0, 0, 0, 1 },          // stored
+    { 4, 4, 8, 4, 1 },
+    { 4, 5, 16, 8, 1 },
+    { 4, 6, 32, 32, 1 },
+    { 4, 4, 16, 16, 0 },
+    { 8, 16, 32, 32, 0 },
+    { 8, 16, 128, 128, 0 },
+    { 8, 32, 128, 256, 0 },
+    { 32, 128, 258, 1024, 0 },
+    { 32, 258, 258, 4096, 0 },
+};
+
+static const uint16_t len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t len_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+// Order in which the code length code lengths are sent
+static const uint8_t cl_order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+static uint8_t len_code[PNG_MAX_MATCH + 1];     // match length -> length code - 257
+static uint8_t dist_code[512];                  // see dist_to_code()
+static uint32_t crc_table[256];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static void tables_init(void) {
+    for (int c = 0; c < 29; c++) {
+        for (int len = len_base[c]; len < len_base[c] + (1 << len_extra[c]) && len <= PNG_MAX_MATCH; len++) {
+            len_code[len] = (uint8_t)c;
+        }
+    }
+    len_code[PNG_MAX_MATCH] = 28;   // 258 has its own code, not 227 + 31
+    for (int c = 0; c < 30; c++) {
+        for (int d = dist_base[c]; d < dist_base[c] + (1 << dist_extra[c]); d++) {
+            if (d <= 256) dist_code[d - 1] = (uint8_t)c;
+            else dist_code[256 + ((d - 1) >> 7)] = (uint8_t)c;
+        }
+    }
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        crc_table[n] = c;
+    }
+}
+
+static inline int dist_to_code(int d) {
+    return d <= 256 ? dist_code[d - 1] : dist_code[256 + ((d - 1) >> 7)];
+}
+
+static uint32_t crc_update(uint32_t crc, const unsigned char *p, size_t n) {
+    for (size_t i = 0; i < n; i++) crc = crc_table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+static uint32_t adler_update(uint32_t adler, const unsigned char *p, size_t n) {
+    uint32_t s1 = adler & 0xffff, s2 = adler >> 16;
+    while (n > 0) {
+        size_t run = n < 5552 ? n : 5552;   // largest run that cannot overflow s2
+        n -= run;
+        while (run--) {
+            s1 += *p++;
+            s2 += s1;
+        }
+        s1 %= 65521;
+        s2 %= 65521;
+    }
+    return s2 << 16 | s1;
+}
+
+// Adler-32 of A followed by B, from adler(A), adler(B) and len(B)
+static uint32_t adler_combine(uint32_t a, uint32_t b, size_t len_b) {
+    uint32_t rem = (uint32_t)(len_b % 65521);
+    uint32_t s1a = a & 0xffff, s2a = a >> 16, s1b = b & 0xffff, s2b = b >> 16;
+    uint32_t s1 = (s1a + s1b + 65521 - 1) % 65521;
+    uint32_t s2 = (uint32_t)((s2a + s2b + (uint64_t)rem * s1a + 65521 - rem) % 65521);
+    return s2 << 16 | s1;
+}
+
+// --- BIT OUTPUT ---
+
+typedef struct {
+    unsigned char *buf;
+    size_t len, cap;
+    uint64_t bits;      // pending bits, LSB first
+    int nbits;
+    int failed;
+} BitWriter;
+
+static int bw_reserve(BitWriter *bw, size_t n) {
+    if (bw->len + n <= bw->cap) return 1;
+    size_t cap = bw->cap ? bw->cap : 4096;
+    while (cap < bw->len + n) cap *= 2;
+    unsigned char *buf = realloc(bw->buf, cap);
+    if (!buf) {
+        bw->failed = 1;
+        return 0;
+    }
+    bw->buf = buf;
+    bw->cap = cap;
+    return 1;
+}
+
+// Appends the low n (<= 16) bits of v
+static inline void bw_put(BitWriter *bw, uint32_t v, int n) {
+    bw->bits |= (uint64_t)v << bw->nbits;
+    bw->nbits += n;
+    if (bw->nbits >= 32) {
+        if (bw_reserve(bw, 4)) {
+            for (int k = 0; k < 4; k++) bw->buf[bw->len++] = (unsigned char)(bw->bits >> (8 * k));
+        }
+        bw->bits >>= 32;
+        bw->nbits -= 32;
+    }
+}
+
+// Pads with zero bits to a byte boundary and flushes
+static void bw_align(BitWriter *bw) {
+    while (bw->nbits > 0) {
+        if (bw_reserve(bw, 1)) bw->buf[bw->len++] = (unsigned char)bw->bits;
+        bw->bits >>= 8;
+        bw->nbits -= 8;
+    }
+    bw->bits = 0;
+    bw->nbits = 0;
+}
+
+static void bw_bytes(BitWriter *bw, const unsigned char *p, size_t n) {
+    if (n && bw_reserve(bw, n)) {
+        memcpy(bw->buf + bw->len, p, n);
+        bw->len += n;
+    }
+}
+
+// --- HUFFMAN CODES ---
+
+// Code lengths for n symbols, none longer than 'limit'. At least two
+// symbols always get a code so the result is a complete prefix code.
+static void huff_lengths(const uint32_t *freq, int n, int limit, uint8_t *len) {
+    uint32_t f[286], w[2 * 286];
+    int sym[286], parent[2 * 286], depth[2 * 286];
+    memcpy(f, freq, sizeof(uint32_t) * n);
+    for (;;) {
+        int m = 0;
+        for (int i = 0; i < n; i++) {
+            len[i] = 0;
+            if (f[i]) sym[m++] = i;
+        }
+        if (m < 2) {
+            for (int i = 0; m < 2 && i < n; i++) {
+                if (!f[i]) sym[m++] = i;
+            }
+            for (int i = 0; i < m; i++) len[sym[i]] = 1;
+            return;
+        }
+        // Leaves in ascending frequency; internal nodes are created in
+        // ascending weight too, so two queues give the Huffman merge order
+        for (int i = 1; i < m; i++) {
+            int s = sym[i], j = i;
+            while (j > 0 && f[sym[j - 1]] > f[s]) {
+                sym[j] = sym[j - 1];
+                j--;
+            }
+            sym[j] = s;
+        }
+        for (int i = 0; i < m; i++) w[i] = f[sym[i]];
+        int leaf = 0, inner = m, nodes = m;
+        while (nodes < 2 * m - 1) {
+            int pick[2];
+            for (int k = 0; k < 2; k++) {
+                if (leaf < m && (inner >= nodes || w[leaf] <= w[inner])) pick[k] = leaf++;
+                else pick[k] = inner++;
+            }
+            w[nodes] = w[pick[0]] + w[pick[1]];
+            parent[pick[0]] = parent[pick[1]] = nodes;
+            nodes++;
+        }
+        int max_depth = 0;
+        depth[nodes - 1] = 0;
+        for (int i = nodes - 2; i >= 0; i--) {
+            depth[i] = depth[parent[i]] + 1;
+            if (i < m && depth[i] > max_depth) max_depth = depth[i];
+        }
+        if (max_depth <= limit) {
+            for (int i = 0; i < m; i++) len[sym[i]] = (uint8_t)depth[i];
+            return;
+        }
+        // Too deep: flatten the distribution and build again
+        for (int i = 0; i < n; i++) {
+            if (f[i]) f[i] = (f[i] >> 1) | 1;
+        }
+    }
+}
+
+// Canonical codes for the lengths, bit-reversed for LSB-first output
+static void huff_codes(const uint8_t *len, int n, uint16_t *code) {
+    int count[16] = { 0 }, next[16];
+    for (int i = 0; i < n; i++) count[len[i]]++;
+    count[0] = 0;
+    int c = 0;
+    for (int bits = 1; bits < 16; bits++) {
+        c = (c + count[bits - 1]) << 1;
+        next[bits] = c;
+    }
+    for (int i = 0; i < n; i++) {
+        if (!len[i]) continue;
+        int v = next[len[i]]++, r = 0;
+        for (int k = 0; k < len[i]; k++) r |= ((v >> k) & 1) << (len[i] - 1 - k);
+        code[i] = (uint16_t)r;
+    }
+}
+
+// Run-length codes concatenated code lengths with symbols 16, 17 and 18.
+// Each output entry is symbol | repeat_extra << 5. Returns the count.
+static int rle_lengths(const uint8_t *lens, int n, uint16_t *out, uint32_t *freq) {
+    int k = 0;
+    for (int i = 0; i < n;) {
+        int l = lens[i], run = 1;
+        while (i + run < n && lens[i + run] == l) run++;
+        i += run;
+        if (l == 0) {
+            while (run >= 11) {
+                int r = run < 138 ? run : 138;
+                out[k++] = (uint16_t)(18 | (r - 11) << 5);
+                run -= r;
+            }
+            if (run >= 3) {
+                out[k++] = (uint16_t)(17 | (run - 3) << 5);
+                run = 0;
+            }
+        } else {
+            out[k++] = (uint16_t)l;
+            run--;
+            while (run >= 3) {
+                int r = run < 6 ? run : 6;
+                out[k++] = (uint16_t)(16 | (r - 3) << 5);
+                run -= r;
+            }
+        }
+        while (run-- > 0) out[k++] = (uint16_t)l;
+    }
+    for (int i = 0; i < k; i++) freq[out[i] & 31]++;
+    return k;
+}
+
+// --- DEFLATE ---
+
+// One LZ77 output symbol: a literal when len == 0 (the byte is in dist)
+typedef struct {
+    uint16_t len;
+    uint16_t dist;
+} PngSym;
+
+static void write_stored(BitWriter *bw, const unsigned char *p, size_t n, int final) {
+    do {
+        size_t piece = n < 65535 ? n : 65535;
+        unsigned char hdr[4] = { (unsigned char)piece, (unsigned char)(piece >> 8),
+                                 (unsigned char)~piece, (unsigned char)(~piece >> 8) };
+        bw_put(bw, final && piece == n, 1);
+        bw_put(bw, 0, 2);
+        bw_align(bw);
+        bw_bytes(bw, hdr, 4);
+        bw_bytes(bw, p, piece);
+        p += piece;
+        n -= piece;
+    } while (n > 0);
+}
+
+// Emits syms as one dynamic Huffman block, or as stored blocks of the
+// 'raw' bytes they encode if that is smaller
+static void write_block(BitWriter *bw, const PngSym *syms, int nsyms,
+                        const unsigned char *raw, size_t raw_len, int final) {
+    uint32_t lfreq[286] = { 0 }, dfreq[30] = { 0 }, cfreq[19] = { 0 };
+    for (int i = 0; i < nsyms; i++) {
+        if (syms[i].len) {
+            lfreq[257 + len_code[syms[i].len]]++;
+            dfreq[dist_to_code(syms[i].dist)]++;
+        } else {
+            lfreq[syms[i].dist]++;
+        }
+    }
+    lfreq[256] = 1;
+
+    uint8_t lens[286 + 30], clen[19];
+    uint8_t *llen = lens, dlen[30];
+    huff_lengths(lfreq, 286, 15, llen);
+    huff_lengths(dfreq, 30, 15, dlen);
+    int hlit = 286, hdist = 30;
+    while (hlit > 257 && !llen[hlit - 1]) hlit--;
+    while (hdist > 1 && !dlen[hdist - 1]) hdist--;
+    memcpy(lens + hlit, dlen, hdist);
+
+    uint16_t cl[286 + 30];
+    int ncl = rle_lengths(lens, hlit + hdist, cl, cfreq);
+    huff_lengths(cfreq, 19, 7, clen);
+    int hclen = 19;
+    while (hclen > 4 && !clen[cl_order[hclen - 1]]) hclen--;
+
+    // Size of each encoding in bits
+    uint64_t dyn = 3 + 14 + 3 * (uint64_t)hclen;
+    for (int i = 0; i < ncl; i++) {
+        int s = cl[i] & 31;
+        dyn += clen[s] + (s == 16 ? 2 : s == 17 ? 3 : s == 18 ? 7 : 0);
+    }
+    for (int i = 0; i < hlit; i++) dyn += (uint64_t)lfreq[i] * llen[i];
+    for (int i = 0; i < 29; i++) dyn += (uint64_t)lfreq[257 + i] * len_extra[i];
+    for (int i = 0; i < 30; i++) dyn += (uint64_t)dfreq[i] * (dlen[i] + dist_extra[i]);
+    uint64_t stored = ((uint64_t)raw_len + 5 * (raw_len / 65535 + 1)) * 8 + 7;
+    if (stored <= dyn) {
+        write_stored(bw, raw, raw_len, final);
+        return;
+    }
+
+    uint16_t lcode[286], dcode[30], ccode[19];
+    huff_codes(llen, hlit, lcode);      // lens[hlit..] now holds the distance lengths
+    huff_codes(dlen, hdist, dcode);
+    huff_codes(clen, 19, ccode);
+
+    bw_put(bw, final, 1);
+    bw_put(bw, 2, 2);
+    bw_put(bw, hlit - 257, 5);
+    bw_put(bw, hdist - 1, 5);
+    bw_put(bw, hclen - 4, 4);
+    for (int i = 0; i < hclen; i++) bw_put(bw, clen[cl_order[i]], 3);
+    for (int i = 0; i < ncl; i++) {
+        int s = cl[i] & 31, extra = cl[i] >> 5;
+        bw_put(bw, ccode[s], clen[s]);
+        if (s == 16) bw_put(bw, extra, 2);
+        else if (s == 17) bw_put(bw, extra, 3);
+        else if (s == 18) bw_put(bw, extra, 7);
+    }
+    for (int i = 0; i < nsyms; i++) {
+        if (!syms[i].len) {
+            bw_put(bw, lcode[syms[i].dist], llen[syms[i].dist]);
+            continue;
+        }
+        int lc = len_code[syms[i].len], dc = dist_to_code(syms[i].dist);
+        bw_put(bw, lcode[257 + lc], llen[257 + lc]);
+        if (len_extra[lc]) bw_put(bw, syms[i].len - len_base[lc], len_extra[lc]);
+        bw_put(bw, dcode[dc], dlen[dc]);
+        if (dist_extra[dc]) bw_put(bw, syms[i].dist - dist_base[dc], dist_extra[dc]);
+    }
+    bw_put(bw, lcode[256], llen[256]);
+}
+
+static inline uint32_t png_hash(const unsigned char *p) {
+    uint32_t v = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16;
+    return (v * 2654435761u) >> (32 - PNG_HASH_BITS);
+}
+
+// Number of equal leading bytes of a and b, up to max
+static inline size_t common_prefix(const unsigned char *a, const unsigned char *b, size_t max) {
+    size_t n = 0;
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; n + 8 <= max; n += 8) {
+        uint64_t x, y;
+        memcpy(&x, a + n, 8);
+        memcpy(&y, b + n, 8);
+        if (x != y) return n + (size_t)(__builtin_ctzll(x ^ y) >> 3);
+    }
+#endif
+    while (n < max && a[n] == b[n]) n++;
+    return n;
+}
+
+// Longest match for buf[p..end) along the hash chain starting at 'cur';
+// 0 unless it beats 'prev_len' and is worth sending
+static int longest_match(const unsigned char *buf, size_t p, size_t end, int32_t cur,
+                         const int32_t *prev, int chain, int nice, int prev_len, int *dist) {
+    size_t max_len = end - p < PNG_MAX_MATCH ? end - p : PNG_MAX_MATCH;
+    size_t best = prev_len > 0 ? (size_t)prev_len : 0;
+    if (best >= max_len) return 0;
+    const unsigned char *b = buf + p;
+    while (cur >= 0 && chain-- > 0) {
+        size_t d = p - (size_t)cur;
+        if (d > PNG_MAX_DIST) break;
+        const unsigned char *a = buf + cur;
+        // Only a candidate agreeing at the current best's last byte and the
+        // one after it can beat it
+        if (a[best] == b[best] && (best == 0 || a[best - 1] == b[best - 1]) && a[0] == b[0]) {
+            size_t n = common_prefix(a, b, max_len);
+            if (n > best) {
+                best = n;
+                *dist = (int)d;
+                if (n >= (size_t)nice || n == max_len) break;
+            }
+        }
+        int32_t next = prev[cur & PNG_WMASK];
+        if (next >= cur) break;
+        cur = next;
+    }
+    if (best <= (size_t)prev_len || best < PNG_MIN_MATCH) return 0;
+    if (best == PNG_MIN_MATCH && *dist > PNG_TOO_FAR) return 0;
+    return (int)best;
+}
+
+// Per-band scratch for deflate_band()
+typedef struct {
+    int32_t *head;      // newest position for each hash
+    int32_t *prev;      // previous position with the same hash, by pos & PNG_WMASK
+    PngSym *syms;
+} Deflater;
+
+// Compresses buf[start, end) as a run of deflate blocks; buf[0, start) is
+// already-sent data that matches may reach back into. A non-final band
+// ends with an empty stored block so the next band starts byte-aligned.
+static void deflate_band(BitWriter *bw, Deflater *z, const unsigned char *buf,
+                         size_t start, size_t end, int level, int final) {
+    if (level == 0) {
+        write_stored(bw, buf + start, end - start, final);
+        return;
+    }
+    int good = png_levels[level].good, max_lazy = png_levels[level].lazy;
+    int nice = png_levels[level].nice, chain = png_levels[level].chain;
+    for (int i = 0; i < 1 << PNG_HASH_BITS; i++) z->head[i] = -1;
+
+#define INSERT(q) do { \
+        uint32_t h_ = png_hash(buf + (q)); \
+        z->prev[(q) & PNG_WMASK] = z->head[h_]; \
+        z->head[h_] = (int32_t)(q); \
+    } while (0)
+    // Queues a symbol covering buf[.., upto) and flushes full blocks
+#define EMIT(l, d, upto) do { \
+        z->syms[nsyms].len = (uint16_t)(l); \
+        z->syms[nsyms].dist = (uint16_t)(d); \
+        if (++nsyms == PNG_BLOCK_SYMBOLS) { \
+            write_block(bw, z->syms, nsyms, buf + block_start, (upto) - block_start, 0); \
+            block_start = (upto); \
+            nsyms = 0; \
+        } \
+    } while (0)
+
+    for (size_t q = start > PNG_WINDOW ? start - PNG_WINDOW : 0; q < start; q++) INSERT(q);
+
+    size_t p = start, block_start = start;
+    int nsyms = 0;
+    if (png_levels[level].greedy) {
+        while (p < end) {
+            int len = 0, dist = 0;
+            if (p + PNG_MIN_MATCH <= end) {
+                int32_t cur = z->head[png_hash(buf + p)];
+                INSERT(p);
+                len = longest_match(buf, p, end, cur, z->prev, chain, nice, 0, &dist);
+            }
+            if (len) {
+                EMIT(len, dist, p + len);
+                if (len <= max_lazy) {
+                    for (size_t q = p + 1; q < p + len && q + PNG_MIN_MATCH <= end; q++) INSERT(q);
+                }
+                p += len;
+            } else {
+                EMIT(0, buf[p], p + 1);
+                p++;
+            }
+        }
+    } else {
+        // The match found at p - 1 is sent only if the one at p is no longer;
+        // otherwise buf[p - 1] goes out as a literal and p's match waits
+        int prev_len = 0, prev_dist = 0, pending = 0;
+        while (p < end) {
+            int len = 0, dist = 0;
+            if (p + PNG_MIN_MATCH <= end) {
+                int32_t cur = z->head[png_hash(buf + p)];
+                INSERT(p);
+                if (prev_len < max_lazy) {
+                    int effort = prev_len >= good ? chain >> 2 : chain;
+                    len = longest_match(buf, p, end, cur, z->prev, effort, nice, prev_len, &dist);
+                }
+            }
+            if (prev_len && !len) {
+                size_t m = p - 1 + prev_len;
+                EMIT(prev_len, prev_dist, m);
+                for (size_t q = p + 1; q < m && q + PNG_MIN_MATCH <= end; q++) INSERT(q);
+                p = m;
+                prev_len = 0;
+                pending = 0;
+            } else {
+                if (pending) EMIT(0, buf[p - 1], p);
+                prev_len = len;
+                prev_dist = dist;
+                pending = 1;
+                p++;
+            }
+        }
+        if (pending) EMIT(0, buf[p - 1], p);
+    }
+    if (nsyms || final) write_block(bw, z->syms, nsyms, buf + block_start, end - block_start, final);
+#undef EMIT
+#undef INSERT
+    if (!final) write_stored(bw, NULL, 0, 0);
+}
+
+// --- FILTERING ---
+
+static inline int paeth(int a, int b, int c) {
+    int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    return pb <= pc ? b : c;
+}
+
+// Adds each filter's sum of |residual| over every 'step'th pixel to cost[]
+static void filter_costs(const unsigned char *row, const unsigned char *up, size_t rowbytes,
+                         int bpp, int step, uint64_t cost[5]) {
+    size_t stride = (size_t)bpp * step;
+    for (size_t x = 0; x < rowbytes; x += stride) {
+        for (int k = 0; k < bpp; k++) {
+            size_t i = x + k;
+            int a = i >= (size_t)bpp ? row[i - bpp] : 0;
+            int b = up[i];
+            int c = i >= (size_t)bpp ? up[i - bpp] : 0;
+            int v = row[i];
+            cost[0] += (uint64_t)abs((signed char)v);
+            cost[1] += (uint64_t)abs((signed char)(v - a));
+            cost[2] += (uint64_t)abs((signed char)(v - b));
+            cost[3] += (uint64_t)abs((signed char)(v - ((a + b) >> 1)));
+            cost[4] += (uint64_t)abs((signed char)(v - paeth(a, b, c)));
+        }
+    }
+}
+
+// Writes the filter type byte and the filtered row to out
+static void filter_row(unsigned char *out, const unsigned char *row, const unsigned char *up,
+                       size_t rowbytes, int bpp, PngFilter filter) {
+    int type;
+    switch (filter) {
+        case PNG_FILTER_SUB: type = 1; break;
+        case PNG_FILTER_UP: type = 2; break;
+        case PNG_FILTER_AVERAGE: type = 3; break;
+        case PNG_FILTER_PAETH: type = 4; break;
+        case PNG_FILTER_ADAPTIVE:
+        case PNG_FILTER_FAST: {
+            uint64_t cost[5] = { 0 };
+            filter_costs(row, up, rowbytes, bpp, filter == PNG_FILTER_FAST ? PNG_SAMPLE_STEP : 1, cost);
+            type = 0;
+            for (int t = 1; t < 5; t++) {
+                if (cost[t] < cost[type]) type = t;
+            }
+            break;
+        }
+        default: type = 0; break;
+    }
+    out[0] = (unsigned char)type;
+    out++;
+    size_t lead = (size_t)bpp < rowbytes ? (size_t)bpp : rowbytes;   // bytes with no left neighbour
+    switch (type) {
+        case 1:
+            memcpy(out, row, lead);
+            for (size_t i = lead; i < rowbytes; i++) out[i] = (unsigned char)(row[i] - row[i - bpp]);
+            break;
+        case 2:
+            for (size_t i = 0; i < rowbytes; i++) out[i] = (unsigned char)(row[i] - up[i]);
+            break;
+        case 3:
+            for (size_t i = 0; i < lead; i++) out[i] = (unsigned char)(row[i] - (up[i] >> 1));
+            for (size_t i = lead; i < rowbytes; i++) out[i] = (unsigned char)(row[i] - ((row[i - bpp] + up[i]) >> 1));
+            break;
+        case 4:
+            for (size_t i = 0; i < lead; i++) out[i] = (unsigned char)(row[i] - up[i]);
+            for (size_t i = lead; i < rowbytes; i++) {
+                out[i] = (unsigned char)(row[i] - paeth(row[i - bpp], up[i], up[i - bpp]));
+            }
+            break;
+        default:
+            memcpy(out, row, rowbytes);
+            break;
+    }
+}
+
+// --- BANDS ---
+
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    uint32_t adler;     // of this band's filtered bytes
+} PngBand;
+
+typedef struct {
+    const unsigned char *pixels;
+    int height, bpp;
+    int swap;           // 16-bit samples in little-endian host order
+    size_t rowbytes;
+    int level;
+    PngFilter filter;
+    int band_rows;      // image rows per band
+    int dict_rows;      // rows before a band that cover the match window
+    int nbands;
+    PngBand *bands;
+    const unsigned char *zero_row;
+    int failed;
+} PngJob;
+
+// Byte-swaps a row of 16-bit samples
+static void swap_row(unsigned char *dst, const unsigned char *src, size_t rowbytes) {
+    for (size_t i = 0; i + 1 < rowbytes; i += 2) {
+        dst[i] = src[i + 1];
+        dst[i + 1] = src[i];
+    }
+}
+
+// Worker for bands [b0, b1): filters each band's rows (plus the rows
+// before it that fill the match window) and compresses them
+static void png_bands(void *ctx, int b0, int b1) {
+    PngJob *job = ctx;
+    size_t line = job->rowbytes + 1;
+    Deflater z = {
+        malloc(sizeof(int32_t) << PNG_HASH_BITS),
+        malloc(sizeof(int32_t) * PNG_WINDOW),
+        malloc(sizeof(PngSym) * PNG_BLOCK_SYMBOLS),
+    };
+    unsigned char *buf = malloc(line * (size_t)(job->dict_rows + job->band_rows));
+    unsigned char *be = job->swap ? malloc(job->rowbytes * 2) : NULL;
+    if (!z.head || !z.prev || !z.syms || !buf || (job->swap && !be)) {
+        job->failed = 1;
+        goto done;
+    }
+
+    for (int b = b0; b < b1; b++) {
+        int r0 = b * job->band_rows;
+        int r1 = r0 + job->band_rows < job->height ? r0 + job->band_rows : job->height;
+        int first = r0 - job->dict_rows > 0 ? r0 - job->dict_rows : 0;
+        if (job->swap && first > 0) {
+            swap_row(be + (size_t)((first - 1) & 1) * job->rowbytes,
+                     job->pixels + (size_t)(first - 1) * job->rowbytes, job->rowbytes);
+        }
+        for (int y = first; y < r1; y++) {
+            const unsigned char *row = job->pixels + (size_t)y * job->rowbytes;
+            const unsigned char *up = y ? row - job->rowbytes : job->zero_row;
+            if (job->swap) {
+                // Big-endian copies of this row and the one above, alternating
+                unsigned char *cur = be + (size_t)(y & 1) * job->rowbytes;
+                swap_row(cur, row, job->rowbytes);
+                row = cur;
+                if (y) up = be + (size_t)((y - 1) & 1) * job->rowbytes;
+            }
+            filter_row(buf + (size_t)(y - first) * line, row, up, job->rowbytes, job->bpp, job->filter);
+        }
+        size_t start = (size_t)(r0 - first) * line, end = (size_t)(r1 - first) * line;
+
+        BitWriter bw = { 0 };
+        bw_reserve(&bw, (end - start) / 2 + 64);
+        if (b == 0) {
+            // zlib header: deflate, 32K window, compression level hint
+            static const unsigned char flg[4] = { 0x01, 0x5e, 0x9c, 0xda };
+            int hint = job->level < 2 ? 0 : job->level < 6 ? 1 : job->level == 6 ? 2 : 3;
+            unsigned char hdr[2] = { 0x78, flg[hint] };
+            bw_bytes(&bw, hdr, 2);
+        }
+        deflate_band(&bw, &z, buf, start, end, job->level, b == job->nbands - 1);
+        bw_align(&bw);
+        if (bw.failed) {
+            free(bw.buf);
+            job->failed = 1;
+            goto done;
+        }
+        job->bands[b].data = bw.buf;
+        job->bands[b].len = bw.len;
+        job->bands[b].adler = adler_update(1, buf + start, end - start);
+    }
+
+done:
+    free(z.head);
+    free(z.prev);
+    free(z.syms);
+    free(buf);
+    free(be);
+}
+
+static int write_chunk(FILE *f, const char *type, const unsigned char *data, size_t len,
+                       const unsigned char *tail, size_t tail_len) {
+    unsigned char hdr[8] = {
+        (unsigned char)((len + tail_len) >> 24), (unsigned char)((len + tail_len) >> 16),
+        (unsigned char)((len + tail_len) >> 8), (unsigned char)(len + tail_len),
+        (unsigned char)type[0], (unsigned char)type[1], (unsigned char)type[2], (unsigned char)type[3],
+    };
+    uint32_t crc = crc_update(0xffffffffu, hdr + 4, 4);
+    crc = crc_update(crc, data, len);
+    crc = crc_update(crc, tail, tail_len) ^ 0xffffffffu;
+    unsigned char crc_be[4] = { (unsigned char)(crc >> 24), (unsigned char)(crc >> 16),
+                                (unsigned char)(crc >> 8), (unsigned char)crc };
+    return fwrite(hdr, 1, 8, f) == 8 && (!len || fwrite(data, 1, len, f) == len) &&
+           (!tail_len || fwrite(tail, 1, tail_len, f) == tail_len) && fwrite(crc_be, 1, 4, f) == 4;
+}
+
+int png_write(const char *filename, const unsigned char *pixels, int width, int height,
+              int channels, int depth, int level, PngFilter filter) {
+    if (!filename || !pixels || width <= 0 || height <= 0 || channels < 1 || channels > 4 ||
+        (depth != 8 && depth != 16) || level < 0 || level > 9) {
+        fprintf(stderr, "Error: Invalid parameters in png_write\n");
+        return 0;
+    }
+    pthread_once(&tables_once, tables_init);
+    if (filter == PNG_FILTER_AUTO) filter = level == 0 ? PNG_FILTER_NONE : PNG_FILTER_ADAPTIVE;
+
+    const uint16_t one = 1;
+    PngJob job = { .pixels = pixels, .height = height, .bpp = channels * depth / 8,
+                   .swap = depth == 16 && *(const unsigned char *)&one == 1,
+                   .rowbytes = (size_t)width * channels * depth / 8, .level = level, .filter = filter };
+    size_t line = job.rowbytes + 1;
+    job.band_rows = line >= PNG_CHUNK_BYTES ? 1 : (int)(PNG_CHUNK_BYTES / line);
+    job.dict_rows = (int)((PNG_WINDOW + line - 1) / line);
+    job.nbands = (height + job.band_rows - 1) / job.band_rows;
+    job.bands = calloc(job.nbands, sizeof(PngBand));
+    unsigned char *zero_row = calloc(job.rowbytes, 1);
+    job.zero_row = zero_row;
+    if (!job.bands || !zero_row) {
+        fprintf(stderr, "Error: Memory allocation failed in png_write\n");
+        free(job.bands);
+        free(zero_row);
+        return 0;
+    }
+    parallel_for_rows(job.nbands, png_bands, &job);
+
+    int ok = !job.failed;
+    FILE *f = ok ? fopen(filename, "wb") : NULL;
+    if (ok && !f) {
+        fprintf(stderr, "Error: Cannot open %s for writing\n", filename);
+        ok = 0;
+    } else if (!ok) {
+        fprintf(stderr, "Error: Memory allocation failed in png_write\n");
+    }
+    if (ok) {
+        static const unsigned char sig[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+        static const unsigned char color_type[5] = { 0, 0, 4, 2, 6 };
+        unsigned char ihdr[13] = {
+            (unsigned char)(width >> 24), (unsigned char)(width >> 16), (unsigned char)(width >> 8), (unsigned char)width,
+            (unsigned char)(height >> 24), (unsigned char)(height >> 16), (unsigned char)(height >> 8), (unsigned char)height,
+            (unsigned char)depth, color_type[channels], 0, 0, 0,
+        };
+        uint32_t adler = 1;
+        size_t filtered = line * job.band_rows;
+        for (int b = 0; b < job.nbands; b++) {
+            size_t len = b == job.nbands - 1 ? line * (size_t)(height - b * job.band_rows) : filtered;
+            adler = b ? adler_combine(adler, job.bands[b].adler, len) : job.bands[b].adler;
+        }
+        unsigned char trailer[4] = { (unsigned char)(adler >> 24), (unsigned char)(adler >> 16),
+                                     (unsigned char)(adler >> 8), (unsigned char)adler };
+
+        ok = fwrite(sig, 1, 8, f) == 8 && write_chunk(f, "IHDR", ihdr, 13, NULL, 0);
+        for (int b = 0; ok && b < job.nbands; b++) {
+            int last = b == job.nbands - 1;
+            ok = write_chunk(f, "IDAT", job.bands[b].data, job.bands[b].len, trailer, last ? 4 : 0);
+        }
+        ok = ok && write_chunk(f, "IEND", NULL, 0, NULL, 0);
+        if (fclose(f) != 0) ok = 0;
+        if (!ok) fprintf(stderr, "Error: Failed to write %s\n", filename);
+    }
+
+    for (int b = 0; b < job.nbands; b++) free(job.bands[b].data);
+    free(job.bands);
+    free(zero_row);
+    return ok;
+}
@@ -0,0 +1,35 @@
+#ifndef PNG_H
+#define PNG_H
+
+// PNG encoder for save_image().
+//
+// Rows are filtered as PNG prescribes, then compressed by a built-in
+// deflate (hash-chain LZ77 with dynamic Huffman blocks). The image is cut
+// into bands of rows that the worker pool compresses independently: each
+// band primes its match window with the 32 KB of filtered data before it,
+// ends on a byte-aligned empty stored block and goes out as its own IDAT
+// chunk, so the bands concatenate into one valid zlib stream. Output does
+// not depend on the thread count.
+
+// Per-row filter choice
+typedef enum {
+    PNG_FILTER_AUTO,        // none at level 0, adaptive otherwise
+    PNG_FILTER_NONE,
+    PNG_FILTER_SUB,
+    PNG_FILTER_UP,
+    PNG_FILTER_AVERAGE,
+    PNG_FILTER_PAETH,
+    PNG_FILTER_ADAPTIVE,    // per row, the filter with the smallest sum of |residual|
+    PNG_FILTER_FAST         // adaptive, judged on every 8th pixel only
+} PngFilter;
+
+#define PNG_DEFAULT_LEVEL 6
+
+// Writes pixels of 1 (gray), 2 (gray + alpha), 3 (RGB) or 4 (RGBA)
+// channels, rows packed, with 'depth' 8 or 16 bits per sample (16-bit
+// samples in host byte order), at deflate level 0 (stored) to 9 (smallest).
+// Returns 1 on success, 0 on failure (reported on stderr).
+int png_write(const char *filename, const unsigned char *pixels, int width, int height,
+              int channels, int depth, int level, PngFilter filter);
+
+#endif
@@ -23,7 +23,7 @@ DUMP_AST="${2:---dump-ast}"  # Default to dump AST for verification
 echo "Building IML..."
 bison -d parser.y
 flex lexer.l
-gcc -o iml parser.tab.c lex.yy.c ast.c runtime.c main.c eval.c -lm -Wall
+gcc -o iml parser.tab.c lex.yy.c ast.c runtime.c parallel.c simd.c fft.c png.c main.c eval.c -lm -lpthread -Wall
 
 if [ $? -ne 0 ]; then
     echo "Build failed!"
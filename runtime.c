@@ -4,839 +4,4537 @@
 #include "include/stb_image_write.h"
 #include "include/canny.h"
 #include "runtime.h"
+#include "parallel.h"
+#include "simd.h"
+#include "fft.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <math.h>
+#include <strings.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+// Shared state for row-band kernels run through parallel_for_rows().
+// Each kernel uses the fields it needs; bands only write their own rows.
+typedef struct {
+    Image *src;
+    Image *src2;        // second input (blend, mask)
+    Image *dst;
+    int ival;           // bias, radius, direction ...
+    float fval;         // factor, alpha ...
+    float x_ratio, y_ratio;
+    float (*kernel)[3];
+    const float *taps;  // 1-D gaussian kernel, or IIR coefficients
+    float *plane;       // float working image (gaussian IIR)
+    const unsigned char *lut;
+    const struct PointSegment *segs;
+    int nsegs;
+    const PointOp *ops; // point ops on 16-bit and float images
+    int nops;
+    int src_y0, dst_y0; // image row stored first in src/dst data (0 unless tiled)
+    int failed;         // set by a band that could not allocate scratch
+} RowJob;
+
+/**
+ * @brief Helper to clamp a float value to the 0-255 byte range.
+ */
+static inline unsigned char clamp_pixel(float v) {
+    if (v < 0.0f) return 0;
+    if (v > 255.0f) return 255;
+    return (unsigned char)v;
+}
+
+// Copies one pixel of n bytes (channels times sample size) with fixed-size
+// moves for 8-bit gray, RGB and RGBA, so per-pixel loops that call it
+// compile to one path per layout
+static inline void copy_pixel(unsigned char *q, const unsigned char *p, size_t n) {
+    switch (n) {
+        case 1: q[0] = p[0]; break;
+        case 3: q[0] = p[0]; q[1] = p[1]; q[2] = p[2]; break;
+        case 4: memcpy(q, p, 4); break;
+        default: memcpy(q, p, n); break;
+    }
+}
+
+// --- SAMPLE TYPES ---
+//
+// Images hold 8-bit, 16-bit or float samples (PixelType). Values stay in
+// their type's own scale, 0 to pixel_type_max(), and only change scale
+// through convert_pixel_type(). 8-bit images keep their byte kernels; the
+// other types go through sample_at() and sample_put(). Hot kernels written
+// against those two take the type as a parameter and are expanded once per
+// type by DISPATCH_PIXEL_TYPE, so the type tests fold away; the box blur,
+// which needs a different accumulator per type, is a macro template.
+// 16-bit stores round and clamp; float stores keep the value as is, so
+// results outside 0..1 survive to the next operator.
+
+// Calls fn(args..., type) with the image's sample type as a constant
+#define DISPATCH_PIXEL_TYPE(type, fn, ...)                      \
+    switch (type) {                                             \
+        case PIXEL_U16: fn(__VA_ARGS__, PIXEL_U16); break;      \
+        case PIXEL_F32: fn(__VA_ARGS__, PIXEL_F32); break;      \
+        default: fn(__VA_ARGS__, PIXEL_U8); break;              \
+    }
+
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
+size_t pixel_type_size(PixelType type) {
+    return type == PIXEL_U16 ? 2 : type == PIXEL_F32 ? 4 : 1;
+}
+
+/**
+ * @brief Bytes of pixel data in an image: width * height * channels samples.
+ */
+size_t image_data_size(const Image *img) {
+    return (size_t)img->width * img->height * img->channels * pixel_type_size(img->type);
+}
+
+// Bytes per pixel
+static inline size_t pixel_size(const Image *img) {
+    return (size_t)img->channels * pixel_type_size(img->type);
+}
+
+// The sample value of white
+static inline float pixel_type_max(PixelType type) {
+    return type == PIXEL_U16 ? 65535.0f : type == PIXEL_F32 ? 1.0f : 255.0f;
+}
+
+// Sample i of 'data'
+ALWAYS_INLINE float sample_at(const unsigned char *data, PixelType type, size_t i) {
+    switch (type) {
+        case PIXEL_U16: return ((const uint16_t *)data)[i];
+        case PIXEL_F32: return ((const float *)data)[i];
+        default: return data[i];
+    }
+}
+
+// Stores v as sample i of 'data'; integer types round and clamp (NaN gives 0)
+ALWAYS_INLINE void sample_put(unsigned char *data, PixelType type, size_t i, float v) {
+    switch (type) {
+        case PIXEL_U16:
+            ((uint16_t *)data)[i] = !(v > 0.0f) ? 0 : v >= 65535.0f ? 65535 : (uint16_t)(v + 0.5f);
+            break;
+        case PIXEL_F32:
+            ((float *)data)[i] = v;
+            break;
+        default:
+            data[i] = !(v > 0.0f) ? 0 : v >= 255.0f ? 255 : (unsigned char)(v + 0.5f);
+            break;
+    }
+}
+
+// Luminance in the type's scale: grayscale_image()'s integer formula for
+// 8 and 16 bits, the same weights in float for floats
+ALWAYS_INLINE float luma_of(float r, float g, float b, PixelType type) {
+    if (type == PIXEL_F32) return 0.299f * r + 0.587f * g + 0.114f * b;
+    return (float)((299u * (uint32_t)r + 587u * (uint32_t)g + 114u * (uint32_t)b) / 1000u);
+}
+
+// acc[i] += k * sample i of src, for n samples
+static void samples_madd_f32(float *acc, const unsigned char *src, PixelType type, size_t n, float k) {
+    switch (type) {
+        case PIXEL_U16: {
+            const uint16_t *s = (const uint16_t *)src;
+            for (size_t i = 0; i < n; i++) acc[i] += s[i] * k;
+            break;
+        }
+        case PIXEL_F32:
+            simd_madd_f32(acc, (const float *)src, n, k);
+            break;
+        default:
+            simd_madd_u8_f32(acc, src, n, k);
+            break;
+    }
+}
+
+// Stores n floats as samples, as sample_put() would
+static void samples_from_f32(unsigned char *dst, PixelType type, const float *src, size_t n) {
+    switch (type) {
+        case PIXEL_U16:
+            for (size_t i = 0; i < n; i++) sample_put(dst, PIXEL_U16, i, src[i]);
+            break;
+        case PIXEL_F32:
+            memcpy(dst, src, n * sizeof(float));
+            break;
+        default:
+            simd_f32_to_u8(dst, src, n);
+            break;
+    }
+}
+
+ALWAYS_INLINE void convert_samples(unsigned char *dst, PixelType dt, const unsigned char *src, PixelType st,
+                                   size_t n) {
+    float scale = pixel_type_max(dt) / pixel_type_max(st);
+    for (size_t i = 0; i < n; i++) sample_put(dst, dt, i, sample_at(src, st, i) * scale);
+}
+
+// Row band worker for convert_pixel_type()
+static void convert_pixel_type_rows(void *ctx, int y0, int y1) {
+    RowJob *job = ctx;
+    PixelType st = job->src->type, dt = job->dst->type;
+    size_t row = (size_t)job->src->width * job->src->channels;
+    const unsigned char *p = job->src->data + (size_t)y0 * row * pixel_type_size(st);
+    unsigned char *q = job->dst->data + (size_t)y0 * row * pixel_type_size(dt);
+    size_t n = (size_t)(y1 - y0) * row;
+
+    if (st == PIXEL_U8 && dt == PIXEL_U16) {
+        // Exact, so no float round trip
+        for (size_t i = 0; i < n; i++) ((uint16_t *)q)[i] = (uint16_t)(p[i] * 257);
+    } else if (st == PIXEL_U8) convert_samples(q, PIXEL_F32, p, PIXEL_U8, n);
+    else if (st == PIXEL_U16 && dt == PIXEL_U8) convert_samples(q, PIXEL_U8, p, PIXEL_U16, n);
+    else if (st == PIXEL_U16) convert_samples(q, PIXEL_F32, p, PIXEL_U16, n);
+    else if (dt == PIXEL_U8) convert_samples(q, PIXEL_U8, p, PIXEL_F32, n);
+    else convert_samples(q, PIXEL_U16, p, PIXEL_F32, n);
+}
+
+/**
+ * @brief Converts an image to another sample type.
+ *
+ * Values are rescaled so white stays white (x257 from 8 to 16 bits, /255
+ * and /65535 to float) and rounded to the nearest step. Floats outside
+ * 0..1 are clamped on the way to an integer type. No gamma is applied:
+ * an HDR file's linear values stay linear.
+ *
+ * @param img The source image.
+ * @param type PIXEL_U8, PIXEL_U16 or PIXEL_F32.
+ * @return A new Image (a new reference to img if it already has that
+ *         type), or NULL on failure.
+ */
+Image *convert_pixel_type(Image *img, PixelType type) {
+    if (!img || !img->data) {
+        fprintf(stderr, "Error: Invalid image in convert_pixel_type\n");
+        return NULL;
+    }
+    if (type != PIXEL_U8 && type != PIXEL_U16 && type != PIXEL_F32) {
+        fprintf(stderr, "Error: Invalid pixel type %d in convert_pixel_type\n", (int)type);
+        return NULL;
+    }
+    if (type == img->type) return retain_image(img);
+
+    Image *out = malloc(sizeof(Image));
+    if (!out) {
+        fprintf(stderr, "Error: Memory allocation failed in convert_pixel_type\n");
+        return NULL;
+    }
+    out->width = img->width;
+    out->height = img->height;
+    out->channels = img->channels;
+    out->type = type;
+    out->refcount = 1;
+    out->data = malloc(image_data_size(out));
+    if (!out->data) {
+        fprintf(stderr, "Error: Memory allocation failed for convert_pixel_type data\n");
+        free(out);
+        return NULL;
+    }
+
+    RowJob job = { .src = img, .dst = out };
+    parallel_for_rows(img->height, convert_pixel_type_rows, &job);
+    return out;
+}
+
+// --- END SAMPLE TYPES ---
+
+// --- LOOKUP TABLES ---
+//
+// invert, brighten and contrast are pure byte -> byte maps. They are built
+// into a 256-entry table once per call and applied with a straight lookup,
+// so the per-byte cost is a load instead of float math and clamping.
+// Tables compose: running an op over a table's entries yields the table of
+// "old table, then op", which is how chains collapse into one pass.
+
+// Row band worker for apply_lut(); alpha passes through
+static void lut_rows(void *ctx, int y0, int y1) {
+    RowJob *job = ctx;
+    int cn = job->src->channels;
+    size_t row_size = (size_t)job->src->width * cn;
+    const unsigned char *lut = job->lut;
+    unsigned char *p = job->src->data + (size_t)(y0 - job->src_y0) * row_size;
+    unsigned char *q = job->dst->data + (size_t)(y0 - job->dst_y0) * row_size;
+    size_t n = (size_t)(y1 - y0) * row_size;
+
+    if (cn != 4) {
+        for (size_t i = 0; i < n; i++) q[i] = lut[p[i]];
+        return;
+    }
+    for (size_t i = 0; i < n; i += 4) {
+        q[i] = lut[p[i]];
+        q[i + 1] = lut[p[i + 1]];
+        q[i + 2] = lut[p[i + 2]];
+        q[i + 3] = p[i + 3];
+    }
+}
+
+// The table read between its entries: 'v' in the type's scale, clamped to
+// 0..white, maps through the straight line joining the two nearest entries
+ALWAYS_INLINE void lut_deep_rows_t(RowJob *job, int y0, int y1, PixelType type) {
+    int cn = job->src->channels;
+    size_t row = (size_t)job->src->width * cn;
+    size_t ss = pixel_type_size(type);
+    const unsigned char *lut = job->lut;
+    const unsigned char *p = job->src->data + (size_t)(y0 - job->src_y0) * row * ss;
+    unsigned char *q = job->dst->data + (size_t)(y0 - job->dst_y0) * row * ss;
+    float m = pixel_type_max(type), to_index = 255.0f / m, unit = m / 255.0f;
+    size_t n = (size_t)(y1 - y0) * row;
+
+    for (size_t i = 0; i < n; i++) {
+        float v = sample_at(p, type, i);
+        if (cn == 4 && i % 4 == 3) {
+            sample_put(q, type, i, v);
+            continue;
+        }
+        float pos = v * to_index;
+        pos = pos > 0.0f ? (pos < 255.0f ? pos : 255.0f) : 0.0f;
+        int k = (int)pos;
+        if (k > 254) k = 254;
+        float f = pos - (float)k;
+        sample_put(q, type, i, (lut[k] + (lut[k + 1] - lut[k]) * f) * unit);
+    }
+}
+
+// Row band worker for apply_lut() on 16-bit and float images
+static void lut_deep_rows(void *ctx, int y0, int y1) {
+    RowJob *job = ctx;
+    if (job->src->type == PIXEL_U16) lut_deep_rows_t(job, y0, y1, PIXEL_U16);
+    else lut_deep_rows_t(job, y0, y1, PIXEL_F32);
+}
+
+// Applies one per-channel op to every entry of 'lut'. Returns 0 for ops
+// that need the whole pixel (grayscale, threshold).
+static int lut_apply_op(unsigned char *lut, const PointOp *op) {
+    switch (op->kind) {
+        case POINT_INVERT:
+            for (int i = 0; i < 256; i++) lut[i] = 255 - lut[i];
+            return 1;
+        case POINT_BRIGHTNESS:
+            for (int i = 0; i < 256; i++) {
+                int new_val = (int)lut[i] + op->ival;
+                lut[i] = new_val < 0 ? 0 : (new_val > 255 ? 255 : (unsigned char)new_val);
+            }
+            return 1;
+        case POINT_CONTRAST:
+            for (int i = 0; i < 256; i++) {
+                lut[i] = clamp_pixel((op->fval * ((float)lut[i] - 128.0f)) + 128.0f);
+            }
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+void lut_identity(unsigned char *lut) {
+    for (int i = 0; i < 256; i++) lut[i] = (unsigned char)i;
+}
+
+/**
+ * @brief Folds a chain of per-channel point ops into an existing table.
+ *
+ * @param lut A 256-entry table, updated in place.
+ * @param ops The operations, applied in array order.
+ * @param nops Number of operations.
+ * @return 1 on success, 0 if an op cannot be expressed as a table (the
+ *         table is then left partially updated).
+ */
+int lut_compose_point_ops(unsigned char *lut, const PointOp *ops, int nops) {
+    for (int k = 0; k < nops; k++) {
+        if (!lut_apply_op(lut, &ops[k])) return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Maps every colour byte of an image through a 256-entry table.
+ *
+ * @param img The source Image.
+ * @param lut The table; out = lut[in] for gray or each of R, G and B.
+ *        Alpha is copied unchanged. 16-bit and float samples are scaled
+ *        to the table's 0-255 range and interpolated between entries.
+ * @return A new Image, or NULL on failure.
+ */
+Image *apply_lut(Image *img, const unsigned char *lut) {
+    if (!img || !img->data || !lut) {
+        fprintf(stderr, "Error: Invalid parameters in apply_lut\n");
+        return NULL;
+    }
+
+    Image *out = malloc(sizeof(Image));
+    if (!out) {
+        fprintf(stderr, "Error: Memory allocation failed in apply_lut\n");
+        return NULL;
+    }
+    out->width = img->width;
+    out->height = img->height;
+    out->channels = img->channels;
+    out->type = img->type;
+    out->refcount = 1;
+    out->data = malloc(image_data_size(out));
+    if (!out->data) {
+        fprintf(stderr, "Error: Memory allocation failed for lut data\n");
+        free(out);
+        return NULL;
+    }
+
+    RowJob job = { .src = img, .dst = out, .lut = lut };
+    parallel_for_rows(img->height, img->type == PIXEL_U8 ? lut_rows : lut_deep_rows, &job);
+    return out;
+}
+
+// --- END LOOKUP TABLES ---
+
+// --- RAW FORMATS ---
+//
+// Uncompressed formats for intermediates that the next script reloads
+// straight away: binary PGM/PPM (P5/P6), PAM (P7) and the native .imlraw, whose
+// fixed 64-byte header leaves the pixels cache-line aligned in the file.
+// .imlraw stores every sample type as is; the PNM formats take 8 and
+// 16 bits (MAXVAL 255 or 65535, big-endian), so float images are written
+// to them as 16-bit.
+// Loading maps the file copy-on-write and points the Image at the pixels
+// in place, so nothing is decoded or copied. In-place edits only touch
+// private pages. Saving writes the header and pixels with one writev()
+// into a temporary file that is then renamed over the target. That keeps
+// any mapping of the old file valid, even when a script overwrites the
+// file it loaded from.
+//
+// .imlraw header (little-endian):
+//   0  "IMLRAW1\n"
+//   8  u32 width, u32 height, u32 channels, u32 row stride in bytes
+//   24 u32 offset of the first row (64)
+//   28 u32 sample type: 0 8-bit, 1 16-bit, 2 float (PixelType; older
+//      files have 0 here), zero padding up to the first row
+// Samples wider than a byte are little-endian.
+
+#define IMLRAW_MAGIC "IMLRAW1\n"
+#define IMLRAW_HEADER 64
+
+// Image buffers that live in a file mapping; free_image() unmaps these
+// instead of freeing them
+typedef struct MappedBuffer {
+    unsigned char *data;
+    void *base;
+    size_t size;
+    struct MappedBuffer *next;
+} MappedBuffer;
+
+static MappedBuffer *mapped_buffers;
+static pthread_mutex_t mapped_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Unmaps 'data' if it points into a file mapping. Returns 0 for ordinary
+// heap buffers.
+static int raw_unmap(unsigned char *data) {
+    pthread_mutex_lock(&mapped_lock);
+    MappedBuffer **link = &mapped_buffers;
+    while (*link && (*link)->data != data) link = &(*link)->next;
+    MappedBuffer *m = *link;
+    if (m) *link = m->next;
+    pthread_mutex_unlock(&mapped_lock);
+    if (!m) return 0;
+    munmap(m->base, m->size);
+    free(m);
+    return 1;
+}
+
+static uint32_t get_le32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put_le32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+static int host_is_little_endian(void) {
+    const uint16_t one = 1;
+    return *(const unsigned char *)&one == 1;
+}
+
+// Copies a sample of 'size' bytes, reversing its byte order if 'swap'
+static inline void copy_sample(unsigned char *q, const unsigned char *p, size_t size, int swap) {
+    for (size_t b = 0; b < size; b++) q[b] = p[swap ? size - 1 - b : b];
+}
+
+// Reads one whitespace-separated PNM header token at *pos, skipping '#'
+// comments. Returns 0 if the header ends first.
+static int pnm_token(const unsigned char *p, size_t size, size_t *pos, char *tok, size_t len) {
+    size_t i = *pos, n = 0;
+    for (;;) {
+        while (i < size && (p[i] == ' ' || p[i] == '\t' || p[i] == '\n' || p[i] == '\r')) i++;
+        if (i < size && p[i] == '#') {
+            while (i < size && p[i] != '\n') i++;
+            continue;
+        }
+        break;
+    }
+    while (i < size && n + 1 < len && p[i] > ' ') tok[n++] = (char)p[i++];
+    tok[n] = '\0';
+    *pos = i;
+    return n > 0;
+}
+
+// Parses a P5, P6 or P7 header. Sets the pixel offset, size and depth and
+// returns the bytes per sample, 1 or 2; 0 for anything else, which is left
+// to stb_image.
+static int pnm_header(const unsigned char *p, size_t size, size_t *offset, int *w, int *h, int *depth) {
+    char tok[32];
+    size_t pos = 2;
+    long maxval = 0;
+    *w = *h = 0;
+    if (p[1] == '5' || p[1] == '6') {
+        if (!pnm_token(p, size, &pos, tok, sizeof(tok))) return 0;
+        *w = atoi(tok);
+        if (!pnm_token(p, size, &pos, tok, sizeof(tok))) return 0;
+        *h = atoi(tok);
+        if (!pnm_token(p, size, &pos, tok, sizeof(tok))) return 0;
+        maxval = atol(tok);
+        *depth = p[1] == '5' ? 1 : 3;
+        pos++;                  // the single whitespace byte before the pixels
+    } else {
+        *depth = 0;
+        for (;;) {
+            if (!pnm_token(p, size, &pos, tok, sizeof(tok))) return 0;
+            if (strcmp(tok, "ENDHDR") == 0) break;
+            char val[32];
+            if (strcmp(tok, "TUPLTYPE") == 0) {
+                // Implied by DEPTH; skip the rest of the line
+                while (pos < size && p[pos] != '\n') pos++;
+                continue;
+            }
+            if (!pnm_token(p, size, &pos, val, sizeof(val))) return 0;
+            if (strcmp(tok, "WIDTH") == 0) *w = atoi(val);
+            else if (strcmp(tok, "HEIGHT") == 0) *h = atoi(val);
+            else if (strcmp(tok, "DEPTH") == 0) *depth = atoi(val);
+            else if (strcmp(tok, "MAXVAL") == 0) maxval = atol(val);
+        }
+        while (pos < size && p[pos] != '\n') pos++;
+        pos++;
+    }
+    *offset = pos;
+    if (*w <= 0 || *h <= 0 || *depth < 1 || *depth > 4) return 0;
+    return maxval == 255 ? 1 : maxval == 65535 ? 2 : 0;
+}
+
+// Copies pixels out of a mapping into packed rows of 'channels' samples of
+// 'size' bytes, reversing each sample's bytes if 'swap'. Only gray + alpha
+// changes layout: it becomes RGBA.
+static unsigned char *raw_unpack(const unsigned char *src, int w, int h, int depth, size_t stride,
+                                 int channels, size_t size, int swap) {
+    size_t row = (size_t)w * channels * size;
+    unsigned char *out = malloc(row * h);
+    if (!out) return NULL;
+    for (int y = 0; y < h; y++) {
+        const unsigned char *p = src + (size_t)y * stride;
+        unsigned char *q = out + (size_t)y * row;
+        if (depth == channels && !swap) {
+            memcpy(q, p, row);
+            continue;
+        }
+        for (int x = 0; x < w; x++, p += depth * size, q += channels * size) {
+            for (int c = 0; c < channels; c++) {
+                int sc = depth == channels ? c : c < 3 ? 0 : 1;
+                copy_sample(q + c * size, p + sc * size, size, swap);
+            }
+        }
+    }
+    return out;
+}
+
+/**
+ * @brief Opens a PPM, PAM or .imlraw file without decoding it.
+ *
+ * @param filename Path of the file.
+ * @param out Receives the Image, or NULL if the file is raw but unreadable.
+ * @return 1 if the file is in a raw format (handled, see *out), 0 if it is
+ *         something else and should go through stb_image.
+ */
+static int load_raw(const char *filename, Image **out) {
+    *out = NULL;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return 0;
+    unsigned char magic[8];
+    ssize_t got = read(fd, magic, sizeof(magic));
+    int is_imlraw = got == (ssize_t)sizeof(magic) && memcmp(magic, IMLRAW_MAGIC, 8) == 0;
+    int is_pnm = got >= 2 && magic[0] == 'P' && magic[1] >= '5' && magic[1] <= '7';
+    struct stat st;
+    if ((!is_imlraw && !is_pnm) || fstat(fd, &st) != 0) {
+        close(fd);
+        return 0;
+    }
+
+    size_t size = (size_t)st.st_size;
+    unsigned char *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return 0;
+
+    size_t offset, stride;
+    int w, h, depth, swap;
+    PixelType type;
+    if (is_imlraw) {
+        if (size < IMLRAW_HEADER) goto bad;
+        w = (int)get_le32(base + 8);
+        h = (int)get_le32(base + 12);
+        depth = (int)get_le32(base + 16);
+        stride = get_le32(base + 20);
+        offset = get_le32(base + 24);
+        uint32_t t = get_le32(base + 28);
+        if (t > PIXEL_F32) goto bad;
+        type = (PixelType)t;
+        swap = type != PIXEL_U8 && !host_is_little_endian();
+        if (w <= 0 || h <= 0 || depth < 1 || depth > 4 ||
+            stride < (size_t)w * depth * pixel_type_size(type)) goto bad;
+    } else {
+        int bytes = pnm_header(base, size, &offset, &w, &h, &depth);
+        if (!bytes) {
+            // Unusual MAXVAL or a broken header: stb_image deals with those
+            munmap(base, size);
+            return 0;
+        }
+        type = bytes == 2 ? PIXEL_U16 : PIXEL_U8;
+        swap = type == PIXEL_U16 && host_is_little_endian();
+        stride = (size_t)w * depth * bytes;
+    }
+    if (offset > size || (size - offset) / stride < (size_t)h) goto bad;
+
+    Image *img = malloc(sizeof(Image));
+    if (!img) goto bad;
+    img->width = w;
+    img->height = h;
+    img->channels = depth == 2 ? 4 : depth;
+    img->type = type;
+    img->refcount = 1;
+    if (depth != 2 && stride == (size_t)w * depth * pixel_type_size(type) && !swap &&
+        offset % pixel_type_size(type) == 0) {
+        MappedBuffer *m = malloc(sizeof(MappedBuffer));
+        if (!m) {
+            free(img);
+            goto bad;
+        }
+        m->data = img->data = base + offset;
+        m->base = base;
+        m->size = size;
+        pthread_mutex_lock(&mapped_lock);
+        m->next = mapped_buffers;
+        mapped_buffers = m;
+        pthread_mutex_unlock(&mapped_lock);
+    } else {
+        // Gray + alpha, padded rows or foreign byte order: one conversion pass
+        img->data = raw_unpack(base + offset, w, h, depth, stride, img->channels,
+                               pixel_type_size(type), swap);
+        munmap(base, size);
+        if (!img->data) {
+            fprintf(stderr, "Error: Memory allocation failed in load_raw\n");
+            free(img);
+            return 1;
+        }
+    }
+    *out = img;
+    return 1;
+
+bad:
+    fprintf(stderr, "Error: Truncated or invalid raw image %s\n", filename);
+    munmap(base, size);
+    return 1;
+}
+
+// Case-insensitive test for a filename extension, e.g. ".ppm"
+static int has_extension(const char *filename, const char *ext) {
+    size_t n = strlen(filename), m = strlen(ext);
+    return n > m && strcasecmp(filename + n - m, ext) == 0;
+}
+
+/**
+ * @brief Writes an image as PGM/PPM, PAM or .imlraw with a single writev().
+ *
+ * Gray images become PGM (P5) under IMAGE_FORMAT_PPM; RGBA loses its
+ * alpha there, as PPM has no place for it. PAM and .imlraw keep every
+ * channel. .imlraw keeps the sample type too; the PNM formats get MAXVAL
+ * 255 for 8-bit images and 65535 for the others, floats being rounded to
+ * 16 bits. The data goes to "<filename>.<pid>.tmp" first and is renamed
+ * into place, so a mapping of the previous file (see load_raw()) stays
+ * intact.
+ *
+ * @return 1 on success, 0 on failure (reported on stderr).
+ */
+static int save_raw(const char *filename, Image *img, ImageFormat format) {
+    static const char *tupltype[5] = { NULL, "GRAYSCALE", "GRAYSCALE_ALPHA", "RGB", "RGB_ALPHA" };
+    char header[128];
+    size_t header_len;
+    Image *src = format != IMAGE_FORMAT_IMLRAW && img->type == PIXEL_F32 ? convert_pixel_type(img, PIXEL_U16)
+                                                                         : retain_image(img);
+    if (!src) return 0;
+    int cn = src->channels, out_cn = format == IMAGE_FORMAT_PPM && cn == 4 ? 3 : cn;
+    size_t size = pixel_type_size(src->type);
+    int swap = size > 1 && (format == IMAGE_FORMAT_IMLRAW) != host_is_little_endian();
+    const unsigned char *pixels = src->data;
+    unsigned char *copy = NULL;
+    if (out_cn != cn || swap) {
+        // Dropped alpha or big-endian samples for PNM: one repacking pass
+        size_t npix = (size_t)img->width * img->height;
+        copy = malloc(npix * out_cn * size);
+        if (!copy) {
+            fprintf(stderr, "Error: Memory allocation failed in save_raw\n");
+            free_image(src);
+            return 0;
+        }
+        for (size_t i = 0; i < npix; i++) {
+            for (int c = 0; c < out_cn; c++) {
+                copy_sample(copy + (i * out_cn + c) * size, pixels + (i * cn + c) * size, size, swap);
+            }
+        }
+        pixels = copy;
+    }
+    cn = out_cn;
+    size_t row = (size_t)img->width * cn * size;
+    int maxval = size == 1 ? 255 : 65535;
+    if (format == IMAGE_FORMAT_IMLRAW) {
+        memset(header, 0, IMLRAW_HEADER);
+        memcpy(header, IMLRAW_MAGIC, 8);
+        put_le32((unsigned char *)header + 8, (uint32_t)img->width);
+        put_le32((unsigned char *)header + 12, (uint32_t)img->height);
+        put_le32((unsigned char *)header + 16, (uint32_t)cn);
+        put_le32((unsigned char *)header + 20, (uint32_t)row);
+        put_le32((unsigned char *)header + 24, IMLRAW_HEADER);
+        put_le32((unsigned char *)header + 28, (uint32_t)src->type);
+        header_len = IMLRAW_HEADER;
+    } else if (format == IMAGE_FORMAT_PAM) {
+        header_len = (size_t)snprintf(header, sizeof(header),
+                                      "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL %d\nTUPLTYPE %s\nENDHDR\n",
+                                      img->width, img->height, cn, maxval, tupltype[cn]);
+    } else {
+        header_len = (size_t)snprintf(header, sizeof(header), "P%c\n%d %d\n%d\n", cn == 1 ? '5' : '6',
+                                      img->width, img->height, maxval);
+    }
+    if (header_len >= sizeof(header)) {
+        fprintf(stderr, "Error: Image too large for raw header in %s\n", filename);
+        free(copy);
+        free_image(src);
+        return 0;
+    }
+
+    size_t path_len = strlen(filename) + 32;
+    char *tmp = malloc(path_len);
+    if (!tmp) {
+        fprintf(stderr, "Error: Memory allocation failed in save_raw\n");
+        free(copy);
+        free_image(src);
+        return 0;
+    }
+    snprintf(tmp, path_len, "%s.%d.tmp", filename, (int)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot create %s\n", tmp);
+        free(tmp);
+        free(copy);
+        free_image(src);
+        return 0;
+    }
+
+    struct iovec iov[2] = {
+        { header, header_len },
+        { (void *)pixels, row * img->height },
+    };
+    int ok = 1;
+    while (ok && (iov[0].iov_len || iov[1].iov_len)) {
+        ssize_t n = writev(fd, iov[0].iov_len ? iov : iov + 1, iov[0].iov_len ? 2 : 1);
+        if (n < 0) {
+            ok = 0;
+            break;
+        }
+        // Short write: advance past what went out and go again
+        for (int i = 0; i < 2 && n > 0; i++) {
+            size_t step = (size_t)n < iov[i].iov_len ? (size_t)n : iov[i].iov_len;
+            iov[i].iov_base = (char *)iov[i].iov_base + step;
+            iov[i].iov_len -= step;
+            n -= (ssize_t)step;
+        }
+    }
+    if (close(fd) != 0) ok = 0;
+    if (ok && rename(tmp, filename) != 0) ok = 0;
+    if (!ok) {
+        fprintf(stderr, "Error: Failed to write %s\n", filename);
+        unlink(tmp);
+    }
+    free(tmp);
+    free(copy);
+    free_image(src);
+    return ok;
+}
+
+// --- END RAW FORMATS ---
 
 Image *load_image(const char *filename) {
     if (!filename) {
         fprintf(stderr, "Error: NULL filename in load_image\n");
         return NULL;
     }
-    Image *img = malloc(sizeof(Image));
-    if (!img) {
-        fprintf(stderr, "Error: Memory allocation failed in load_image\n");
+    Image *img;
+    if (load_raw(filename, &img)) return img;
+    img = malloc(sizeof(Image));
+    if (!img) {
+        fprintf(stderr, "Error: Memory allocation failed in load_image\n");
+        return NULL;
+    }
+    // Keep the file's own channel count and depth: 16-bit PNG/PNM stays
+    // 16-bit, Radiance HDR loads as float. Gray + alpha becomes RGBA.
+    int comp = 0;
+    if (stbi_info(filename, &img->width, &img->height, &comp) && comp == 2) comp = 4;
+    if (stbi_is_hdr(filename)) {
+        img->type = PIXEL_F32;
+        img->data = (unsigned char *)stbi_loadf(filename, &img->width, &img->height, &img->channels, comp);
+    } else if (stbi_is_16_bit(filename)) {
+        img->type = PIXEL_U16;
+        img->data = (unsigned char *)stbi_load_16(filename, &img->width, &img->height, &img->channels, comp);
+    } else {
+        img->type = PIXEL_U8;
+        img->data = stbi_load(filename, &img->width, &img->height, &img->channels, comp);
+    }
+    if (!img->data) {
+        fprintf(stderr, "Error: Failed to load image %s\n", filename);
+        free(img);
+        return NULL;
+    }
+    if (comp) img->channels = comp;
+    img->refcount = 1;
+    return img;
+}
+
+/**
+ * @brief Picks the output format from a file name's extension.
+ *
+ * @return The matching format, or IMAGE_FORMAT_PNG for unknown extensions.
+ */
+ImageFormat image_format_from_path(const char *filename) {
+    static const struct {
+        const char *ext;
+        ImageFormat format;
+    } exts[] = {
+        { ".png", IMAGE_FORMAT_PNG }, { ".jpg", IMAGE_FORMAT_JPEG }, { ".jpeg", IMAGE_FORMAT_JPEG },
+        { ".jpe", IMAGE_FORMAT_JPEG }, { ".bmp", IMAGE_FORMAT_BMP }, { ".tga", IMAGE_FORMAT_TGA },
+        { ".ppm", IMAGE_FORMAT_PPM }, { ".pnm", IMAGE_FORMAT_PPM }, { ".pam", IMAGE_FORMAT_PAM },
+        { ".imlraw", IMAGE_FORMAT_IMLRAW }, { ".hdr", IMAGE_FORMAT_HDR },
+    };
+    for (size_t i = 0; filename && i < sizeof(exts) / sizeof(exts[0]); i++) {
+        if (has_extension(filename, exts[i].ext)) return exts[i].format;
+    }
+    return IMAGE_FORMAT_PNG;
+}
+
+void save_image(const char *filename, Image *img) {
+    save_image_as(filename, img, IMAGE_FORMAT_AUTO);
+}
+
+/**
+ * @brief Saves an image in the given format with that format's defaults.
+ *
+ * PNG, PNM and .imlraw keep 16-bit samples (float goes to PNG and PNM as
+ * 16-bit), HDR is written from float, and JPEG, BMP and TGA take 8-bit
+ * samples; other types are converted on the way out.
+ *
+ * @param filename Output path.
+ * @param img The Image to write.
+ * @param format Encoder to use; IMAGE_FORMAT_AUTO goes by the extension.
+ */
+void save_image_as(const char *filename, Image *img, ImageFormat format) {
+    if (!filename || !img || !img->data) {
+        fprintf(stderr, "Error: Invalid save_image parameters (filename=%p, img=%p, data=%p)\n",
+                (void*)filename, (void*)img, img ? (void*)img->data : NULL);
+        return;
+    }
+    if (format == IMAGE_FORMAT_AUTO) format = image_format_from_path(filename);
+    int ok = 1;
+    Image *conv = NULL;
+    switch (format) {
+        case IMAGE_FORMAT_JPEG:
+            save_image_jpeg(filename, img, JPEG_DEFAULT_QUALITY, JPEG_SUBSAMPLE_AUTO);
+            break;
+        case IMAGE_FORMAT_BMP:
+        case IMAGE_FORMAT_TGA:
+            conv = convert_pixel_type(img, PIXEL_U8);
+            if (!conv) return;
+            if (format == IMAGE_FORMAT_BMP) {
+                ok = stbi_write_bmp(filename, conv->width, conv->height, conv->channels, conv->data);
+            } else {
+                ok = stbi_write_tga(filename, conv->width, conv->height, conv->channels, conv->data);
+            }
+            break;
+        case IMAGE_FORMAT_HDR:
+            conv = convert_pixel_type(img, PIXEL_F32);
+            if (!conv) return;
+            ok = stbi_write_hdr(filename, conv->width, conv->height, conv->channels, (const float *)conv->data);
+            break;
+        case IMAGE_FORMAT_PPM:
+        case IMAGE_FORMAT_PAM:
+        case IMAGE_FORMAT_IMLRAW:
+            save_raw(filename, img, format);
+            break;
+        default:
+            save_image_png(filename, img, PNG_DEFAULT_LEVEL, PNG_FILTER_AUTO);
+            break;
+    }
+    free_image(conv);
+    if (!ok) fprintf(stderr, "Error: Failed to write %s\n", filename);
+}
+
+/**
+ * @brief Saves an image as PNG with a chosen compression effort.
+ *
+ * @param filename Output path; the extension is not consulted.
+ * @param img The Image to write.
+ * @param level Deflate level, 0 (stored, fastest) to 9 (smallest).
+ * @param filter Row filter choice; PNG_FILTER_FAST trades a little size
+ *        for much less filtering work.
+ *
+ * 16-bit and float images are written with 16-bit samples.
+ */
+void save_image_png(const char *filename, Image *img, int level, PngFilter filter) {
+    if (!filename || !img || !img->data) {
+        fprintf(stderr, "Error: Invalid save_image_png parameters\n");
+        return;
+    }
+    Image *src = img->type == PIXEL_F32 ? convert_pixel_type(img, PIXEL_U16) : retain_image(img);
+    if (!src) return;
+    png_write(filename, src->data, src->width, src->height, src->channels,
+              src->type == PIXEL_U16 ? 16 : 8, level, filter);
+    free_image(src);
+}
+
+// Growable buffer behind the JPEG encoder's write callback
+typedef struct {
+    unsigned char *data;
+    size_t len, cap;
+    int failed;
+} JpegSink;
+
+static void jpeg_sink_write(void *context, void *data, int size) {
+    JpegSink *sink = context;
+    if (sink->failed || size <= 0) return;
+    if (sink->len + (size_t)size > sink->cap) {
+        size_t cap = sink->cap ? sink->cap * 2 : 65536;
+        while (cap < sink->len + (size_t)size) cap *= 2;
+        unsigned char *grown = realloc(sink->data, cap);
+        if (!grown) {
+            sink->failed = 1;
+            return;
+        }
+        sink->data = grown;
+        sink->cap = cap;
+    }
+    if (size == 1) sink->data[sink->len] = *(unsigned char *)data;
+    else memcpy(sink->data + sink->len, data, (size_t)size);
+    sink->len += (size_t)size;
+}
+
+/**
+ * @brief Saves an image as baseline JPEG. Alpha is dropped and 16-bit or
+ *        float samples are converted to 8 bits.
+ *
+ * @param filename Output path; the extension is not consulted.
+ * @param img The Image to write.
+ * @param quality 1 (smallest) to 100 (best).
+ * @param subsample Chroma resolution; 4:2:0 halves the colour planes both
+ *        ways, which suits photos and previews.
+ */
+void save_image_jpeg(const char *filename, Image *img, int quality, JpegSubsample subsample) {
+    if (!filename || !img || !img->data || quality < 1 || quality > 100) {
+        fprintf(stderr, "Error: Invalid save_image_jpeg parameters\n");
+        return;
+    }
+    int mode = subsample == JPEG_SUBSAMPLE_420 ? 1 : subsample == JPEG_SUBSAMPLE_444 ? 0 : -1;
+    img = convert_pixel_type(img, PIXEL_U8);
+    if (!img) return;
+    // The encoder emits the entropy-coded data a byte at a time, so collect
+    // it in memory and write the file in one go
+    JpegSink sink = { 0 };
+    stbi__write_context s = { 0 };
+    stbi__start_write_callbacks(&s, jpeg_sink_write, &sink);
+    int ok = stbi_write_jpg_core_ex(&s, img->width, img->height, img->channels, img->data, quality, mode) &&
+             !sink.failed;
+    FILE *f = ok ? fopen(filename, "wb") : NULL;
+    if (f) {
+        ok = fwrite(sink.data, 1, sink.len, f) == sink.len;
+        if (fclose(f) != 0) ok = 0;
+    } else {
+        ok = 0;
+    }
+    if (!ok) fprintf(stderr, "Error: Failed to write %s\n", filename);
+    free(sink.data);
+    free_image(img);
+}
+
+// --- SCALED JPEG DECODING ---
+//
+// A JPEG holds each 8x8 block as DCT coefficients, so a 1/2, 1/4 or 1/8
+// scale picture can be produced block by block without a full-size buffer
+// ever existing: the DC coefficient alone is the block mean (1/8 scale, no
+// IDCT at all), and the 1/2 and 1/4 scales average the block's IDCT output
+// before storing it. Everything else - markers, entropy decoding, chroma
+// upsampling and colour conversion - is stb_image's own code, run on
+// component planes allocated at the reduced size.
+
+#define JPEG_MAX_SHIFT 3        // 1/8 scale, one pixel per block
+
+// Stores one dequantised block at 1/(1 << shift) scale, shift 1..3
+static void jpeg_store_block(stbi__jpeg *z, stbi_uc *out, int stride, short *data, int shift) {
+    if (shift == JPEG_MAX_SHIFT) {
+        int v = 128 + ((data[0] + 4) >> 3);
+        *out = (stbi_uc)(v < 0 ? 0 : (v > 255 ? 255 : v));
+        return;
+    }
+    STBI_SIMD_ALIGN(stbi_uc, px[64]);
+    z->idct_block_kernel(px, 8, data);
+    int s = 1 << shift, n = 8 >> shift;
+    for (int y = 0; y < n; y++) {
+        for (int x = 0; x < n; x++) {
+            const stbi_uc *p = px + y * s * 8 + x * s;
+            int sum = 0;
+            for (int dy = 0; dy < s; dy++) {
+                for (int dx = 0; dx < s; dx++) sum += p[dy * 8 + dx];
+            }
+            out[y * stride + x] = (stbi_uc)((sum + s * s / 2) >> (2 * shift));
+        }
+    }
+}
+
+// Counts down the restart interval after an MCU. Returns 0 when the scan
+// ends early on a marker that is not a restart.
+static int jpeg_next_mcu(stbi__jpeg *z) {
+    if (--z->todo <= 0) {
+        if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+        if (!STBI__RESTART(z->marker)) return 0;
+        stbi__jpeg_reset(z);
+    }
+    return 1;
+}
+
+// stbi__parse_entropy_coded_data() for a baseline scan, storing scaled blocks
+static int jpeg_parse_scaled(stbi__jpeg *z, int shift) {
+    STBI_SIMD_ALIGN(short, data[64]);
+    int b = 8 >> shift;
+    stbi__jpeg_reset(z);
+    if (z->scan_n == 1) {
+        // Non-interleaved: one block per MCU, in scanline order
+        int n = z->order[0];
+        int ha = z->img_comp[n].ha;
+        int w = (z->img_comp[n].x + 7) >> 3;
+        int h = (z->img_comp[n].y + 7) >> 3;
+        for (int j = 0; j < h; j++) {
+            for (int i = 0; i < w; i++) {
+                if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha,
+                                             z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+                jpeg_store_block(z, z->img_comp[n].data + z->img_comp[n].w2 * j * b + i * b,
+                                 z->img_comp[n].w2, data, shift);
+                if (!jpeg_next_mcu(z)) return 1;
+            }
+        }
+        return 1;
+    }
+    for (int j = 0; j < z->img_mcu_y; j++) {
+        for (int i = 0; i < z->img_mcu_x; i++) {
+            for (int k = 0; k < z->scan_n; k++) {
+                int n = z->order[k];
+                int ha = z->img_comp[n].ha;
+                for (int y = 0; y < z->img_comp[n].v; y++) {
+                    for (int x = 0; x < z->img_comp[n].h; x++) {
+                        int x2 = (i * z->img_comp[n].h + x) * b;
+                        int y2 = (j * z->img_comp[n].v + y) * b;
+                        if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha,
+                                                     z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+                        jpeg_store_block(z, z->img_comp[n].data + z->img_comp[n].w2 * y2 + x2,
+                                         z->img_comp[n].w2, data, shift);
+                    }
+                }
+            }
+            if (!jpeg_next_mcu(z)) return 1;
+        }
+    }
+    return 1;
+}
+
+// stbi__jpeg_finish() for a progressive image: stb has gathered every
+// block's coefficients, this dequantises and stores them scaled
+static void jpeg_finish_scaled(stbi__jpeg *z, int shift) {
+    int b = 8 >> shift;
+    for (int n = 0; n < z->s->img_n; n++) {
+        int w = (z->img_comp[n].x + 7) >> 3;
+        int h = (z->img_comp[n].y + 7) >> 3;
+        for (int j = 0; j < h; j++) {
+            for (int i = 0; i < w; i++) {
+                short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
+                stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
+                jpeg_store_block(z, z->img_comp[n].data + z->img_comp[n].w2 * j * b + i * b,
+                                 z->img_comp[n].w2, data, shift);
+            }
+        }
+    }
+}
+
+// The upsample and colour-convert half of load_jpeg_image(), for gray or
+// RGB output from 1 or 3 components of a w x h scaled decode
+static stbi_uc *jpeg_output(stbi__jpeg *z, int w, int h, int shift) {
+    int img_n = z->s->img_n;
+    int is_rgb = img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
+    stbi__resample res[3];
+    stbi_uc *coutput[3] = { NULL, NULL, NULL };
+
+    for (int k = 0; k < img_n; k++) {
+        stbi__resample *r = &res[k];
+        z->img_comp[k].y = (z->img_comp[k].y + (1 << shift) - 1) >> shift;
+        z->img_comp[k].linebuf = stbi__malloc(w + 3);
+        if (!z->img_comp[k].linebuf) return NULL;
+
+        r->hs = z->img_h_max / z->img_comp[k].h;
+        r->vs = z->img_v_max / z->img_comp[k].v;
+        r->ystep = r->vs >> 1;
+        r->w_lores = (w + r->hs - 1) / r->hs;
+        r->ypos = 0;
+        r->line0 = r->line1 = z->img_comp[k].data;
+
+        if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
+        else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
+        else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
+        else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
+        else                               r->resample = stbi__resample_row_generic;
+    }
+
+    // One spare byte: the colour kernels store a fourth channel even at step 3
+    stbi_uc *output = stbi__malloc_mad3(img_n, w, h, 1);
+    if (!output) return NULL;
+    for (int j = 0; j < h; j++) {
+        stbi_uc *out = output + (size_t)w * img_n * j;
+        for (int k = 0; k < img_n; k++) {
+            stbi__resample *r = &res[k];
+            int y_bot = r->ystep >= (r->vs >> 1);
+            coutput[k] = r->resample(z->img_comp[k].linebuf, y_bot ? r->line1 : r->line0,
+                                     y_bot ? r->line0 : r->line1, r->w_lores, r->hs);
+            if (++r->ystep >= r->vs) {
+                r->ystep = 0;
+                r->line0 = r->line1;
+                if (++r->ypos < z->img_comp[k].y) r->line1 += z->img_comp[k].w2;
+            }
+        }
+        if (img_n == 1) {
+            memcpy(out, coutput[0], (size_t)w);
+        } else if (is_rgb) {
+            for (int i = 0; i < w; i++, out += 3) {
+                out[0] = coutput[0][i];
+                out[1] = coutput[1][i];
+                out[2] = coutput[2][i];
+            }
+        } else {
+            z->YCbCr_to_RGB_kernel(out, coutput[0], coutput[1], coutput[2], w, 3);
+        }
+    }
+    return output;
+}
+
+// stbi__decode_jpeg_image() plus output at 1/(1 << shift) scale, with as
+// many channels as components. Returns NULL for anything that is not a 1-
+// or 3-component JPEG, or on error.
+static stbi_uc *jpeg_load_scaled(FILE *f, int shift, int *out_w, int *out_h, int *out_n) {
+    stbi__context s;
+    stbi__start_file(&s, f);
+    stbi__jpeg *z = stbi__malloc(sizeof(stbi__jpeg));
+    if (!z) return NULL;
+    memset(z, 0, sizeof(stbi__jpeg));
+    z->s = &s;
+    z->s->img_n = 0;        // makes stbi__cleanup_jpeg() safe before the frame header
+    stbi__setup_jpeg(z);
+
+    stbi_uc *result = NULL;
+    if (!stbi__decode_jpeg_header(z, STBI__SCAN_load)) goto done;
+    // CMYK and YCCK are rare enough to leave to stbi_load()
+    if (z->s->img_n != 1 && z->s->img_n != 3) goto done;
+
+    // Swap the full-size planes the frame header allocated (and never
+    // touched) for scaled ones; the padded plane sizes are multiples of 8
+    for (int n = 0; n < z->s->img_n; n++) {
+        STBI_FREE(z->img_comp[n].raw_data);
+        z->img_comp[n].w2 >>= shift;
+        z->img_comp[n].h2 >>= shift;
+        z->img_comp[n].raw_data = stbi__malloc_mad2(z->img_comp[n].w2, z->img_comp[n].h2, 0);
+        z->img_comp[n].data = z->img_comp[n].raw_data;
+        if (!z->img_comp[n].data) goto done;
+    }
+
+    int m = stbi__get_marker(z);
+    while (!stbi__EOI(m)) {
+        if (stbi__SOS(m)) {
+            if (!stbi__process_scan_header(z)) goto done;
+            if (z->progressive ? !stbi__parse_entropy_coded_data(z) : !jpeg_parse_scaled(z, shift)) goto done;
+            if (z->marker == STBI__MARKER_none) z->marker = stbi__skip_jpeg_junk_at_end(z);
+            m = stbi__get_marker(z);
+            if (STBI__RESTART(m)) m = stbi__get_marker(z);
+        } else if (stbi__DNL(m)) {
+            int ld = stbi__get16be(z->s);
+            stbi__uint32 nl = stbi__get16be(z->s);
+            if (ld != 4 || nl != z->s->img_y) goto done;
+            m = stbi__get_marker(z);
+        } else {
+            if (!stbi__process_marker(z, m)) break;
+            m = stbi__get_marker(z);
+        }
+    }
+    if (z->progressive) jpeg_finish_scaled(z, shift);
+
+    *out_w = (int)((z->s->img_x + (1u << shift) - 1) >> shift);
+    *out_h = (int)((z->s->img_y + (1u << shift) - 1) >> shift);
+    *out_n = z->s->img_n;
+    result = jpeg_output(z, *out_w, *out_h, shift);
+
+done:
+    stbi__cleanup_jpeg(z);
+    STBI_FREE(z);
+    return result;
+}
+
+/**
+ * @brief Tells whether a file starts with the JPEG SOI marker.
+ *
+ * Only the first three bytes (FF D8 FF) are read, so this is cheap enough to
+ * call before choosing a decode path; the extension is not consulted.
+ *
+ * @param filename Path of the image file.
+ * @return 1 if the file looks like a JPEG, 0 otherwise (including when it
+ *         cannot be opened).
+ */
+int is_jpeg_file(const char *filename) {
+    if (!filename) return 0;
+    FILE *f = stbi__fopen(filename, "rb");
+    if (!f) return 0;
+    unsigned char magic[3];
+    int jpeg = fread(magic, 1, 3, f) == 3 && magic[0] == 0xFF && magic[1] == 0xD8 && magic[2] == 0xFF;
+    fclose(f);
+    return jpeg;
+}
+
+/**
+ * @brief Loads an image at the smallest power-of-two reduction that still
+ *        covers a target size.
+ *
+ * The scale is the smallest of 1, 1/2, 1/4 and 1/8 whose result (rounded
+ * up, as JPEG decoders round) is at least want_w x want_h, so a following
+ * resize to the target never upsamples. JPEGs are decoded straight at that
+ * scale and never exist at full size; each output pixel is the average of
+ * the pixels it replaces, so a following resize is close to, but not
+ * identical with, resizing the full decode. Other formats are decoded in full
+ * and box-filtered down.
+ *
+ * @param filename Path of the image file.
+ * @param want_w Width the caller needs; <= 0 for no constraint.
+ * @param want_h Height the caller needs; <= 0 for no constraint.
+ * @return A new Image, or NULL on failure.
+ */
+Image *load_image_scaled(const char *filename, int want_w, int want_h) {
+    if (!filename) {
+        fprintf(stderr, "Error: NULL filename in load_image_scaled\n");
+        return NULL;
+    }
+    int w, h, comp;
+    if (!stbi_info(filename, &w, &h, &comp)) return load_image(filename);
+
+    int shift = 0;
+    while (shift < JPEG_MAX_SHIFT) {
+        int next = 1 << (shift + 1);
+        if ((w + next - 1) / next < want_w || (h + next - 1) / next < want_h) break;
+        shift++;
+    }
+    if (shift == 0) return load_image(filename);
+
+    FILE *f = stbi__fopen(filename, "rb");
+    if (!f) {
+        fprintf(stderr, "Error: Failed to load image %s\n", filename);
+        return NULL;
+    }
+    Image *img = malloc(sizeof(Image));
+    if (!img) {
+        fprintf(stderr, "Error: Memory allocation failed in load_image_scaled\n");
+        fclose(f);
+        return NULL;
+    }
+    img->data = jpeg_load_scaled(f, shift, &img->width, &img->height, &img->channels);
+    fclose(f);
+    if (img->data) {
+        img->type = PIXEL_U8;
+        img->refcount = 1;
+        return img;
+    }
+    free(img);
+
+    Image *full = load_image(filename);
+    if (!full) return NULL;
+    img = resize_image(full, (w + (1 << shift) - 1) >> shift, (h + (1 << shift) - 1) >> shift, INTERP_BOX);
+    free_image(full);
+    return img;
+}
+
+// --- END SCALED JPEG DECODING ---
+
+Image *crop_image(Image *img, int x, int y, int w, int h) {
+    if (!img || !img->data || w <= 0 || h <= 0 || x < 0 || y < 0) {
+        fprintf(stderr, "Error: Invalid crop parameters (img=%p, data=%p, x=%d, y=%d, w=%d, h=%d)\n",
+                (void*)img, img ? (void*)img->data : NULL, x, y, w, h);
+        return NULL;
+    }
+    if (x + w > img->width || y + h > img->height) {
+        fprintf(stderr, "Error: Crop out of bounds (img: %dx%d, crop: x=%d, y=%d, w=%d, h=%d)\n",
+                img->width, img->height, x, y, w, h);
+        return NULL;
+    }
+    Image *out = malloc(sizeof(Image));
+    if (!out) {
+        fprintf(stderr, "Error: Memory allocation failed in crop_image\n");
+        return NULL;
+    }
+    out->width = w;
+    out->height = h;
+    out->channels = img->channels;
+    out->type = img->type;
+    out->refcount = 1;
+    size_t psize = pixel_size(img);
+    size_t row_size = w * psize;
+    out->data = malloc(h * row_size);
+    if (!out->data) {
+        fprintf(stderr, "Error: Memory allocation failed for crop data\n");
+        free(out);
+        return NULL;
+    }
+    // Initialize output to zero to avoid garbage
+    memset(out->data, 0, h * row_size);
+    for (int i = 0; i < h; i++) {
+        size_t src_offset = ((size_t)(y + i) * img->width + x) * psize;
+        size_t dst_offset = i * row_size;
+        memcpy(out->data + dst_offset, img->data + src_offset, row_size);
+    }
+    return out;
+}
+
+// Row band worker for blur_image(), one per sample type T. ACC holds the
+// running sums: exact integers for 8 and 16 bits, double for float. Each
+// band primes its own column sums at y0.
+#define DEFINE_BLUR_ROWS(NAME, T, ACC)                                                          \
+static void NAME(void *ctx, int y0_band, int y1_band) {                                         \
+    RowJob *job = ctx;                                                                          \
+    Image *img = job->src, *out = job->dst;                                                     \
+    int radius = job->ival;                                                                     \
+    int w = img->width, h = img->height, c = out->channels;                                     \
+    size_t row_size = (size_t)w * c;                                                            \
+    const T *src = (const T *)img->data;                                                        \
+                                                                                                \
+    /* Per-column sums of the rows currently inside the vertical window */                      \
+    ACC *col_sum = calloc(row_size, sizeof(ACC));                                               \
+    if (!col_sum) {                                                                             \
+        job->failed = 1;                                                                        \
+        return;                                                                                 \
+    }                                                                                           \
+    for (int yy = (y0_band - radius < 0) ? 0 : y0_band - radius; yy <= y0_band + radius && yy < h; yy++) { \
+        const T *p = src + (size_t)(yy - job->src_y0) * row_size;                               \
+        for (size_t i = 0; i < row_size; i++) col_sum[i] += p[i];                               \
+    }                                                                                           \
+                                                                                                \
+    for (int y = y0_band; y < y1_band; y++) {                                                   \
+        if (y > y0_band) {                                                                      \
+            /* Slide the vertical window down by one row */                                     \
+            int add_y = y + radius;                                                             \
+            int sub_y = y - radius - 1;                                                         \
+            if (add_y < h) {                                                                    \
+                const T *p = src + (size_t)(add_y - job->src_y0) * row_size;                    \
+                for (size_t i = 0; i < row_size; i++) col_sum[i] += p[i];                       \
+            }                                                                                   \
+            if (sub_y >= 0) {                                                                   \
+                const T *p = src + (size_t)(sub_y - job->src_y0) * row_size;                    \
+                for (size_t i = 0; i < row_size; i++) col_sum[i] -= p[i];                       \
+            }                                                                                   \
+        }                                                                                       \
+        int y0 = (y - radius < 0) ? 0 : y - radius;                                             \
+        int y1 = (y + radius >= h) ? h - 1 : y + radius;                                        \
+        long long count_y = y1 - y0 + 1;                                                        \
+                                                                                                \
+        ACC sum[4] = {0};  /* up to RGBA */                                                     \
+        for (int xx = 0; xx <= radius && xx < w; xx++) {                                        \
+            for (int ch = 0; ch < c; ch++) sum[ch] += col_sum[xx * c + ch];                     \
+        }                                                                                       \
+                                                                                                \
+        T *q = (T *)out->data + (size_t)(y - job->dst_y0) * row_size;                           \
+        for (int x = 0; x < w; x++) {                                                           \
+            if (x > 0) {                                                                        \
+                /* Slide the horizontal window right by one column */                           \
+                int add_x = x + radius;                                                         \
+                int sub_x = x - radius - 1;                                                     \
+                if (add_x < w) {                                                                \
+                    for (int ch = 0; ch < c; ch++) sum[ch] += col_sum[add_x * c + ch];          \
+                }                                                                               \
+                if (sub_x >= 0) {                                                               \
+                    for (int ch = 0; ch < c; ch++) sum[ch] -= col_sum[sub_x * c + ch];          \
+                }                                                                               \
+            }                                                                                   \
+            int x0 = (x - radius < 0) ? 0 : x - radius;                                         \
+            int x1 = (x + radius >= w) ? w - 1 : x + radius;                                    \
+            long long count = count_y * (x1 - x0 + 1);                                          \
+            for (int ch = 0; ch < c; ch++) q[x * c + ch] = (T)(sum[ch] / count);                \
+        }                                                                                       \
+    }                                                                                           \
+                                                                                                \
+    free(col_sum);                                                                              \
+}
+
+DEFINE_BLUR_ROWS(blur_rows_u8, unsigned char, long long)
+DEFINE_BLUR_ROWS(blur_rows_u16, uint16_t, long long)
+DEFINE_BLUR_ROWS(blur_rows_f32, float, double)
+
+static void blur_rows(void *ctx, int y0, int y1) {
+    RowJob *job = ctx;
+    switch (job->src->type) {
+        case PIXEL_U16: blur_rows_u16(ctx, y0, y1); break;
+        case PIXEL_F32: blur_rows_f32(ctx, y0, y1); break;
+        default: blur_rows_u8(ctx, y0, y1); break;
+    }
+}
+
+/**
+ * @brief Box blur whose cost does not depend on the radius.
+ *
+ * Keeps a running vertical sum per column (one row enters, one row leaves
+ * as y advances) and slides a running horizontal sum across it. Each output
+ * pixel is the window total divided by the number of in-bounds pixels, so
+ * edges are normalised exactly as in the direct (2r+1)^2 formulation.
+ *
+ * @param img The source Image.
+ * @param radius Blur radius in pixels (>= 1).
+ * @return A new, blurred Image, or NULL on failure.
+ */
+Image *blur_image(Image *img, int radius) {
+    if (!img || !img->data || radius < 1) {
+        fprintf(stderr, "Error: Invalid blur parameters (img=%p, data=%p, radius=%d)\n",
+                (void*)img, img ? (void*)img->data : NULL, radius);
+        return NULL;
+    }
+    Image *out = malloc(sizeof(Image));
+    if (!out) {
+        fprintf(stderr, "Error: Memory allocation failed in blur_image\n");
+        return NULL;
+    }
+    out->width = img->width;
+    out->height = img->height;
+    out->channels = img->channels;
+    out->type = img->type;
+    out->refcount = 1;
+    out->data = malloc(image_data_size(out));
+    if (!out->data) {
+        fprintf(stderr, "Error: Memory allocation failed for blur data\n");
+        free(out);
+        return NULL;
+    }
+    RowJob job = { .src = img, .dst = out, .ival = radius };
+    parallel_for_rows(out->height, blur_rows, &job);
+    if (job.failed) {
+        fprintf(stderr, "Error: Memory allocation failed for blur column sums\n");
+        free(out->data);
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+// --- GAUSSIAN BLUR ---
+//
+// Small sigmas use a separable FIR kernel of radius ceil(3 sigma). Each band
+// streams its rows: the vertical taps accumulate straight from the source
+// samples into one float row, which is edge-padded and run through the
+// horizontal taps. Nothing image-sized is allocated and the inner loops are
+// the simd_madd kernels.
+//
+// Past GAUSSIAN_IIR_SIGMA the FIR cost grows linearly with sigma, so the
+// Young / van Vliet recursive filter takes over: a third-order causal plus
+// anticausal pass per axis, a fixed handful of multiply-adds per sample
+// whatever the sigma. Edges are replicated in both paths.
+
+#define GAUSSIAN_IIR_SIGMA 3.0f
+#define GAUSSIAN_IIR_COLS 64    // pixels per column strip in the vertical IIR pass
+#define GAUSSIAN_IIR_ROWS 16    // rows transposed together for the horizontal IIR pass
+
+// Row band worker for the FIR path of gaussian_image()
+static void gaussian_fir_rows(void *ctx, int y0, int y1) {
+    RowJob *job = ctx;
+    Image *img = job->src, *out = job->dst;
+    int w = img->width, h = img->height, r = job->ival, cn = img->channels;
+    size_t row_size = (size_t)w * cn, row_bytes = row_size * pixel_type_size(img->type);
+    const float *taps = job->taps;
+
+    float *vrow = malloc(((size_t)w + 2 * r) * cn * sizeof(float));
+    float *hrow = malloc(row_size * sizeof(float));
+    if (!vrow || !hrow) {
+        free(vrow);
+        free(hrow);
+        job->failed = 1;
+        return;
+    }
+    float *mid = vrow + (size_t)r * cn;
+
+    for (int y = y0; y < y1; y++) {
+        memset(mid, 0, row_size * sizeof(float));
+        for (int k = -r; k <= r; k++) {
+            int yy = y + k;
+            if (yy < 0) yy = 0;
+            if (yy >= h) yy = h - 1;
+            samples_madd_f32(mid, img->data + (size_t)yy * row_bytes, img->type, row_size, taps[k + r]);
+        }
+        for (int i = 0; i < r; i++) {
+            memcpy(vrow + (size_t)i * cn, mid, cn * sizeof(float));
+            memcpy(mid + row_size + (size_t)i * cn, mid + row_size - cn, cn * sizeof(float));
+        }
+
+        memset(hrow, 0, row_size * sizeof(float));
+        for (int k = 0; k <= 2 * r; k++) {
+            simd_madd_f32(hrow, vrow + (size_t)k * cn, row_size, taps[k]);
+        }
+        samples_from_f32(out->data + (size_t)y * row_bytes, out->type, hrow, row_size);
+    }
+    free(vrow);
+    free(hrow);
+}
+
+// Anticausal start state for the IIR path (Triggs & Sdika, 2006): given the
+// last three causal outputs u0, u1, u2 (newest first) and the edge input,
+// the first output v[0] plus the two virtual ones beyond the edge v[1], v[2]
+// that a replicated border would have produced.
+static void gaussian_iir_edge(const float *c, float edge, float u0, float u1, float u2, float v[3]) {
+    const float *m = c + 4;
+    u0 -= edge; u1 -= edge; u2 -= edge;
+    for (int k = 0; k < 3; k++) {
+        v[k] = edge + c[0] * (m[3 * k] * u0 + m[3 * k + 1] * u1 + m[3 * k + 2] * u2);
+    }
+}
+
+// Runs the causal and then the anticausal filter along 'len' lines of 'n'
+// floats spaced 'stride' apart, in place, filtering all n columns at once.
+// 'scratch' holds 3 * n floats.
+static void gaussian_iir_lines(float *base, size_t stride, int len, size_t n,
+                               const float *c, float *scratch) {
+    float *edge = scratch, *ext1 = scratch + n, *ext2 = ext1 + n;
+    float *last = base + (size_t)(len - 1) * stride;
+    memcpy(edge, last, n * sizeof(float));
+
+    // Lines before the first repeat it
+    for (int i = 1; i < len; i++) {
+        float *p1 = base + (size_t)(i - 1) * stride;
+        float *p2 = base + (size_t)(i >= 2 ? i - 2 : 0) * stride;
+        float *p3 = base + (size_t)(i >= 3 ? i - 3 : 0) * stride;
+        float *q = base + (size_t)i * stride;
+        simd_iir3_f32(q, q, p1, p2, p3, n, c);
+    }
+
+    const float *u1 = base + (size_t)(len > 1 ? len - 2 : 0) * stride;
+    const float *u2 = base + (size_t)(len > 2 ? len - 3 : 0) * stride;
+    for (size_t k = 0; k < n; k++) {
+        float e[3];
+        gaussian_iir_edge(c, edge[k], last[k], u1[k], u2[k], e);
+        last[k] = e[0];
+        ext1[k] = e[1];
+        ext2[k] = e[2];
+    }
+    for (int i = len - 2; i >= 0; i--) {
+        float *p1 = base + (size_t)(i + 1) * stride;
+        float *p2 = i + 2 < len ? base + (size_t)(i + 2) * stride : ext1;
+        float *p3 = i + 3 < len ? base + (size_t)(i + 3) * stride : (i + 3 == len ? ext1 : ext2);
+        float *q = base + (size_t)i * stride;
+        simd_iir3_f32(q, q, p1, p2, p3, n, c);
+    }
+}
+
+// Transposes nr rows of samples starting at p into the column-major block
+ALWAYS_INLINE void gaussian_iir_gather(float *block, const unsigned char *p, int w, int cn, int nr,
+                                       PixelType type) {
+    const size_t block_n = (size_t)GAUSSIAN_IIR_ROWS * cn;
+    size_t row_size = (size_t)w * cn;
+    for (int x = 0; x < w; x++) {
+        float *b = block + x * block_n;
+        for (int r = 0; r < nr; r++) {
+            size_t px = r * row_size + (size_t)x * cn;
+            for (int c = 0; c < cn; c++) b[r * cn + c] = sample_at(p, type, px + c);
+        }
+    }
+}
+
+// Row band worker for the IIR path, horizontal passes: samples in, floats
+// out to job->plane. GAUSSIAN_IIR_ROWS rows are transposed into a
+// column-major block so the recursion runs across all their samples at
+// once, exactly like the vertical pass.
+static void gaussian_iir_h_rows(void *ctx, int y0, int y1) {
+    RowJob *job = ctx;
+    int w = job->src->width, cn = job->src->channels;
+    size_t row_size = (size_t)w * cn;
+
+    const size_t block_n = (size_t)GAUSSIAN_IIR_ROWS * cn;
+    float *block = malloc(((size_t)w + 3) * block_n * sizeof(float));
+    if (!block) {
+        job->failed = 1;
+        return;
+    }
+    float *scratch = block + (size_t)w * block_n;
+
+    for (int y = y0; y < y1; y += GAUSSIAN_IIR_ROWS) {
+        int nr = y1 - y < GAUSSIAN_IIR_ROWS ? y1 - y : GAUSSIAN_IIR_ROWS;
+        const unsigned char *p = job->src->data + (size_t)y * row_size * pixel_type_size(job->src->type);
+        DISPATCH_PIXEL_TYPE(job->src->type, gaussian_iir_gather, block, p, w, cn, nr)
+        gaussian_iir_lines(block, block_n, w, (size_t)nr * cn, job->taps, scratch);
+        float *q = job->plane + (size_t)y * row_size;
+        for (int x = 0; x < w; x++) {
+            const float *b = block + x * block_n;
+            for (int r = 0; r < nr; r++) {
+                float *qx = q + r * row_size + x * cn;
+                for (int c = 0; c < cn; c++) qx[c] = b[r * cn + c];
+            }
+        }
+    }
+    free(block);
+}
+
+// Strip worker for the IIR path: vertical passes over columns
+// [s0, s1) * GAUSSIAN_IIR_COLS of job->plane, in place
+static void gaussian_iir_v_cols(void *ctx, int s0, int s1) {
+    RowJob *job = ctx;
+    int cn = job->src->channels;
+    size_t row_size = (size_t)job->src->width * cn;
+    size_t x0 = (size_t)s0 * GAUSSIAN_IIR_COLS * cn;
+    size_t x1 = (size_t)s1 * GAUSSIAN_IIR_COLS * cn;
+    if (x1 > row_size) x1 = row_size;
+
+    float *scratch = malloc((x1 - x0) * 3 * sizeof(float));
+    if (!scratch) {
+        job->failed = 1;
+        return;
+    }
+    gaussian_iir_lines(job->plane + x0, row_size, job->src->height, x1 - x0, job->taps, scratch);
+    free(scratch);
+}
+
+// Row band worker: stores job->plane as samples
+static void gaussian_store_rows(void *ctx, int y0, int y1) {
+    RowJob *job = ctx;
+    size_t row_size = (size_t)job->dst->width * job->dst->channels;
+    samples_from_f32(job->dst->data + (size_t)y0 * row_size * pixel_type_size(job->dst->type), job->dst->type,
+                     job->plane + (size_t)y0 * row_size, (size_t)(y1 - y0) * row_size);
+}
+
+// Young & van Vliet (1995) coefficients, folded so that one step is
+// v[n] = c0*in[n] + c1*v[n-1] + c2*v[n-2] + c3*v[n-3] with unit DC gain,
+// followed in c[4..12] by the Triggs & Sdika edge matrix.
+static void gaussian_iir_coeffs(float sigma, float c[13]) {
+    double q;
+    if (sigma >= 2.5f) q = 0.98711 * sigma - 0.96330;
+    else q = 3.97156 - 4.14554 * sqrt(1.0 - 0.26891 * sigma);
+    double q2 = q * q, q3 = q2 * q;
+    double b0 = 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+    double a1 = (2.44413 * q + 2.85619 * q2 + 1.26661 * q3) / b0;
+    double a2 = -(1.4281 * q2 + 1.26661 * q3) / b0;
+    double a3 = 0.422205 * q3 / b0;
+    c[0] = (float)(1.0 - (a1 + a2 + a3));
+    c[1] = (float)a1;
+    c[2] = (float)a2;
+    c[3] = (float)a3;
+
+    double s = 1.0 / ((1.0 + a1 - a2 + a3) * (1.0 - a1 - a2 - a3) * (1.0 + a2 + (a1 - a3) * a3));
+    double m[9] = {
+        s * (-a3 * a1 + 1.0 - a3 * a3 - a2),
+        s * (a3 + a1) * (a2 + a3 * a1),
+        s * a3 * (a1 + a3 * a2),
+        s * (a1 + a3 * a2),
+        -s * (a2 - 1.0) * (a2 + a3 * a1),
+        -s * a3 * (a3 * a1 + a3 * a3 + a2 - 1.0),
+        s * (a3 * a1 + a2 + a1 * a1 - a2 * a2),
+        s * (a1 * a2 + a3 * a2 * a2 - a1 * a3 * a3 - a3 * a3 * a3 - a3 * a2 + a3),
+        s * a3 * (a1 + a3 * a2),
+    };
+    for (int i = 0; i < 9; i++) c[4 + i] = (float)m[i];
+}
+
+/**
+ * @brief Applies a Gaussian blur with standard deviation 'sigma' (in pixels).
+ *
+ * Uses a separable FIR kernel up to GAUSSIAN_IIR_SIGMA and a recursive
+ * filter beyond it, whose cost does not depend on sigma.
+ *
+ * @param img The source image; every channel, alpha included, is blurred.
+ * @param sigma Standard deviation of the Gaussian, > 0.
+ * @return A new blurred image, or NULL on failure.
+ */
+Image *gaussian_image(Image *img, float sigma) {
+    if (!img || !img->data || !(sigma > 0.0f)) {
+        fprintf(stderr, "Error: Invalid gaussian parameters (img=%p, sigma=%g)\n",
+                (void*)img, sigma);
+        return NULL;
+    }
+    Image *out = malloc(sizeof(Image));
+    if (!out) {
+        fprintf(stderr, "Error: Memory allocation failed in gaussian_image\n");
+        return NULL;
+    }
+    out->width = img->width;
+    out->height = img->height;
+    out->channels = img->channels;
+    out->type = img->type;
+    out->refcount = 1;
+    size_t data_size = (size_t)img->width * img->height * out->channels;
+    out->data = malloc(image_data_size(out));
+    if (!out->data) {
+        fprintf(stderr, "Error: Memory allocation failed for gaussian data\n");
+        free(out);
+        return NULL;
+    }
+
+    RowJob job = { .src = img, .dst = out };
+    if (sigma <= GAUSSIAN_IIR_SIGMA) {
+        int r = (int)ceilf(3.0f * sigma);
+        float *taps = malloc((size_t)(2 * r + 1) * sizeof(float));
+        if (!taps) {
+            fprintf(stderr, "Error: Memory allocation failed for gaussian kernel\n");
+            free(out->data);
+            free(out);
+            return NULL;
+        }
+        float sum = 0.0f;
+        for (int k = -r; k <= r; k++) {
+            taps[k + r] = expf(-(float)(k * k) / (2.0f * sigma * sigma));
+            sum += taps[k + r];
+        }
+        for (int k = 0; k <= 2 * r; k++) taps[k] /= sum;
+
+        job.ival = r;
+        job.taps = taps;
+        parallel_for_rows(out->height, gaussian_fir_rows, &job);
+        free(taps);
+    } else {
+        float coeffs[13];
+        gaussian_iir_coeffs(sigma, coeffs);
+        job.taps = coeffs;
+        job.plane = malloc(data_size * sizeof(float));
+        if (!job.plane) {
+            fprintf(stderr, "Error: Memory allocation failed for gaussian plane\n");
+            free(out->data);
+            free(out);
+            return NULL;
+        }
+        int strips = (img->width + GAUSSIAN_IIR_COLS - 1) / GAUSSIAN_IIR_COLS;
+        parallel_for_rows(out->height, gaussian_iir_h_rows, &job);
+        parallel_for_rows(strips, gaussian_iir_v_cols, &job);
+        parallel_for_rows(out->height, gaussian_store_rows, &job);
+        free(job.plane);
+    }
+    if (job.failed) {
+        fprintf(stderr, "Error: Memory allocation failed for gaussian rows\n");
+        free(out->data);
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+/**
+ * @brief Drops one reference to an image, freeing it when the last owner lets go.
+ */
+void free_image(Image *img) {
+    if (!img) return;
+    if (--img->refcount > 0) return;
+    if (img->data && !raw_unmap(img->data)) stbi_image_free(img->data);
+    free(img);
+}
+
+/**
+ * @brief Adds a reference to an image so it can be shared without copying pixels.
+ *
+ * Every retain must be balanced by a free_image(). Shared images are treated
+ * as read-only: every operator writes its result to a new image.
+ *
+ * @param img The image to share.
+ * @return The same image, for convenience.
+ */
+Image *retain_image(Image *img) {
+    if (img) img->refcount++;
+    return img;
+}
+
+// Row band worker for grayscale_image()
+static void grayscale_rows(void *ctx, int y0, int y1) {
+    RowJob *job = ctx;
+    size_t w = job->src->width;
+    int cn = job->src->channels;
+    const unsigned char *src = job->src->data + y0 * w * cn;
+    unsigned char *dst = job->dst->data + y0 * w * cn;
+    size_t n = (size_t)(y1 - y0) * w;
+
+    if (cn == 3) {
+        // Integer luminance Y = (299*R + 587*G + 114*B) / 1000 written to R, G and B
+        simd_grayscale_rgb(src, dst, n);
+    } else if (cn == 1) {
+        memcpy(dst, src, n);
+    } else {
+        // RGBA: same luminance, alpha kept
+        for (size_t i = 0; i < n; i++, src += 4, dst += 4) {
+            unsigned char g = (299 * src[0] + 587 * src[1] + 114 * src[2]) / 1000;
+            dst[0] = dst[1] = dst[2] = g;
+            dst[3] = src[3];
+        }
+    }
+}
+
+Image *grayscale_image(Image *img) {
+    if (!img || !img->data) {
+        fprintf(stderr, "Error: Invalid image in grayscale_image\n");
+        return NULL;
+    }
+    if (img->type != PIXEL_U8) {
+        PointOp op = { POINT_GRAYSCALE, 0, 0, 0.0f };
+        return apply_point_ops(img, &op, 1);
+    }
+
+    // Allocate new image struct
+    Image *out = malloc(sizeof(Image));
+    if (!out) {
+        fprintf(stderr, "Error: Memory allocation failed in grayscale_image\n");
+        return NULL;
+    }
+    out->width = img->width;
+    out->height = img->height;
+    out->channels = img->channels; // Gray stays in every colour channel
+    out->type = PIXEL_U8;
+    out->refcount = 1;
+    size_t data_size = (size_t)img->width * img->height * img->channels;
+    out->data = malloc(data_size);
+    if (!out->data) {
+        fprintf(stderr, "Error: Memory allocation failed for grayscale data\n");
+        free(out);
+        return NULL;
+    }
+
+    RowJob job = { .src = img, .dst = out };
+    parallel_for_rows(img->height, grayscale_rows, &job);
+    return out;
+}
+
+// Row band worker for invert_image()
+static void invert_rows(void *ctx, int y0, int y1) {
+    RowJob *job = ctx;
+    size_t row_size = (size_t)job->src->width * job->src->channels;
+
+    // Process each byte (R, G, and B components)
+    simd_invert(job->src->data + y0 * row_size, job->dst->data + y0 * row_size,
+                (size_t)(y1 - y0) * row_size);
+}
+
+Image *invert_image(Image *img) {
+    if (!img || !img->data) {
+        fprintf(stderr, "Error: Invalid image in invert_image\n");
+        return NULL;
+    }
+    if (img->channels == 4 || img->type != PIXEL_U8) {
+        // Alpha must survive, which the table path already handles
+        PointOp op = { POINT_INVERT, 0, 0, 0.0f };
+        return apply_point_ops(img, &op, 1);
+    }
+
+    // Allocate new image struct
+    Image *out = malloc(sizeof(Image));
+    if (!out) {
+        fprintf(stderr, "Error: Memory allocation failed in invert_image\n");
+        return NULL;
+    }
+    out->width = img->width;
+    out->height = img->height;
+    out->channels = img->channels;
+    out->type = PIXEL_U8;
+    out->refcount = 1;
+    size_t data_size = (size_t)img->width * img->height * img->channels;
+    out->data = malloc(data_size);
+    if (!out->data) {
+        fprintf(stderr, "Error: Memory allocation failed for invert data\n");
+        free(out);
+        return NULL;
+    }
+
+    RowJob job = { .src = img, .dst = out };
+    parallel_for_rows(img->height, invert_rows, &job);
+    return out;
+}
+
+// --- CHANNELS ---
+//
+// Images keep the channel count they were loaded with: 1 (gray), 3 (RGB)
+// or 4 (RGBA, straight alpha). Spatial operators treat alpha like any other
+// channel; colour operators leave it alone. These convert between layouts
+// and between straight and premultiplied alpha.
+
+// Row band worker for convert_channels(); ival = output channel count
+static void convert_channels_rows(void *ctx, int y0, int y1) {
+    RowJob *job = ctx;
+    int sn = job->src->channels, dn = job->ival;
+    size_t w = job->src->width;
+    const unsigned char *p = job->src->data + (size_t)y0 * w * sn;
+    unsigned char *q = job->dst->data + (size_t)y0 * w * dn;
+
+    for (size_t i = 0; i < (size_t)(y1 - y0) * w; i++, p += sn, q += dn) {
+        if (sn == 1) {
+            q[0] = p[0];
+            if (dn > 1) q[1] = q[2] = p[0];
+        } else if (dn == 1) {
+            // Same integer luminance as grayscale_image()
+            q[0] = (299 * p[0] + 587 * p[1] + 114 * p[2]) / 1000;
+        } else {
+            q[0] = p[0];
+            q[1] = p[1];
+            q[2] = p[2];
+        }
+        if (dn == 4) q[3] = sn == 4 ? p[3] : 255;
+    }
+}
+
+ALWAYS_INLINE void convert_channels_deep_rows_t(RowJob *job, int y0, int y1, PixelType type) {
+    int sn = job->src->channels, dn = job->ival;
+    size_t w = job->src->width, ss = pixel_type_size(type);
+    const unsigned char *p = job->src->data + (size_t)y0 * w * sn * ss;
+    unsigned char *q = job->dst->data + (size_t)y0 * w * dn * ss;
+
+    for (size_t i = 0; i < (size_t)(y1 - y0) * w; i++, p += sn * ss, q += dn * ss) {
+        float v0 = sample_at(p, type, 0);
+        if (sn == 1) {
+            for (int c = 0; c < (dn > 1 ? 3 : 1); c++) sample_put(q, type, c, v0);
+        } else if (dn == 1) {
+            sample_put(q, type, 0, luma_of(v0, sample_at(p, type, 1), sample_at(p, type, 2), type));
+        } else {
+            for (int c = 0; c < 3; c++) sample_put(q, type, c, sample_at(p, type, c));
+        }
+        if (dn == 4) sample_put(q, type, 3, sn == 4 ? sample_at(p, type, 3) : pixel_type_max(type));
+    }
+}
+
+// convert_channels_rows() for 16-bit and float images
+static void convert_channels_deep_rows(void *ctx, int y0, int y1) {
+    RowJob *job = ctx;
+    if (job->src->type == PIXEL_U16) convert_channels_deep_rows_t(job, y0, y1, PIXEL_U16);
+    else convert_channels_deep_rows_t(job, y0, y1, PIXEL_F32);
+}
+
+/**
+ * @brief Converts an image to 1 (gray), 3 (RGB) or 4 (RGBA) channels.
+ *
+ * Colour to gray uses the luminance of grayscale_image(); gray to colour
+ * copies the value into R, G and B. Added alpha is opaque and dropped
+ * alpha is discarded without compositing.
+ *
+ * @param img The source image.
+ * @param channels 1, 3 or 4.
+ * @return A new Image (a new reference to img if nothing changes), or NULL
+ *         on failure.
+ */
+Image *convert_channels(Image *img, int channels) {
+    if (!img || !img->data) {
+        fprintf(stderr, "Error: Invalid image in convert_channels\n");
+        return NULL;
+    }
+    if (channels != 1 && channels != 3 && channels != 4) {
+        fprintf(stderr, "Error: Invalid channel count %d in convert_channels (1, 3 or 4)\n", channels);
+        return NULL;
+    }
+    if (channels == img->channels) return retain_image(img);
+
+    Image *out = malloc(sizeof(Image));
+    if (!out) {
+        fprintf(stderr, "Error: Memory allocation failed in convert_channels\n");
+        return NULL;
+    }
+    out->width = img->width;
+    out->height = img->height;
+    out->channels = channels;
+    out->type = img->type;
+    out->refcount = 1;
+    out->data = malloc(image_data_size(out));
+    if (!out->data) {
+        fprintf(stderr, "Error: Memory allocation failed for convert_channels data\n");
+        free(out);
+        return NULL;
+    }
+
+    RowJob job = { .src = img, .dst = out, .ival = channels };
+    parallel_for_rows(img->height, img->type == PIXEL_U8 ? convert_channels_rows : convert_channels_deep_rows, &job);
+    return out;
+}
+
+// Row band worker for premultiply_image(); ival = 1 to multiply, 0 to divide
+static void premultiply_rows(void *ctx, int y0, int y1) {
+    RowJob *job = ctx;
+    size_t w = job->src->width;
+    const unsigned char *p = job->src->data + (size_t)y0 * w * 4;
+    unsigned char *q = job->dst->data + (size_t)y0 * w * 4;
+
+    for (size_t i = 0; i < (size_t)(y1 - y0) * w; i++, p += 4, q += 4) {
+        unsigned a = p[3];
+        for (int c = 0; c < 3; c++) {
+            if (job->ival) {
+                q[c] = (unsigned char)((p[c] * a + 127) / 255);
+            } else {
+                unsigned v = a ? (p[c] * 255 + a / 2) / a : 0;
+                q[c] = (unsigned char)(v > 255 ? 255 : v);
+            }
+        }
+        q[3] = (unsigned char)a;
+    }
+}
+
+// premultiply_rows() for 16-bit and float images; float colour is not
+// clamped when dividing
+ALWAYS_INLINE void premultiply_deep_rows_t(RowJob *job, int y0, int y1, PixelType type) {
+    size_t w = job->src->width, ss = pixel_type_size(type);
+    const unsigned char *p = job->src->data + (size_t)y0 * w * 4 * ss;
+    unsigned char *q = job->dst->data + (size_t)y0 * w * 4 * ss;
+    float m = pixel_type_max(type);
+
+    for (size_t i = 0; i < (size_t)(y1 - y0) * w * 4; i += 4) {
+        float a = sample_at(p, type, i + 3);
+        for (int c = 0; c < 3; c++) {
+            double v = sample_at(p, type, i + c);
+            v = job->ival ? v * a / m : a > 0.0f ? v * m / a : 0.0;
+            sample_put(q, type, i + c, (float)v);
+        }
+        sample_put(q, type, i + 3, a);
+    }
+}
+
+static void premultiply_deep_rows(void *ctx, int y0, int y1) {
+    RowJob *job = ctx;
+    if (job->src->type == PIXEL_U16) premultiply_deep_rows_t(job, y0, y1, PIXEL_U16);
+    else premultiply_deep_rows_t(job, y0, y1, PIXEL_F32);
+}
+
+static Image *premultiply_apply(Image *img, int multiply, const char *name) {
+    if (!img || !img->data) {
+        fprintf(stderr, "Error: Invalid image in %s\n", name);
+        return NULL;
+    }
+    // Without alpha every pixel is opaque, so there is nothing to scale
+    if (img->channels != 4) return retain_image(img);
+
+    Image *out = malloc(sizeof(Image));
+    if (!out) {
+        fprintf(stderr, "Error: Memory allocation failed in %s\n", name);
+        return NULL;
+    }
+    out->width = img->width;
+    out->height = img->height;
+    out->channels = 4;
+    out->type = img->type;
+    out->refcount = 1;
+    out->data = malloc(image_data_size(out));
+    if (!out->data) {
+        fprintf(stderr, "Error: Memory allocation failed for %s data\n", name);
+        free(out);
+        return NULL;
+    }
+
+    RowJob job = { .src = img, .dst = out, .ival = multiply };
+    parallel_for_rows(img->height, img->type == PIXEL_U8 ? premultiply_rows : premultiply_deep_rows, &job);
+    return out;
+}
+
+/**
+ * @brief Multiplies the colour channels of an RGBA image by its alpha.
+ *
+ * Filtering premultiplied pixels (blur, resize, warp ...) keeps colour
+ * from transparent pixels out of the result. Images without alpha are
+ * returned unchanged.
+ *
+ * @param img The source image, straight alpha.
+ * @return A new, premultiplied Image, or NULL on failure.
+ */
+Image *premultiply_image(Image *img) {
+    return premultiply_apply(img, 1, "premultiply_image");
+}
+
+/**
+ * @brief Undoes premultiply_image(); fully transparent pixels become black.
+ *
+ * @param img The source image, premultiplied alpha.
+ * @return A new, straight-alpha Image, or NULL on failure.
+ */
+Image *unpremultiply_image(Image *img) {
+    return premultiply_apply(img, 0, "unpremultiply_image");
+}
+
+// --- END CHANNELS ---
+
+Image *flip_image_along_X(Image *img) {
+    if (!img || !img->data) {
+        fprintf(stderr, "Error: Invalid image in flip_image_vertical\n");
+        return NULL;
+    }
+    return orient_image(img, ORIENT_FLIP_V);
+}
+
+Image *flip_image_along_Y(Image *img) {
+    if (!img || !img->data) {
+        fprintf(stderr, "Error: Invalid image in flip_image_horizontal\n");
+        return NULL;
+    }
+    return orient_image(img, ORIENT_FLIP_H);
+}
+
+// Edge maps are 8-bit whatever the source: 16-bit and float images are
+// converted first, which also puts the thresholds on their usual 0-255 scale
+Image* run_canny(Image *img, float sigma, unsigned char low_thresh, unsigned char high_thresh){
+    if (img && img->data && img->type != PIXEL_U8) {
+        Image *src = convert_pixel_type(img, PIXEL_U8);
+        if (!src) return NULL;
+        Image *out = canny_edge_detector(src, sigma, low_thresh, high_thresh);
+        free_image(src);
+        return out;
+    }
+    return canny_edge_detector(img, sigma, low_thresh, high_thresh);
+}
+
+Image *adjust_brightness(Image *img, int bias, int direction) {
+    if (!img || !img->data) {
+        fprintf(stderr, "Error: Invalid image in adjust_brightness\n");
+        return NULL;
+    }
+
+    // Determine the actual value to add (-bias or +bias)
+    int final_bias = (direction == 1) ? bias : -bias;
+
+    PointOp op = { POINT_BRIGHTNESS, final_bias, 0, 0.0f };
+    if (img->type != PIXEL_U8) return apply_point_ops(img, &op, 1);
+    unsigned char lut[256];
+    lut_identity(lut);
+    lut_apply_op(lut, &op);
+    return apply_lut(img, lut);
+}
+
+
+/**
+ * @brief Adjusts the contrast of an image.
+ *
+ * Implements contrast adjustment using the formula:
+ * New = Factor * (Old - 128) + 128
+ * The factor is derived from the amount and direction.
+ *
+ * @param img The source Image.
+ * @param amount The amount to adjust (0-100).
+ * @param direction 1 to increase contrast, 0 to reduce contrast.
+ * @return A new, contrast-adjusted Image, or NULL on failure.
+ */
+
+Image *adjust_contrast(Image *img, int amount, int direction) {
+    if (!img || !img->data) {
+        fprintf(stderr, "Error: Invalid image in adjust_contrast\n");
+        return NULL;
+    }
+    
+    if (amount < 0) amount = 0;
+    if (amount > 100) amount = 100;
+
+    // Calculate the contrast factor
+    float factor;
+    if (direction == 1) {
+        factor = 1.0f + (float)amount / 100.0f;
+    } else {
+        factor = 1.0f - (float)amount / 100.0f;
+    }
+
+    PointOp op = { POINT_CONTRAST, 0, 0, factor };
+    if (img->type != PIXEL_U8) return apply_point_ops(img, &op, 1);
+    unsigned char lut[256];
+    lut_identity(lut);
+    lut_apply_op(lut, &op);
+    return apply_lut(img, lut);
+}
+
+/**
+ * @brief Applies a binary threshold to an image.
+ *
+ * Each pixel's grayscale luminance is compared against the
+ * threshold, and all channels are set to 0 (black) or 255 (white)
+ * based on the result and direction.
+ *
+ * @param img The source Image.
+ * @param threshold The threshold value (0-255).
+ * @param direction 1: (val > thresh) ? 255 : 0.  0: (val > thresh) ? 0 : 255.
+ * @return A new, binary Image with the source's channel count (alpha kept),
+ *         or NULL on failure.
+ */
+Image *apply_threshold(Image *img, int threshold, int direction) {
+    if (!img || !img->data) {
+        fprintf(stderr, "Error: Invalid image in apply_threshold\n");
+        return NULL;
+    }
+
+    if (threshold < 0) threshold = 0;
+    if (threshold > 255) threshold = 255;
+
+    PointOp op = { POINT_THRESHOLD, threshold, direction, 0.0f };
+    return apply_point_ops(img, &op, 1);
+}
+
+// convolve_rows() for 16-bit and float images
+ALWAYS_INLINE void convolve_deep_rows_t(RowJob *job, int y0, int y1, PixelType type) {
+    const unsigned char *src = job->src->data;
+    unsigned char *dst = job->dst->data;
+    float (*kernel)[3] = job->kernel;
+    int w = job->src->width, h = job->src->height, c = job->src->channels;
+
+    for (int y = y0; y < y1; y++) {
+        for (int x = 0; x < w; x++) {
+            float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+            // for borders
+            if (y == 0 || y == h - 1 || x == 0 || x == w - 1) {
+                size_t p = ((size_t)(y - job->src_y0) * w + x) * c;
+                for (int ch = 0; ch < c; ch++) sum[ch] = sample_at(src, type, p + ch);
+            } else {
+                // Apply 3x3 kernel
+                for (int ky = -1; ky <= 1; ky++) {
+                    for (int kx = -1; kx <= 1; kx++) {
+                        size_t p = ((size_t)(y + ky - job->src_y0) * w + (x + kx)) * c;
+                        float kval = kernel[ky + 1][kx + 1];
+                        for (int ch = 0; ch < c; ch++) sum[ch] += sample_at(src, type, p + ch) * kval;
+                    }
+                }
+            }
+            size_t q = ((size_t)(y - job->dst_y0) * w + x) * c;
+            for (int ch = 0; ch < c; ch++) sample_put(dst, type, q + ch, sum[ch]);
+        }
+    }
+}
+
+// Row band worker for convolve_image()
+static void convolve_rows(void *ctx, int y0, int y1) {
+    RowJob *job = ctx;
+    Image *img = job->src, *out = job->dst;
+    float (*kernel)[3] = job->kernel;
+    int w = img->width, h = img->height, c = img->channels;
+
+    if (img->type == PIXEL_U16) {
+        convolve_deep_rows_t(job, y0, y1, PIXEL_U16);
+        return;
+    }
+    if (img->type == PIXEL_F32) {
+        convolve_deep_rows_t(job, y0, y1, PIXEL_F32);
+        return;
+    }
+
+    for (int y = y0; y < y1; y++) {
+        for (int x = 0; x < w; x++) {
+            float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+            // for borders
+            if (y == 0 || y == h - 1 || x == 0 || x == w - 1) {
+                unsigned char *p = img->data + ((size_t)(y - job->src_y0) * w + x) * c;
+                for (int ch = 0; ch < c; ch++) sum[ch] = p[ch];
+            } else {
+                // Apply 3x3 kernel
+                for (int ky = -1; ky <= 1; ky++) {
+                    for (int kx = -1; kx <= 1; kx++) {
+                        unsigned char *p = img->data + ((size_t)(y + ky - job->src_y0) * w + (x + kx)) * c;
+                        float kval = kernel[ky + 1][kx + 1];
+                        for (int ch = 0; ch < c; ch++) sum[ch] += p[ch] * kval;
+                    }
+                }
+            }
+            unsigned char *q = out->data + ((size_t)(y - job->dst_y0) * w + x) * c;
+            for (int ch = 0; ch < c; ch++) q[ch] = clamp_pixel(sum[ch]);
+        }
+    }
+}
+
+/**
+ * @brief Applies a 3x3 convolution kernel to an image.
+ *
+ * @param img The source Image.
+ * @param kernel A 3x3 float kernel.
+ * @return A new, convolved Image, or NULL on failure.
+ */
+Image *convolve_image(Image *img, float kernel[3][3]) {
+    if (!img || !img->data) {
+        fprintf(stderr, "Error: Invalid image in convolve_image\n");
+        return NULL;
+    }
+
+    Image *out = malloc(sizeof(Image));
+    if (!out) {
+        fprintf(stderr, "Error: Memory allocation failed in convolve_image\n");
+        return NULL;
+    }
+    out->width = img->width;
+    out->height = img->height;
+    out->channels = img->channels;
+    out->type = img->type;
+    out->refcount = 1;
+    out->data = malloc(image_data_size(out));
+    if (!out->data) {
+        fprintf(stderr, "Error: Memory allocation failed for convolve_image data\n");
+        free(out);
+        return NULL;
+    }
+
+    RowJob job = { .src = img, .dst = out, .kernel = kernel };
+    parallel_for_rows(img->height, convolve_rows, &job);
+    return out;
+}
+
+// --- GENERAL CONVOLUTION ---
+//
+// convolve_kernel() takes any kw x kh kernel and a border mode. Rank-1
+// kernels (box, Gaussian, binomial, Sobel ...) are split into a column and
+// a row vector and run as two 1-D passes, kh + kw multiply-adds per sample
+// instead of kh * kw. Either way a band builds each output row in a float
+// accumulator from edge-padded float copies of the source rows, so every
+// inner loop is a simd_madd kernel over a whole row.
+
+typedef struct {
+    Image *src, *dst;
+    const float *kernel;        // kh rows of kw weights
+    const float *col, *row;     // rank-1 factors (separable path)
+    int kw, kh;
+    BorderMode border;
+    int failed;
+} ConvJob;
+
+// Maps coordinate i into [0, n) according to 'border'; -1 means "zero"
+static int border_index(int i, int n, BorderMode border) {
+    if (i >= 0 && i < n) return i;
+    switch (border) {
+        case BORDER_CLAMP:
+            return i < 0 ? 0 : n - 1;
+        case BORDER_MIRROR: {
+            int period = 2 * n;
+            i %= period;
+            if (i < 0) i += period;
+            return i < n ? i : period - 1 - i;
+        }
+        case BORDER_WRAP:
+            i %= n;
+            return i < 0 ? i + n : i;
+        default:
+            return -1;
+    }
+}
+
+// Fills the pixels left and right of a float row of w cn-channel pixels at
+// 'mid' (cx to the left, kw - 1 - cx to the right) according to 'border'
+static void conv_pad_pixel(float *mid, int x, int w, int cn, BorderMode border) {
+    int sx = border_index(x, w, border);
+    if (sx < 0) memset(mid + x * cn, 0, cn * sizeof(float));
+    else memcpy(mid + x * cn, mid + sx * cn, cn * sizeof(float));
+}
+
+static void conv_pad_row(float *mid, int w, int cn, int cx, int kw, BorderMode border) {
+    for (int x = -cx; x < 0; x++) conv_pad_pixel(mid, x, w, cn, border);
+    for (int x = w; x < w + kw - 1 - cx; x++) conv_pad_pixel(mid, x, w, cn, border);
+}
+
+// Row band worker for convolve_kernel(): rank-1 kernels, vertical pass
+// straight from the source samples, then horizontal over the padded result
+static void conv_separable_rows(void *ctx, int y0, int y1) {
+    ConvJob *job = ctx;
+    Image *img = job->src;
+    int w = img->width, h = img->height, kw = job->kw, kh = job->kh;
+    int cx = kw / 2, cy = kh / 2, cn = img->channels;
+    size_t row_size = (size_t)w * cn, row_bytes = row_size * pixel_type_size(img->type);
+
+    float *padded = malloc(((size_t)w + kw - 1) * cn * sizeof(float));
+    float *acc = malloc(row_size * sizeof(float));
+    if (!padded || !acc) {
+        free(padded);
+        free(acc);
+        job->failed = 1;
+        return;
+    }
+    float *mid = padded + (size_t)cx * cn;
+
+    for (int y = y0; y < y1; y++) {
+        memset(mid, 0, row_size * sizeof(float));
+        for (int i = 0; i < kh; i++) {
+            int sy = border_index(y + i - cy, h, job->border);
+            if (sy < 0 || job->col[i] == 0.0f) continue;
+            samples_madd_f32(mid, img->data + (size_t)sy * row_bytes, img->type, row_size, job->col[i]);
+        }
+        conv_pad_row(mid, w, cn, cx, kw, job->border);
+
+        memset(acc, 0, row_size * sizeof(float));
+        for (int j = 0; j < kw; j++) {
+            if (job->row[j] == 0.0f) continue;
+            simd_madd_f32(acc, padded + (size_t)j * cn, row_size, job->row[j]);
+        }
+        samples_from_f32(job->dst->data + (size_t)y * row_bytes, img->type, acc, row_size);
+    }
+    free(padded);
+    free(acc);
+}
+
+// Row band worker for convolve_kernel(): full kernels, one padded source
+// row per kernel row
+static void conv_full_rows(void *ctx, int y0, int y1) {
+    ConvJob *job = ctx;
+    Image *img = job->src;
+    int w = img->width, h = img->height, kw = job->kw, kh = job->kh;
+    int cx = kw / 2, cy = kh / 2, cn = img->channels;
+    size_t row_size = (size_t)w * cn, row_bytes = row_size * pixel_type_size(img->type);
+
+    float *padded = malloc(((size_t)w + kw - 1) * cn * sizeof(float));
+    float *acc = malloc(row_size * sizeof(float));
+    if (!padded || !acc) {
+        free(padded);
+        free(acc);
+        job->failed = 1;
+        return;
+    }
+    float *mid = padded + (size_t)cx * cn;
+
+    for (int y = y0; y < y1; y++) {
+        memset(acc, 0, row_size * sizeof(float));
+        for (int i = 0; i < kh; i++) {
+            int sy = border_index(y + i - cy, h, job->border);
+            if (sy < 0) continue;
+            const float *krow = job->kernel + (size_t)i * kw;
+            memset(mid, 0, row_size * sizeof(float));
+            samples_madd_f32(mid, img->data + (size_t)sy * row_bytes, img->type, row_size, 1.0f);
+            conv_pad_row(mid, w, cn, cx, kw, job->border);
+            for (int j = 0; j < kw; j++) {
+                if (krow[j] == 0.0f) continue;
+                simd_madd_f32(acc, padded + (size_t)j * cn, row_size, krow[j]);
+            }
+        }
+        samples_from_f32(job->dst->data + (size_t)y * row_bytes, img->type, acc, row_size);
+    }
+    free(padded);
+    free(acc);
+}
+
+// Writes col (kh) and row (kw) with col[i] * row[j] == kernel[i][j] when the
+// kernel has rank 1 (to float rounding). Returns 0 otherwise.
+static int conv_separate(const float *kernel, int kw, int kh, float *col, float *row) {
+    int pi = 0, pj = 0;
+    float peak = 0.0f;
+    for (int i = 0; i < kh; i++) {
+        for (int j = 0; j < kw; j++) {
+            float a = fabsf(kernel[i * kw + j]);
+            if (a > peak) {
+                peak = a;
+                pi = i;
+                pj = j;
+            }
+        }
+    }
+    float pivot = kernel[pi * kw + pj];
+    for (int i = 0; i < kh; i++) col[i] = kernel[i * kw + pj];
+    for (int j = 0; j < kw; j++) row[j] = pivot != 0.0f ? kernel[pi * kw + j] / pivot : 0.0f;
+
+    float tol = 1e-5f * peak;
+    for (int i = 0; i < kh; i++) {
+        for (int j = 0; j < kw; j++) {
+            if (fabsf(col[i] * row[j] - kernel[i * kw + j]) > tol) return 0;
+        }
+    }
+    return 1;
+}
+
+// --- FFT CONVOLUTION ---
+//
+// Spatial cost grows with the kernel area (or its width plus height when
+// separable); a transform costs about log(N * M) per sample whatever the
+// kernel. Above the crossover the image, extended by the border mode, and
+// the kernel are zero-padded to N x M >= (h + kh - 1) x (w + kw - 1), so the
+// circular correlation equals the linear one, and multiplied as spectra.
+// The kernel is real, so two channels ride in one complex plane (R + iG,
+// then B) and come back apart in the real and imaginary parts.
+
+#define FFT_COL_BLOCK 16        // columns gathered together for the column pass
+#define FFT_COST_SCALE 20.0     // measured: spatial multiply-adds per sample that cost
+                                // as much as N*M*log2(N*M) / (w*h) in the FFT path
+
+typedef struct {
+    ConvJob *conv;
+    FftComplex *plane;          // N rows of M values
+    FftComplex *kspec;          // kernel spectrum, same layout
+    const FftPlan *row_plan, *col_plan;
+    int n, m;
+    int inverse;
+    int pass;                   // 0: channels 0 + 1, 1: channel 2
+    const int *xmap;            // padded column -> source column (-1 = zero)
+    int failed;
+} FftJob;
+
+// Picks the frequency domain when it should beat the spatial loops
+static int conv_prefers_fft(int w, int h, int kw, int kh, int separable) {
+    double spatial = separable ? kw + kh : (double)kw * kh;
+    double nm = (double)fft_good_size(w + kw - 1) * fft_good_size(h + kh - 1);
+    double fft = FFT_COST_SCALE * nm * log2(nm) / ((double)w * h);
+    return spatial > fft;
+}
+
+// Row band worker: 1-D transforms of rows [y0, y1)
+static void fft_rows(void *ctx, int y0, int y1) {
+    FftJob *job = ctx;
+    FftComplex *tmp = malloc((size_t)job->m * sizeof(FftComplex));
+    if (!tmp) {
+        job->failed = 1;
+        return;
+    }
+    for (int y = y0; y < y1; y++) {
+        FftComplex *row = job->plane + (size_t)y * job->m;
+        int ok = job->inverse ? fft_inverse(job->row_plan, row, 1, tmp)
+                              : fft_forward(job->row_plan, row, 1, tmp);
+        if (!ok) {
+            job->failed = 1;
+            break;
+        }
+        memcpy(row, tmp, (size_t)job->m * sizeof(FftComplex));
+    }
+    free(tmp);
+}
+
+// Block worker: 1-D transforms of columns [b0, b1) * FFT_COL_BLOCK. Columns
+// are gathered a block at a time so every cache line read is used.
+static void fft_cols(void *ctx, int b0, int b1) {
+    FftJob *job = ctx;
+    int n = job->n, m = job->m;
+    FftComplex *gather = malloc((size_t)(FFT_COL_BLOCK + 1) * n * sizeof(FftComplex));
+    if (!gather) {
+        job->failed = 1;
+        return;
+    }
+    FftComplex *tmp = gather + (size_t)FFT_COL_BLOCK * n;
+
+    for (int b = b0; b < b1; b++) {
+        int x0 = b * FFT_COL_BLOCK;
+        int nc = m - x0 < FFT_COL_BLOCK ? m - x0 : FFT_COL_BLOCK;
+        for (int y = 0; y < n; y++) {
+            const FftComplex *src = job->plane + (size_t)y * m + x0;
+            for (int c = 0; c < nc; c++) gather[(size_t)c * n + y] = src[c];
+        }
+        for (int c = 0; c < nc; c++) {
+            FftComplex *col = gather + (size_t)c * n;
+            int ok = job->inverse ? fft_inverse(job->col_plan, col, 1, tmp)
+                                  : fft_forward(job->col_plan, col, 1, tmp);
+            if (!ok) {
+                job->failed = 1;
+                free(gather);
+                return;
+            }
+            memcpy(col, tmp, (size_t)n * sizeof(FftComplex));
+        }
+        for (int y = 0; y < n; y++) {
+            FftComplex *dst = job->plane + (size_t)y * m + x0;
+            for (int c = 0; c < nc; c++) dst[c] = gather[(size_t)c * n + y];
+        }
+    }
+    free(gather);
+}
+
+// 2-D transform of job->plane. Forward: only the first 'rows' rows are
+// non-zero, so the row pass skips the rest. Inverse: columns first, then
+// only the first 'rows' rows are needed.
+static void fft_2d(FftJob *job, FftComplex *plane, int inverse, int rows) {
+    job->plane = plane;
+    job->inverse = inverse;
+    int blocks = (job->m + FFT_COL_BLOCK - 1) / FFT_COL_BLOCK;
+    if (!inverse) parallel_for_rows(rows, fft_rows, job);
+    parallel_for_rows(blocks, fft_cols, job);
+    if (inverse) parallel_for_rows(rows, fft_rows, job);
+}
+
+// Row band worker: writes the border-extended source channels of this pass
+// into the plane, zero beyond the (h + kh - 1) x (w + kw - 1) area
+static void fft_fill_rows(void *ctx, int y0, int y1) {
+    FftJob *job = ctx;
+    ConvJob *conv = job->conv;
+    Image *img = conv->src;
+    int w = img->width, h = img->height;
+    int padded_w = w + conv->kw - 1, padded_h = h + conv->kh - 1;
+    int cn = img->channels, ch = job->pass * 2;
+    int pair = ch + 1 < cn;
+
+    for (int y = y0; y < y1; y++) {
+        FftComplex *row = job->plane + (size_t)y * job->m;
+        memset(row, 0, (size_t)job->m * sizeof(FftComplex));
+        int sy = y < padded_h ? border_index(y - conv->kh / 2, h, conv->border) : -1;
+        if (sy < 0) continue;
+        const unsigned char *p = img->data + (size_t)sy * w * cn * pixel_type_size(img->type);
+        for (int x = 0; x < padded_w; x++) {
+            int sx = job->xmap[x];
+            if (sx < 0) continue;
+            row[x].re = sample_at(p, img->type, (size_t)sx * cn + ch);
+            if (pair) row[x].im = sample_at(p, img->type, (size_t)sx * cn + ch + 1);
+        }
+    }
+}
+
+// Row band worker: plane *= conj(kernel spectrum), which turns the
+// product's inverse into a correlation
+static void fft_multiply_rows(void *ctx, int y0, int y1) {
+    FftJob *job = ctx;
+    size_t i0 = (size_t)y0 * job->m, i1 = (size_t)y1 * job->m;
+    for (size_t i = i0; i < i1; i++) {
+        FftComplex a = job->plane[i], k = job->kspec[i];
+        job->plane[i].re = a.re * k.re + a.im * k.im;
+        job->plane[i].im = a.im * k.re - a.re * k.im;
+    }
+}
+
+// Row band worker: scales the inverse transform back and stores this
+// pass's channels
+static void fft_store_rows(void *ctx, int y0, int y1) {
+    FftJob *job = ctx;
+    Image *out = job->conv->dst;
+    int w = out->width;
+    float scale = 1.0f / ((float)job->n * job->m);
+    int cn = out->channels, ch = job->pass * 2;
+    int pair = ch + 1 < cn;
+
+    for (int y = y0; y < y1; y++) {
+        const FftComplex *row = job->plane + (size_t)y * job->m;
+        unsigned char *q = out->data + (size_t)y * w * cn * pixel_type_size(out->type);
+        for (int x = 0; x < w; x++) {
+            sample_put(q, out->type, (size_t)x * cn + ch, row[x].re * scale);
+            if (pair) sample_put(q, out->type, (size_t)x * cn + ch + 1, row[x].im * scale);
+        }
+    }
+}
+
+// Frequency-domain path of convolve_kernel(). Returns 0 if it runs out of
+// memory, so the caller can fall back to the spatial loops.
+static int convolve_fft(ConvJob *conv) {
+    Image *img = conv->src;
+    int w = img->width, h = img->height, kw = conv->kw, kh = conv->kh;
+    FftJob job = { .conv = conv };
+    job.m = fft_good_size(w + kw - 1);
+    job.n = fft_good_size(h + kh - 1);
+    job.row_plan = fft_plan(job.m);
+    job.col_plan = fft_plan(job.n);
+    size_t count = (size_t)job.n * job.m;
+
+    job.kspec = calloc(count, sizeof(FftComplex));
+    FftComplex *plane = malloc(count * sizeof(FftComplex));
+    int *xmap = malloc((size_t)(w + kw - 1) * sizeof(int));
+    if (!job.row_plan || !job.col_plan || !job.kspec || !plane || !xmap) {
+        fft_plan_release(job.row_plan);
+        fft_plan_release(job.col_plan);
+        free(job.kspec);
+        free(plane);
+        free(xmap);
+        return 0;
+    }
+    for (int x = 0; x < w + kw - 1; x++) xmap[x] = border_index(x - kw / 2, w, conv->border);
+    job.xmap = xmap;
+
+    for (int i = 0; i < kh; i++) {
+        for (int j = 0; j < kw; j++) job.kspec[(size_t)i * job.m + j].re = conv->kernel[i * kw + j];
+    }
+    fft_2d(&job, job.kspec, 0, kh);
+
+    // Two channels per pass, packed as the real and imaginary parts
+    int passes = (img->channels + 1) / 2;
+    for (job.pass = 0; job.pass < passes && !job.failed; job.pass++) {
+        job.plane = plane;
+        parallel_for_rows(job.n, fft_fill_rows, &job);
+        fft_2d(&job, plane, 0, h + kh - 1);
+        parallel_for_rows(job.n, fft_multiply_rows, &job);
+        fft_2d(&job, plane, 1, h);
+        parallel_for_rows(h, fft_store_rows, &job);
+    }
+    fft_plan_release(job.row_plan);
+    fft_plan_release(job.col_plan);
+    free(job.kspec);
+    free(plane);
+    free(xmap);
+    return !job.failed;
+}
+
+/**
+ * @brief Convolves an image with an arbitrary kw x kh kernel.
+ *
+ * The kernel is applied as a correlation (not flipped), anchored at
+ * (kw / 2, kh / 2), to each channel. Samples outside the image come from
+ * 'border'. Integer results are rounded and clamped. Large kernels are
+ * applied through FFTs when that is estimated to be cheaper.
+ *
+ * @param img The source image.
+ * @param kernel kh rows of kw weights.
+ * @param kw Kernel width, >= 1.
+ * @param kh Kernel height, >= 1.
+ * @param border How to extend the image past its edges.
+ * @return A new, convolved Image, or NULL on failure.
+ */
+Image *convolve_kernel(Image *img, const float *kernel, int kw, int kh, BorderMode border) {
+    if (!img || !img->data || !kernel || kw < 1 || kh < 1) {
+        fprintf(stderr, "Error: Invalid convolve_kernel parameters (img=%p, kernel=%dx%d)\n",
+                (void*)img, kw, kh);
+        return NULL;
+    }
+
+    Image *out = malloc(sizeof(Image));
+    if (!out) {
+        fprintf(stderr, "Error: Memory allocation failed in convolve_kernel\n");
         return NULL;
     }
-    // Force 3 channels (RGB) to ensure color
-    img->data = stbi_load(filename, &img->width, &img->height, &img->channels, 3);
-    if (!img->data) {
-        fprintf(stderr, "Error: Failed to load image %s\n", filename);
-        free(img);
+    out->width = img->width;
+    out->height = img->height;
+    out->channels = img->channels;
+    out->type = img->type;
+    out->refcount = 1;
+    out->data = malloc(image_data_size(out));
+    float *factors = malloc(((size_t)kw + kh) * sizeof(float));
+    if (!out->data || !factors) {
+        fprintf(stderr, "Error: Memory allocation failed for convolve_kernel data\n");
+        free(factors);
+        free(out->data);
+        free(out);
         return NULL;
     }
-    img->channels = 3; // Explicitly set to RGB
-    return img;
+
+    ConvJob job = { .src = img, .dst = out, .kernel = kernel, .kw = kw, .kh = kh, .border = border };
+    int separable = kw > 1 && kh > 1 && conv_separate(kernel, kw, kh, factors, factors + kh);
+    if (conv_prefers_fft(img->width, img->height, kw, kh, separable) && convolve_fft(&job)) {
+        // done in the frequency domain
+    } else if (separable) {
+        job.col = factors;
+        job.row = factors + kh;
+        parallel_for_rows(out->height, conv_separable_rows, &job);
+    } else {
+        parallel_for_rows(out->height, conv_full_rows, &job);
+    }
+    free(factors);
+    if (job.failed) {
+        fprintf(stderr, "Error: Memory allocation failed for convolve_kernel rows\n");
+        free(out->data);
+        free(out);
+        return NULL;
+    }
+    return out;
 }
 
-void save_image(const char *filename, Image *img) {
-    if (!filename || !img || !img->data) {
-        fprintf(stderr, "Error: Invalid save_image parameters (filename=%p, img=%p, data=%p)\n",
-                (void*)filename, (void*)img, img ? (void*)img->data : NULL);
+// 3x3 sharpen kernel whose strength is amount / 10
+static void sharpen_kernel(float kernel[3][3], int amount) {
+    float k = (float)amount / 10.0f;
+    kernel[0][0] = 0.0f; kernel[0][1] = -k;               kernel[0][2] = 0.0f;
+    kernel[1][0] = -k;   kernel[1][1] = 1.0f + 4.0f * k;  kernel[1][2] = -k;
+    kernel[2][0] = 0.0f; kernel[2][1] = -k;               kernel[2][2] = 0.0f;
+}
+
+/**
+ * @brief Sharpens or softens an image.
+ *
+ * direction = 1 (Sharpen): Applies a 3x3 sharpen kernel. 'amount' controls
+ * the strength (recommended 1-10).
+ * direction = 0 (Soften):  Applies a box blur. 'amount' is used as the
+ * blur radius.
+ *
+ * @param img The source Image.
+ * @param amount The strength (for sharpen) or radius (for soften).
+ * @param direction 1 to sharpen, 0 to soften/blur.
+ * @return A new, processed Image, or NULL on failure.
+ */
+Image *sharpen_image(Image *img, int amount, int direction) {
+    if (!img || !img->data) {
+        fprintf(stderr, "Error: Invalid image in sharpen_image\n");
+        return NULL;
+    }
+
+    if (direction == 0) {
+        if (amount < 1) amount = 1; 
+        return blur_image(img, amount);
+    }
+
+    float kernel[3][3];
+    sharpen_kernel(kernel, amount);
+    return convolve_image(img, kernel);
+}
+
+
+ALWAYS_INLINE void blend_deep_rows_t(RowJob *job, int y0, int y1, PixelType type) {
+    size_t row_size = (size_t)job->dst->width * job->dst->channels;
+    size_t offset = (size_t)y0 * row_size * pixel_type_size(type);
+    const unsigned char *a = job->src->data + offset, *b = job->src2->data + offset;
+    unsigned char *q = job->dst->data + offset;
+    float alpha = job->fval, alpha_neg = 1.0f - alpha;
+    for (size_t i = 0; i < (size_t)(y1 - y0) * row_size; i++) {
+        sample_put(q, type, i, sample_at(a, type, i) * alpha_neg + sample_at(b, type, i) * alpha);
+    }
+}
+
+// Row band worker for blend_images()
+static void blend_rows(void *ctx, int y0, int y1) {
+    RowJob *job = ctx;
+    size_t row_size = (size_t)job->dst->width * job->dst->channels;
+    size_t offset = y0 * row_size;
+
+    if (job->dst->type == PIXEL_U16) {
+        blend_deep_rows_t(job, y0, y1, PIXEL_U16);
+        return;
+    }
+    if (job->dst->type == PIXEL_F32) {
+        blend_deep_rows_t(job, y0, y1, PIXEL_F32);
         return;
     }
-    // Explicitly use 3 channels for PNG
-    stbi_write_png(filename, img->width, img->height, 3, img->data, img->width * 3);
+
+    // Apply blend formula to each component
+    simd_blend(job->src->data + offset, job->src2->data + offset, job->dst->data + offset,
+               (size_t)(y1 - y0) * row_size, job->fval);
 }
 
-Image *crop_image(Image *img, int x, int y, int w, int h) {
-    if (!img || !img->data || w <= 0 || h <= 0 || x < 0 || y < 0) {
-        fprintf(stderr, "Error: Invalid crop parameters (img=%p, data=%p, x=%d, y=%d, w=%d, h=%d)\n",
-                (void*)img, img ? (void*)img->data : NULL, x, y, w, h);
+/**
+ * @brief Blends two images together using a specified alpha.
+ *
+ * The images must have the same dimensions, channel count and sample type.
+ * The blend formula is: out = img1 * (1.0 - alpha) + img2 * alpha
+ *
+ * @param img1 The first source Image (visible at alpha=0.0).
+ * @param img2 The second source Image (visible at alpha=1.0).
+ * @param alpha The blend factor (0.0 to 1.0).
+ * @return A new, blended Image, or NULL on failure.
+ */
+Image *blend_images(Image *img1, Image *img2, float alpha) {
+    if (!img1 || !img1->data || !img2 || !img2->data) {
+        fprintf(stderr, "Error: Invalid image(s) in blend_images\n");
         return NULL;
     }
-    if (x + w > img->width || y + h > img->height) {
-        fprintf(stderr, "Error: Crop out of bounds (img: %dx%d, crop: x=%d, y=%d, w=%d, h=%d)\n",
-                img->width, img->height, x, y, w, h);
+
+    if (img1->width != img2->width || img1->height != img2->height) {
+        fprintf(stderr, "Error: Image dimensions must match in blend_images (%dx%d vs %dx%d)\n",
+                img1->width, img1->height, img2->width, img2->height);
+        return NULL;
+    }
+    if (img1->channels != img2->channels) {
+        fprintf(stderr, "Error: Channel counts must match in blend_images (%d vs %d)\n",
+                img1->channels, img2->channels);
         return NULL;
     }
+    if (img1->type != img2->type) {
+        fprintf(stderr, "Error: Pixel types must match in blend_images\n");
+        return NULL;
+    }
+
+    // Clamp alpha
+    if (alpha < 0.0f) alpha = 0.0f;
+    if (alpha > 1.0f) alpha = 1.0f;
+
     Image *out = malloc(sizeof(Image));
     if (!out) {
-        fprintf(stderr, "Error: Memory allocation failed in crop_image\n");
+        fprintf(stderr, "Error: Memory allocation failed in blend_images\n");
         return NULL;
     }
-    out->width = w;
-    out->height = h;
-    out->channels = 3;  // Force RGB
-    size_t row_size = w * out->channels;
-    out->data = malloc(h * row_size);
+    out->width = img1->width;
+    out->height = img1->height;
+    out->channels = img1->channels;
+    out->type = img1->type;
+    out->refcount = 1;
+    out->data = malloc(image_data_size(out));
     if (!out->data) {
-        fprintf(stderr, "Error: Memory allocation failed for crop data\n");
+        fprintf(stderr, "Error: Memory allocation failed for blend_images data\n");
         free(out);
         return NULL;
     }
-    // Initialize output to zero to avoid garbage
-    memset(out->data, 0, h * row_size);
-    for (int i = 0; i < h; i++) {
-        size_t src_offset = ((y + i) * img->width + x) * img->channels;
-        size_t dst_offset = i * row_size;
-        memcpy(out->data + dst_offset, img->data + src_offset, row_size);
-    }
+
+    RowJob job = { .src = img1, .src2 = img2, .dst = out, .fval = alpha };
+    parallel_for_rows(out->height, blend_rows, &job);
+
     return out;
 }
 
-// Simple box blur
-Image *blur_image(Image *img, int radius) {
-    if (!img || !img->data || radius < 1) {
-        fprintf(stderr, "Error: Invalid blur parameters (img=%p, data=%p, radius=%d)\n",
-                (void*)img, img ? (void*)img->data : NULL, radius);
+
+// mask_rows() for 16-bit and float images or masks; 'mtype' is the mask's
+// sample type, the image's pixels are copied as bytes
+ALWAYS_INLINE void mask_deep_rows_t(RowJob *job, int y0, int y1, PixelType mtype) {
+    unsigned char *s_data = job->src->data;
+    unsigned char *m_data = job->src2->data;
+    unsigned char *d_data = job->dst->data;
+    size_t w = job->dst->width;
+    size_t psize = pixel_size(job->dst);
+    int mcn = job->src2->channels;
+
+    for (size_t i = y0 * w; i < y1 * w; i++) {
+        unsigned char *s_ptr = s_data + i * psize;
+        unsigned char *d_ptr = d_data + i * psize;
+
+        if (sample_at(m_data, mtype, i * mcn) > 0.0f) {
+            memcpy(d_ptr, s_ptr, psize);
+        } else {
+            memset(d_ptr, 0, psize);
+        }
+    }
+}
+
+// Row band worker for mask_image()
+static void mask_rows(void *ctx, int y0, int y1) {
+    RowJob *job = ctx;
+    unsigned char *s_data = job->src->data;
+    unsigned char *m_data = job->src2->data;
+    unsigned char *d_data = job->dst->data;
+    size_t w = job->dst->width;
+    int cn = job->dst->channels, mcn = job->src2->channels;
+
+    if (job->src->type != PIXEL_U8 || job->src2->type != PIXEL_U8) {
+        DISPATCH_PIXEL_TYPE(job->src2->type, mask_deep_rows_t, job, y0, y1)
+        return;
+    }
+
+    for (size_t i = y0 * w; i < y1 * w; i++) {
+        unsigned char *s_ptr = s_data + i * cn;
+        unsigned char *m_ptr = m_data + i * mcn;
+        unsigned char *d_ptr = d_data + i * cn;
+
+        if (m_ptr[0] > 0) {
+            memcpy(d_ptr, s_ptr, cn);
+        } else {
+            memset(d_ptr, 0, cn);
+        }
+    }
+}
+
+/**
+ * @brief Applies a binary mask to an image.
+ *
+ * The images must have the same dimensions.
+ * The output pixel will be:
+ * - Copied from img if the corresponding mask pixel is "on" (non-black).
+ * - Black if the corresponding mask pixel is "off" (black).
+ *
+ * @param img The source Image to be masked.
+ * @param mask The binary mask Image (grayscale, 0 or white, any channel
+ *             count or sample type; its first channel decides). Masked-out
+ *             pixels are cleared in every channel, alpha included.
+ * @return A new, masked Image, or NULL on failure.
+ */
+Image *mask_image(Image *img, Image *mask) {
+    if (!img || !img->data || !mask || !mask->data) {
+        fprintf(stderr, "Error: Invalid image(s) in mask_image\n");
+        return NULL;
+    }
+
+    if (img->width != mask->width || img->height != mask->height) {
+        fprintf(stderr, "Error: Image dimensions must match in mask_image (%dx%d vs %dx%d)\n",
+                img->width, img->height, mask->width, mask->height);
         return NULL;
     }
+
     Image *out = malloc(sizeof(Image));
     if (!out) {
-        fprintf(stderr, "Error: Memory allocation failed in blur_image\n");
+        fprintf(stderr, "Error: Memory allocation failed in mask_image\n");
         return NULL;
     }
     out->width = img->width;
     out->height = img->height;
-    out->channels = 3;  // Force RGB
-    size_t data_size = img->width * img->height * out->channels;
-    out->data = malloc(data_size);
+    out->channels = img->channels;
+    out->type = img->type;
+    out->refcount = 1;
+    out->data = malloc(image_data_size(out));
     if (!out->data) {
-        fprintf(stderr, "Error: Memory allocation failed for blur data\n");
+        fprintf(stderr, "Error: Memory allocation failed for mask_image data\n");
         free(out);
         return NULL;
     }
-    int w = img->width, h = img->height, c = out->channels;
-    for (int y = 0; y < h; y++) {
-        for (int x = 0; x < w; x++) {
-            long long sum[3] = {0};  // long long for overflow, 3 for RGB
-            int count = 0;
-            for (int dy = -radius; dy <= radius; dy++) {
-                int yy = y + dy;
-                if (yy < 0 || yy >= h) continue;
-                for (int dx = -radius; dx <= radius; dx++) {
-                    int xx = x + dx;
-                    if (xx < 0 || xx >= w) continue;
-                    unsigned char *p = img->data + (yy * w + xx) * c;
-                    for (int ch = 0; ch < c; ch++) sum[ch] += p[ch];
-                    count++;
+
+    RowJob job = { .src = img, .src2 = mask, .dst = out };
+    parallel_for_rows(out->height, mask_rows, &job);
+
+    return out;
+}
+
+// --- RESAMPLING ---
+//
+// resize_image() is separable: a horizontal pass from the source into an
+// intermediate image of new width and source height, then a vertical pass
+// into the result. Each pass uses a weight table built once per resize:
+// every output column (or row) reads a fixed number of consecutive source
+// pixels, starting at start[i], with int16 weights in SIMD_RESAMPLE_BITS
+// fixed point. When downscaling the filter is stretched by the scale
+// factor so every source pixel contributes, which is what keeps thumbnails
+// from aliasing. 16-bit and float images take the same tables in float
+// arithmetic, with a float intermediate so only the result is rounded.
+
+// Row band worker for resize_image_nearest()
+static void resize_nearest_rows(void *ctx, int y0, int y1) {
+    RowJob *job = ctx;
+    int old_w = job->src->width;
+    int new_w = job->dst->width;
+    unsigned char *s_data = job->src->data;
+    unsigned char *d_data = job->dst->data;
+    float x_ratio = job->x_ratio;
+    float y_ratio = job->y_ratio;
+    size_t psize = pixel_size(job->dst);
+
+    for (int y = y0; y < y1; y++) {
+        for (int x = 0; x < new_w; x++) {
+            int src_x = (int)(x * x_ratio);
+            int src_y = (int)(y * y_ratio);
+
+            unsigned char *src_pixel = s_data + ((size_t)src_y * old_w + src_x) * psize;
+            unsigned char *dst_pixel = d_data + ((size_t)y * new_w + x) * psize;
+
+            copy_pixel(dst_pixel, src_pixel, psize);
+        }
+    }
+}
+
+/**
+ * @brief Resizes an image using the nearest-neighbor algorithm.
+ *
+ * @param img The source Image to resize.
+ * @param new_w The target width.
+ * @param new_h The target height.
+ * @return A new, resized Image, or NULL on failure.
+ */
+Image *resize_image_nearest(Image *img, int new_w, int new_h) {
+    if (!img || !img->data || new_w <= 0 || new_h <= 0) {
+        fprintf(stderr, "Error: Invalid parameters in resize_image_nearest (img=%p, data=%p, w=%d, h=%d)\n",
+                (void*)img, img ? (void*)img->data : NULL, new_w, new_h);
+        return NULL;
+    }
+
+    Image *out = malloc(sizeof(Image));
+    if (!out) {
+        fprintf(stderr, "Error: Memory allocation failed in resize_image_nearest\n");
+        return NULL;
+    }
+    out->width = new_w;
+    out->height = new_h;
+    out->channels = img->channels;
+    out->type = img->type;
+    out->refcount = 1;
+    out->data = malloc(image_data_size(out));
+    if (!out->data) {
+        fprintf(stderr, "Error: Memory allocation failed for resize_image_nearest data\n");
+        free(out);
+        return NULL;
+    }
+
+    RowJob job = { .src = img, .dst = out };
+    job.x_ratio = img->width / (float)new_w;
+    job.y_ratio = img->height / (float)new_h;
+    parallel_for_rows(new_h, resize_nearest_rows, &job);
+
+    return out;
+}
+
+// From the pyramid code after scale_image_factor()
+#define PYRAMID_MAX_LEVELS 16
+static Image *shrink_pow2(Image *img, int levels);
+
+typedef struct {
+    int taps;           // source pixels read per output pixel
+    int *start;         // first source pixel for each output pixel
+    int16_t *w;         // taps weights per output pixel
+} ResampleTable;
+
+typedef struct {
+    Image *src;
+    Image *dst;
+    unsigned char *mid; // horizontal pass output / vertical pass input
+    PixelType mid_type;
+    int row0;           // source row held by the first row of 'mid'
+    ResampleTable h, v;
+} ResampleJob;
+
+// Catmull-Rom (a = -0.5) cubic convolution weight at distance d
+static double cubic_weight(double d) {
+    const double a = -0.5;
+    d = fabs(d);
+    if (d <= 1.0) return ((a + 2.0) * d - (a + 3.0)) * d * d + 1.0;
+    if (d < 2.0) return ((a * d - 5.0 * a) * d + 8.0 * a) * d - 4.0 * a;
+    return 0.0;
+}
+
+static double sinc(double x) {
+    if (x == 0.0) return 1.0;
+    x *= M_PI;
+    return sin(x) / x;
+}
+
+// Filter support radius in source pixels at scale 1
+static double resample_support(Interp filter) {
+    switch (filter) {
+        case INTERP_BOX:      return 0.5;
+        case INTERP_BILINEAR: return 1.0;
+        case INTERP_BICUBIC:  return 2.0;
+        case INTERP_LANCZOS3: return 3.0;
+        default:              return 0.0;
+    }
+}
+
+static double resample_weight(Interp filter, double x) {
+    switch (filter) {
+        case INTERP_BOX:      return x > -0.5 && x <= 0.5 ? 1.0 : 0.0;
+        case INTERP_BILINEAR: return fabs(x) < 1.0 ? 1.0 - fabs(x) : 0.0;
+        case INTERP_BICUBIC:  return cubic_weight(x);
+        case INTERP_LANCZOS3: return fabs(x) < 3.0 ? sinc(x) * sinc(x / 3.0) : 0.0;
+        default:              return 0.0;
+    }
+}
+
+static void resample_table_free(ResampleTable *t) {
+    free(t->start);
+    free(t->w);
+    t->start = NULL;
+    t->w = NULL;
+}
+
+// Builds the table mapping 'in' source pixels onto 'out' output pixels.
+// Windows near the end are moved left so all 'taps' reads stay inside the
+// source, with zero weights over the extra pixels. The weights are
+// quantised as differences of the rounded running sum, so each output
+// pixel's weights sum to exactly 1 << SIMD_RESAMPLE_BITS (flat areas stay
+// flat however many taps there are) and no tap is off by more than one
+// unit, even at large reductions. Returns 0 if out of memory.
+static int resample_table(ResampleTable *t, int in, int out, Interp filter) {
+    double scale = (double)in / out;
+    double fscale = scale > 1.0 ? scale : 1.0;
+    double support = resample_support(filter) * fscale;
+    int taps = (int)ceil(support) * 2 + 1;
+    if (taps > in) taps = in;
+
+    t->taps = taps;
+    t->start = malloc((size_t)out * sizeof(int));
+    t->w = calloc((size_t)out * taps, sizeof(int16_t));
+    double *ws = malloc((size_t)taps * sizeof(double));
+    if (!t->start || !t->w || !ws) {
+        resample_table_free(t);
+        free(ws);
+        return 0;
+    }
+
+    for (int i = 0; i < out; i++) {
+        double center = (i + 0.5) * scale;
+        int x0 = (int)(center - support + 0.5);
+        int x1 = (int)(center + support + 0.5);
+        if (x0 < 0) x0 = 0;
+        if (x1 > in) x1 = in;
+        if (x1 - x0 > taps) x1 = x0 + taps;
+
+        double total = 0.0;
+        for (int x = x0; x < x1; x++) {
+            ws[x - x0] = resample_weight(filter, (x - center + 0.5) / fscale);
+            total += ws[x - x0];
+        }
+
+        // Quantise the running sum rather than each weight, so rounding
+        // error never builds up past one unit on any tap
+        int start = x0 + taps > in ? in - taps : x0;
+        int16_t *w = t->w + (size_t)i * taps + (x0 - start);
+        double running = 0.0;
+        long prev = 0;
+        for (int k = 0; k < x1 - x0; k++) {
+            running += ws[k];
+            long q = k == x1 - x0 - 1 ? 1 << SIMD_RESAMPLE_BITS
+                   : lround(total != 0.0 ? running / total * (1 << SIMD_RESAMPLE_BITS) : 0.0);
+            w[k] = (int16_t)(q - prev);
+            prev = q;
+        }
+        t->start[i] = start;
+    }
+    free(ws);
+    return 1;
+}
+
+// Horizontal pass for 16-bit and float sources
+static void resample_h_rows_deep(ResampleJob *job, int y0, int y1) {
+    int in_w = job->src->width, out_w = job->dst->width, cn = job->src->channels;
+    PixelType type = job->src->type;
+    int taps = job->h.taps;
+    const float unit = 1.0f / (1 << SIMD_RESAMPLE_BITS);
+    for (int y = y0; y < y1; y++) {
+        size_t src_row = (size_t)(job->row0 + y) * in_w * cn;
+        size_t mid_row = (size_t)y * out_w * cn;
+        for (int x = 0; x < out_w; x++) {
+            const int16_t *w = job->h.w + (size_t)x * taps;
+            size_t s = src_row + (size_t)job->h.start[x] * cn;
+            for (int c = 0; c < cn; c++) {
+                float acc = 0.0f;
+                for (int k = 0; k < taps; k++) {
+                    acc += w[k] * sample_at(job->src->data, type, s + (size_t)k * cn + c);
                 }
+                sample_put(job->mid, job->mid_type, mid_row + (size_t)x * cn + c, acc * unit);
             }
-            unsigned char *q = out->data + (y * w + x) * c;
-            for (int ch = 0; ch < c; ch++) q[ch] = (unsigned char)(sum[ch] / count);
         }
     }
-    return out;
 }
 
-void free_image(Image *img) {
-    if (!img) return;
-    if (img->data) stbi_image_free(img->data);
-    free(img);
+// Vertical pass for 16-bit and float results
+static void resample_v_rows_deep(ResampleJob *job, int y0, int y1) {
+    size_t stride = (size_t)job->dst->width * job->dst->channels;
+    int taps = job->v.taps;
+    const float unit = 1.0f / (1 << SIMD_RESAMPLE_BITS);
+    for (int y = y0; y < y1; y++) {
+        const int16_t *w = job->v.w + (size_t)y * taps;
+        size_t m = (size_t)(job->v.start[y] - job->row0) * stride;
+        for (size_t i = 0; i < stride; i++) {
+            float acc = 0.0f;
+            for (int k = 0; k < taps; k++) {
+                acc += w[k] * sample_at(job->mid, job->mid_type, m + (size_t)k * stride + i);
+            }
+            sample_put(job->dst->data, job->dst->type, (size_t)y * stride + i, acc * unit);
+        }
+    }
 }
 
-Image *grayscale_image(Image *img) {
-    if (!img || !img->data) {
-        fprintf(stderr, "Error: Invalid image in grayscale_image\n");
-        return NULL;
+// Row band worker for the horizontal pass; rows are source rows counted
+// from job->row0
+static void resample_h_rows(void *ctx, int y0, int y1) {
+    ResampleJob *job = ctx;
+    int in_w = job->src->width, out_w = job->dst->width, cn = job->src->channels;
+    if (job->src->type != PIXEL_U8) {
+        resample_h_rows_deep(job, y0, y1);
+        return;
     }
+    for (int y = y0; y < y1; y++) {
+        simd_resample_horiz(job->mid + (size_t)y * out_w * cn,
+                            job->src->data + (size_t)(job->row0 + y) * in_w * cn,
+                            job->h.start, job->h.w, job->h.taps, (size_t)out_w, cn);
+    }
+}
 
-    // Allocate new image struct
-    Image *out = malloc(sizeof(Image));
-    if (!out) {
-        fprintf(stderr, "Error: Memory allocation failed in grayscale_image\n");
+// Row band worker for the vertical pass
+static void resample_v_rows(void *ctx, int y0, int y1) {
+    ResampleJob *job = ctx;
+    size_t stride = (size_t)job->dst->width * job->dst->channels;
+    if (job->dst->type != PIXEL_U8) {
+        resample_v_rows_deep(job, y0, y1);
+        return;
+    }
+    for (int y = y0; y < y1; y++) {
+        simd_resample_vert(job->dst->data + y * stride,
+                           job->mid + (size_t)(job->v.start[y] - job->row0) * stride, stride,
+                           job->v.w + (size_t)y * job->v.taps, job->v.taps, stride);
+    }
+}
+
+/**
+ * @brief Resizes an image with a separable resampling filter.
+ *
+ * INTERP_NEAREST goes to resize_image_nearest(). The other filters are
+ * area-aware: when shrinking, each output pixel averages the whole
+ * footprint it covers. A dimension that does not change skips its pass,
+ * and a box shrink by exactly a power of two in both directions runs as
+ * repeated 2x2 averages instead.
+ *
+ * @param img The source image.
+ * @param new_w The target width.
+ * @param new_h The target height.
+ * @param filter INTERP_NEAREST, INTERP_BOX, INTERP_BILINEAR, INTERP_BICUBIC or INTERP_LANCZOS3.
+ * @return A new, resized Image, or NULL on failure.
+ */
+Image *resize_image(Image *img, int new_w, int new_h, Interp filter) {
+    if (!img || !img->data || new_w <= 0 || new_h <= 0) {
+        fprintf(stderr, "Error: Invalid parameters in resize_image (img=%p, w=%d, h=%d)\n",
+                (void*)img, new_w, new_h);
         return NULL;
     }
-    out->width = img->width;
-    out->height = img->height;
-    out->channels = 3; // Keep 3 channels
-    size_t data_size = img->width * img->height * 3;
-    out->data = malloc(data_size);
-    if (!out->data) {
-        fprintf(stderr, "Error: Memory allocation failed for grayscale data\n");
-        free(out);
+    if (filter == INTERP_NEAREST) return resize_image_nearest(img, new_w, new_h);
+    if (filter < INTERP_NEAREST || filter > INTERP_LANCZOS3) {
+        fprintf(stderr, "Error: Invalid filter %d in resize_image\n", (int)filter);
         return NULL;
     }
 
-    // Process each pixel
-    for (int y = 0; y < img->height; y++) {
-        for (int x = 0; x < img->width; x++) {
-            // Get pointers to source and destination pixels
-            unsigned char *p = img->data + (y * img->width + x) * 3;
-            unsigned char *q = out->data + (y * img->width + x) * 3;
-
-            // Use integer math for luminance calculation (avoids floats)
-            // Y = (299*R + 587*G + 114*B) / 1000
-            int r = p[0];
-            int g = p[1];
-            int b = p[2];
-            unsigned char gray = (unsigned char)((299 * r + 587 * g + 114 * b) / 1000);
-
-            // Set R, G, and B to the same grayscale value
-            q[0] = gray;
-            q[1] = gray;
-            q[2] = gray;
+    // Exact power-of-two box shrinks are repeated 2x2 averages
+    if (filter == INTERP_BOX) {
+        int k = 0;
+        while (k < PYRAMID_MAX_LEVELS && ((int64_t)new_w << k) < img->width) k++;
+        if (k > 0 && ((int64_t)new_w << k) == img->width && ((int64_t)new_h << k) == img->height) {
+            return shrink_pow2(img, k);
         }
     }
-    return out;
-}
-
-Image *invert_image(Image *img) {
-    if (!img || !img->data) {
-        fprintf(stderr, "Error: Invalid image in invert_image\n");
-        return NULL;
-    }
 
-    // Allocate new image struct
     Image *out = malloc(sizeof(Image));
     if (!out) {
-        fprintf(stderr, "Error: Memory allocation failed in invert_image\n");
+        fprintf(stderr, "Error: Memory allocation failed in resize_image\n");
         return NULL;
     }
-    out->width = img->width;
-    out->height = img->height;
-    out->channels = 3;
-    size_t data_size = img->width * img->height * 3;
-    out->data = malloc(data_size);
+    out->width = new_w;
+    out->height = new_h;
+    out->channels = img->channels;
+    out->type = img->type;
+    out->refcount = 1;
+    out->data = malloc(image_data_size(out));
     if (!out->data) {
-        fprintf(stderr, "Error: Memory allocation failed for invert data\n");
+        fprintf(stderr, "Error: Memory allocation failed for resize_image data\n");
         free(out);
         return NULL;
     }
 
-    // Process each byte (R, G, and B components)
-    for (size_t i = 0; i < data_size; i++) {
-        out->data[i] = 255 - img->data[i];
+    int do_h = new_w != img->width, do_v = new_h != img->height;
+    ResampleJob job = { .src = img, .dst = out, .mid_type = img->type };
+    int ok = (!do_h || resample_table(&job.h, img->width, new_w, filter)) &&
+             (!do_v || resample_table(&job.v, img->height, new_h, filter));
+
+    // The horizontal pass only needs the source rows the vertical pass reads
+    unsigned char *tmp = NULL;
+    int tmp_h = img->height;
+    if (ok && do_h && do_v) {
+        job.row0 = job.v.start[0];
+        tmp_h = job.v.start[new_h - 1] + job.v.taps - job.row0;
+        if (img->type != PIXEL_U8) job.mid_type = PIXEL_F32;
+        tmp = malloc((size_t)new_w * tmp_h * out->channels * pixel_type_size(job.mid_type));
+        ok = tmp != NULL;
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: Memory allocation failed for resize_image tables\n");
+        resample_table_free(&job.h);
+        resample_table_free(&job.v);
+        free(out->data);
+        free(out);
+        return NULL;
     }
+
+    job.mid = tmp ? tmp : do_h ? out->data : img->data;
+    if (do_h) parallel_for_rows(tmp_h, resample_h_rows, &job);
+    if (do_v) parallel_for_rows(new_h, resample_v_rows, &job);
+    if (!do_h && !do_v) memcpy(out->data, img->data, image_data_size(out));
+
+    free(tmp);
+    resample_table_free(&job.h);
+    resample_table_free(&job.v);
     return out;
 }
 
-Image *flip_image_along_X(Image *img) {
-    if (!img || !img->data) {
-        fprintf(stderr, "Error: Invalid image in flip_image_vertical\n");
+/**
+ * @brief Scales both dimensions of an image by the same factor.
+ *
+ * @param img The source image.
+ * @param factor Scale factor, > 0.
+ * @param filter Resampling filter, as for resize_image().
+ * @return A new, scaled Image, or NULL on failure.
+ */
+Image *scale_image_factor(Image *img, float factor, Interp filter) {
+    if (!img || !img->data || factor <= 0.0f) {
+        fprintf(stderr, "Error: Invalid parameters for scale\n");
         return NULL;
     }
+    
+    int w_out = (int)(img->width * factor);
+    int h_out = (int)(img->height * factor);
+    
+    if (w_out <= 0 || h_out <= 0) {
+         fprintf(stderr, "Error: Scale factor results in zero or negative size\n");
+         return NULL;
+    }
+    
+    return resize_image(img, w_out, h_out, filter);
+}
 
-    // Allocate new image struct
-    Image *out = malloc(sizeof(Image));
-    if (!out) {
-        fprintf(stderr, "Error: Memory allocation failed in flip_image_vertical\n");
-        return NULL;
+// --- PYRAMIDS ---
+//
+// pyramid_build() makes successive 2x2-average halvings in one pass over
+// the source. The level-1 rows are cut into bands of 2^(n-1) rows; a band
+// halves its source rows and, as soon as two rows of a level are done,
+// makes the row of the next level they cover, so every row is read again
+// while it is still in cache. Bands are independent and run on the thread
+// pool. Deep pyramids restart every PYRAMID_BAND_LEVELS levels from the
+// last level built, which keeps bands short enough to share out.
+
+#define PYRAMID_BAND_LEVELS 5
+
+typedef struct {
+    int levels;                                 // levels made by this pass
+    int cn;                                     // channels per pixel
+    PixelType type;
+    unsigned char *data[PYRAMID_BAND_LEVELS + 1];   // [0] is the input level
+    size_t stride[PYRAMID_BAND_LEVELS + 1];     // in bytes
+    int w[PYRAMID_BAND_LEVELS + 1], h[PYRAMID_BAND_LEVELS + 1];
+} PyramidJob;
+
+static inline int halved(int n) {
+    return n > 1 ? n / 2 : 1;
+}
+
+// simd_halve() for 16-bit and float rows
+static void halve_deep(unsigned char *dst, const unsigned char *row0, const unsigned char *row1,
+                       size_t src_w, int cn, PixelType type) {
+    size_t n = src_w > 1 ? src_w / 2 : 1;
+    for (size_t i = 0; i < n; i++) {
+        size_t a = 2 * i * cn, b = (2 * i + 1 < src_w ? 2 * i + 1 : src_w - 1) * cn;
+        for (int c = 0; c < cn; c++) {
+            float sum = sample_at(row0, type, a + c) + sample_at(row0, type, b + c) +
+                        sample_at(row1, type, a + c) + sample_at(row1, type, b + c);
+            sample_put(dst, type, i * cn + c, sum * 0.25f);
+        }
     }
-    out->width = img->width;
-    out->height = img->height;
-    out->channels = 3;
-    size_t row_size = (size_t)img->width * 3; // Size of one row in bytes
-    out->data = malloc(img->height * row_size);
-    if (!out->data) {
-        fprintf(stderr, "Error: Memory allocation failed for flip data\n");
-        free(out);
-        return NULL;
+}
+
+// Band worker for pyramid_build(); b0..b1 are band indices
+static void pyramid_rows(void *ctx, int b0, int b1) {
+    PyramidJob *job = ctx;
+    int band = 1 << (job->levels - 1);
+
+    for (int b = b0; b < b1; b++) {
+        int end = (b + 1) * band < job->h[1] ? (b + 1) * band : job->h[1];
+        for (int j = b * band; j < end; j++) {
+            // Make row j of level 1, then carry on up while it completes a pair
+            int k = 1, row = j;
+            for (;;) {
+                const unsigned char *top = job->data[k - 1] + (size_t)2 * row * job->stride[k - 1];
+                const unsigned char *bottom = 2 * row + 1 < job->h[k - 1] ? top + job->stride[k - 1] : top;
+                unsigned char *dst = job->data[k] + (size_t)row * job->stride[k];
+                if (job->type == PIXEL_U8) {
+                    simd_halve(dst, top, bottom, (size_t)job->w[k - 1], job->cn);
+                } else {
+                    halve_deep(dst, top, bottom, (size_t)job->w[k - 1], job->cn, job->type);
+                }
+                if (k == job->levels || !((row & 1) || job->h[k] == 1)) break;
+                row >>= 1;
+                k++;
+            }
+        }
     }
+}
 
-    // Copy rows from source to destination in reverse order
-    for (int y = 0; y < img->height; y++) {
-        int src_y = (img->height - 1) - y; // Source row (from bottom up)
-        int dst_y = y;                     // Destination row (from top down)
+// Writes 'levels' halvings of img; level k (1-based) goes to data[k - 1]
+// with row stride stride[k - 1] bytes and size halved() k times
+static void pyramid_build(Image *img, int levels, unsigned char **data, const size_t *stride) {
+    PyramidJob job;
+    job.cn = img->channels;
+    job.type = img->type;
+    job.data[0] = img->data;
+    job.stride[0] = (size_t)img->width * pixel_size(img);
+    job.w[0] = img->width;
+    job.h[0] = img->height;
 
-        unsigned char *src_row_ptr = img->data + (src_y * row_size);
-        unsigned char *dst_row_ptr = out->data + (dst_y * row_size);
+    for (int base = 0; base < levels; base += job.levels) {
+        job.levels = levels - base < PYRAMID_BAND_LEVELS ? levels - base : PYRAMID_BAND_LEVELS;
+        for (int k = 1; k <= job.levels; k++) {
+            job.data[k] = data[base + k - 1];
+            job.stride[k] = stride[base + k - 1];
+            job.w[k] = halved(job.w[k - 1]);
+            job.h[k] = halved(job.h[k - 1]);
+        }
+        int band = 1 << (job.levels - 1);
+        parallel_for_rows((job.h[1] + band - 1) / band, pyramid_rows, &job);
 
-        memcpy(dst_row_ptr, src_row_ptr, row_size);
+        job.data[0] = job.data[job.levels];
+        job.stride[0] = job.stride[job.levels];
+        job.w[0] = job.w[job.levels];
+        job.h[0] = job.h[job.levels];
     }
-    return out;
 }
 
-Image *flip_image_along_Y(Image *img) {
+/**
+ * @brief Builds an image pyramid of successive 2x2-average halvings.
+ *
+ * The levels are packed side by side into one image, top-aligned: level 1
+ * (half size) at x = 0, level 2 at x = width of level 1, and so on. Each
+ * level is half the previous one rounded down (an odd last row or column
+ * is dropped), never less than 1 pixel. The area under the smaller levels
+ * is black.
+ *
+ * @param img The source image.
+ * @param levels Number of halvings, 1 to PYRAMID_MAX_LEVELS.
+ * @return A new Image holding every level, or NULL on failure.
+ */
+Image *pyramid_image(Image *img, int levels) {
     if (!img || !img->data) {
-        fprintf(stderr, "Error: Invalid image in flip_image_horizontal\n");
+        fprintf(stderr, "Error: Invalid image in pyramid_image\n");
+        return NULL;
+    }
+    if (levels < 1 || levels > PYRAMID_MAX_LEVELS) {
+        fprintf(stderr, "Error: Invalid level count %d in pyramid_image (1 to %d)\n",
+                levels, PYRAMID_MAX_LEVELS);
         return NULL;
     }
 
-    // Allocate new image struct
+    int x_at[PYRAMID_MAX_LEVELS];
+    int atlas_w = 0, lw = img->width;
+    for (int k = 0; k < levels; k++) {
+        lw = halved(lw);
+        x_at[k] = atlas_w;
+        atlas_w += lw;
+    }
+
     Image *out = malloc(sizeof(Image));
     if (!out) {
-        fprintf(stderr, "Error: Memory allocation failed in flip_image_horizontal\n");
+        fprintf(stderr, "Error: Memory allocation failed in pyramid_image\n");
         return NULL;
     }
-    out->width = img->width;
-    out->height = img->height;
-    out->channels = 3;
-    size_t data_size = (size_t)img->width * img->height * 3;
-    out->data = malloc(data_size);
+    out->width = atlas_w;
+    out->height = halved(img->height);
+    out->channels = img->channels;
+    out->type = img->type;
+    out->refcount = 1;
+    out->data = calloc((size_t)out->width * out->height, pixel_size(out));
     if (!out->data) {
-        fprintf(stderr, "Error: Memory allocation failed for flip data\n");
+        fprintf(stderr, "Error: Memory allocation failed for pyramid_image data\n");
         free(out);
         return NULL;
     }
 
-    // Process each row
-    for (int y = 0; y < img->height; y++) {
-        for (int x = 0; x < img->width; x++) {
-            // Find source and destination pixel locations
-            int src_x = (img->width - 1) - x; // Source pixel (from right)
-            int dst_x = x;                     // Destination pixel (from left)
-
-            // Get pointers to source and destination pixels
-            unsigned char *src_ptr = img->data + (y * img->width + src_x) * 3;
-            unsigned char *dst_ptr = out->data + (y * img->width + dst_x) * 3;
-
-            // Copy the 3 bytes (R, G, B)
-            memcpy(dst_ptr, src_ptr, 3);
-        }
+    unsigned char *data[PYRAMID_MAX_LEVELS];
+    size_t stride[PYRAMID_MAX_LEVELS];
+    for (int k = 0; k < levels; k++) {
+        data[k] = out->data + (size_t)x_at[k] * pixel_size(out);
+        stride[k] = (size_t)atlas_w * pixel_size(out);
     }
+    pyramid_build(img, levels, data, stride);
     return out;
 }
 
-Image* run_canny(Image *img, float sigma, unsigned char low_thresh, unsigned char high_thresh){
-
-    return canny_edge_detector(img, sigma, low_thresh, high_thresh);
-}
-
-Image *adjust_brightness(Image *img, int bias, int direction) {
-    if (!img || !img->data) {
-        fprintf(stderr, "Error: Invalid image in adjust_brightness\n");
-        return NULL;
+// Shrinks by 2^levels in each direction through the pyramid kernel; the
+// intermediate levels share one scratch buffer
+static Image *shrink_pow2(Image *img, int levels) {
+    unsigned char *data[PYRAMID_MAX_LEVELS];
+    size_t stride[PYRAMID_MAX_LEVELS];
+    size_t scratch_size = 0;
+    int w = img->width, h = img->height;
+    for (int k = 0; k < levels; k++) {
+        w = halved(w);
+        h = halved(h);
+        stride[k] = (size_t)w * pixel_size(img);
+        if (k < levels - 1) scratch_size += stride[k] * h;
     }
 
-    // Allocate new image struct
     Image *out = malloc(sizeof(Image));
-    if (!out) {
-        fprintf(stderr, "Error: Memory allocation failed in adjust_brightness\n");
+    unsigned char *scratch = scratch_size ? malloc(scratch_size) : NULL;
+    if (!out || (scratch_size && !scratch)) {
+        fprintf(stderr, "Error: Memory allocation failed in shrink_pow2\n");
+        free(out);
+        free(scratch);
         return NULL;
     }
-    out->width = img->width;
-    out->height = img->height;
-    out->channels = 3; // Force 3 channels
-    size_t data_size = (size_t)img->width * img->height * 3;
-    out->data = malloc(data_size);
+    out->width = w;
+    out->height = h;
+    out->channels = img->channels;
+    out->type = img->type;
+    out->refcount = 1;
+    out->data = malloc(image_data_size(out));
     if (!out->data) {
-        fprintf(stderr, "Error: Memory allocation failed for brightness data\n");
+        fprintf(stderr, "Error: Memory allocation failed for shrink_pow2 data\n");
         free(out);
+        free(scratch);
         return NULL;
     }
 
-    // Determine the actual value to add (-bias or +bias)
-    int final_bias = (direction == 1) ? bias : -bias;
+    unsigned char *p = scratch;
+    h = img->height;
+    for (int k = 0; k < levels - 1; k++) {
+        h = halved(h);
+        data[k] = p;
+        p += stride[k] * h;
+    }
+    data[levels - 1] = out->data;
+    pyramid_build(img, levels, data, stride);
+    free(scratch);
+    return out;
+}
 
-    // Process every byte (R, G, and B channels)
-    for (size_t i = 0; i < data_size; i++) {
-        // Calculate new value
-        int new_val = (int)img->data[i] + final_bias;
+// --- ORIENTATION ---
+//
+// Flips, 90/180/270 degree rotations, transpose and transverse are all
+// "out(x, y) = in(sx, sy)" with sx, sy affine in x, y, i.e. a fixed source
+// byte step per output column and per output row. orient_rows() walks the
+// output in ORIENT_TILE x ORIENT_TILE tiles, so when the axes swap the
+// source is read a short run of rows at a time instead of one cache line
+// (and one page) per output pixel.
 
-        // Clamp the value to the valid 0-255 range
-        if (new_val < 0) {
-            out->data[i] = 0;
-        } else if (new_val > 255) {
-            out->data[i] = 255;
-        } else {
-            out->data[i] = (unsigned char)new_val;
-        }
+#define ORIENT_TILE 32
+
+// Row band worker for orient_image() and the tiled flips; ival = Orientation
+static void orient_rows(void *ctx, int y0, int y1) {
+    RowJob *job = ctx;
+    Image *img = job->src, *out = job->dst;
+    int w_in = img->width, h_in = img->height;
+    int w_out = out->width;
+    ptrdiff_t psize = (ptrdiff_t)pixel_size(img);
+
+    // sx = a*x + b*y + c, sy = d*x + e*y + f
+    int a = 1, b = 0, c = 0, d = 0, e = 1, f = 0;
+    switch ((Orientation)job->ival) {
+        case ORIENT_IDENTITY:                                   break;
+        case ORIENT_FLIP_H:     a = -1; c = w_in - 1;           break;
+        case ORIENT_FLIP_V:     e = -1; f = h_in - 1;           break;
+        case ORIENT_ROTATE_180: a = -1; c = w_in - 1; e = -1; f = h_in - 1; break;
+        case ORIENT_TRANSPOSE:  a = 0; b = 1; d = 1; e = 0;     break;
+        case ORIENT_ROTATE_90:  a = 0; b = 1; d = -1; e = 0; f = h_in - 1; break;
+        case ORIENT_TRANSVERSE: a = 0; b = -1; c = w_in - 1; d = -1; e = 0; f = h_in - 1; break;
+        case ORIENT_ROTATE_270: a = 0; b = -1; c = w_in - 1; d = 1; e = 0; break;
     }
+    ptrdiff_t step_x = ((ptrdiff_t)d * w_in + a) * psize;
+    ptrdiff_t step_y = ((ptrdiff_t)e * w_in + b) * psize;
+    const unsigned char *origin = img->data + (((ptrdiff_t)f - job->src_y0) * w_in + c) * psize;
 
-    return out;
+    for (int ty = y0; ty < y1; ty += ORIENT_TILE) {
+        int ty1 = ty + ORIENT_TILE < y1 ? ty + ORIENT_TILE : y1;
+        for (int tx = 0; tx < w_out; tx += ORIENT_TILE) {
+            int tx1 = tx + ORIENT_TILE < w_out ? tx + ORIENT_TILE : w_out;
+            for (int y = ty; y < ty1; y++) {
+                const unsigned char *p = origin + y * step_y + tx * step_x;
+                unsigned char *q = out->data + ((size_t)(y - job->dst_y0) * w_out + tx) * psize;
+                if (step_x == psize) {
+                    memcpy(q, p, (size_t)(tx1 - tx) * psize);
+                    continue;
+                }
+                for (int x = tx; x < tx1; x++, p += step_x, q += psize) copy_pixel(q, p, psize);
+            }
+        }
+    }
 }
 
-
 /**
- * @brief Adjusts the contrast of an image.
+ * @brief Applies one of the eight flip/rotate/transpose orientations.
  *
- * Implements contrast adjustment using the formula:
- * New = Factor * (Old - 128) + 128
- * The factor is derived from the amount and direction.
+ * ORIENT_TRANSPOSE, ORIENT_TRANSVERSE and the 90/270 degree rotations swap
+ * width and height.
  *
- * @param img The source Image.
- * @param amount The amount to adjust (0-100).
- * @param direction 1 to increase contrast, 0 to reduce contrast.
- * @return A new, contrast-adjusted Image, or NULL on failure.
+ * @param img The source image.
+ * @param orientation The transform to apply.
+ * @return A new, reoriented Image, or NULL on failure.
  */
-
-Image *adjust_contrast(Image *img, int amount, int direction) {
+Image *orient_image(Image *img, Orientation orientation) {
     if (!img || !img->data) {
-        fprintf(stderr, "Error: Invalid image in adjust_contrast\n");
+        fprintf(stderr, "Error: Invalid image in orient_image\n");
         return NULL;
     }
-    
-    if (amount < 0) amount = 0;
-    if (amount > 100) amount = 100;
+    if (orientation < ORIENT_IDENTITY || orientation > ORIENT_ROTATE_270) {
+        fprintf(stderr, "Error: Invalid orientation %d in orient_image\n", (int)orientation);
+        return NULL;
+    }
+    int swap = orientation == ORIENT_TRANSPOSE || orientation == ORIENT_TRANSVERSE ||
+               orientation == ORIENT_ROTATE_90 || orientation == ORIENT_ROTATE_270;
 
-    // Allocate new image space
     Image *out = malloc(sizeof(Image));
     if (!out) {
-        fprintf(stderr, "Error: Memory allocation failed in adjust_contrast\n");
+        fprintf(stderr, "Error: Memory allocation failed in orient_image\n");
         return NULL;
     }
-    out->width = img->width;
-    out->height = img->height;
-    out->channels = 3; // Force 3 channels
-    size_t data_size = (size_t)img->width * img->height * 3;
-    out->data = malloc(data_size);
+    out->width = swap ? img->height : img->width;
+    out->height = swap ? img->width : img->height;
+    out->channels = img->channels;
+    out->type = img->type;
+    out->refcount = 1;
+    out->data = malloc(image_data_size(out));
     if (!out->data) {
-        fprintf(stderr, "Error: Memory allocation failed for contrast data\n");
+        fprintf(stderr, "Error: Memory allocation failed for orient_image data\n");
         free(out);
         return NULL;
     }
 
-    // Calculate the contrast factor
-    float factor;
-    if (direction == 1) {
-        factor = 1.0f + (float)amount / 100.0f;
-    } else {
-        factor = 1.0f - (float)amount / 100.0f;
-    }
-
-    // Process R, G, and B channels
-    for (size_t i = 0; i < data_size; i++) {
-        float old_val = (float)img->data[i];
-        
-        //contrast formula
-        float new_val_f = (factor * (old_val - 128.0f)) + 128.0f;
-        // Clamp the value to the valid 0-255 range
-        if (new_val_f < 0.0f) {
-            out->data[i] = 0;
-        } else if (new_val_f > 255.0f) {
-            out->data[i] = 255;
-        } else {
-            out->data[i] = (unsigned char)new_val_f;
-        }
-    }
-
+    RowJob job = { .src = img, .dst = out, .ival = orientation };
+    parallel_for_rows(out->height, orient_rows, &job);
     return out;
 }
 
 /**
- * @brief Applies a binary threshold to an image.
+ * @brief Rotates an image by 90 degrees left or right.
  *
- * The function first converts the image to grayscale.
- * Then, it sets pixel values to 0 (black) or 255 (white)
- * based on the threshold and direction.
+ * This is much faster than the general-purpose rotate.
+ * Note: The output image will have its width and height swapped.
  *
- * @param img The source Image.
- * @param threshold The threshold value (0-255).
- * @param direction 1: (val > thresh) ? 255 : 0.  0: (val > thresh) ? 0 : 255.
- * @return A new, binary (but 3-channel) Image, or NULL on failure.
+ * @param img The source image.
+ * @param direction 1 for 90-degrees clockwise (right), -1 for 90-degrees counter-clockwise (left).
+ * @return A new, rotated Image, or NULL on failure.
  */
-Image *apply_threshold(Image *img, int threshold, int direction) {
+Image *rotate_image_90(Image *img, int direction) {
     if (!img || !img->data) {
-        fprintf(stderr, "Error: Invalid image in apply_threshold\n");
+        fprintf(stderr, "Error: Invalid image in rotate_image_90\n");
         return NULL;
     }
-
-    if (threshold < 0) threshold = 0;
-    if (threshold > 255) threshold = 255;
-
-    Image *gray_img = grayscale_image(img);
-    if (!gray_img) {
-        fprintf(stderr, "Error: Grayscale conversion failed in apply_threshold\n");
+    if (direction != 1 && direction != -1) {
+        fprintf(stderr, "Error: Invalid direction for rotate_image_90 (must be 1 or -1)\n");
         return NULL;
     }
+    return orient_image(img, direction == 1 ? ORIENT_ROTATE_90 : ORIENT_ROTATE_270);
+}
 
-    Image *out = malloc(sizeof(Image));
-    if (!out) {
-        fprintf(stderr, "Error: Memory allocation failed in apply_threshold\n");
-        free_image(gray_img);
-        return NULL;
+// --- AFFINE WARP ---
+//
+// warp_affine() maps every output pixel back into the source through an
+// affine matrix. The matrix is evaluated once per output row in double
+// precision; along the row the source coordinate is stepped in
+// SIMD_WARP_BITS fixed point, so there is no per-pixel multiply or trig.
+// Each row is split into an interior run, where every tap the filter reads
+// is inside the source and simd_warp_bilinear() (or a plain loop) can read
+// it directly, and the few border pixels on either side, which gather
+// their neighbourhood with black outside the image. 16-bit and float
+// images take the border path for every pixel, in float.
+
+#define WARP_CUBIC_BITS 8
+#define WARP_CUBIC_STEPS (1 << WARP_CUBIC_BITS)
+
+typedef struct {
+    Image *src;
+    Image *dst;
+    double m[6];
+    Interp interp;
+    float cubic[WARP_CUBIC_STEPS][4];   // Catmull-Rom taps per fraction
+} WarpJob;
+
+// Source coordinate to fixed point, clamped well away from int64 overflow
+static inline int64_t warp_fixed(double v) {
+    const double limit = 1e11;
+    if (v > limit) v = limit;
+    if (v < -limit) v = -limit;
+    return (int64_t)llround(v * (double)((int64_t)1 << SIMD_WARP_BITS));
+}
+
+// Narrows [*i0, *i1] to the i with lo <= v + i * dv <= hi. The range is
+// estimated in double and then corrected against the exact fixed-point
+// positions, which are monotonic in i.
+static void warp_clip(int64_t v, int64_t dv, int64_t lo, int64_t hi, int *i0, int *i1) {
+    if (dv == 0) {
+        if (v < lo || v > hi) *i1 = *i0 - 1;
+        return;
     }
-    out->width = gray_img->width;
-    out->height = gray_img->height;
-    out->channels = 3;
-    size_t data_size = (size_t)out->width * out->height * 3;
-    out->data = malloc(data_size);
-    if (!out->data) {
-        fprintf(stderr, "Error: Memory allocation failed for threshold data\n");
-        free_image(gray_img);
-        free(out);
-        return NULL;
+    double a = (double)(lo - v) / (double)dv;
+    double b = (double)(hi - v) / (double)dv;
+    if (a > b) {
+        double t = a;
+        a = b;
+        b = t;
     }
+    a = ceil(a);
+    b = floor(b);
+    if (a > (double)*i0) *i0 = a > (double)*i1 ? *i1 + 1 : (int)a;
+    if (b < (double)*i1) *i1 = b < (double)*i0 ? *i0 - 1 : (int)b;
+    while (*i0 <= *i1 && (v + *i0 * dv < lo || v + *i0 * dv > hi)) (*i0)++;
+    while (*i1 >= *i0 && (v + *i1 * dv < lo || v + *i1 * dv > hi)) (*i1)--;
+}
 
-    unsigned char *src_data = gray_img->data;
-    unsigned char *dst_data = out->data;
+// p points at the top-left of a 4x4 neighbourhood of cn-channel pixels
+static inline void warp_cubic_pixel(unsigned char *q, const unsigned char *p, size_t stride, int cn,
+                                    const float *wx, const float *wy) {
+    for (int c = 0; c < cn; c++) {
+        float acc = 0.0f;
+        for (int r = 0; r < 4; r++) {
+            const unsigned char *row = p + r * stride + c;
+            acc += (row[0] * wx[0] + row[cn] * wx[1] + row[2 * cn] * wx[2] + row[3 * cn] * wx[3]) * wy[r];
+        }
+        q[c] = clamp_pixel(acc + 0.5f);
+    }
+}
 
-    for (size_t i = 0; i < data_size; i += 3) {
-        unsigned char value = src_data[i];
-        unsigned char out_val;
+// One output pixel whose neighbourhood may leave the source; x, y are the
+// fixed-point source coordinate (already offset by half a pixel for nearest)
+static void warp_border_pixel(const WarpJob *job, int64_t x, int64_t y, unsigned char *q) {
+    const Image *img = job->src;
+    const int64_t frac = ((int64_t)1 << SIMD_WARP_BITS) - 1;
+    int lo = job->interp == INTERP_BICUBIC ? -1 : 0;
+    int n = job->interp == INTERP_BICUBIC ? 4 : job->interp == INTERP_BILINEAR ? 2 : 1;
+    int64_t ix = (x >> SIMD_WARP_BITS) + lo, iy = (y >> SIMD_WARP_BITS) + lo;
+    int cn = img->channels;
+    size_t tstride = (size_t)4 * cn;
+    unsigned char tmp[4 * 16];
+    static const unsigned char black[4] = { 0, 0, 0, 0 };
 
-        if (direction == 1) {
-            out_val = (value > threshold) ? 255 : 0;
-        } else {
-            out_val = (value > threshold) ? 0 : 255;
+    for (int r = 0; r < n; r++) {
+        for (int k = 0; k < n; k++) {
+            int64_t sx = ix + k, sy = iy + r;
+            unsigned char *t = tmp + r * tstride + k * cn;
+            if (sx < 0 || sy < 0 || sx >= img->width || sy >= img->height) {
+                copy_pixel(t, black, cn);
+            } else {
+                copy_pixel(t, img->data + ((size_t)sy * img->width + (size_t)sx) * cn, cn);
+            }
         }
+    }
 
-        dst_data[i] = out_val;
-        dst_data[i + 1] = out_val;
-        dst_data[i + 2] = out_val;
+    switch (job->interp) {
+        case INTERP_NEAREST:
+            copy_pixel(q, tmp, cn);
+            break;
+        case INTERP_BILINEAR:
+            scalar_warp_bilinear(q, tmp, tstride, x & frac, y & frac, 0, 0, 1, cn);
+            break;
+        case INTERP_BICUBIC:
+            warp_cubic_pixel(q, tmp, tstride, cn, job->cubic[(x >> (SIMD_WARP_BITS - WARP_CUBIC_BITS)) & (WARP_CUBIC_STEPS - 1)],
+                             job->cubic[(y >> (SIMD_WARP_BITS - WARP_CUBIC_BITS)) & (WARP_CUBIC_STEPS - 1)]);
+            break;
+        default:
+            break;
     }
+}
 
-    free_image(gray_img);
+// warp_border_pixel() for 16-bit and float images; q is the pixel index
+ALWAYS_INLINE void warp_deep_pixel_t(const WarpJob *job, int64_t x, int64_t y, size_t q, PixelType type) {
+    const Image *img = job->src;
+    const int64_t frac = ((int64_t)1 << SIMD_WARP_BITS) - 1;
+    const float unit = 1.0f / (float)((int64_t)1 << SIMD_WARP_BITS);
+    int lo = job->interp == INTERP_BICUBIC ? -1 : 0;
+    int n = job->interp == INTERP_BICUBIC ? 4 : job->interp == INTERP_BILINEAR ? 2 : 1;
+    int64_t ix = (x >> SIMD_WARP_BITS) + lo, iy = (y >> SIMD_WARP_BITS) + lo;
+    int cn = img->channels;
+    float wx[4] = { 1.0f }, wy[4] = { 1.0f };
 
-    return out;
+    if (job->interp == INTERP_BILINEAR) {
+        wx[1] = (x & frac) * unit;
+        wx[0] = 1.0f - wx[1];
+        wy[1] = (y & frac) * unit;
+        wy[0] = 1.0f - wy[1];
+    } else if (job->interp == INTERP_BICUBIC) {
+        const int shift = SIMD_WARP_BITS - WARP_CUBIC_BITS;
+        memcpy(wx, job->cubic[(x >> shift) & (WARP_CUBIC_STEPS - 1)], sizeof(wx));
+        memcpy(wy, job->cubic[(y >> shift) & (WARP_CUBIC_STEPS - 1)], sizeof(wy));
+    }
+
+    for (int c = 0; c < cn; c++) {
+        float acc = 0.0f;
+        for (int r = 0; r < n; r++) {
+            int64_t sy = iy + r;
+            if (sy < 0 || sy >= img->height) continue;
+            for (int k = 0; k < n; k++) {
+                int64_t sx = ix + k;
+                if (sx < 0 || sx >= img->width) continue;
+                acc += sample_at(img->data, type, ((size_t)sy * img->width + (size_t)sx) * cn + c) * wx[k] * wy[r];
+            }
+        }
+        sample_put(job->dst->data, type, q * cn + c, acc);
+    }
 }
 
-/**
- * @brief Helper to clamp a float value to the 0-255 byte range.
- */
-static inline unsigned char clamp_pixel(float v) {
-    if (v < 0.0f) return 0;
-    if (v > 255.0f) return 255;
-    return (unsigned char)v;
+ALWAYS_INLINE void warp_deep_rows_t(WarpJob *job, int y0, int y1, PixelType type) {
+    int ow = job->dst->width;
+    const int64_t half = job->interp == INTERP_NEAREST ? ((int64_t)1 << SIMD_WARP_BITS) / 2 : 0;
+    int64_t dx = warp_fixed(job->m[0]), dy = warp_fixed(job->m[3]);
+    for (int y = y0; y < y1; y++) {
+        int64_t x0 = warp_fixed(job->m[1] * y + job->m[2]) + half;
+        int64_t yy0 = warp_fixed(job->m[4] * y + job->m[5]) + half;
+        for (int i = 0; i < ow; i++) {
+            warp_deep_pixel_t(job, x0 + i * dx, yy0 + i * dy, (size_t)y * ow + i, type);
+        }
+    }
+}
+
+// Row band worker for warp_affine()
+static void warp_rows(void *ctx, int y0, int y1) {
+    WarpJob *job = ctx;
+    const Image *img = job->src;
+    Image *out = job->dst;
+    int w = img->width, h = img->height, ow = out->width, cn = img->channels;
+    size_t stride = (size_t)w * cn;
+    const int64_t one = (int64_t)1 << SIMD_WARP_BITS;
+    const int shift = SIMD_WARP_BITS - WARP_CUBIC_BITS;
+
+    if (img->type != PIXEL_U8) {
+        DISPATCH_PIXEL_TYPE(img->type, warp_deep_rows_t, job, y0, y1)
+        return;
+    }
+
+    // Taps read relative to floor(coordinate): [lo, hi]
+    int lo = job->interp == INTERP_BICUBIC ? -1 : 0;
+    int hi = job->interp == INTERP_BICUBIC ? 2 : job->interp == INTERP_BILINEAR ? 1 : 0;
+    int64_t dx = warp_fixed(job->m[0]), dy = warp_fixed(job->m[3]);
+
+    for (int y = y0; y < y1; y++) {
+        int64_t x0 = warp_fixed(job->m[1] * y + job->m[2]);
+        int64_t yy0 = warp_fixed(job->m[4] * y + job->m[5]);
+        if (job->interp == INTERP_NEAREST) {
+            x0 += one / 2;
+            yy0 += one / 2;
+        }
+        unsigned char *q = out->data + (size_t)y * ow * cn;
+
+        int i0 = 0, i1 = ow - 1;
+        warp_clip(x0, dx, -lo * one, (int64_t)(w - hi) * one - 1, &i0, &i1);
+        warp_clip(yy0, dy, -lo * one, (int64_t)(h - hi) * one - 1, &i0, &i1);
+        if (i0 > i1) {
+            i0 = ow;
+            i1 = ow - 1;
+        }
+
+        for (int i = 0; i < i0; i++) warp_border_pixel(job, x0 + i * dx, yy0 + i * dy, q + i * cn);
+
+        int64_t x = x0 + i0 * dx, sy = yy0 + i0 * dy;
+        switch (job->interp) {
+            case INTERP_NEAREST:
+                for (int i = i0; i <= i1; i++, x += dx, sy += dy) {
+                    const unsigned char *p = img->data + (size_t)(sy >> SIMD_WARP_BITS) * stride +
+                                             (size_t)(x >> SIMD_WARP_BITS) * cn;
+                    copy_pixel(q + i * cn, p, cn);
+                }
+                break;
+            case INTERP_BILINEAR:
+                if (i1 >= i0) simd_warp_bilinear(q + (size_t)i0 * cn, img->data, stride, x, sy, dx, dy,
+                                                 (size_t)(i1 - i0 + 1), cn);
+                break;
+            case INTERP_BICUBIC:
+                for (int i = i0; i <= i1; i++, x += dx, sy += dy) {
+                    const unsigned char *p = img->data + (size_t)((sy >> SIMD_WARP_BITS) - 1) * stride +
+                                             (size_t)((x >> SIMD_WARP_BITS) - 1) * cn;
+                    warp_cubic_pixel(q + i * cn, p, stride, cn, job->cubic[(x >> shift) & (WARP_CUBIC_STEPS - 1)],
+                                     job->cubic[(sy >> shift) & (WARP_CUBIC_STEPS - 1)]);
+                }
+                break;
+            default:
+                break;
+        }
+
+        for (int i = i1 + 1; i < ow; i++) warp_border_pixel(job, x0 + i * dx, yy0 + i * dy, q + i * cn);
+    }
 }
 
 /**
- * @brief Applies a 3x3 convolution kernel to an image.
+ * @brief Resamples an image through an affine map.
  *
- * @param img The source Image.
- * @param kernel A 3x3 float kernel.
- * @return A new, convolved Image, or NULL on failure.
+ * Output pixel (x, y) takes the source value at
+ * (m[0]*x + m[1]*y + m[2], m[3]*x + m[4]*y + m[5]), with integer source
+ * coordinates at pixel centres. Whatever falls outside the source is black.
+ *
+ * @param img The source image.
+ * @param m The output-to-source matrix, row-major 2x3.
+ * @param out_w Output width.
+ * @param out_h Output height.
+ * @param interp Sampling filter.
+ * @return A new Image of out_w x out_h, or NULL on failure.
  */
-Image *convolve_image(Image *img, float kernel[3][3]) {
+Image *warp_affine(Image *img, const double m[6], int out_w, int out_h, Interp interp) {
     if (!img || !img->data) {
-        fprintf(stderr, "Error: Invalid image in convolve_image\n");
+        fprintf(stderr, "Error: Invalid image in warp_affine\n");
+        return NULL;
+    }
+    if (out_w <= 0 || out_h <= 0) {
+        fprintf(stderr, "Error: Invalid output size %dx%d in warp_affine\n", out_w, out_h);
+        return NULL;
+    }
+    if (interp != INTERP_NEAREST && interp != INTERP_BILINEAR && interp != INTERP_BICUBIC) {
+        fprintf(stderr, "Error: Invalid filter %d in warp_affine\n", (int)interp);
         return NULL;
     }
+    for (int i = 0; i < 6; i++) {
+        if (!isfinite(m[i])) {
+            fprintf(stderr, "Error: Non-finite matrix in warp_affine\n");
+            return NULL;
+        }
+    }
 
+    WarpJob *job = malloc(sizeof(WarpJob));
     Image *out = malloc(sizeof(Image));
-    if (!out) {
-        fprintf(stderr, "Error: Memory allocation failed in convolve_image\n");
+    if (!job || !out) {
+        fprintf(stderr, "Error: Memory allocation failed in warp_affine\n");
+        free(job);
+        free(out);
         return NULL;
     }
-    out->width = img->width;
-    out->height = img->height;
-    out->channels = 3;
-    size_t data_size = (size_t)out->width * out->height * 3;
-    out->data = malloc(data_size);
+    out->width = out_w;
+    out->height = out_h;
+    out->channels = img->channels;
+    out->type = img->type;
+    out->refcount = 1;
+    out->data = malloc(image_data_size(out));
     if (!out->data) {
-        fprintf(stderr, "Error: Memory allocation failed for convolve_image data\n");
+        fprintf(stderr, "Error: Memory allocation failed for warp_affine data\n");
+        free(job);
         free(out);
         return NULL;
     }
 
-    int w = img->width, h = img->height, c = img->channels;
-
-    for (int y = 0; y < h; y++) {
-        for (int x = 0; x < w; x++) {
-            float sum_r = 0.0f, sum_g = 0.0f, sum_b = 0.0f;
-
-            // for borders
-            if (y == 0 || y == h - 1 || x == 0 || x == w - 1) {
-                unsigned char *p = img->data + (y * w + x) * c;
-                sum_r = p[0];
-                sum_g = p[1];
-                sum_b = p[2];
-            } else {
-                // Apply 3x3 kernel
-                for (int ky = -1; ky <= 1; ky++) {
-                    for (int kx = -1; kx <= 1; kx++) {
-                        unsigned char *p = img->data + ((y + ky) * w + (x + kx)) * c;
-                        float kval = kernel[ky + 1][kx + 1];
-                        sum_r += p[0] * kval;
-                        sum_g += p[1] * kval;
-                        sum_b += p[2] * kval;
-                    }
-                }
-            }
-            unsigned char *q = out->data + (y * w + x) * c;
-            q[0] = clamp_pixel(sum_r);
-            q[1] = clamp_pixel(sum_g);
-            q[2] = clamp_pixel(sum_b);
+    job->src = img;
+    job->dst = out;
+    memcpy(job->m, m, sizeof(job->m));
+    job->interp = interp;
+    if (interp == INTERP_BICUBIC) {
+        for (int f = 0; f < WARP_CUBIC_STEPS; f++) {
+            double t = (double)f / WARP_CUBIC_STEPS;
+            for (int k = 0; k < 4; k++) job->cubic[f][k] = (float)cubic_weight(t - (k - 1));
         }
     }
+    parallel_for_rows(out_h, warp_rows, job);
+    free(job);
     return out;
 }
 
 /**
- * @brief Sharpens or softens an image.
+ * @brief Rotates an image clockwise by any angle.
  *
- * direction = 1 (Sharpen): Applies a 3x3 sharpen kernel. 'amount' controls
- * the strength (recommended 1-10).
- * direction = 0 (Soften):  Applies a box blur. 'amount' is used as the
- * blur radius.
+ * The rotation is about the image centre. With 'expand' the output grows
+ * to hold the whole rotated image; otherwise it keeps the source size and
+ * the corners are cut off. Corners not covered by the source are black.
+ * Multiples of 90 degrees that need no cropping go through orient_image().
  *
- * @param img The source Image.
- * @param amount The strength (for sharpen) or radius (for soften).
- * @param direction 1 to sharpen, 0 to soften/blur.
- * @return A new, processed Image, or NULL on failure.
+ * @param img The source image.
+ * @param degrees Clockwise angle in degrees; negative turns counter-clockwise.
+ * @param interp Sampling filter.
+ * @param expand Non-zero to fit the output to the rotated bounds.
+ * @return A new, rotated Image, or NULL on failure.
  */
-Image *sharpen_image(Image *img, int amount, int direction) {
+Image *rotate_image(Image *img, double degrees, Interp interp, int expand) {
     if (!img || !img->data) {
-        fprintf(stderr, "Error: Invalid image in sharpen_image\n");
+        fprintf(stderr, "Error: Invalid image in rotate_image\n");
         return NULL;
     }
+    if (!isfinite(degrees)) {
+        fprintf(stderr, "Error: Invalid angle in rotate_image\n");
+        return NULL;
+    }
+    double turn = fmod(degrees, 360.0);
+    if (turn < 0.0) turn += 360.0;
 
-    if (direction == 0) {
-        if (amount < 1) amount = 1; 
-        return blur_image(img, amount);
+    int w = img->width, h = img->height;
+    double c, s;
+    if (fmod(turn, 90.0) == 0.0) {
+        static const Orientation by_quarter[4] = {
+            ORIENT_IDENTITY, ORIENT_ROTATE_90, ORIENT_ROTATE_180, ORIENT_ROTATE_270
+        };
+        static const int cos_q[4] = { 1, 0, -1, 0 }, sin_q[4] = { 0, 1, 0, -1 };
+        int quarter = (int)(turn / 90.0);
+        if (expand || quarter % 2 == 0 || w == h) return orient_image(img, by_quarter[quarter]);
+        c = cos_q[quarter];
+        s = sin_q[quarter];
+    } else {
+        c = cos(turn * M_PI / 180.0);
+        s = sin(turn * M_PI / 180.0);
     }
 
-    float k = (float)amount / 10.0f; 
-    float kernel[3][3] = {
-        { 0.0f, -k, 0.0f },
-        { -k, 1.0f + 4.0f * k, -k },
-        { 0.0f, -k, 0.0f }
-    };
+    int ow = w, oh = h;
+    if (expand) {
+        // Bounding box of the rotated rectangle, shaved so rounding noise
+        // does not add a column
+        ow = (int)ceil(fabs(w * c) + fabs(h * s) - 1e-6);
+        oh = (int)ceil(fabs(w * s) + fabs(h * c) - 1e-6);
+        if (ow < 1) ow = 1;
+        if (oh < 1) oh = 1;
+    }
 
-    return convolve_image(img, kernel);
+    // Output pixel centre relative to the output centre, rotated back by
+    // the angle, then moved to source pixel indices
+    double ux = 0.5 - ow / 2.0, uy = 0.5 - oh / 2.0;
+    double m[6] = {
+        c,  s, c * ux + s * uy + w / 2.0 - 0.5,
+        -s, c, -s * ux + c * uy + h / 2.0 - 0.5
+    };
+    return warp_affine(img, m, ow, oh, interp);
 }
 
+// A run of point ops compiled for apply_point_ops(): optionally collapse the
+// pixel to its luminance first, then map each channel through 'lut'.
+typedef struct PointSegment {
+    int luma;
+    unsigned char lut[256];
+} PointSegment;
 
-/**
- * @brief Blends two images together using a specified alpha.
- *
- * The images must have the same dimensions.
- * The blend formula is: out = img1 * (1.0 - alpha) + img2 * alpha
- *
- * @param img1 The first source Image (visible at alpha=0.0).
- * @param img2 The second source Image (visible at alpha=1.0).
- * @param alpha The blend factor (0.0 to 1.0).
- * @return A new, blended Image, or NULL on failure.
- */
-Image *blend_images(Image *img1, Image *img2, float alpha) {
-    if (!img1 || !img1->data || !img2 || !img2->data) {
-        fprintf(stderr, "Error: Invalid image(s) in blend_images\n");
-        return NULL;
-    }
+// Row band worker for apply_point_ops(); runs every segment on a pixel before moving on
+static void point_ops_rows(void *ctx, int y0, int y1) {
+    RowJob *job = ctx;
+    const PointSegment *segs = job->segs;
+    int nsegs = job->nsegs;
+    int cn = job->dst->channels;
+    size_t w = job->dst->width;
+    unsigned char *src = job->src->data + (size_t)(y0 - job->src_y0) * w * cn;
+    unsigned char *dst = job->dst->data + (size_t)(y0 - job->dst_y0) * w * cn;
 
-    if (img1->width != img2->width || img1->height != img2->height) {
-        fprintf(stderr, "Error: Image dimensions must match in blend_images (%dx%d vs %dx%d)\n",
-                img1->width, img1->height, img2->width, img2->height);
-        return NULL;
-    }
+    for (size_t i = 0; i < (size_t)(y1 - y0) * w; i++) {
+        unsigned char *p = src + i * cn;
+        unsigned char *q = dst + i * cn;
 
-    // Clamp alpha
-    if (alpha < 0.0f) alpha = 0.0f;
-    if (alpha > 1.0f) alpha = 1.0f;
+        if (cn == 1) {
+            // The luminance of a gray pixel is the pixel itself
+            unsigned char v = p[0];
+            for (int k = 0; k < nsegs; k++) v = segs[k].lut[v];
+            q[0] = v;
+            continue;
+        }
 
-    Image *out = malloc(sizeof(Image));
-    if (!out) {
-        fprintf(stderr, "Error: Memory allocation failed in blend_images\n");
-        return NULL;
+        unsigned char v0 = p[0], v1 = p[1], v2 = p[2];
+
+        for (int k = 0; k < nsegs; k++) {
+            const unsigned char *lut = segs[k].lut;
+            if (segs[k].luma) {
+                // Same integer luminance as grayscale_image()
+                int gray = (299 * v0 + 587 * v1 + 114 * v2) / 1000;
+                v0 = v1 = v2 = lut[gray];
+            } else {
+                v0 = lut[v0];
+                v1 = lut[v1];
+                v2 = lut[v2];
+            }
+        }
+
+        q[0] = v0;
+        q[1] = v1;
+        q[2] = v2;
+        if (cn == 4) q[3] = p[3];
     }
-    out->width = img1->width;
-    out->height = img1->height;
-    out->channels = 3;
-    size_t data_size = (size_t)out->width * out->height * 3;
-    out->data = malloc(data_size);
-    if (!out->data) {
-        fprintf(stderr, "Error: Memory allocation failed for blend_images data\n");
-        free(out);
-        return NULL;
+}
+
+// One per-channel op on a 16-bit or float sample. Bias and threshold are
+// given on the 0-255 scale and move with the type; 16-bit results are
+// rounded and clamped after every op as the 8-bit tables are, float ones
+// are kept as they are.
+ALWAYS_INLINE float point_op_deep(const PointOp *op, float v, PixelType type) {
+    float m = pixel_type_max(type), unit = m / 255.0f;
+    switch (op->kind) {
+        case POINT_INVERT:     v = m - v; break;
+        case POINT_BRIGHTNESS: v += op->ival * unit; break;
+        case POINT_CONTRAST:   v = op->fval * (v - 128.0f * unit) + 128.0f * unit; break;
+        case POINT_THRESHOLD:  v = ((v > op->ival * unit) == (op->direction == 1)) ? m : 0.0f; break;
+        default: break;
     }
+    if (type == PIXEL_F32) return v;
+    return !(v > 0.0f) ? 0.0f : v >= m ? m : floorf(v + 0.5f);
+}
 
-    float alpha_neg = 1.0f - alpha;
-    unsigned char *p1 = img1->data;
-    unsigned char *p2 = img2->data;
-    unsigned char *q = out->data;
+ALWAYS_INLINE void point_ops_deep_rows_t(RowJob *job, int y0, int y1, PixelType type) {
+    const PointOp *ops = job->ops;
+    int nops = job->nops;
+    int cn = job->dst->channels;
+    size_t w = job->dst->width;
+    const unsigned char *src = job->src->data + (size_t)(y0 - job->src_y0) * w * cn * pixel_type_size(type);
+    unsigned char *dst = job->dst->data + (size_t)(y0 - job->dst_y0) * w * cn * pixel_type_size(type);
+
+    for (size_t i = 0; i < (size_t)(y1 - y0) * w; i++) {
+        size_t p = i * cn;
+        if (cn == 1) {
+            // The luminance of a gray pixel is the pixel itself
+            float v = sample_at(src, type, p);
+            for (int k = 0; k < nops; k++) v = point_op_deep(&ops[k], v, type);
+            sample_put(dst, type, p, v);
+            continue;
+        }
 
-    for (size_t i = 0; i < data_size; i++) {
-        // Apply blend formula to each component
-        float val = (p1[i] * alpha_neg) + (p2[i] * alpha);
-        q[i] = clamp_pixel(val);
+        float v0 = sample_at(src, type, p), v1 = sample_at(src, type, p + 1), v2 = sample_at(src, type, p + 2);
+        for (int k = 0; k < nops; k++) {
+            if (ops[k].kind == POINT_GRAYSCALE || ops[k].kind == POINT_THRESHOLD) {
+                v0 = v1 = v2 = point_op_deep(&ops[k], luma_of(v0, v1, v2, type), type);
+            } else {
+                v0 = point_op_deep(&ops[k], v0, type);
+                v1 = point_op_deep(&ops[k], v1, type);
+                v2 = point_op_deep(&ops[k], v2, type);
+            }
+        }
+        sample_put(dst, type, p, v0);
+        sample_put(dst, type, p + 1, v1);
+        sample_put(dst, type, p + 2, v2);
+        if (cn == 4) sample_put(dst, type, p + 3, sample_at(src, type, p + 3));
     }
+}
 
-    return out;
+// Row band worker for apply_point_ops() on 16-bit and float images; the
+// ops run one by one on each pixel, no tables
+static void point_ops_deep_rows(void *ctx, int y0, int y1) {
+    RowJob *job = ctx;
+    if (job->src->type == PIXEL_U16) point_ops_deep_rows_t(job, y0, y1, PIXEL_U16);
+    else point_ops_deep_rows_t(job, y0, y1, PIXEL_F32);
 }
 
+// Compiles 'ops' into at most 'nops' segments and returns how many were used.
+// Grayscale and threshold start a new segment; everything else folds into
+// the current segment's table.
+static int compile_point_ops(PointSegment *segs, const PointOp *ops, int nops) {
+    int nsegs = 0;
+    for (int k = 0; k < nops; k++) {
+        const PointOp *op = &ops[k];
+        if (op->kind == POINT_GRAYSCALE || op->kind == POINT_THRESHOLD) {
+            PointSegment *seg = &segs[nsegs++];
+            seg->luma = 1;
+            lut_identity(seg->lut);
+            if (op->kind == POINT_THRESHOLD) {
+                for (int i = 0; i < 256; i++) {
+                    int above = i > op->ival;
+                    seg->lut[i] = (op->direction == 1 ? above : !above) ? 255 : 0;
+                }
+            }
+        } else {
+            if (nsegs == 0) {
+                segs[0].luma = 0;
+                lut_identity(segs[0].lut);
+                nsegs = 1;
+            }
+            lut_apply_op(segs[nsegs - 1].lut, op);
+        }
+    }
+    return nsegs;
+}
 
 /**
- * @brief Applies a binary mask to an image.
+ * @brief Applies a chain of per-pixel operations in a single pass.
  *
- * The images must have the same dimensions.
- * The output pixel will be:
- * - Copied from img if the corresponding mask pixel is "on" (non-black).
- * - Black if the corresponding mask pixel is "off" (black).
+ * Produces exactly what calling grayscale_image(), invert_image(),
+ * adjust_brightness(), adjust_contrast() and apply_threshold() one after
+ * another would, but reads the source once and allocates one output
+ * instead of one intermediate image per step. Consecutive per-channel ops
+ * are composed into a single lookup table before any pixel is touched.
+ * 16-bit and float images run the ops directly on each sample instead,
+ * with bias and threshold scaled from 0-255 to the sample range. Alpha
+ * passes through unchanged.
  *
- * @param img The source Image to be masked.
- * @param mask The binary mask Image (assumed to be 3-channel grayscale, 0 or 255).
- * @return A new, masked Image, or NULL on failure.
+ * @param img The source Image.
+ * @param ops The operations, applied in array order.
+ * @param nops Number of operations.
+ * @return A new Image, or NULL on failure.
  */
-Image *mask_image(Image *img, Image *mask) {
-    if (!img || !img->data || !mask || !mask->data) {
-        fprintf(stderr, "Error: Invalid image(s) in mask_image\n");
+Image *apply_point_ops(Image *img, const PointOp *ops, int nops) {
+    if (!img || !img->data || !ops || nops < 1) {
+        fprintf(stderr, "Error: Invalid parameters in apply_point_ops\n");
         return NULL;
     }
 
-    if (img->width != mask->width || img->height != mask->height) {
-        fprintf(stderr, "Error: Image dimensions must match in mask_image (%dx%d vs %dx%d)\n",
-                img->width, img->height, mask->width, mask->height);
-        return NULL;
+    PointSegment *segs = NULL;
+    int nsegs = 0;
+    if (img->type == PIXEL_U8) {
+        segs = malloc(sizeof(PointSegment) * nops);
+        if (!segs) {
+            fprintf(stderr, "Error: Memory allocation failed in apply_point_ops\n");
+            return NULL;
+        }
+        nsegs = compile_point_ops(segs, ops, nops);
+
+        // A lone table needs no per-pixel luminance work
+        if (nsegs == 1 && !segs[0].luma) {
+            Image *out = apply_lut(img, segs[0].lut);
+            free(segs);
+            return out;
+        }
     }
 
     Image *out = malloc(sizeof(Image));
     if (!out) {
-        fprintf(stderr, "Error: Memory allocation failed in mask_image\n");
+        fprintf(stderr, "Error: Memory allocation failed in apply_point_ops\n");
+        free(segs);
         return NULL;
     }
     out->width = img->width;
     out->height = img->height;
-    out->channels = 3;
-    size_t data_size = (size_t)out->width * out->height * 3;
-    out->data = malloc(data_size);
+    out->channels = img->channels;
+    out->type = img->type;
+    out->refcount = 1;
+    out->data = malloc(image_data_size(out));
     if (!out->data) {
-        fprintf(stderr, "Error: Memory allocation failed for mask_image data\n");
+        fprintf(stderr, "Error: Memory allocation failed for point op data\n");
+        free(segs);
         free(out);
         return NULL;
     }
 
-    unsigned char *s_data = img->data;
-    unsigned char *m_data = mask->data;
-    unsigned char *d_data = out->data;
+    RowJob job = { .src = img, .dst = out, .segs = segs, .nsegs = nsegs, .ops = ops, .nops = nops };
+    parallel_for_rows(img->height, segs ? point_ops_rows : point_ops_deep_rows, &job);
+    free(segs);
+    return out;
+}
 
-    size_t num_pixels = (size_t)out->width * out->height;
-    for (size_t i = 0; i < num_pixels; i++) {
-        unsigned char *s_ptr = s_data + i * 3;
-        unsigned char *m_ptr = m_data + i * 3;
-        unsigned char *d_ptr = d_data + i * 3;
+// --- TILED EXECUTION ---
+//
+// run_tiled() produces a pipeline's result one band of output rows at a
+// time. For each band it first works backwards to find the rows every stage
+// must produce (the band plus the halo of each later stage, shifted by a
+// crop or mirrored by a vertical flip), then runs the stages forwards
+// through small per-stage strip buffers. Only the source and the result are
+// ever held in full, so the working set does not grow with the number of
+// stages. Strips always span the full image width, which lets every stage
+// reuse its ordinary row-band worker.
 
-        if (m_ptr[0] > 0) {
-            memcpy(d_ptr, s_ptr, 3);
-        } else {
-            d_ptr[0] = 0;
-            d_ptr[1] = 0;
-            d_ptr[2] = 0;
-        }
-    }
+// Below this many rows per band, blur priming and thread hand-off dominate
+#define TILE_MIN_ROWS 16
 
-    return out;
+static size_t tile_budget_bytes = 0;
+
+void tile_set_budget(size_t bytes) {
+    tile_budget_bytes = bytes;
 }
 
+size_t tile_budget(void) {
+    return tile_budget_bytes;
+}
 
-/**
- * @brief Resizes an image using the nearest-neighbor algorithm.
- *
- * @param img The source Image to resize.
- * @param new_w The target width.
- * @param new_h The target height.
- * @return A new, resized Image, or NULL on failure.
- */
-Image *resize_image_nearest(Image *img, int new_w, int new_h) {
-    if (!img || !img->data || new_w <= 0 || new_h <= 0) {
-        fprintf(stderr, "Error: Invalid parameters in resize_image_nearest (img=%p, data=%p, w=%d, h=%d)\n",
-                (void*)img, img ? (void*)img->data : NULL, new_w, new_h);
-        return NULL;
-    }
+// One executable step of a tiled pipeline; consecutive point ops share a pass
+typedef struct {
+    TileStageKind kind;     // TILE_SHARPEN here always means the 3x3 kernel
+    PointSegment *segs;     // TILE_POINT
+    int nsegs;
+    PointOp *ops;           // TILE_POINT on 16-bit and float images
+    int nops;
+    int radius;             // TILE_BLUR
+    float kernel[3][3];     // TILE_SHARPEN
+    int x, y;               // TILE_CROP origin
+    int in_w, in_h;
+    int out_w, out_h;
+    int halo;               // input rows needed above and below each output row
+    unsigned char *buf;     // output strip; NULL for the last pass
+    int row0, row1;         // output rows needed for the current band
+} TilePass;
 
-    Image *out = malloc(sizeof(Image));
-    if (!out) {
-        fprintf(stderr, "Error: Memory allocation failed in resize_image_nearest\n");
-        return NULL;
-    }
-    out->width = new_w;
-    out->height = new_h;
-    out->channels = 3;
-    size_t data_size = (size_t)new_w * new_h * 3;
-    out->data = malloc(data_size);
-    if (!out->data) {
-        fprintf(stderr, "Error: Memory allocation failed for resize_image_nearest data\n");
-        free(out);
-        return NULL;
+// Shifts a band worker so parallel_for_rows() can cover rows [base, base + n)
+typedef struct {
+    RowKernel fn;
+    void *ctx;
+    int base;
+} BandJob;
+
+static void band_rows(void *ctx, int y0, int y1) {
+    BandJob *band = ctx;
+    band->fn(band->ctx, band->base + y0, band->base + y1);
+}
+
+static void parallel_for_band(int y0, int y1, RowKernel fn, void *ctx) {
+    BandJob band = { fn, ctx, y0 };
+    parallel_for_rows(y1 - y0, band_rows, &band);
+}
+
+static void free_tile_passes(TilePass *passes, int npasses) {
+    for (int k = 0; k < npasses; k++) {
+        free(passes[k].segs);
+        free(passes[k].ops);
+        free(passes[k].buf);
     }
+    free(passes);
+}
 
-    int old_w = img->width;
-    int old_h = img->height;
-    unsigned char *s_data = img->data;
-    unsigned char *d_data = out->data;
+// Turns the stage list into passes, checking parameters as the untiled
+// operators would. Returns the number of passes, or -1 on failure.
+static int build_tile_passes(TilePass *passes, Image *img, const TileStage *stages, int nstages) {
+    int npasses = 0;
+    int w = img->width, h = img->height;
 
-    float x_ratio = old_w / (float)new_w;
-    float y_ratio = old_h / (float)new_h;
+    for (int k = 0; k < nstages; k++) {
+        const TileStage *st = &stages[k];
+        TilePass *p = &passes[npasses++];
+        p->kind = st->kind;
+        p->in_w = p->out_w = w;
+        p->in_h = p->out_h = h;
 
-    for (int y = 0; y < new_h; y++) {
-        for (int x = 0; x < new_w; x++) {
-            int src_x = (int)(x * x_ratio);
-            int src_y = (int)(y * y_ratio);
+        switch (st->kind) {
+            case TILE_POINT: {
+                int n = 1;
+                while (k + n < nstages && stages[k + n].kind == TILE_POINT) n++;
+                p->ops = malloc(sizeof(PointOp) * n);
+                p->segs = malloc(sizeof(PointSegment) * n);
+                if (!p->ops || !p->segs) {
+                    fprintf(stderr, "Error: Memory allocation failed in run_tiled\n");
+                    return -1;
+                }
+                for (int i = 0; i < n; i++) p->ops[i] = stages[k + i].op;
+                p->nops = n;
+                p->nsegs = compile_point_ops(p->segs, p->ops, n);
+                k += n - 1;
+                break;
+            }
+            case TILE_SHARPEN:
+                if (st->direction == 0) {
+                    // Softening is a box blur, as in sharpen_image()
+                    p->kind = TILE_BLUR;
+                    p->radius = p->halo = st->amount < 1 ? 1 : st->amount;
+                } else {
+                    sharpen_kernel(p->kernel, st->amount);
+                    p->halo = 1;
+                }
+                break;
+            case TILE_BLUR:
+                if (st->radius < 1) {
+                    fprintf(stderr, "Error: Invalid blur parameters (radius=%d)\n", st->radius);
+                    return -1;
+                }
+                p->radius = p->halo = st->radius;
+                break;
+            case TILE_CROP:
+                if (st->w <= 0 || st->h <= 0 || st->x < 0 || st->y < 0) {
+                    fprintf(stderr, "Error: Invalid crop parameters (x=%d, y=%d, w=%d, h=%d)\n",
+                            st->x, st->y, st->w, st->h);
+                    return -1;
+                }
+                if (st->x + st->w > w || st->y + st->h > h) {
+                    fprintf(stderr, "Error: Crop out of bounds (img: %dx%d, crop: x=%d, y=%d, w=%d, h=%d)\n",
+                            w, h, st->x, st->y, st->w, st->h);
+                    return -1;
+                }
+                p->x = st->x;
+                p->y = st->y;
+                p->out_w = w = st->w;
+                p->out_h = h = st->h;
+                break;
+            case TILE_FLIP_X:
+            case TILE_FLIP_Y:
+                break;
+        }
+    }
+    return npasses;
+}
 
-            unsigned char *src_pixel = s_data + (src_y * old_w + src_x) * 3;
-            unsigned char *dst_pixel = d_data + (y * new_w + x) * 3;
+// Rows per band such that the strip buffers and blur scratch fit in 'budget';
+// cn and type are the image's channel count and sample type, which no stage changes
+static int tile_band_rows(const TilePass *passes, int npasses, int cn, PixelType type, size_t budget) {
+    size_t per_row = 0, fixed = 0;
+    int down = 0;   // halo of every pass after the current one
 
-            memcpy(dst_pixel, src_pixel, 3);
+    for (int k = npasses - 1; k >= 0; k--) {
+        const TilePass *p = &passes[k];
+        size_t row_size = (size_t)p->out_w * cn * pixel_type_size(type);
+        if (k < npasses - 1) {
+            per_row += row_size;
+            fixed += row_size * 2 * down;
         }
+        if (p->kind == TILE_BLUR) {
+            fixed += (size_t)p->in_w * cn * sizeof(long long) * parallel_threads();
+        }
+        down += p->halo;
     }
 
-    return out;
+    int out_h = passes[npasses - 1].out_h;
+    if (per_row == 0) return out_h;     // nothing to buffer between passes
+    size_t rows = budget > fixed ? (budget - fixed) / per_row : 0;
+    if (rows < TILE_MIN_ROWS) rows = TILE_MIN_ROWS;
+    return rows < (size_t)out_h ? (int)rows : out_h;
 }
 
-Image *scale_image_factor(Image *img, float factor) {
-    if (!img || !img->data || factor <= 0.0f) {
-        fprintf(stderr, "Error: Invalid parameters for scale\n");
-        return NULL;
-    }
-    
-    int w_out = (int)(img->width * factor);
-    int h_out = (int)(img->height * factor);
-    
-    if (w_out <= 0 || h_out <= 0) {
-         fprintf(stderr, "Error: Scale factor results in zero or negative size\n");
-         return NULL;
+// Runs one pass over output rows [p->row0, p->row1)
+static int run_tile_pass(TilePass *p, Image *in, int in_y0, Image *out, int out_y0) {
+    RowJob job = { .src = in, .dst = out, .src_y0 = in_y0, .dst_y0 = out_y0 };
+
+    switch (p->kind) {
+        case TILE_POINT:
+            if (in->type != PIXEL_U8) {
+                job.ops = p->ops;
+                job.nops = p->nops;
+                parallel_for_band(p->row0, p->row1, point_ops_deep_rows, &job);
+            } else if (p->nsegs == 1 && !p->segs[0].luma) {
+                job.lut = p->segs[0].lut;
+                parallel_for_band(p->row0, p->row1, lut_rows, &job);
+            } else {
+                job.segs = p->segs;
+                job.nsegs = p->nsegs;
+                parallel_for_band(p->row0, p->row1, point_ops_rows, &job);
+            }
+            break;
+        case TILE_BLUR:
+            job.ival = p->radius;
+            parallel_for_band(p->row0, p->row1, blur_rows, &job);
+            if (job.failed) {
+                fprintf(stderr, "Error: Memory allocation failed for blur column sums\n");
+                return 0;
+            }
+            break;
+        case TILE_SHARPEN:
+            job.kernel = p->kernel;
+            parallel_for_band(p->row0, p->row1, convolve_rows, &job);
+            break;
+        case TILE_CROP: {
+            size_t psize = pixel_size(in);
+            size_t row_size = (size_t)p->out_w * psize;
+            for (int y = p->row0; y < p->row1; y++) {
+                memcpy(out->data + (size_t)(y - out_y0) * row_size,
+                       in->data + ((size_t)(y + p->y - in_y0) * p->in_w + p->x) * psize, row_size);
+            }
+            break;
+        }
+        case TILE_FLIP_X:
+        case TILE_FLIP_Y:
+            job.ival = p->kind == TILE_FLIP_X ? ORIENT_FLIP_V : ORIENT_FLIP_H;
+            parallel_for_band(p->row0, p->row1, orient_rows, &job);
+            break;
     }
-    
-    return resize_image_nearest(img, w_out, h_out);
+    return 1;
 }
 
 /**
- * @brief Rotates an image by 90 degrees left or right.
+ * @brief Runs a pipeline of local operators band by band.
  *
- * This is much faster than the general-purpose rotate.
- * Note: The output image will have its width and height swapped.
+ * Gives exactly the image that applying each stage to the whole image in
+ * turn would, but intermediate results only ever exist as strips of a few
+ * rows, sized so that they fit in about 'budget' bytes. Stages that only
+ * need part of their input (a crop near the end) only compute that part.
  *
- * @param img The source image.
- * @param direction 1 for 90-degrees clockwise (right), -1 for 90-degrees counter-clockwise (left).
- * @return A new, rotated Image, or NULL on failure.
+ * @param img The source Image.
+ * @param stages The operations, applied in array order.
+ * @param nstages Number of stages.
+ * @param budget Target size in bytes for intermediate strips and scratch.
+ * @return A new Image, or NULL on failure.
  */
-Image *rotate_image_90(Image *img, int direction) {
-    if (!img || !img->data) {
-        fprintf(stderr, "Error: Invalid image in rotate_image_90\n");
+Image *run_tiled(Image *img, const TileStage *stages, int nstages, size_t budget) {
+    if (!img || !img->data || !stages || nstages < 1) {
+        fprintf(stderr, "Error: Invalid parameters in run_tiled\n");
         return NULL;
     }
-    if (direction != 1 && direction != -1) {
-        fprintf(stderr, "Error: Invalid direction for rotate_image_90 (must be 1 or -1)\n");
+
+    TilePass *passes = calloc(nstages, sizeof(TilePass));
+    if (!passes) {
+        fprintf(stderr, "Error: Memory allocation failed in run_tiled\n");
         return NULL;
     }
+    int npasses = build_tile_passes(passes, img, stages, nstages);
+    if (npasses < 0) {
+        free_tile_passes(passes, nstages);
+        return NULL;
+    }
+    TilePass *last = &passes[npasses - 1];
+    int cn = img->channels;
+    size_t psize = pixel_size(img);
+    int band = tile_band_rows(passes, npasses, cn, img->type, budget);
 
-    int w_in = img->width;
-    int h_in = img->height;
-    int c_in = img->channels;
-
-    int w_out = h_in;
-    int h_out = w_in;
+    // Every strip but the last pass's is sized for a full band plus halo
+    int down = 0;
+    for (int k = npasses - 1; k >= 0; k--) {
+        TilePass *p = &passes[k];
+        if (k < npasses - 1) {
+            int rows = band + 2 * down < p->out_h ? band + 2 * down : p->out_h;
+            p->buf = malloc((size_t)p->out_w * psize * rows);
+            if (!p->buf) {
+                fprintf(stderr, "Error: Memory allocation failed for tile strips\n");
+                free_tile_passes(passes, nstages);
+                return NULL;
+            }
+        }
+        down += p->halo;
+    }
 
     Image *out = malloc(sizeof(Image));
     if (!out) {
-        fprintf(stderr, "Error: Memory allocation failed for Image struct (rotate_90)\n");
+        fprintf(stderr, "Error: Memory allocation failed in run_tiled\n");
+        free_tile_passes(passes, nstages);
         return NULL;
     }
-    out->width = w_out;
-    out->height = h_out;
-    out->channels = 3;
-    size_t data_size = w_out * h_out * out->channels;
-    
-    out->data = malloc(data_size);
+    out->width = last->out_w;
+    out->height = last->out_h;
+    out->channels = cn;
+    out->type = img->type;
+    out->refcount = 1;
+    out->data = malloc(image_data_size(out));
     if (!out->data) {
-         fprintf(stderr, "Error: Memory allocation failed for image data (rotate_90)\n");
-         free(out);
-         return NULL;
-    }
-    
-
-    if (c_in < 3) {
-         fprintf(stderr, "Error: rotate_90 input must have at least 3 channels\n");
-         free(out->data);
-         free(out);
-         return NULL;
+        fprintf(stderr, "Error: Memory allocation failed for tiled output\n");
+        free_tile_passes(passes, nstages);
+        free(out);
+        return NULL;
     }
 
-    for (int y_out = 0; y_out < h_out; y_out++) {
-        for (int x_out = 0; x_out < w_out; x_out++) {
-            int x_src, y_src;
+    for (int y0 = 0; y0 < out->height; y0 += band) {
+        int y1 = y0 + band < out->height ? y0 + band : out->height;
 
-            if (direction == 1) { 
-                x_src = y_out;
-                y_src = h_in - 1 - x_out;
-            } else { 
-                x_src = w_in - 1 - y_out;
-                y_src = x_out;
+        // Backwards: the rows each pass has to produce for this band
+        int a = y0, b = y1;
+        for (int k = npasses - 1; k >= 0; k--) {
+            TilePass *p = &passes[k];
+            p->row0 = a;
+            p->row1 = b;
+            if (p->kind == TILE_CROP) {
+                a += p->y;
+                b += p->y;
+            } else if (p->kind == TILE_FLIP_X) {
+                int flipped = p->in_h - b;
+                b = p->in_h - a;
+                a = flipped;
+            } else {
+                a = a - p->halo < 0 ? 0 : a - p->halo;
+                b = b + p->halo > p->in_h ? p->in_h : b + p->halo;
             }
+        }
 
-            unsigned char *p = img->data + (y_src * w_in + x_src) * c_in;
-            unsigned char *q = out->data + (y_out * w_out + x_out) * 3;
-            
-            q[0] = p[0];
-            q[1] = p[1];
-            q[2] = p[2];
+        // Forwards: each pass reads the previous pass's strip
+        for (int k = 0; k < npasses; k++) {
+            TilePass *p = &passes[k];
+            Image in_strip = { p->in_w, p->in_h, cn, img->type, 1, k > 0 ? passes[k - 1].buf : NULL };
+            Image out_strip = { p->out_w, p->out_h, cn, img->type, 1, p->buf };
+            Image *in = k > 0 ? &in_strip : img;
+            int in_y0 = k > 0 ? passes[k - 1].row0 : 0;
+            Image *dst = k < npasses - 1 ? &out_strip : out;
+            int out_y0 = k < npasses - 1 ? p->row0 : 0;
+
+            if (!run_tile_pass(p, in, in_y0, dst, out_y0)) {
+                free_tile_passes(passes, nstages);
+                free(out->data);
+                free(out);
+                return NULL;
+            }
         }
     }
-    
+
+    free_tile_passes(passes, nstages);
     return out;
 }
 
+// --- END TILED EXECUTION ---
+
 // Helper function to print a string while interpreting basic escape sequences
 void print_string_escaped(const char *s) {
     if (!s) return;
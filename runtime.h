@@ -3,18 +3,121 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include "png.h"
+
+// Sample type of Image.data; every channel of every pixel has the same one
+typedef enum {
+    PIXEL_U8,       // 0 to 255
+    PIXEL_U16,      // 0 to 65535, host byte order
+    PIXEL_F32       // 0.0 (black) to 1.0 (white), may go past either (HDR)
+} PixelType;
 
 typedef struct {
     int width, height, channels;
-    unsigned char *data;
+    PixelType type;
+    int refcount;           // number of owners sharing this buffer
+    unsigned char *data;    // packed rows of width * channels samples
 } Image;
 
+// File formats save_image_as() can write
+typedef enum {
+    IMAGE_FORMAT_AUTO,      // from the file extension, PNG if unknown
+    IMAGE_FORMAT_PNG,
+    IMAGE_FORMAT_JPEG,
+    IMAGE_FORMAT_BMP,
+    IMAGE_FORMAT_TGA,       // RLE compressed
+    IMAGE_FORMAT_PPM,       // binary P6, P5 for gray
+    IMAGE_FORMAT_PAM,       // P7
+    IMAGE_FORMAT_IMLRAW,
+    IMAGE_FORMAT_HDR        // Radiance RGBE
+} ImageFormat;
+
+// JPEG chroma resolution
+typedef enum {
+    JPEG_SUBSAMPLE_AUTO,    // 4:2:0 up to quality 90, 4:4:4 above
+    JPEG_SUBSAMPLE_420,     // chroma at half resolution both ways
+    JPEG_SUBSAMPLE_444      // full-resolution chroma
+} JpegSubsample;
+
+#define JPEG_DEFAULT_QUALITY 90
+
+// Per-pixel operations that can be fused into a single pass by apply_point_ops()
+typedef enum {
+    POINT_GRAYSCALE,
+    POINT_INVERT,
+    POINT_BRIGHTNESS,   // ival = signed bias
+    POINT_CONTRAST,     // fval = contrast factor
+    POINT_THRESHOLD     // ival = threshold, direction = 1 standard / 0 inverted
+} PointOpKind;
+
+typedef struct {
+    PointOpKind kind;
+    int ival;
+    int direction;
+    float fval;
+} PointOp;
+
+// How convolve_kernel() extends an image past its edges
+typedef enum {
+    BORDER_CLAMP,       // repeat the edge pixel
+    BORDER_MIRROR,      // reflect, edge pixel included (cba|abc|cba)
+    BORDER_WRAP,        // tile the image
+    BORDER_ZERO         // black outside
+} BorderMode;
+
+// The eight flip/rotate combinations, for orient_image()
+typedef enum {
+    ORIENT_IDENTITY,
+    ORIENT_FLIP_H,      // mirror left-right
+    ORIENT_FLIP_V,      // mirror top-bottom
+    ORIENT_ROTATE_180,
+    ORIENT_TRANSPOSE,   // mirror along the main diagonal
+    ORIENT_ROTATE_90,   // clockwise
+    ORIENT_TRANSVERSE,  // mirror along the anti-diagonal
+    ORIENT_ROTATE_270   // clockwise, i.e. 90 counter-clockwise
+} Orientation;
+
+// Sampling filter for warp_affine(), rotate_image() and resize_image()
+typedef enum {
+    INTERP_NEAREST,
+    INTERP_BILINEAR,
+    INTERP_BICUBIC,     // Catmull-Rom
+    INTERP_BOX,         // resize_image() only
+    INTERP_LANCZOS3     // resize_image() only
+} Interp;
+
+// Local operators the tiled executor can run a band of rows at a time
+typedef enum {
+    TILE_POINT,         // op
+    TILE_BLUR,          // radius
+    TILE_SHARPEN,       // amount, direction as for sharpen_image()
+    TILE_CROP,          // x, y, w, h
+    TILE_FLIP_X,        // flipX(): rows in reverse order
+    TILE_FLIP_Y         // flipY(): each row mirrored
+} TileStageKind;
+
+typedef struct {
+    TileStageKind kind;
+    PointOp op;
+    int radius;
+    int amount, direction;
+    int x, y, w, h;
+} TileStage;
+
 // runtime ops
 Image *load_image(const char *filename);
+Image *load_image_scaled(const char *filename, int want_w, int want_h);
+int is_jpeg_file(const char *filename);
 void save_image(const char *filename, Image *img);
+void save_image_as(const char *filename, Image *img, ImageFormat format);
+void save_image_png(const char *filename, Image *img, int level, PngFilter filter);
+void save_image_jpeg(const char *filename, Image *img, int quality, JpegSubsample subsample);
+ImageFormat image_format_from_path(const char *filename);
 Image *crop_image(Image *img, int x, int y, int w, int h);
 Image *blur_image(Image *img, int radius);
+Image *gaussian_image(Image *img, float sigma);
 void free_image(Image *img);
+Image *retain_image(Image *img);
 
 
 Image *grayscale_image(Image *img);
@@ -22,16 +125,43 @@ Image *invert_image(Image *img);
 Image *flip_image_along_X(Image *img);
 Image *flip_image_along_Y(Image *img);
 Image* run_canny(Image *img, float sigma, unsigned char low_thresh, unsigned char high_thresh);
+void canny_shutdown(void);        // frees the scratch reused across detections
 Image *adjust_brightness(Image *img, int bias, int direction);
 Image *adjust_contrast(Image *img, int amount, int direction);
 Image *apply_threshold(Image *img, int threshold, int direction);
 Image *convolve_image(Image *img, float kernel[3][3]);
+Image *convolve_kernel(Image *img, const float *kernel, int kw, int kh, BorderMode border);
 Image *sharpen_image(Image *img, int amount, int direction);
 Image *blend_images(Image *img1, Image *img2, float alpha);
 Image *mask_image(Image *img, Image *mask);
 Image *resize_image_nearest(Image *img, int new_w, int new_h);
-Image *scale_image_factor(Image *img, float factor);
+Image *resize_image(Image *img, int new_w, int new_h, Interp filter);
+Image *scale_image_factor(Image *img, float factor, Interp filter);
+Image *pyramid_image(Image *img, int levels);
 Image *rotate_image_90(Image *img, int direction) ;
+Image *orient_image(Image *img, Orientation orientation);
+Image *warp_affine(Image *img, const double m[6], int out_w, int out_h, Interp interp);
+Image *rotate_image(Image *img, double degrees, Interp interp, int expand);
+Image *apply_point_ops(Image *img, const PointOp *ops, int nops);
+Image *convert_channels(Image *img, int channels);
+Image *premultiply_image(Image *img);
+Image *unpremultiply_image(Image *img);
+
+// Sample types
+size_t pixel_type_size(PixelType type);
+size_t image_data_size(const Image *img);
+Image *convert_pixel_type(Image *img, PixelType type);
+
+// 256-entry lookup tables for per-channel point ops (invert, brighten, contrast)
+void lut_identity(unsigned char *lut);
+int lut_compose_point_ops(unsigned char *lut, const PointOp *ops, int nops);
+Image *apply_lut(Image *img, const unsigned char *lut);
+
+// Tiled execution: bounds the working set of a pipeline of local operators
+// to roughly 'budget' bytes on top of its source and result images.
+void tile_set_budget(size_t bytes);     // 0 disables tiling
+size_t tile_budget(void);
+Image *run_tiled(Image *img, const TileStage *stages, int nstages, size_t budget);
 
 void print_string_escaped(const char *s);
 
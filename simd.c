@@ -0,0 +1,702 @@
+#include "simd.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define IML_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+// --- SCALAR REFERENCE ---
+
+void scalar_invert(const unsigned char *src, unsigned char *dst, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = 255 - src[i];
+    }
+}
+
+void scalar_grayscale_rgb(const unsigned char *src, unsigned char *dst, size_t npixels) {
+    for (size_t i = 0; i < npixels; i++) {
+        const unsigned char *p = src + i * 3;
+        unsigned char *q = dst + i * 3;
+        // Integer luminance, identical to grayscale_image()
+        unsigned char gray = (unsigned char)((299 * p[0] + 587 * p[1] + 114 * p[2]) / 1000);
+        q[0] = gray;
+        q[1] = gray;
+        q[2] = gray;
+    }
+}
+
+void scalar_blend(const unsigned char *a, const unsigned char *b, unsigned char *dst,
+                  size_t n, float alpha) {
+    float alpha_neg = 1.0f - alpha;
+    for (size_t i = 0; i < n; i++) {
+        float val = (a[i] * alpha_neg) + (b[i] * alpha);
+        if (val < 0.0f) dst[i] = 0;
+        else if (val > 255.0f) dst[i] = 255;
+        else dst[i] = (unsigned char)val;
+    }
+}
+
+void scalar_madd_u8_f32(float *acc, const unsigned char *src, size_t n, float k) {
+    for (size_t i = 0; i < n; i++) {
+        acc[i] += src[i] * k;
+    }
+}
+
+void scalar_madd_f32(float *acc, const float *src, size_t n, float k) {
+    for (size_t i = 0; i < n; i++) {
+        acc[i] += src[i] * k;
+    }
+}
+
+void scalar_iir3_f32(float *dst, const float *in, const float *p1, const float *p2,
+                     const float *p3, size_t n, const float *c) {
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = c[0] * in[i] + c[1] * p1[i] + c[2] * p2[i] + c[3] * p3[i];
+    }
+}
+
+void scalar_f32_to_u8(unsigned char *dst, const float *src, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        float v = src[i];
+        if (v < 0.0f) dst[i] = 0;
+        else if (v > 255.0f) dst[i] = 255;
+        else dst[i] = (unsigned char)(v + 0.5f);
+    }
+}
+
+void scalar_warp_bilinear(unsigned char *dst, const unsigned char *src, size_t stride,
+                          int64_t x, int64_t y, int64_t dx, int64_t dy, size_t n, int cn) {
+    for (size_t i = 0; i < n; i++, x += dx, y += dy, dst += cn) {
+        const unsigned char *p = src + (size_t)(y >> SIMD_WARP_BITS) * stride +
+                                 (size_t)(x >> SIMD_WARP_BITS) * cn;
+        int fx = (int)(x >> (SIMD_WARP_BITS - 7)) & 127;
+        int fy = (int)(y >> (SIMD_WARP_BITS - 7)) & 127;
+        for (int c = 0; c < cn; c++) {
+            int top = p[c] * (128 - fx) + p[c + cn] * fx;
+            int bot = p[stride + c] * (128 - fx) + p[stride + c + cn] * fx;
+            dst[c] = (unsigned char)((top * (128 - fy) + bot * fy + 8192) >> 14);
+        }
+    }
+}
+
+static inline unsigned char resample_round(int acc) {
+    acc >>= SIMD_RESAMPLE_BITS;
+    return (unsigned char)(acc < 0 ? 0 : acc > 255 ? 255 : acc);
+}
+
+void scalar_resample_horiz(unsigned char *dst, const unsigned char *src, const int *start,
+                           const int16_t *w, int taps, size_t n, int cn) {
+    for (size_t i = 0; i < n; i++, w += taps, dst += cn) {
+        const unsigned char *p = src + (size_t)start[i] * cn;
+        for (int c = 0; c < cn; c++) {
+            int acc = 1 << (SIMD_RESAMPLE_BITS - 1);
+            for (int k = 0; k < taps; k++) acc += p[k * cn + c] * w[k];
+            dst[c] = resample_round(acc);
+        }
+    }
+}
+
+void scalar_resample_vert(unsigned char *dst, const unsigned char *src, size_t stride,
+                          const int16_t *w, int taps, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        int acc = 1 << (SIMD_RESAMPLE_BITS - 1);
+        for (int k = 0; k < taps; k++) acc += src[k * stride + i] * w[k];
+        dst[i] = resample_round(acc);
+    }
+}
+
+void scalar_halve(unsigned char *dst, const unsigned char *row0, const unsigned char *row1,
+                  size_t src_w, int cn) {
+    size_t n = src_w > 1 ? src_w / 2 : 1;
+    for (size_t i = 0; i < n; i++, dst += cn) {
+        size_t a = 2 * i * cn, b = (2 * i + 1 < src_w ? 2 * i + 1 : src_w - 1) * cn;
+        for (int c = 0; c < cn; c++) {
+            dst[c] = (unsigned char)((row0[a + c] + row0[b + c] + row1[a + c] + row1[b + c] + 2) >> 2);
+        }
+    }
+}
+
+void (*simd_invert)(const unsigned char *, unsigned char *, size_t) = scalar_invert;
+void (*simd_grayscale_rgb)(const unsigned char *, unsigned char *, size_t) = scalar_grayscale_rgb;
+void (*simd_blend)(const unsigned char *, const unsigned char *, unsigned char *, size_t, float) = scalar_blend;
+void (*simd_madd_u8_f32)(float *, const unsigned char *, size_t, float) = scalar_madd_u8_f32;
+void (*simd_madd_f32)(float *, const float *, size_t, float) = scalar_madd_f32;
+void (*simd_iir3_f32)(float *, const float *, const float *, const float *, const float *,
+                      size_t, const float *) = scalar_iir3_f32;
+void (*simd_f32_to_u8)(unsigned char *, const float *, size_t) = scalar_f32_to_u8;
+void (*simd_warp_bilinear)(unsigned char *, const unsigned char *, size_t, int64_t, int64_t,
+                           int64_t, int64_t, size_t, int) = scalar_warp_bilinear;
+void (*simd_resample_horiz)(unsigned char *, const unsigned char *, const int *, const int16_t *,
+                            int, size_t, int) = scalar_resample_horiz;
+void (*simd_resample_vert)(unsigned char *, const unsigned char *, size_t, const int16_t *,
+                           int, size_t) = scalar_resample_vert;
+void (*simd_halve)(unsigned char *, const unsigned char *, const unsigned char *,
+                   size_t, int) = scalar_halve;
+
+static const char *level_name = "scalar";
+
+#ifdef IML_X86_SIMD
+
+// --- SSE2 / SSSE3 ---
+
+__attribute__((target("sse2")))
+static void sse2_invert(const unsigned char *src, unsigned char *dst, size_t n) {
+    const __m128i ones = _mm_set1_epi8((char)0xFF);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(v, ones));
+    }
+    scalar_invert(src + i, dst + i, n - i);
+}
+
+// Same float expression as scalar_blend, four lanes at a time. Rounding is
+// identical (no FMA), and packus saturation does the 0..255 clamp.
+__attribute__((target("sse2")))
+static void sse2_blend(const unsigned char *a, const unsigned char *b, unsigned char *dst,
+                       size_t n, float alpha) {
+    const __m128 va = _mm_set1_ps(alpha);
+    const __m128 vna = _mm_set1_ps(1.0f - alpha);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i pa = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i pb = _mm_loadu_si128((const __m128i *)(b + i));
+        __m128i a16[2] = { _mm_unpacklo_epi8(pa, zero), _mm_unpackhi_epi8(pa, zero) };
+        __m128i b16[2] = { _mm_unpacklo_epi8(pb, zero), _mm_unpackhi_epi8(pb, zero) };
+        __m128i res16[2];
+        for (int h = 0; h < 2; h++) {
+            __m128i a32lo = _mm_unpacklo_epi16(a16[h], zero);
+            __m128i a32hi = _mm_unpackhi_epi16(a16[h], zero);
+            __m128i b32lo = _mm_unpacklo_epi16(b16[h], zero);
+            __m128i b32hi = _mm_unpackhi_epi16(b16[h], zero);
+            __m128 lo = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(a32lo), vna),
+                                   _mm_mul_ps(_mm_cvtepi32_ps(b32lo), va));
+            __m128 hi = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(a32hi), vna),
+                                   _mm_mul_ps(_mm_cvtepi32_ps(b32hi), va));
+            res16[h] = _mm_packs_epi32(_mm_cvttps_epi32(lo), _mm_cvttps_epi32(hi));
+        }
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(res16[0], res16[1]));
+    }
+    scalar_blend(a + i, b + i, dst + i, n - i, alpha);
+}
+
+// Separate multiply and add, as in the scalar loop, so sums match exactly
+__attribute__((target("sse2")))
+static void sse2_madd_u8_f32(float *acc, const unsigned char *src, size_t n, float k) {
+    const __m128 vk = _mm_set1_ps(k);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i p = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i p16[2] = { _mm_unpacklo_epi8(p, zero), _mm_unpackhi_epi8(p, zero) };
+        for (int h = 0; h < 2; h++) {
+            __m128i p32[2] = { _mm_unpacklo_epi16(p16[h], zero), _mm_unpackhi_epi16(p16[h], zero) };
+            for (int j = 0; j < 2; j++) {
+                float *a = acc + i + 8 * h + 4 * j;
+                __m128 prod = _mm_mul_ps(_mm_cvtepi32_ps(p32[j]), vk);
+                _mm_storeu_ps(a, _mm_add_ps(_mm_loadu_ps(a), prod));
+            }
+        }
+    }
+    scalar_madd_u8_f32(acc + i, src + i, n - i, k);
+}
+
+__attribute__((target("sse2")))
+static void sse2_madd_f32(float *acc, const float *src, size_t n, float k) {
+    const __m128 vk = _mm_set1_ps(k);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 prod = _mm_mul_ps(_mm_loadu_ps(src + i), vk);
+        _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), prod));
+    }
+    scalar_madd_f32(acc + i, src + i, n - i, k);
+}
+
+// Same association as the scalar loop: ((c0*in + c1*p1) + c2*p2) + c3*p3.
+// dst may alias in.
+__attribute__((target("sse2")))
+static void sse2_iir3_f32(float *dst, const float *in, const float *p1, const float *p2,
+                          const float *p3, size_t n, const float *c) {
+    const __m128 c0 = _mm_set1_ps(c[0]), c1 = _mm_set1_ps(c[1]);
+    const __m128 c2 = _mm_set1_ps(c[2]), c3 = _mm_set1_ps(c[3]);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_add_ps(_mm_mul_ps(c0, _mm_loadu_ps(in + i)), _mm_mul_ps(c1, _mm_loadu_ps(p1 + i)));
+        v = _mm_add_ps(v, _mm_mul_ps(c2, _mm_loadu_ps(p2 + i)));
+        v = _mm_add_ps(v, _mm_mul_ps(c3, _mm_loadu_ps(p3 + i)));
+        _mm_storeu_ps(dst + i, v);
+    }
+    scalar_iir3_f32(dst + i, in + i, p1 + i, p2 + i, p3 + i, n - i, c);
+}
+
+// Rounds half up like the scalar (v + 0.5) truncation; packus does the clamp
+__attribute__((target("sse2")))
+static void sse2_f32_to_u8(unsigned char *dst, const float *src, size_t n) {
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 lo = _mm_setzero_ps();
+    const __m128 hi = _mm_set1_ps(255.0f);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i q[4];
+        for (int j = 0; j < 4; j++) {
+            __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i + 4 * j), lo), hi);
+            q[j] = _mm_cvttps_epi32(_mm_add_ps(v, half));
+        }
+        __m128i q16a = _mm_packs_epi32(q[0], q[1]);
+        __m128i q16b = _mm_packs_epi32(q[2], q[3]);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(q16a, q16b));
+    }
+    scalar_f32_to_u8(dst + i, src + i, n - i);
+}
+
+// Stores the low cn (1, 3 or 4) bytes of px with fixed-size moves
+static inline void store_pixel(unsigned char *dst, uint32_t px, int cn) {
+    switch (cn) {
+        case 1: dst[0] = (unsigned char)px; break;
+        case 4: memcpy(dst, &px, 4); break;
+        default: memcpy(dst, &px, 3); break;
+    }
+}
+
+// Two adjacent pixels of cn channels as 16-bit channel pairs, e.g.
+// [r0 r1 g0 g1 b0 b1 r1 0] for RGB. For RGB two overlapping 4-byte loads
+// keep the read inside the 6 bytes.
+__attribute__((target("sse2")))
+static inline __m128i sse2_load_pixel_pair(const unsigned char *p, int cn) {
+    uint32_t lo, hi;
+    if (cn == 3) {
+        memcpy(&lo, p, 4);              // r0 g0 b0 r1
+        memcpy(&hi, p + 2, 4);
+        hi >>= 8;                       // r1 g1 b1 0
+    } else if (cn == 4) {
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+    } else {
+        lo = p[0];
+        hi = p[1];
+    }
+    __m128i a = _mm_cvtsi32_si128((int)lo);
+    __m128i b = _mm_cvtsi32_si128((int)hi);
+    return _mm_unpacklo_epi8(_mm_unpacklo_epi8(a, b), _mm_setzero_si128());
+}
+
+// One pixel per iteration, all channels in one register. pmaddwd does
+// each weighted pair sum exactly as the scalar code does. Inlined once per
+// channel count so cn is a constant in the loop.
+__attribute__((target("sse2"), always_inline))
+static inline void sse2_warp_bilinear_cn(unsigned char *dst, const unsigned char *src, size_t stride,
+                                         int64_t x, int64_t y, int64_t dx, int64_t dy, size_t n, int cn) {
+    const __m128i round = _mm_set1_epi32(8192);
+    for (size_t i = 0; i < n; i++, x += dx, y += dy, dst += cn) {
+        const unsigned char *p = src + (size_t)(y >> SIMD_WARP_BITS) * stride +
+                                 (size_t)(x >> SIMD_WARP_BITS) * cn;
+        int fx = (int)(x >> (SIMD_WARP_BITS - 7)) & 127;
+        int fy = (int)(y >> (SIMD_WARP_BITS - 7)) & 127;
+        __m128i wx = _mm_set1_epi32((fx << 16) | (128 - fx));
+        __m128i wy = _mm_set1_epi32((fy << 16) | (128 - fy));
+
+        __m128i top = _mm_madd_epi16(sse2_load_pixel_pair(p, cn), wx);
+        __m128i bot = _mm_madd_epi16(sse2_load_pixel_pair(p + stride, cn), wx);
+        __m128i tb = _mm_unpacklo_epi16(_mm_packs_epi32(top, top), _mm_packs_epi32(bot, bot));
+        __m128i v = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(tb, wy), round), 14);
+        v = _mm_packus_epi16(_mm_packs_epi32(v, v), v);
+
+        store_pixel(dst, (uint32_t)_mm_cvtsi128_si32(v), cn);
+    }
+}
+
+__attribute__((target("sse2")))
+static void sse2_warp_bilinear(unsigned char *dst, const unsigned char *src, size_t stride,
+                               int64_t x, int64_t y, int64_t dx, int64_t dy, size_t n, int cn) {
+    switch (cn) {
+        case 1: sse2_warp_bilinear_cn(dst, src, stride, x, y, dx, dy, n, 1); break;
+        case 4: sse2_warp_bilinear_cn(dst, src, stride, x, y, dx, dy, n, 4); break;
+        default: sse2_warp_bilinear_cn(dst, src, stride, x, y, dx, dy, n, 3); break;
+    }
+}
+
+// Two int16 weights as the (low, high) pair pmaddwd multiplies against
+static inline int weight_pair(int16_t lo, int16_t hi) {
+    return (int)((uint32_t)(uint16_t)hi << 16 | (uint16_t)lo);
+}
+
+// One output pixel per iteration: source pixels go through pmaddwd two at
+// a time against their pair of weights, accumulating [r g b a] in int32.
+__attribute__((target("sse2"), always_inline))
+static inline void sse2_resample_horiz_cn(unsigned char *dst, const unsigned char *src, const int *start,
+                                          const int16_t *w, int taps, size_t n, int cn) {
+    const __m128i zero = _mm_setzero_si128();
+    for (size_t i = 0; i < n; i++, w += taps, dst += cn) {
+        const unsigned char *p = src + (size_t)start[i] * cn;
+        __m128i acc = _mm_set1_epi32(1 << (SIMD_RESAMPLE_BITS - 1));
+        int k = 0;
+        for (; k + 1 < taps; k += 2) {
+            __m128i wk = _mm_set1_epi32(weight_pair(w[k], w[k + 1]));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(sse2_load_pixel_pair(p + k * cn, cn), wk));
+        }
+        if (k < taps) {
+            uint32_t v = 0;
+            if (cn == 1) v = p[k];
+            else memcpy(&v, p + k * cn, cn == 4 ? 4 : 3);
+            __m128i px = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)v), zero);
+            px = _mm_unpacklo_epi16(px, zero);                  // [r 0 g 0 b 0 a 0]
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(px, _mm_set1_epi32(weight_pair(w[k], 0))));
+        }
+        __m128i v = _mm_srai_epi32(acc, SIMD_RESAMPLE_BITS);
+        v = _mm_packus_epi16(_mm_packs_epi32(v, v), v);
+        store_pixel(dst, (uint32_t)_mm_cvtsi128_si32(v), cn);
+    }
+}
+
+__attribute__((target("sse2")))
+static void sse2_resample_horiz(unsigned char *dst, const unsigned char *src, const int *start,
+                                const int16_t *w, int taps, size_t n, int cn) {
+    switch (cn) {
+        case 1: sse2_resample_horiz_cn(dst, src, start, w, taps, n, 1); break;
+        case 4: sse2_resample_horiz_cn(dst, src, start, w, taps, n, 4); break;
+        default: sse2_resample_horiz_cn(dst, src, start, w, taps, n, 3); break;
+    }
+}
+
+// 8 bytes per iteration; rows are interleaved in pairs so one pmaddwd
+// applies two taps
+__attribute__((target("sse2")))
+static void sse2_resample_vert(unsigned char *dst, const unsigned char *src, size_t stride,
+                               const int16_t *w, int taps, size_t n) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi32(1 << (SIMD_RESAMPLE_BITS - 1));
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i lo = round, hi = round;
+        int k = 0;
+        for (; k + 1 < taps; k += 2) {
+            __m128i wk = _mm_set1_epi32(weight_pair(w[k], w[k + 1]));
+            __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(src + k * stride + i)), zero);
+            __m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(src + (k + 1) * stride + i)), zero);
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), wk));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), wk));
+        }
+        if (k < taps) {
+            __m128i wk = _mm_set1_epi32(weight_pair(w[k], 0));
+            __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(src + k * stride + i)), zero);
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, zero), wk));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, zero), wk));
+        }
+        __m128i v = _mm_packs_epi32(_mm_srai_epi32(lo, SIMD_RESAMPLE_BITS),
+                                    _mm_srai_epi32(hi, SIMD_RESAMPLE_BITS));
+        _mm_storel_epi64((__m128i *)(dst + i), _mm_packus_epi16(v, v));
+    }
+    if (i < n) scalar_resample_vert(dst + i, src + i, stride, w, taps, n - i);
+}
+
+// 16 pixels per iteration. pshufb splits the 48 interleaved bytes into R, G
+// and B planes, madd forms 299R + 587G + 114B in 32 bits, and the exact
+// divide by 1000 is (s >> 3) / 125 done as a 16-bit multiply-high by
+// ceil(2^22 / 125) = 33555 followed by >> 6 (exact for s >> 3 < 32768).
+#define SHUF(...) _mm_setr_epi8(__VA_ARGS__)
+__attribute__((target("ssse3")))
+static void ssse3_grayscale_rgb(const unsigned char *src, unsigned char *dst, size_t npixels) {
+    const __m128i r_mask[3] = {
+        SHUF(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1),
+        SHUF(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1),
+        SHUF(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13) };
+    const __m128i g_mask[3] = {
+        SHUF(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1),
+        SHUF(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1),
+        SHUF(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14) };
+    const __m128i b_mask[3] = {
+        SHUF(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1),
+        SHUF(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1),
+        SHUF(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15) };
+    const __m128i out_mask[3] = {
+        SHUF(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5),
+        SHUF(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10),
+        SHUF(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15) };
+    const __m128i w_rg = _mm_setr_epi16(299, 587, 299, 587, 299, 587, 299, 587);
+    const __m128i w_b = _mm_setr_epi16(114, 0, 114, 0, 114, 0, 114, 0);
+    const __m128i div125 = _mm_set1_epi16((short)33555);
+    const __m128i zero = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + 16 <= npixels; i += 16) {
+        const unsigned char *p = src + i * 3;
+        __m128i v[3] = { _mm_loadu_si128((const __m128i *)p),
+                         _mm_loadu_si128((const __m128i *)(p + 16)),
+                         _mm_loadu_si128((const __m128i *)(p + 32)) };
+        __m128i r = zero, g = zero, b = zero;
+        for (int j = 0; j < 3; j++) {
+            r = _mm_or_si128(r, _mm_shuffle_epi8(v[j], r_mask[j]));
+            g = _mm_or_si128(g, _mm_shuffle_epi8(v[j], g_mask[j]));
+            b = _mm_or_si128(b, _mm_shuffle_epi8(v[j], b_mask[j]));
+        }
+
+        __m128i q16[2];
+        for (int h = 0; h < 2; h++) {
+            __m128i r16 = h ? _mm_unpackhi_epi8(r, zero) : _mm_unpacklo_epi8(r, zero);
+            __m128i g16 = h ? _mm_unpackhi_epi8(g, zero) : _mm_unpacklo_epi8(g, zero);
+            __m128i b16 = h ? _mm_unpackhi_epi8(b, zero) : _mm_unpacklo_epi8(b, zero);
+            __m128i s_lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(r16, g16), w_rg),
+                                         _mm_madd_epi16(_mm_unpacklo_epi16(b16, zero), w_b));
+            __m128i s_hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(r16, g16), w_rg),
+                                         _mm_madd_epi16(_mm_unpackhi_epi16(b16, zero), w_b));
+            __m128i s8 = _mm_packs_epi32(_mm_srli_epi32(s_lo, 3), _mm_srli_epi32(s_hi, 3));
+            q16[h] = _mm_srli_epi16(_mm_mulhi_epu16(s8, div125), 6);
+        }
+        __m128i gray = _mm_packus_epi16(q16[0], q16[1]);
+
+        unsigned char *q = dst + i * 3;
+        _mm_storeu_si128((__m128i *)q, _mm_shuffle_epi8(gray, out_mask[0]));
+        _mm_storeu_si128((__m128i *)(q + 16), _mm_shuffle_epi8(gray, out_mask[1]));
+        _mm_storeu_si128((__m128i *)(q + 32), _mm_shuffle_epi8(gray, out_mask[2]));
+    }
+    scalar_grayscale_rgb(src + i * 3, dst + i * 3, npixels - i);
+}
+
+// 32 bytes of each row -> 16 output bytes per iteration for gray (the
+// pairs are already adjacent) and RGBA (pshufb pairs bytes 4 apart).
+// pmaddubsw adds each pair and the two rows' sums are added in 16 bits
+// before rounding.
+__attribute__((target("ssse3")))
+static void ssse3_halve_gray_rgba(unsigned char *dst, const unsigned char *row0, const unsigned char *row1,
+                                  size_t src_w, int cn) {
+    const __m128i pair_mask = SHUF(0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13, 10, 14, 11, 15);
+    const __m128i ones = _mm_set1_epi8(1);
+    const __m128i two = _mm_set1_epi16(2);
+
+    size_t n = src_w > 1 ? src_w / 2 : 1;
+    size_t step = 16 / cn;      // output pixels per iteration
+    size_t i = 0;
+    for (; i + step <= n; i += step) {
+        __m128i sum[2] = { two, two };
+        for (int r = 0; r < 2; r++) {
+            const unsigned char *p = (r ? row1 : row0) + i * 2 * cn;
+            for (int k = 0; k < 2; k++) {
+                __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * k));
+                if (cn == 4) v = _mm_shuffle_epi8(v, pair_mask);
+                sum[k] = _mm_add_epi16(sum[k], _mm_maddubs_epi16(v, ones));
+            }
+        }
+        _mm_storeu_si128((__m128i *)(dst + i * cn),
+                         _mm_packus_epi16(_mm_srli_epi16(sum[0], 2), _mm_srli_epi16(sum[1], 2)));
+    }
+    if (i < n) scalar_halve(dst + i * cn, row0 + i * 2 * cn, row1 + i * 2 * cn, src_w - 2 * i, cn);
+}
+
+// 16 source pixels -> 8 output pixels per iteration. pshufb puts the two
+// bytes each output channel averages side by side (48 source bytes make
+// three registers of pairs), pmaddubsw adds each pair, and the two rows'
+// sums are added in 16 bits before rounding.
+__attribute__((target("ssse3")))
+static void ssse3_halve(unsigned char *dst, const unsigned char *row0, const unsigned char *row1,
+                        size_t src_w, int cn) {
+    if (cn != 3) {
+        ssse3_halve_gray_rgba(dst, row0, row1, src_w, cn);
+        return;
+    }
+
+    const __m128i pair_mask[3][3] = {
+        { SHUF(0, 3, 1, 4, 2, 5, 6, 9, 7, 10, 8, 11, 12, 15, 13, -1),
+          SHUF(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0),
+          SHUF(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1) },
+        { SHUF(14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1),
+          SHUF(-1, 1, 2, 5, 3, 6, 4, 7, 8, 11, 9, 12, 10, 13, 14, -1),
+          SHUF(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1) },
+        { SHUF(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1),
+          SHUF(15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1),
+          SHUF(-1, 2, 0, 3, 4, 7, 5, 8, 6, 9, 10, 13, 11, 14, 12, 15) } };
+    const __m128i ones = _mm_set1_epi8(1);
+    const __m128i two = _mm_set1_epi16(2);
+
+    size_t n = src_w > 1 ? src_w / 2 : 1;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i sum[3] = { two, two, two };
+        for (int r = 0; r < 2; r++) {
+            const unsigned char *p = (r ? row1 : row0) + i * 6;
+            __m128i v[3] = { _mm_loadu_si128((const __m128i *)p),
+                             _mm_loadu_si128((const __m128i *)(p + 16)),
+                             _mm_loadu_si128((const __m128i *)(p + 32)) };
+            for (int k = 0; k < 3; k++) {
+                __m128i pairs = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v[0], pair_mask[k][0]),
+                                                          _mm_shuffle_epi8(v[1], pair_mask[k][1])),
+                                             _mm_shuffle_epi8(v[2], pair_mask[k][2]));
+                sum[k] = _mm_add_epi16(sum[k], _mm_maddubs_epi16(pairs, ones));
+            }
+        }
+        __m128i lo = _mm_packus_epi16(_mm_srli_epi16(sum[0], 2), _mm_srli_epi16(sum[1], 2));
+        __m128i hi = _mm_packus_epi16(_mm_srli_epi16(sum[2], 2), _mm_srli_epi16(sum[2], 2));
+        _mm_storeu_si128((__m128i *)(dst + i * 3), lo);
+        _mm_storel_epi64((__m128i *)(dst + i * 3 + 16), hi);
+    }
+    if (i < n) scalar_halve(dst + i * 3, row0 + i * 6, row1 + i * 6, src_w - 2 * i, 3);
+}
+#undef SHUF
+
+// --- AVX2 ---
+
+__attribute__((target("avx2")))
+static void avx2_invert(const unsigned char *src, unsigned char *dst, size_t n) {
+    const __m256i ones = _mm256_set1_epi8((char)0xFF);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(v, ones));
+    }
+    scalar_invert(src + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void avx2_blend(const unsigned char *a, const unsigned char *b, unsigned char *dst,
+                       size_t n, float alpha) {
+    const __m256 va = _mm256_set1_ps(alpha);
+    const __m256 vna = _mm256_set1_ps(1.0f - alpha);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i res32[2][2];
+        for (int h = 0; h < 2; h++) {
+            __m256i a32 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(a + i + 8 * h)));
+            __m256i b32 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(b + i + 8 * h)));
+            __m256 val = _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(a32), vna),
+                                       _mm256_mul_ps(_mm256_cvtepi32_ps(b32), va));
+            __m256i q = _mm256_cvttps_epi32(val);
+            res32[h][0] = _mm256_castsi256_si128(q);
+            res32[h][1] = _mm256_extracti128_si256(q, 1);
+        }
+        __m128i lo = _mm_packus_epi32(res32[0][0], res32[0][1]);
+        __m128i hi = _mm_packus_epi32(res32[1][0], res32[1][1]);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    scalar_blend(a + i, b + i, dst + i, n - i, alpha);
+}
+
+__attribute__((target("avx2")))
+static void avx2_madd_u8_f32(float *acc, const unsigned char *src, size_t n, float k) {
+    const __m256 vk = _mm256_set1_ps(k);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        for (int h = 0; h < 2; h++) {
+            __m256i p32 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i + 8 * h)));
+            __m256 prod = _mm256_mul_ps(_mm256_cvtepi32_ps(p32), vk);
+            float *a = acc + i + 8 * h;
+            _mm256_storeu_ps(a, _mm256_add_ps(_mm256_loadu_ps(a), prod));
+        }
+    }
+    scalar_madd_u8_f32(acc + i, src + i, n - i, k);
+}
+
+__attribute__((target("avx2")))
+static void avx2_madd_f32(float *acc, const float *src, size_t n, float k) {
+    const __m256 vk = _mm256_set1_ps(k);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 prod = _mm256_mul_ps(_mm256_loadu_ps(src + i), vk);
+        _mm256_storeu_ps(acc + i, _mm256_add_ps(_mm256_loadu_ps(acc + i), prod));
+    }
+    scalar_madd_f32(acc + i, src + i, n - i, k);
+}
+
+__attribute__((target("avx2")))
+static void avx2_iir3_f32(float *dst, const float *in, const float *p1, const float *p2,
+                          const float *p3, size_t n, const float *c) {
+    const __m256 c0 = _mm256_set1_ps(c[0]), c1 = _mm256_set1_ps(c[1]);
+    const __m256 c2 = _mm256_set1_ps(c[2]), c3 = _mm256_set1_ps(c[3]);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_add_ps(_mm256_mul_ps(c0, _mm256_loadu_ps(in + i)),
+                                 _mm256_mul_ps(c1, _mm256_loadu_ps(p1 + i)));
+        v = _mm256_add_ps(v, _mm256_mul_ps(c2, _mm256_loadu_ps(p2 + i)));
+        v = _mm256_add_ps(v, _mm256_mul_ps(c3, _mm256_loadu_ps(p3 + i)));
+        _mm256_storeu_ps(dst + i, v);
+    }
+    scalar_iir3_f32(dst + i, in + i, p1 + i, p2 + i, p3 + i, n - i, c);
+}
+
+// 16 bytes per iteration, as the SSE2 version. The in-lane unpacks leave
+// lo = bytes 0-3, 8-11 and hi = 4-7, 12-15, which packs back in order
+// within each lane; the final permute joins the two lanes' low halves.
+__attribute__((target("avx2")))
+static void avx2_resample_vert(unsigned char *dst, const unsigned char *src, size_t stride,
+                               const int16_t *w, int taps, size_t n) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i round = _mm256_set1_epi32(1 << (SIMD_RESAMPLE_BITS - 1));
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i lo = round, hi = round;
+        int k = 0;
+        for (; k + 1 < taps; k += 2) {
+            __m256i wk = _mm256_set1_epi32(weight_pair(w[k], w[k + 1]));
+            __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src + k * stride + i)));
+            __m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src + (k + 1) * stride + i)));
+            lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), wk));
+            hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), wk));
+        }
+        if (k < taps) {
+            __m256i wk = _mm256_set1_epi32(weight_pair(w[k], 0));
+            __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src + k * stride + i)));
+            lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, zero), wk));
+            hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, zero), wk));
+        }
+        __m256i v = _mm256_packs_epi32(_mm256_srai_epi32(lo, SIMD_RESAMPLE_BITS),
+                                       _mm256_srai_epi32(hi, SIMD_RESAMPLE_BITS));
+        v = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0x08);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm256_castsi256_si128(v));
+    }
+    if (i < n) sse2_resample_vert(dst + i, src + i, stride, w, taps, n - i);
+}
+
+#endif // IML_X86_SIMD
+
+void simd_init(void) {
+    simd_invert = scalar_invert;
+    simd_grayscale_rgb = scalar_grayscale_rgb;
+    simd_blend = scalar_blend;
+    simd_madd_u8_f32 = scalar_madd_u8_f32;
+    simd_madd_f32 = scalar_madd_f32;
+    simd_iir3_f32 = scalar_iir3_f32;
+    simd_f32_to_u8 = scalar_f32_to_u8;
+    simd_warp_bilinear = scalar_warp_bilinear;
+    simd_resample_horiz = scalar_resample_horiz;
+    simd_resample_vert = scalar_resample_vert;
+    simd_halve = scalar_halve;
+    level_name = "scalar";
+
+    const char *env = getenv("IML_SIMD");
+    if (env && strcmp(env, "off") == 0) return;
+
+#ifdef IML_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        simd_invert = sse2_invert;
+        simd_blend = sse2_blend;
+        simd_madd_u8_f32 = sse2_madd_u8_f32;
+        simd_madd_f32 = sse2_madd_f32;
+        simd_iir3_f32 = sse2_iir3_f32;
+        simd_f32_to_u8 = sse2_f32_to_u8;
+        simd_warp_bilinear = sse2_warp_bilinear;
+        simd_resample_horiz = sse2_resample_horiz;
+        simd_resample_vert = sse2_resample_vert;
+        level_name = "sse2";
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        simd_grayscale_rgb = ssse3_grayscale_rgb;
+        simd_halve = ssse3_halve;
+        level_name = "ssse3";
+    }
+    if (__builtin_cpu_supports("avx2") && !(env && strcmp(env, "sse") == 0)) {
+        simd_invert = avx2_invert;
+        simd_blend = avx2_blend;
+        simd_madd_u8_f32 = avx2_madd_u8_f32;
+        simd_madd_f32 = avx2_madd_f32;
+        simd_iir3_f32 = avx2_iir3_f32;
+        simd_resample_vert = avx2_resample_vert;
+        level_name = "avx2";
+    }
+#endif
+}
+
+const char *simd_level_name(void) {
+    return level_name;
+}
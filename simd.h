@@ -0,0 +1,79 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Vectorised inner loops for the runtime kernels.
+//
+// simd_init() probes the CPU once and points each simd_* entry at the best
+// implementation available (AVX2, SSSE3/SSE2 or plain C). Until it is
+// called every entry uses the scalar code, which is also the reference the
+// vector paths must match byte for byte. Set IML_SIMD=off to force scalar,
+// or IML_SIMD=sse to stop below AVX2.
+
+void simd_init(void);
+const char *simd_level_name(void);
+
+// dst[i] = 255 - src[i]
+extern void (*simd_invert)(const unsigned char *src, unsigned char *dst, size_t n);
+// RGB -> RGB with R = G = B = (299*R + 587*G + 114*B) / 1000
+extern void (*simd_grayscale_rgb)(const unsigned char *src, unsigned char *dst, size_t npixels);
+// dst[i] = clamp(a[i] * (1 - alpha) + b[i] * alpha), evaluated in float
+extern void (*simd_blend)(const unsigned char *a, const unsigned char *b, unsigned char *dst,
+                          size_t n, float alpha);
+// acc[i] += src[i] * k, multiply then add in float (no FMA)
+extern void (*simd_madd_u8_f32)(float *acc, const unsigned char *src, size_t n, float k);
+// acc[i] += src[i] * k
+extern void (*simd_madd_f32)(float *acc, const float *src, size_t n, float k);
+// dst[i] = c[0]*in[i] + c[1]*p1[i] + c[2]*p2[i] + c[3]*p3[i]; dst may alias in
+extern void (*simd_iir3_f32)(float *dst, const float *in, const float *p1, const float *p2,
+                             const float *p3, size_t n, const float *c);
+// dst[i] = src[i] clamped to 0..255 and rounded half up
+extern void (*simd_f32_to_u8)(unsigned char *dst, const float *src, size_t n);
+
+// Fraction bits of the fixed-point source coordinates taken by simd_warp_bilinear
+#define SIMD_WARP_BITS 24
+// n pixels of cn (1, 3 or 4) channels, pixel i sampled bilinearly at
+// (x + i*dx, y + i*dy) with 7-bit weights; every 2x2 neighbourhood touched
+// must lie inside 'src'
+extern void (*simd_warp_bilinear)(unsigned char *dst, const unsigned char *src, size_t stride,
+                                  int64_t x, int64_t y, int64_t dx, int64_t dy, size_t n, int cn);
+
+// Fraction bits of the int16 filter weights taken by the simd_resample_* kernels.
+// Both round the weighted sum and clamp it to 0..255.
+#define SIMD_RESAMPLE_BITS 14
+// n pixels of cn (1, 3 or 4) channels; pixel i = sum over k < taps of src
+// pixel start[i] + k times w[i * taps + k]
+extern void (*simd_resample_horiz)(unsigned char *dst, const unsigned char *src, const int *start,
+                                   const int16_t *w, int taps, size_t n, int cn);
+// dst[i] = sum over k < taps of src[k * stride + i] * w[k], for n bytes
+extern void (*simd_resample_vert)(unsigned char *dst, const unsigned char *src, size_t stride,
+                                  const int16_t *w, int taps, size_t n);
+
+// Averages each 2x2 block of two rows of src_w pixels of cn (1, 3 or 4)
+// channels into max(1, src_w / 2) pixels, rounding half up; an odd last
+// column is dropped, and a 1-pixel row is averaged with itself
+extern void (*simd_halve)(unsigned char *dst, const unsigned char *row0,
+                          const unsigned char *row1, size_t src_w, int cn);
+
+// Scalar reference implementations
+void scalar_invert(const unsigned char *src, unsigned char *dst, size_t n);
+void scalar_grayscale_rgb(const unsigned char *src, unsigned char *dst, size_t npixels);
+void scalar_blend(const unsigned char *a, const unsigned char *b, unsigned char *dst,
+                  size_t n, float alpha);
+void scalar_madd_u8_f32(float *acc, const unsigned char *src, size_t n, float k);
+void scalar_madd_f32(float *acc, const float *src, size_t n, float k);
+void scalar_iir3_f32(float *dst, const float *in, const float *p1, const float *p2,
+                     const float *p3, size_t n, const float *c);
+void scalar_f32_to_u8(unsigned char *dst, const float *src, size_t n);
+void scalar_warp_bilinear(unsigned char *dst, const unsigned char *src, size_t stride,
+                          int64_t x, int64_t y, int64_t dx, int64_t dy, size_t n, int cn);
+void scalar_resample_horiz(unsigned char *dst, const unsigned char *src, const int *start,
+                           const int16_t *w, int taps, size_t n, int cn);
+void scalar_resample_vert(unsigned char *dst, const unsigned char *src, size_t stride,
+                          const int16_t *w, int taps, size_t n);
+void scalar_halve(unsigned char *dst, const unsigned char *row0, const unsigned char *row1,
+                  size_t src_w, int cn);
+
+#endif